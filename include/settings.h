@@ -0,0 +1,117 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stddef.h>
+
+#include "CborWriter.h"
+#include "JsonScanner.h"
+#include "JsonWriter.h"
+
+#ifndef LED_BUILTIN
+#define LED_BUILTIN 4
+#endif
+
+const int DEFAULT_LED_PIN = LED_BUILTIN;
+const uint16_t DEFAULT_MQTT_PORT = 1883;
+constexpr const char* DEFAULT_MQTT_TOPIC = "meow/lamp";
+const int LED_PIN_MIN = 0;
+const int LED_PIN_MAX = 40;
+const uint16_t DEFAULT_BRIGHTNESS = 255;
+const uint16_t BRIGHTNESS_MAX = 255;
+const uint16_t DEFAULT_FADE_MS = 300;
+const uint16_t FADE_MS_MAX = 10000;
+const int STRIP_PIN_NONE = -1;
+// Warm white, 0xRRGGBB.
+const int32_t DEFAULT_STRIP_COLOR = 0xFFB46B;
+const int32_t STRIP_COLOR_MAX = 0xFFFFFF;
+const uint16_t LOOP_REPORT_S_MAX = 3600;
+
+const size_t WIFI_SSID_MAX = 32;
+const size_t WIFI_PASSWORD_MAX = 64;
+const size_t MQTT_HOST_MAX = 64;
+const size_t MQTT_TOPIC_MAX = 96;
+// POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3".
+const size_t TIMEZONE_MAX = 47;
+constexpr const char* DEFAULT_TIMEZONE = "UTC0";
+
+struct DeviceSettings {
+    bool wifiEnabled;
+    char wifiSsid[WIFI_SSID_MAX + 1];
+    char wifiPassword[WIFI_PASSWORD_MAX + 1];
+    bool mqttEnabled;
+    char mqttHost[MQTT_HOST_MAX + 1];
+    uint16_t mqttPort;
+    char mqttTopic[MQTT_TOPIC_MAX + 1];
+    int32_t ledPin;
+    // 0-255, gamma-corrected into the LEDC duty when the lamp is on.
+    uint16_t brightness;
+    // On/off and mode changes fade over this long; 0 switches instantly.
+    uint16_t fadeMs;
+    // Drive effect edges from an esp_timer callback instead of loop().
+    bool effectTimer;
+    // WS2812 strip data pin and length; the strip is off while either is
+    // unset. It renders the lamp mode in stripColor (0xRRGGBB).
+    int32_t stripPin;
+    uint16_t stripPixels;
+    int32_t stripColor;
+    // Local time for daily schedules.
+    char timezone[TIMEZONE_MAX + 1];
+    // Run the network stack and the effect engine in tasks on separate
+    // cores. Read at boot; ignored on single-core chips.
+    bool splitCores;
+    // Print the loop phase profile over serial this often; 0 = never.
+    uint16_t loopReportS;
+};
+
+enum class SettingType : uint8_t {
+    Bool,
+    Int,
+    UInt16,
+    Text
+};
+
+// One entry per persisted setting. The JSON reader and writer, the NVS
+// load/store code and the range checks all walk this table, so a new setting
+// is a new DeviceSettings member plus one line in SETTINGS_SCHEMA.
+struct SettingField {
+    const char* jsonKey;
+    const char* nvsKey;
+    SettingType type;
+    uint16_t offset;
+    // Text capacity including the terminator; unused for other types.
+    uint16_t size;
+    int32_t minValue;
+    int32_t maxValue;
+    int32_t defaultValue;
+    const char* defaultText;
+};
+
+const SettingField* findSettingField(const char* jsonKey);
+
+void loadSettings(Preferences& prefs, DeviceSettings& out);
+// Writes only the fields that differ from `previous`.
+void storeSettings(Preferences& prefs, const DeviceSettings& next, const DeviceSettings& previous);
+
+// Upper bound of writeSettings() output as JSON, checked against the schema
+// in settings.cpp. Text settings carry no control characters, so escaping at
+// most doubles them; the CBOR encoding is never longer than the JSON one.
+const size_t SETTINGS_JSON_MAX = 1024;
+
+// Instantiated for JsonWriter and CborWriter.
+template <typename Writer>
+void writeSettings(Writer& writer, const DeviceSettings& value);
+
+struct SettingsParse {
+    DeviceSettings pending;
+    // Key of the field that failed validation, if any.
+    const char* errorKey;
+};
+
+// JsonTokenHandler that applies members of the top-level object to
+// SettingsParse::pending. Out-of-range numbers are ignored, wrong types,
+// over-long strings and strings with control characters reject the body.
+bool applySettingsToken(void* context, const JsonToken& token);
+
+#endif
@@ -0,0 +1,344 @@
+#include "CborScanner.h"
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+namespace {
+
+const uint8_t MAJOR_UNSIGNED = 0;
+const uint8_t MAJOR_NEGATIVE = 1;
+const uint8_t MAJOR_BYTES = 2;
+const uint8_t MAJOR_TEXT = 3;
+const uint8_t MAJOR_ARRAY = 4;
+const uint8_t MAJOR_MAP = 5;
+const uint8_t MAJOR_TAG = 6;
+const uint8_t MAJOR_SIMPLE = 7;
+
+const uint8_t INFO_INDEFINITE = 31;
+const uint8_t SIMPLE_FALSE = 20;
+const uint8_t SIMPLE_TRUE = 21;
+const uint8_t SIMPLE_NULL = 22;
+const uint8_t SIMPLE_UNDEFINED = 23;
+const uint8_t FLOAT_HALF = 25;
+const uint8_t FLOAT_SINGLE = 26;
+const uint8_t FLOAT_DOUBLE = 27;
+const uint8_t BREAK_BYTE = 0xFF;
+
+double decodeHalf(uint16_t half) {
+    const int exponent = (half >> 10) & 0x1F;
+    const int mantissa = half & 0x3FF;
+    double value;
+    if (exponent == 0) {
+        value = ldexp(mantissa, -24);
+    } else if (exponent == 31) {
+        value = mantissa == 0 ? INFINITY : NAN;
+    } else {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+}  // namespace
+
+CborScanner::CborScanner(JsonTokenHandler handler, void* context) : handler_(handler), context_(context) {
+    reset();
+}
+
+void CborScanner::reset() {
+    state_ = State::Head;
+    error_ = JsonError::None;
+    major_ = 0;
+    info_ = 0;
+    argumentBytes_ = 0;
+    argument_ = 0;
+    depth_ = 0;
+    textIsKey_ = false;
+    textRemaining_ = 0;
+    number_ = 0;
+    integral_ = true;
+    boolean_ = false;
+    keyLength_ = 0;
+    valueLength_ = 0;
+    key_[0] = '\0';
+    value_[0] = '\0';
+}
+
+void CborScanner::reset(JsonTokenHandler handler, void* context) {
+    handler_ = handler;
+    context_ = context;
+    reset();
+}
+
+bool CborScanner::feed(const uint8_t* data, size_t length) {
+    if (state_ == State::Failed) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!step(data[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CborScanner::finish() {
+    if (state_ == State::Done) {
+        return true;
+    }
+    if (state_ == State::Failed) {
+        return false;
+    }
+    return fail(JsonError::Incomplete);
+}
+
+bool CborScanner::done() const {
+    return state_ == State::Done;
+}
+
+JsonError CborScanner::error() const {
+    return error_;
+}
+
+const char* CborScanner::errorKey() const {
+    return key_;
+}
+
+bool CborScanner::step(uint8_t byte) {
+    switch (state_) {
+        case State::Head:
+            if (byte == BREAK_BYTE) {
+                if (depth_ == 0 || !levels_[depth_ - 1].indefinite ||
+                    (levels_[depth_ - 1].map && !expectingKey())) {
+                    return fail(JsonError::Syntax);
+                }
+                return closeContainer();
+            }
+            major_ = byte >> 5;
+            info_ = byte & 0x1F;
+            argument_ = 0;
+            if (info_ < 24 || info_ == INFO_INDEFINITE) {
+                argument_ = info_ < 24 ? info_ : 0;
+                return dispatch();
+            }
+            if (info_ > FLOAT_DOUBLE) {
+                return fail(JsonError::Syntax);
+            }
+            argumentBytes_ = static_cast<uint8_t>(1U << (info_ - 24));
+            state_ = State::Argument;
+            return true;
+
+        case State::Argument:
+            argument_ = (argument_ << 8) | byte;
+            if (--argumentBytes_ > 0) {
+                return true;
+            }
+            return dispatch();
+
+        case State::Text:
+            if (textIsKey_) {
+                key_[keyLength_++] = static_cast<char>(byte);
+            } else {
+                value_[valueLength_++] = static_cast<char>(byte);
+            }
+            if (--textRemaining_ > 0) {
+                return true;
+            }
+            return finishText();
+
+        case State::Done:
+            return fail(JsonError::Syntax);
+
+        case State::Failed:
+            return false;
+    }
+    return fail(JsonError::Syntax);
+}
+
+bool CborScanner::dispatch() {
+    state_ = State::Head;
+    const bool indefinite = info_ == INFO_INDEFINITE;
+
+    if (expectingKey() && major_ != MAJOR_TEXT) {
+        return fail(JsonError::Syntax);
+    }
+
+    switch (major_) {
+        case MAJOR_UNSIGNED:
+            if (indefinite) {
+                return fail(JsonError::Syntax);
+            }
+            integral_ = argument_ <= static_cast<uint64_t>(LONG_MAX);
+            number_ = integral_ ? static_cast<long>(argument_) : LONG_MAX;
+            return emit(JsonTokenType::Number) && itemDone();
+
+        case MAJOR_NEGATIVE:
+            if (indefinite) {
+                return fail(JsonError::Syntax);
+            }
+            integral_ = argument_ <= static_cast<uint64_t>(LONG_MAX);
+            number_ = integral_ ? -1 - static_cast<long>(argument_) : LONG_MIN;
+            return emit(JsonTokenType::Number) && itemDone();
+
+        case MAJOR_TEXT:
+            if (indefinite) {
+                return fail(JsonError::Syntax);
+            }
+            return beginText();
+
+        case MAJOR_ARRAY:
+        case MAJOR_MAP:
+            return openContainer(major_ == MAJOR_MAP);
+
+        case MAJOR_TAG:
+            if (indefinite) {
+                return fail(JsonError::Syntax);
+            }
+            return true;
+
+        case MAJOR_SIMPLE:
+            switch (info_) {
+                case SIMPLE_FALSE:
+                case SIMPLE_TRUE:
+                    boolean_ = info_ == SIMPLE_TRUE;
+                    return emit(JsonTokenType::Bool) && itemDone();
+                case SIMPLE_NULL:
+                case SIMPLE_UNDEFINED:
+                    return emit(JsonTokenType::Null) && itemDone();
+                case FLOAT_HALF:
+                    return emitFloat(decodeHalf(static_cast<uint16_t>(argument_)));
+                case FLOAT_SINGLE: {
+                    const uint32_t bits = static_cast<uint32_t>(argument_);
+                    float value;
+                    memcpy(&value, &bits, sizeof(value));
+                    return emitFloat(value);
+                }
+                case FLOAT_DOUBLE: {
+                    double value;
+                    memcpy(&value, &argument_, sizeof(value));
+                    return emitFloat(value);
+                }
+                default:
+                    return fail(JsonError::Syntax);
+            }
+
+        case MAJOR_BYTES:
+        default:
+            return fail(JsonError::Syntax);
+    }
+}
+
+bool CborScanner::beginText() {
+    textIsKey_ = expectingKey();
+    const size_t limit = textIsKey_ ? MEOW_JSON_KEY_MAX : MEOW_JSON_VALUE_MAX;
+    if (argument_ > limit) {
+        return fail(textIsKey_ ? JsonError::KeyTooLong : JsonError::ValueTooLong);
+    }
+    if (textIsKey_) {
+        keyLength_ = 0;
+    } else {
+        valueLength_ = 0;
+    }
+    textRemaining_ = static_cast<size_t>(argument_);
+    if (textRemaining_ == 0) {
+        return finishText();
+    }
+    state_ = State::Text;
+    return true;
+}
+
+bool CborScanner::finishText() {
+    state_ = State::Head;
+    if (textIsKey_) {
+        key_[keyLength_] = '\0';
+        return itemDone();
+    }
+    value_[valueLength_] = '\0';
+    return emit(JsonTokenType::String) && itemDone();
+}
+
+bool CborScanner::openContainer(bool map) {
+    if (depth_ >= MEOW_JSON_DEPTH_MAX) {
+        return fail(JsonError::Depth);
+    }
+    const bool indefinite = info_ == INFO_INDEFINITE;
+    if (!indefinite && argument_ > (map ? UINT32_MAX / 2 : UINT32_MAX)) {
+        return fail(JsonError::Syntax);
+    }
+    if (!emit(map ? JsonTokenType::ObjectStart : JsonTokenType::ArrayStart)) {
+        return false;
+    }
+    Level& level = levels_[depth_++];
+    level.map = map;
+    level.indefinite = indefinite;
+    level.expectKey = map;
+    level.remaining = indefinite ? 0 : static_cast<uint32_t>(map ? argument_ * 2 : argument_);
+    if (!indefinite && level.remaining == 0) {
+        return closeContainer();
+    }
+    return true;
+}
+
+bool CborScanner::closeContainer() {
+    const bool map = levels_[depth_ - 1].map;
+    depth_--;
+    if (!emit(map ? JsonTokenType::ObjectEnd : JsonTokenType::ArrayEnd)) {
+        return false;
+    }
+    return itemDone();
+}
+
+bool CborScanner::itemDone() {
+    if (depth_ == 0) {
+        state_ = State::Done;
+        return true;
+    }
+    Level& level = levels_[depth_ - 1];
+    if (level.map) {
+        level.expectKey = !level.expectKey;
+    }
+    if (!level.indefinite && --level.remaining == 0) {
+        return closeContainer();
+    }
+    return true;
+}
+
+bool CborScanner::emit(JsonTokenType type) {
+    const bool inMap = depth_ > 0 && levels_[depth_ - 1].map;
+    JsonToken token;
+    token.type = type;
+    token.depth = depth_;
+    token.key = inMap && type != JsonTokenType::ObjectEnd && type != JsonTokenType::ArrayEnd ? key_ : "";
+    token.text = value_;
+    token.length = type == JsonTokenType::String ? valueLength_ : 0;
+    token.number = number_;
+    token.integral = integral_;
+    token.boolean = boolean_;
+    if (!handler_(context_, token)) {
+        return fail(JsonError::Rejected);
+    }
+    return true;
+}
+
+bool CborScanner::emitFloat(double value) {
+    if (!(value > static_cast<double>(LONG_MIN) && value < static_cast<double>(LONG_MAX))) {
+        integral_ = false;
+        number_ = 0;
+    } else {
+        number_ = static_cast<long>(value);
+        integral_ = static_cast<double>(number_) == value;
+    }
+    return emit(JsonTokenType::Number) && itemDone();
+}
+
+bool CborScanner::expectingKey() const {
+    return depth_ > 0 && levels_[depth_ - 1].map && levels_[depth_ - 1].expectKey;
+}
+
+bool CborScanner::fail(JsonError error) {
+    if (state_ != State::Failed) {
+        error_ = error;
+        state_ = State::Failed;
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+#ifndef MEOW_CBOR_SCANNER_H
+#define MEOW_CBOR_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "JsonScanner.h"
+
+// Single-pass, push-style CBOR (RFC 8949) decoder.
+//
+// It reports the same JsonToken stream as JsonScanner, so every token handler
+// written for JSON bodies accepts CBOR bodies unchanged: maps become objects,
+// arrays stay arrays, text strings, integers, floats, booleans and null map to
+// their JSON counterparts. Map keys must be text strings. Byte strings,
+// indefinite-length strings and simple values other than false/true/null are
+// rejected; tags are skipped.
+
+class CborScanner {
+public:
+    CborScanner(JsonTokenHandler handler, void* context);
+
+    void reset();
+    void reset(JsonTokenHandler handler, void* context);
+
+    // Consumes a chunk of input. Returns false once decoding has failed.
+    bool feed(const uint8_t* data, size_t length);
+
+    // Returns true if exactly one complete data item was decoded and the
+    // handler accepted every token.
+    bool finish();
+
+    bool done() const;
+    JsonError error() const;
+    const char* errorKey() const;
+
+private:
+    enum class State : uint8_t {
+        Head,
+        Argument,
+        Text,
+        Done,
+        Failed
+    };
+
+    struct Level {
+        bool map;
+        bool indefinite;
+        bool expectKey;
+        uint32_t remaining;
+    };
+
+    bool step(uint8_t byte);
+    bool dispatch();
+    bool beginText();
+    bool finishText();
+    bool openContainer(bool map);
+    bool closeContainer();
+    bool itemDone();
+    bool emit(JsonTokenType type);
+    bool emitFloat(double value);
+    bool expectingKey() const;
+    bool fail(JsonError error);
+
+    JsonTokenHandler handler_;
+    void* context_;
+    State state_;
+    JsonError error_;
+    uint8_t major_;
+    uint8_t info_;
+    uint8_t argumentBytes_;
+    uint64_t argument_;
+    uint8_t depth_;
+    Level levels_[MEOW_JSON_DEPTH_MAX];
+    bool textIsKey_;
+    size_t textRemaining_;
+    long number_;
+    bool integral_;
+    bool boolean_;
+    size_t keyLength_;
+    size_t valueLength_;
+    char key_[MEOW_JSON_KEY_MAX + 1];
+    char value_[MEOW_JSON_VALUE_MAX + 1];
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "CborWriter.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t MAJOR_UNSIGNED = 0;
+const uint8_t MAJOR_NEGATIVE = 1;
+const uint8_t MAJOR_TEXT = 3;
+
+const uint8_t INDEFINITE_ARRAY = 0x9F;
+const uint8_t INDEFINITE_MAP = 0xBF;
+const uint8_t BREAK_BYTE = 0xFF;
+const uint8_t VALUE_FALSE = 0xF4;
+const uint8_t VALUE_TRUE = 0xF5;
+const uint8_t VALUE_NULL = 0xF6;
+
+}  // namespace
+
+CborWriter::CborWriter(char* buffer, size_t capacity) : CborWriter(buffer, capacity, nullptr, nullptr) {}
+
+CborWriter::CborWriter(char* buffer, size_t capacity, CborFlushHandler flush, void* context)
+    : buffer_(buffer),
+      capacity_(capacity),
+      flush_(flush),
+      context_(context),
+      length_(0),
+      overflowed_(false),
+      flushed_(false) {}
+
+void CborWriter::beginObject() {
+    append(INDEFINITE_MAP);
+}
+
+void CborWriter::endObject() {
+    append(BREAK_BYTE);
+}
+
+void CborWriter::beginArray() {
+    append(INDEFINITE_ARRAY);
+}
+
+void CborWriter::endArray() {
+    append(BREAK_BYTE);
+}
+
+void CborWriter::key(const char* name) {
+    stringValue(name);
+}
+
+void CborWriter::boolValue(bool value) {
+    append(value ? VALUE_TRUE : VALUE_FALSE);
+}
+
+void CborWriter::intValue(long value) {
+    if (value < 0) {
+        head(MAJOR_NEGATIVE, static_cast<uint64_t>(-1 - value));
+    } else {
+        head(MAJOR_UNSIGNED, static_cast<uint64_t>(value));
+    }
+}
+
+void CborWriter::uintValue(unsigned long value) {
+    head(MAJOR_UNSIGNED, value);
+}
+
+void CborWriter::stringValue(const char* value) {
+    const size_t length = strlen(value);
+    head(MAJOR_TEXT, length);
+    append(value, length);
+}
+
+void CborWriter::nullValue() {
+    append(VALUE_NULL);
+}
+
+void CborWriter::flush() {
+    drain();
+}
+
+bool CborWriter::overflowed() const {
+    return overflowed_;
+}
+
+bool CborWriter::flushed() const {
+    return flushed_;
+}
+
+size_t CborWriter::length() const {
+    return length_;
+}
+
+const char* CborWriter::data() const {
+    return buffer_;
+}
+
+bool CborWriter::drain() {
+    if (!flush_) {
+        return false;
+    }
+    if (length_ > 0) {
+        flush_(context_, buffer_, length_);
+        flushed_ = true;
+        length_ = 0;
+    }
+    return true;
+}
+
+void CborWriter::head(uint8_t major, uint64_t value) {
+    uint8_t bytes[9];
+    size_t size;
+    const uint8_t type = static_cast<uint8_t>(major << 5);
+    if (value < 24) {
+        bytes[0] = static_cast<uint8_t>(type | value);
+        size = 1;
+    } else if (value <= 0xFF) {
+        bytes[0] = type | 24;
+        size = 2;
+    } else if (value <= 0xFFFF) {
+        bytes[0] = type | 25;
+        size = 3;
+    } else if (value <= 0xFFFFFFFFULL) {
+        bytes[0] = type | 26;
+        size = 5;
+    } else {
+        bytes[0] = type | 27;
+        size = 9;
+    }
+    for (size_t i = size - 1; i > 0; i--) {
+        bytes[i] = static_cast<uint8_t>(value & 0xFF);
+        value >>= 8;
+    }
+    append(bytes, size);
+}
+
+void CborWriter::append(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        size_t room = capacity_ - length_;
+        if (room == 0) {
+            if (!drain() || capacity_ == 0) {
+                overflowed_ = true;
+                return;
+            }
+            room = capacity_;
+        }
+        const size_t chunk = length < room ? length : room;
+        memcpy(buffer_ + length_, bytes, chunk);
+        length_ += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void CborWriter::append(uint8_t byte) {
+    append(&byte, 1);
+}
@@ -0,0 +1,56 @@
+#ifndef MEOW_CBOR_WRITER_H
+#define MEOW_CBOR_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation-free CBOR (RFC 8949) encoder with the same interface as
+// JsonWriter, so one serializer template can produce either format.
+//
+// Objects and arrays are written as indefinite-length maps and arrays, which
+// lets callers stream members without counting them first. Integers use the
+// shortest head that fits. With a flush handler the buffer acts as a window
+// exactly like JsonWriter's.
+
+typedef void (*CborFlushHandler)(void* context, const char* data, size_t length);
+
+class CborWriter {
+public:
+    CborWriter(char* buffer, size_t capacity);
+    CborWriter(char* buffer, size_t capacity, CborFlushHandler flush, void* context);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    void key(const char* name);
+    void boolValue(bool value);
+    void intValue(long value);
+    void uintValue(unsigned long value);
+    void stringValue(const char* value);
+    void nullValue();
+
+    void flush();
+
+    bool overflowed() const;
+    bool flushed() const;
+    size_t length() const;
+    const char* data() const;
+
+private:
+    bool drain();
+    void head(uint8_t major, uint64_t value);
+    void append(const void* data, size_t length);
+    void append(uint8_t byte);
+
+    char* buffer_;
+    size_t capacity_;
+    CborFlushHandler flush_;
+    void* context_;
+    size_t length_;
+    bool overflowed_;
+    bool flushed_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "CoapMessage.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t COAP_VERSION = 1;
+const uint8_t PAYLOAD_MARKER = 0xFF;
+
+const uint16_t OPTION_URI_HOST = 3;
+const uint16_t OPTION_OBSERVE = 6;
+const uint16_t OPTION_URI_PORT = 7;
+const uint16_t OPTION_URI_PATH = 11;
+const uint16_t OPTION_CONTENT_FORMAT = 12;
+const uint16_t OPTION_URI_QUERY = 15;
+const uint16_t OPTION_ACCEPT = 17;
+
+// Reads an option delta or length nibble plus its extended bytes.
+bool readOptionField(uint8_t nibble, const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+    if (nibble < 13) {
+        value = nibble;
+        return true;
+    }
+    if (nibble == 13) {
+        if (end - p < 1) {
+            return false;
+        }
+        value = 13U + p[0];
+        p += 1;
+        return true;
+    }
+    if (nibble == 14) {
+        if (end - p < 2) {
+            return false;
+        }
+        value = 269U + ((static_cast<uint32_t>(p[0]) << 8) | p[1]);
+        p += 2;
+        return true;
+    }
+    return false;
+}
+
+uint32_t readUint(const uint8_t* value, uint32_t length) {
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        result = (result << 8) | value[i];
+    }
+    return result;
+}
+
+bool appendPathSegment(CoapMessage& out, size_t& pathLength, const uint8_t* value, uint32_t length) {
+    const size_t separator = pathLength > 0 ? 1 : 0;
+    if (pathLength + separator + length > COAP_PATH_MAX) {
+        return false;
+    }
+    if (separator) {
+        out.path[pathLength++] = '/';
+    }
+    memcpy(out.path + pathLength, value, length);
+    pathLength += length;
+    out.path[pathLength] = '\0';
+    return true;
+}
+
+class OptionEncoder {
+public:
+    OptionEncoder(uint8_t* out, size_t capacity, size_t length)
+        : out_(out), capacity_(capacity), length_(length), previous_(0), ok_(true) {}
+
+    void uintOption(uint16_t number, uint32_t value) {
+        uint8_t bytes[4];
+        uint8_t length = 0;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            const uint8_t byte = static_cast<uint8_t>(value >> shift);
+            if (length > 0 || byte != 0) {
+                bytes[length++] = byte;
+            }
+        }
+        option(number, bytes, length);
+    }
+
+    void raw(const uint8_t* data, size_t length) {
+        if (!ok_ || length > capacity_ - length_) {
+            ok_ = false;
+            return;
+        }
+        memcpy(out_ + length_, data, length);
+        length_ += length;
+    }
+
+    size_t length() const {
+        return ok_ ? length_ : 0;
+    }
+
+private:
+    static uint8_t nibble(uint32_t value, uint8_t* extended, size_t& extendedLength) {
+        if (value < 13) {
+            return static_cast<uint8_t>(value);
+        }
+        if (value < 269) {
+            extended[extendedLength++] = static_cast<uint8_t>(value - 13);
+            return 13;
+        }
+        extended[extendedLength++] = static_cast<uint8_t>((value - 269) >> 8);
+        extended[extendedLength++] = static_cast<uint8_t>((value - 269) & 0xFF);
+        return 14;
+    }
+
+    void option(uint16_t number, const uint8_t* value, size_t length) {
+        uint8_t header[5];
+        size_t headerLength = 1;
+        const uint8_t delta = nibble(number - previous_, header + 1, headerLength);
+        const uint8_t size = nibble(static_cast<uint32_t>(length), header + 1, headerLength);
+        header[0] = static_cast<uint8_t>(delta << 4 | size);
+        raw(header, headerLength);
+        raw(value, length);
+        previous_ = number;
+    }
+
+    uint8_t* out_;
+    size_t capacity_;
+    size_t length_;
+    uint16_t previous_;
+    bool ok_;
+};
+
+}  // namespace
+
+bool parseCoapMessage(const uint8_t* data, size_t length, CoapMessage& out) {
+    memset(&out, 0, sizeof(out));
+    if (length < 4 || (data[0] >> 6) != COAP_VERSION) {
+        return false;
+    }
+    out.type = static_cast<CoapType>((data[0] >> 4) & 0x03);
+    out.tokenLength = data[0] & 0x0F;
+    out.code = static_cast<CoapCode>(data[1]);
+    out.messageId = static_cast<uint16_t>((data[2] << 8) | data[3]);
+    if (out.tokenLength > COAP_TOKEN_MAX || length < 4U + out.tokenLength) {
+        return false;
+    }
+    memcpy(out.token, data + 4, out.tokenLength);
+
+    const uint8_t* p = data + 4 + out.tokenLength;
+    const uint8_t* end = data + length;
+    size_t pathLength = 0;
+    uint32_t number = 0;
+    while (p < end && *p != PAYLOAD_MARKER) {
+        const uint8_t header = *p++;
+        uint32_t delta;
+        uint32_t optionLength;
+        if (!readOptionField(header >> 4, p, end, delta) || !readOptionField(header & 0x0F, p, end, optionLength) ||
+            static_cast<uint32_t>(end - p) < optionLength) {
+            return false;
+        }
+        number += delta;
+        const uint8_t* value = p;
+        p += optionLength;
+
+        switch (number) {
+            case OPTION_URI_PATH:
+                if (!appendPathSegment(out, pathLength, value, optionLength)) {
+                    return false;
+                }
+                break;
+            case OPTION_OBSERVE:
+                out.hasObserve = optionLength <= 3;
+                out.observe = readUint(value, optionLength);
+                break;
+            case OPTION_CONTENT_FORMAT:
+                out.hasContentFormat = optionLength <= 2;
+                out.contentFormat = static_cast<uint16_t>(readUint(value, optionLength));
+                break;
+            case OPTION_ACCEPT:
+                out.hasAccept = optionLength <= 2;
+                out.accept = static_cast<uint16_t>(readUint(value, optionLength));
+                break;
+            case OPTION_URI_HOST:
+            case OPTION_URI_PORT:
+            case OPTION_URI_QUERY:
+                break;
+            default:
+                if (number & 1) {
+                    out.unknownCriticalOption = true;
+                }
+                break;
+        }
+    }
+
+    if (p < end) {
+        // Payload marker followed by nothing is a format error.
+        if (end - p < 2) {
+            return false;
+        }
+        out.payload = p + 1;
+        out.payloadLength = static_cast<size_t>(end - p - 1);
+    }
+    return true;
+}
+
+size_t buildCoapMessage(const CoapMessage& message, uint8_t* out, size_t capacity) {
+    if (capacity < 4U + message.tokenLength || message.tokenLength > COAP_TOKEN_MAX) {
+        return 0;
+    }
+    out[0] = static_cast<uint8_t>(COAP_VERSION << 6 | static_cast<uint8_t>(message.type) << 4 | message.tokenLength);
+    out[1] = static_cast<uint8_t>(message.code);
+    out[2] = static_cast<uint8_t>(message.messageId >> 8);
+    out[3] = static_cast<uint8_t>(message.messageId & 0xFF);
+    memcpy(out + 4, message.token, message.tokenLength);
+
+    OptionEncoder encoder(out, capacity, 4U + message.tokenLength);
+    if (message.hasObserve) {
+        encoder.uintOption(OPTION_OBSERVE, message.observe & 0xFFFFFF);
+    }
+    if (message.hasContentFormat) {
+        encoder.uintOption(OPTION_CONTENT_FORMAT, message.contentFormat);
+    }
+    if (message.payloadLength > 0) {
+        const uint8_t marker = PAYLOAD_MARKER;
+        encoder.raw(&marker, 1);
+        encoder.raw(message.payload, message.payloadLength);
+    }
+    return encoder.length();
+}
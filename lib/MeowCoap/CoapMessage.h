@@ -0,0 +1,86 @@
+#ifndef MEOW_COAP_MESSAGE_H
+#define MEOW_COAP_MESSAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal CoAP (RFC 7252) message codec, including the Observe option
+// (RFC 7641).
+//
+// Parsing reads the received datagram in place and building writes into a
+// caller-provided buffer, so neither allocates. Only the options the lamp
+// needs are decoded; other elective options are skipped, and unknown
+// critical options are reported so the caller can answer 4.02.
+
+const uint16_t COAP_DEFAULT_PORT = 5683;
+const uint8_t COAP_TOKEN_MAX = 8;
+const size_t COAP_PATH_MAX = 31;
+// Bytes around the payload of the largest message buildCoapMessage() writes:
+// header, token, Observe and Content-Format options and the payload marker.
+const size_t COAP_ENVELOPE_MAX = 4 + COAP_TOKEN_MAX + 4 + 3 + 1;
+
+enum class CoapType : uint8_t {
+    Confirmable = 0,
+    NonConfirmable = 1,
+    Acknowledgement = 2,
+    Reset = 3
+};
+
+// Codes are class << 5 | detail, e.g. 2.05 is 0x45.
+enum class CoapCode : uint8_t {
+    Empty = 0x00,
+    Get = 0x01,
+    Post = 0x02,
+    Put = 0x03,
+    Delete = 0x04,
+    Changed = 0x44,
+    Content = 0x45,
+    BadRequest = 0x80,
+    BadOption = 0x82,
+    NotFound = 0x84,
+    MethodNotAllowed = 0x85,
+    NotAcceptable = 0x86,
+    RequestEntityTooLarge = 0x8D,
+    UnsupportedContentFormat = 0x8F,
+    InternalServerError = 0xA0,
+    ServiceUnavailable = 0xA3
+};
+
+// Content-Format registry values used by the firmware.
+const uint16_t COAP_FORMAT_TEXT = 0;
+const uint16_t COAP_FORMAT_JSON = 50;
+const uint16_t COAP_FORMAT_CBOR = 60;
+
+// Observe option values in a GET request.
+const uint32_t COAP_OBSERVE_REGISTER = 0;
+const uint32_t COAP_OBSERVE_DEREGISTER = 1;
+
+struct CoapMessage {
+    CoapType type;
+    CoapCode code;
+    uint16_t messageId;
+    uint8_t token[COAP_TOKEN_MAX];
+    uint8_t tokenLength;
+    // Uri-Path segments joined with '/', e.g. "api/paw".
+    char path[COAP_PATH_MAX + 1];
+    bool hasObserve;
+    uint32_t observe;
+    bool hasContentFormat;
+    uint16_t contentFormat;
+    bool hasAccept;
+    uint16_t accept;
+    // Set when a critical option this codec does not understand was present.
+    bool unknownCriticalOption;
+    const uint8_t* payload;
+    size_t payloadLength;
+};
+
+// Decodes a datagram. Returns false if it is not a well-formed CoAP message
+// or its Uri-Path does not fit `path`.
+bool parseCoapMessage(const uint8_t* data, size_t length, CoapMessage& out);
+
+// Encodes `message` (path and Accept are ignored) into `out`. Returns the
+// number of bytes written, or 0 if it does not fit.
+size_t buildCoapMessage(const CoapMessage& message, uint8_t* out, size_t capacity);
+
+#endif
@@ -0,0 +1,117 @@
+#include "EffectScheduler.h"
+
+namespace {
+
+bool isEarlier(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+bool heapLess(const EffectScheduler& scheduler, uint8_t i, uint8_t j) {
+    return isEarlier(scheduler.dueMs[scheduler.heap[i]], scheduler.dueMs[scheduler.heap[j]]);
+}
+
+void swapEntries(EffectScheduler& scheduler, uint8_t i, uint8_t j) {
+    const uint8_t channel = scheduler.heap[i];
+    scheduler.heap[i] = scheduler.heap[j];
+    scheduler.heap[j] = channel;
+    scheduler.position[scheduler.heap[i]] = i;
+    scheduler.position[scheduler.heap[j]] = j;
+}
+
+void siftUp(EffectScheduler& scheduler, uint8_t index) {
+    while (index > 0) {
+        const uint8_t parent = static_cast<uint8_t>((index - 1) / 2);
+        if (!heapLess(scheduler, index, parent)) {
+            return;
+        }
+        swapEntries(scheduler, index, parent);
+        index = parent;
+    }
+}
+
+void siftDown(EffectScheduler& scheduler, uint8_t index) {
+    for (;;) {
+        const unsigned left = 2U * index + 1;
+        if (left >= scheduler.size) {
+            return;
+        }
+        uint8_t earliest = static_cast<uint8_t>(left);
+        if (left + 1 < scheduler.size && heapLess(scheduler, static_cast<uint8_t>(left + 1), earliest)) {
+            earliest = static_cast<uint8_t>(left + 1);
+        }
+        if (!heapLess(scheduler, earliest, index)) {
+            return;
+        }
+        swapEntries(scheduler, index, earliest);
+        index = earliest;
+    }
+}
+
+}  // namespace
+
+void clearEffectScheduler(EffectScheduler& scheduler) {
+    scheduler.size = 0;
+    for (uint8_t i = 0; i < EFFECT_SCHEDULER_CAPACITY; i++) {
+        scheduler.position[i] = EFFECT_UNSCHEDULED;
+    }
+}
+
+void scheduleEffect(EffectScheduler& scheduler, uint8_t channel, uint32_t dueMs) {
+    if (channel >= EFFECT_SCHEDULER_CAPACITY) {
+        return;
+    }
+    uint8_t index = scheduler.position[channel];
+    if (index == EFFECT_UNSCHEDULED) {
+        index = scheduler.size++;
+        scheduler.heap[index] = channel;
+        scheduler.position[channel] = index;
+        scheduler.dueMs[channel] = dueMs;
+        siftUp(scheduler, index);
+        return;
+    }
+    const bool earlier = isEarlier(dueMs, scheduler.dueMs[channel]);
+    scheduler.dueMs[channel] = dueMs;
+    if (earlier) {
+        siftUp(scheduler, index);
+    } else {
+        siftDown(scheduler, index);
+    }
+}
+
+void cancelEffect(EffectScheduler& scheduler, uint8_t channel) {
+    if (channel >= EFFECT_SCHEDULER_CAPACITY) {
+        return;
+    }
+    const uint8_t index = scheduler.position[channel];
+    if (index == EFFECT_UNSCHEDULED) {
+        return;
+    }
+    const uint8_t last = --scheduler.size;
+    scheduler.position[channel] = EFFECT_UNSCHEDULED;
+    if (index == last) {
+        return;
+    }
+    // The entry moved into the hole may belong above or below it.
+    const uint8_t moved = scheduler.heap[last];
+    scheduler.heap[index] = moved;
+    scheduler.position[moved] = index;
+    siftUp(scheduler, index);
+    siftDown(scheduler, scheduler.position[moved]);
+}
+
+bool earliestEffectDeadline(const EffectScheduler& scheduler, uint32_t& dueMs) {
+    if (scheduler.size == 0) {
+        return false;
+    }
+    dueMs = scheduler.dueMs[scheduler.heap[0]];
+    return true;
+}
+
+bool takeDueEffect(EffectScheduler& scheduler, uint32_t now, uint8_t& channel) {
+    if (scheduler.size == 0 || isEarlier(now, scheduler.dueMs[scheduler.heap[0]])) {
+        return false;
+    }
+    channel = scheduler.heap[0];
+    cancelEffect(scheduler, channel);
+    return true;
+}
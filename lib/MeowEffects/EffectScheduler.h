@@ -0,0 +1,45 @@
+#ifndef MEOW_EFFECT_SCHEDULER_H
+#define MEOW_EFFECT_SCHEDULER_H
+
+#include <stdint.h>
+
+// Earliest-deadline queue for effect channels.
+//
+// Each channel has at most one pending deadline, kept in a binary min-heap
+// so the next edge across all channels is always at the root. Asking for due
+// work costs one comparison when nothing is due, and rescheduling a channel
+// is O(log n), so the per-tick cost follows the number of due edges rather
+// than the number of channels. Deadlines are millis() values compared with
+// wrap-around arithmetic; they must lie within 2^31 ms of each other.
+
+const uint8_t EFFECT_SCHEDULER_CAPACITY = 32;
+const uint8_t EFFECT_UNSCHEDULED = 0xFF;
+
+struct EffectScheduler {
+    uint8_t size;
+    // Channel ids, earliest deadline first.
+    uint8_t heap[EFFECT_SCHEDULER_CAPACITY];
+    // Indexed by channel id.
+    uint32_t dueMs[EFFECT_SCHEDULER_CAPACITY];
+    uint8_t position[EFFECT_SCHEDULER_CAPACITY];
+};
+
+void clearEffectScheduler(EffectScheduler& scheduler);
+
+// Inserts the channel or moves its existing deadline.
+void scheduleEffect(EffectScheduler& scheduler, uint8_t channel, uint32_t dueMs);
+
+void cancelEffect(EffectScheduler& scheduler, uint8_t channel);
+
+// False when nothing is scheduled.
+bool earliestEffectDeadline(const EffectScheduler& scheduler, uint32_t& dueMs);
+
+// Removes and returns the earliest channel if its deadline is at or before
+// `now`. The caller reschedules it after stepping.
+bool takeDueEffect(EffectScheduler& scheduler, uint32_t now, uint8_t& channel);
+
+inline bool isEffectScheduled(const EffectScheduler& scheduler, uint8_t channel) {
+    return scheduler.position[channel] != EFFECT_UNSCHEDULED;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "LampEffects.h"
+
+#include <string.h>
+
+#include "LampPattern.h"
+
+namespace {
+
+constexpr uint32_t BLINK_ON_MS = 650;
+constexpr uint32_t BLINK_OFF_MS = 650;
+
+constexpr uint32_t PURR_PATTERN_MS[] = {160, 90, 220, 520};
+constexpr bool PURR_PATTERN_ON[] = {true, false, true, false};
+constexpr uint8_t PURR_PATTERN_LEN = sizeof(PURR_PATTERN_MS) / sizeof(PURR_PATTERN_MS[0]);
+static_assert(sizeof(PURR_PATTERN_ON) / sizeof(PURR_PATTERN_ON[0]) == PURR_PATTERN_LEN,
+              "purr timings and levels must line up");
+
+constexpr uint32_t BZZZ_GAP_MIN_MS = 6000;
+constexpr uint32_t BZZZ_GAP_MAX_MS = 14000;
+constexpr uint16_t BZZZ_FLICKER_MIN_MS = 50;
+constexpr uint16_t BZZZ_FLICKER_MAX_MS = 120;
+constexpr uint8_t BZZZ_FLICKER_MIN_COUNT = 3;
+constexpr uint8_t BZZZ_FLICKER_MAX_COUNT = 4;
+
+void startSteady(EffectState& state, uint32_t, EffectRandom) {
+    state.level = LAMP_EFFECT_FULL;
+}
+
+void startBlink(EffectState& state, uint32_t now, EffectRandom) {
+    state.level = LAMP_EFFECT_FULL;
+    state.nextMs = now + BLINK_ON_MS;
+}
+
+void stepBlink(EffectState& state, uint32_t now, EffectRandom) {
+    state.level = state.level ? LAMP_EFFECT_OFF : LAMP_EFFECT_FULL;
+    state.nextMs = now + (state.level ? BLINK_ON_MS : BLINK_OFF_MS);
+}
+
+void startPurr(EffectState& state, uint32_t now, EffectRandom) {
+    state.step = 0;
+    state.level = PURR_PATTERN_ON[0] ? LAMP_EFFECT_FULL : LAMP_EFFECT_OFF;
+    state.nextMs = now + PURR_PATTERN_MS[0];
+}
+
+void stepPurr(EffectState& state, uint32_t now, EffectRandom) {
+    state.step = static_cast<uint8_t>((state.step + 1) % PURR_PATTERN_LEN);
+    state.level = PURR_PATTERN_ON[state.step] ? LAMP_EFFECT_FULL : LAMP_EFFECT_OFF;
+    state.nextMs = now + PURR_PATTERN_MS[state.step];
+}
+
+uint32_t bzzzGap(uint32_t now, EffectRandom random) {
+    return now + static_cast<uint32_t>(random(BZZZ_GAP_MIN_MS, BZZZ_GAP_MAX_MS + 1));
+}
+
+void startBzzz(EffectState& state, uint32_t now, EffectRandom random) {
+    state.level = LAMP_EFFECT_FULL;
+    state.flickersRemaining = 0;
+    state.nextMs = bzzzGap(now, random);
+}
+
+// Mostly steady, with a burst of 3-4 short flickers after every random gap.
+void stepBzzz(EffectState& state, uint32_t now, EffectRandom random) {
+    if (state.flickersRemaining == 0) {
+        state.flickersRemaining =
+            static_cast<uint8_t>(random(BZZZ_FLICKER_MIN_COUNT, BZZZ_FLICKER_MAX_COUNT + 1) * 2);
+    }
+    state.level = state.level ? LAMP_EFFECT_OFF : LAMP_EFFECT_FULL;
+    state.flickersRemaining--;
+    state.nextMs = now + static_cast<uint32_t>(random(BZZZ_FLICKER_MIN_MS, BZZZ_FLICKER_MAX_MS + 1));
+    if (state.flickersRemaining == 0) {
+        state.level = LAMP_EFFECT_FULL;
+        state.nextMs = bzzzGap(now, random);
+    }
+}
+
+}  // namespace
+
+// Indexed by LampMode.
+const EffectDescriptor LAMP_EFFECTS[LAMP_MODE_COUNT] = {
+    {"static", startSteady, nullptr},
+    {"blink", startBlink, stepBlink},
+    {"purr", startPurr, stepPurr},
+    {"bzzz", startBzzz, stepBzzz},
+};
+
+bool isPatternMode(LampMode mode) {
+    return static_cast<size_t>(mode) >= LAMP_MODE_COUNT;
+}
+
+const char* lampModeName(LampMode mode) {
+    if (isPatternMode(mode)) {
+        return lampPatterns[static_cast<size_t>(mode) - LAMP_MODE_COUNT].name;
+    }
+    return LAMP_EFFECTS[static_cast<size_t>(mode)].name;
+}
+
+bool parseLampMode(const char* name, LampMode& out) {
+    for (size_t i = 0; i < LAMP_MODE_COUNT; i++) {
+        if (strcmp(name, LAMP_EFFECTS[i].name) == 0) {
+            out = static_cast<LampMode>(i);
+            return true;
+        }
+    }
+    const int slot = findLampPattern(name);
+    if (slot < 0) {
+        return false;
+    }
+    out = lampPatternMode(static_cast<uint8_t>(slot));
+    return true;
+}
+
+void resetEffect(EffectState& state) {
+    state.nextMs = 0;
+    state.step = 0;
+    state.flickersRemaining = 0;
+    state.level = LAMP_EFFECT_FULL;
+    state.started = false;
+    memset(state.loopsLeft, 0, sizeof(state.loopsLeft));
+}
+
+bool lampEffectSteps(LampMode mode) {
+    return isPatternMode(mode) || LAMP_EFFECTS[static_cast<size_t>(mode)].step;
+}
+
+bool lampEffectDue(LampMode mode, const EffectState& state, uint32_t now) {
+    return state.started && lampEffectSteps(mode) && static_cast<int32_t>(now - state.nextMs) >= 0;
+}
+
+uint8_t tickLampEffect(LampMode mode, EffectState& state, uint32_t now, EffectRandom random) {
+    if (isPatternMode(mode)) {
+        if (!state.started || lampEffectDue(mode, state, now)) {
+            state.started = true;
+            runLampPattern(lampPatterns[static_cast<size_t>(mode) - LAMP_MODE_COUNT], state, now, random);
+        }
+        return state.level;
+    }
+    const EffectDescriptor& effect = LAMP_EFFECTS[static_cast<size_t>(mode)];
+    if (!state.started) {
+        effect.start(state, now, random);
+        state.started = true;
+    } else if (lampEffectDue(mode, state, now)) {
+        effect.step(state, now, random);
+    }
+    return state.level;
+}
@@ -0,0 +1,76 @@
+#ifndef MEOW_LAMP_EFFECTS_H
+#define MEOW_LAMP_EFFECTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Table-driven lamp effects.
+//
+// A mode is an index into LAMP_EFFECTS; names are only looked at when a mode
+// crosses the API or NVS boundary. Each tick costs one table lookup and one
+// deadline comparison. Adding an effect means adding a LampMode value and one
+// table entry in LampEffects.cpp. Modes past LampMode::Count run uploaded
+// patterns (see LampPattern.h).
+
+enum class LampMode : uint8_t {
+    Static,
+    Blink,
+    Purr,
+    Bzzz,
+    Count
+};
+
+const size_t LAMP_MODE_COUNT = static_cast<size_t>(LampMode::Count);
+const size_t LAMP_MODE_NAME_MAX = 15;
+const uint8_t LAMP_PATTERN_LOOPS_MAX = 4;
+
+// Effects output a level that scales the lamp brightness.
+const uint8_t LAMP_EFFECT_OFF = 0;
+const uint8_t LAMP_EFFECT_FULL = 255;
+
+// Returns a value in [min, maxExclusive). Injected so the firmware can use
+// the hardware RNG and tests can replay a fixed sequence.
+typedef long (*EffectRandom)(long min, long maxExclusive);
+
+struct EffectState {
+    uint32_t nextMs;
+    uint8_t step;
+    uint8_t flickersRemaining;
+    uint8_t level;
+    bool started;
+    // Pass counters of a pattern's loops; 0 when the loop is not running.
+    uint8_t loopsLeft[LAMP_PATTERN_LOOPS_MAX];
+};
+
+struct EffectDescriptor {
+    const char* name;
+    // Sets the first level and deadline.
+    void (*start)(EffectState& state, uint32_t now, EffectRandom random);
+    // Called once the deadline is reached; nullptr for effects that never
+    // change after start.
+    void (*step)(EffectState& state, uint32_t now, EffectRandom random);
+};
+
+extern const EffectDescriptor LAMP_EFFECTS[LAMP_MODE_COUNT];
+
+// Built-in modes plus the uploaded patterns currently installed.
+const char* lampModeName(LampMode mode);
+// Case-sensitive; callers lowercase user input first.
+bool parseLampMode(const char* name, LampMode& out);
+bool isPatternMode(LampMode mode);
+
+// Restarts the effect on the next tick.
+void resetEffect(EffectState& state);
+
+// False for effects that never change after their first tick.
+bool lampEffectSteps(LampMode mode);
+
+// True when the next tick at `now` steps a running effect, i.e. an edge that
+// was scheduled for `state.nextMs` is due. Never true for the first tick after
+// resetEffect() or for effects without a step.
+bool lampEffectDue(LampMode mode, const EffectState& state, uint32_t now);
+
+// Advances `state` to `now` and returns the effect level.
+uint8_t tickLampEffect(LampMode mode, EffectState& state, uint32_t now, EffectRandom random);
+
+#endif
@@ -0,0 +1,21 @@
+#include "LampFade.h"
+
+void startLampFade(LampFade& fade, uint32_t durationMs, uint32_t frameMs) {
+    uint32_t frames = frameMs > 0 ? durationMs / frameMs : 0;
+    if (frames == 0) {
+        frames = 1;
+    }
+    fade.weight = 0;
+    // Rounded up so the last frame always lands on the target.
+    fade.step = (LAMP_FADE_ONE + frames - 1) / frames;
+    fade.active = true;
+}
+
+uint32_t advanceLampFade(LampFade& fade) {
+    fade.weight += fade.step;
+    if (fade.weight >= LAMP_FADE_ONE) {
+        fade.weight = LAMP_FADE_ONE;
+        fade.active = false;
+    }
+    return fade.weight;
+}
@@ -0,0 +1,41 @@
+#ifndef MEOW_LAMP_FADE_H
+#define MEOW_LAMP_FADE_H
+
+#include <stdint.h>
+
+// Fixed-point fades between two lamp levels.
+//
+// Levels are brightness in Q8 (0..255 << 8) so a fade moves through the
+// gamma table smoothly instead of in whole brightness steps. Fade progress
+// is a Q16 weight advanced by a constant step per frame; a frame costs one
+// add, two multiplies and a shift, whatever the duration.
+
+const uint32_t LAMP_FADE_ONE = 1UL << 16;
+const uint16_t LAMP_LEVEL_MAX = 255U << 8;
+// Frame period of the firmware's fade timer.
+const uint32_t LAMP_FADE_FRAME_MS = 10;
+
+struct LampFade {
+    // Weight of the target level, 0..LAMP_FADE_ONE.
+    uint32_t weight;
+    uint32_t step;
+    bool active;
+};
+
+// Starts a fade lasting `durationMs`, advanced every `frameMs`.
+void startLampFade(LampFade& fade, uint32_t durationMs, uint32_t frameMs);
+
+// Moves one frame forward and returns the new weight; clears `active` once
+// the target is reached.
+uint32_t advanceLampFade(LampFade& fade);
+
+inline uint16_t blendLampLevel(uint16_t from, uint16_t to, uint32_t weight) {
+    // 65280 * 65536 still fits in 32 bits, so the sum cannot overflow.
+    return static_cast<uint16_t>((from * (LAMP_FADE_ONE - weight) + to * weight) >> 16);
+}
+
+inline uint16_t lampLevel(uint8_t brightness) {
+    return static_cast<uint16_t>(brightness << 8);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "LampGamma.h"
+
+namespace {
+
+constexpr double LAMP_GAMMA_EXPONENT = 2.2;
+constexpr double LN2 = 0.69314718055994530942;
+
+// constexpr stand-ins for log() and exp(), only valid for the ranges the
+// table needs: x in (0, 1] and y <= 0.
+constexpr double logUnit(double x) {
+    int halvings = 0;
+    while (x < 0.5) {
+        x *= 2;
+        halvings++;
+    }
+    // ln(x) = 2 atanh(z) with z = (x - 1) / (x + 1), |z| <= 1/3.
+    const double z = (x - 1) / (x + 1);
+    const double z2 = z * z;
+    double term = z;
+    double sum = 0;
+    for (int n = 1; n < 40; n += 2) {
+        sum += term / n;
+        term *= z2;
+    }
+    return 2 * sum - halvings * LN2;
+}
+
+constexpr double expNonPositive(double y) {
+    int squarings = 0;
+    while (y < -0.5) {
+        y /= 2;
+        squarings++;
+    }
+    double term = 1;
+    double sum = 1;
+    for (int n = 1; n < 20; n++) {
+        term *= y / n;
+        sum += term;
+    }
+    while (squarings-- > 0) {
+        sum *= sum;
+    }
+    return sum;
+}
+
+constexpr LampGammaTable makeGammaTable() {
+    LampGammaTable table = {};
+    for (size_t i = 1; i < LAMP_GAMMA_STEPS; i++) {
+        const double level = static_cast<double>(i) / LAMP_BRIGHTNESS_MAX;
+        const double duty = expNonPositive(LAMP_GAMMA_EXPONENT * logUnit(level)) * LAMP_PWM_MAX_DUTY + 0.5;
+        // Every non-zero brightness stays visibly lit.
+        table.duty[i] = duty < 1 ? 1 : static_cast<uint16_t>(duty);
+    }
+    return table;
+}
+
+constexpr bool isMonotonic(const LampGammaTable& table, size_t index) {
+    return index >= LAMP_GAMMA_STEPS ||
+           (table.duty[index - 1] <= table.duty[index] && isMonotonic(table, index + 1));
+}
+
+}  // namespace
+
+// Declared extern in the header, so this constexpr definition has external
+// linkage and lands in flash as a plain table.
+constexpr LampGammaTable LAMP_GAMMA = makeGammaTable();
+
+static_assert(LAMP_GAMMA.duty[0] == 0, "brightness 0 must be dark");
+static_assert(LAMP_GAMMA.duty[LAMP_BRIGHTNESS_MAX] == LAMP_PWM_MAX_DUTY, "full brightness must be full duty");
+static_assert(isMonotonic(LAMP_GAMMA, 1), "gamma table must not decrease");
@@ -0,0 +1,40 @@
+#ifndef MEOW_LAMP_GAMMA_H
+#define MEOW_LAMP_GAMMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Perceptual brightness to LEDC duty.
+//
+// The table is computed by the compiler, so mapping a 0-255 API brightness
+// to a duty cycle is one lookup with no floating point at run time (the
+// esp32c3 has no FPU).
+
+const uint8_t LAMP_PWM_BITS = 13;
+const uint16_t LAMP_PWM_MAX_DUTY = (1U << LAMP_PWM_BITS) - 1;
+const uint8_t LAMP_BRIGHTNESS_MAX = 255;
+const size_t LAMP_GAMMA_STEPS = LAMP_BRIGHTNESS_MAX + 1;
+
+struct LampGammaTable {
+    uint16_t duty[LAMP_GAMMA_STEPS];
+};
+
+extern const LampGammaTable LAMP_GAMMA;
+
+inline uint16_t lampDuty(uint8_t brightness) {
+    return LAMP_GAMMA.duty[brightness];
+}
+
+// Same for a Q8 level, interpolating between neighbouring table entries.
+inline uint16_t lampDutyForLevel(uint16_t levelQ8) {
+    const uint8_t index = static_cast<uint8_t>(levelQ8 >> 8);
+    const uint32_t fraction = levelQ8 & 0xFF;
+    if (index == LAMP_BRIGHTNESS_MAX || fraction == 0) {
+        return LAMP_GAMMA.duty[index];
+    }
+    const uint32_t low = LAMP_GAMMA.duty[index];
+    const uint32_t high = LAMP_GAMMA.duty[index + 1];
+    return static_cast<uint16_t>(low + (((high - low) * fraction) >> 8));
+}
+
+#endif
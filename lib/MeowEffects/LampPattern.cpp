@@ -0,0 +1,284 @@
+#include "LampPattern.h"
+
+#include <string.h>
+
+LampPattern lampPatterns[LAMP_PATTERN_SLOTS];
+
+namespace {
+
+uint16_t drawRange(uint16_t min, uint16_t max, EffectRandom random) {
+    return min == max ? min : static_cast<uint16_t>(random(min, static_cast<long>(max) + 1));
+}
+
+bool bodyHasKeyframe(const LampPattern& pattern, uint8_t from, uint8_t to) {
+    for (uint8_t i = from; i < to; i++) {
+        if (pattern.code[i].op == PatternOp::Key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rejectPattern(PatternCompile* compile, const char* key) {
+    compile->errorKey = key;
+    return false;
+}
+
+void clearStep(PatternCompile* compile) {
+    compile->hasLevel = false;
+    compile->hasMs = false;
+    compile->hasLoop = false;
+    compile->hasTimes = false;
+    compile->range = PatternRange::None;
+}
+
+bool endStep(PatternCompile* compile) {
+    LampPattern& pattern = compile->pattern;
+    if (pattern.length >= LAMP_PATTERN_STEPS_MAX) {
+        return rejectPattern(compile, "steps");
+    }
+    PatternInstruction& instruction = pattern.code[pattern.length];
+    memset(&instruction, 0, sizeof(instruction));
+    if (compile->hasLoop) {
+        if (compile->hasLevel || compile->hasMs) {
+            return rejectPattern(compile, "loop");
+        }
+        if (!compile->hasTimes || compile->timesRange[0] < 1 || compile->timesRange[0] > compile->timesRange[1] ||
+            compile->timesRange[1] > LAMP_PATTERN_TIMES_MAX) {
+            return rejectPattern(compile, "times");
+        }
+        if (compile->loopTarget < 0 || compile->loopTarget >= pattern.length ||
+            compile->loops >= LAMP_PATTERN_LOOPS_MAX) {
+            return rejectPattern(compile, "loop");
+        }
+        instruction.op = PatternOp::Loop;
+        instruction.arg = static_cast<uint8_t>(compile->loopTarget);
+        instruction.slot = compile->loops++;
+        instruction.min = static_cast<uint16_t>(compile->timesRange[0]);
+        instruction.max = static_cast<uint16_t>(compile->timesRange[1]);
+    } else {
+        if (!compile->hasLevel || compile->level < 0 || compile->level > LAMP_EFFECT_FULL || compile->hasTimes) {
+            return rejectPattern(compile, "level");
+        }
+        if (!compile->hasMs || compile->msRange[0] < 1 || compile->msRange[0] > compile->msRange[1] ||
+            compile->msRange[1] > LAMP_PATTERN_MS_MAX) {
+            return rejectPattern(compile, "ms");
+        }
+        instruction.op = PatternOp::Key;
+        instruction.arg = static_cast<uint8_t>(compile->level);
+        instruction.min = static_cast<uint16_t>(compile->msRange[0]);
+        instruction.max = static_cast<uint16_t>(compile->msRange[1]);
+    }
+    pattern.length++;
+    return true;
+}
+
+// Members of one step object; "ms" and "times" take a number or a
+// [min, max] pair.
+bool applyStepToken(PatternCompile* compile, const JsonToken& token) {
+    if (token.depth == 4) {
+        long* range = compile->range == PatternRange::Ms ? compile->msRange : compile->timesRange;
+        if (compile->range == PatternRange::None || token.type != JsonTokenType::Number || !token.integral ||
+            compile->rangeCount >= 2) {
+            return rejectPattern(compile, compile->range == PatternRange::Times ? "times" : "ms");
+        }
+        range[compile->rangeCount++] = token.number;
+        return true;
+    }
+    if (token.type == JsonTokenType::ArrayEnd) {
+        const PatternRange range = compile->range;
+        compile->range = PatternRange::None;
+        return compile->rangeCount == 2 || rejectPattern(compile, range == PatternRange::Times ? "times" : "ms");
+    }
+
+    const bool ms = strcmp(token.key, "ms") == 0;
+    const bool times = strcmp(token.key, "times") == 0;
+    if ((ms || times) && token.type == JsonTokenType::ArrayStart) {
+        compile->range = ms ? PatternRange::Ms : PatternRange::Times;
+        compile->rangeCount = 0;
+        (ms ? compile->hasMs : compile->hasTimes) = true;
+        return true;
+    }
+    if (token.type != JsonTokenType::Number || !token.integral) {
+        return rejectPattern(compile, ms || times || strcmp(token.key, "level") == 0 ||
+                                              strcmp(token.key, "loop") == 0
+                                          ? token.key
+                                          : "steps");
+    }
+    if (ms || times) {
+        long* range = ms ? compile->msRange : compile->timesRange;
+        range[0] = token.number;
+        range[1] = token.number;
+        (ms ? compile->hasMs : compile->hasTimes) = true;
+    } else if (strcmp(token.key, "level") == 0) {
+        compile->level = token.number;
+        compile->hasLevel = true;
+    } else if (strcmp(token.key, "loop") == 0) {
+        compile->loopTarget = token.number;
+        compile->hasLoop = true;
+    } else {
+        return rejectPattern(compile, "steps");
+    }
+    return true;
+}
+
+}  // namespace
+
+int findLampPattern(const char* name) {
+    for (uint8_t i = 0; i < LAMP_PATTERN_SLOTS; i++) {
+        if (lampPatterns[i].length > 0 && strcmp(lampPatterns[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int installLampPattern(const LampPattern& pattern) {
+    int slot = findLampPattern(pattern.name);
+    for (uint8_t i = 0; slot < 0 && i < LAMP_PATTERN_SLOTS; i++) {
+        if (lampPatterns[i].length == 0) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        lampPatterns[slot] = pattern;
+    }
+    return slot;
+}
+
+void removeLampPattern(uint8_t slot) {
+    memset(&lampPatterns[slot], 0, sizeof(lampPatterns[slot]));
+}
+
+bool isValidPatternName(const char* name) {
+    const size_t length = strnlen(name, LAMP_MODE_NAME_MAX + 1);
+    if (length == 0 || length > LAMP_MODE_NAME_MAX) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        const char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < LAMP_MODE_COUNT; i++) {
+        if (strcmp(name, LAMP_EFFECTS[i].name) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool validateLampPattern(const LampPattern& pattern) {
+    if (pattern.length == 0 || pattern.length > LAMP_PATTERN_STEPS_MAX || !isValidPatternName(pattern.name)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < pattern.length; i++) {
+        const PatternInstruction& instruction = pattern.code[i];
+        if (instruction.min > instruction.max) {
+            return false;
+        }
+        switch (instruction.op) {
+            case PatternOp::Key:
+                if (instruction.min < 1 || instruction.max > LAMP_PATTERN_MS_MAX) {
+                    return false;
+                }
+                break;
+            case PatternOp::Loop:
+                if (instruction.arg >= i || instruction.slot >= LAMP_PATTERN_LOOPS_MAX || instruction.min < 1 ||
+                    instruction.max > LAMP_PATTERN_TIMES_MAX || !bodyHasKeyframe(pattern, instruction.arg, i)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return bodyHasKeyframe(pattern, 0, pattern.length);
+}
+
+void runLampPattern(const LampPattern& pattern, EffectState& state, uint32_t now, EffectRandom random) {
+    // Every loop body holds a keyframe and each backward jump lands before the
+    // previous one, so a keyframe comes within 2 * length instructions.
+    const uint16_t budget = static_cast<uint16_t>(pattern.length) * 2;
+    if (state.step >= pattern.length) {
+        // A state left over from a longer pattern in the same slot.
+        state.step = 0;
+        memset(state.loopsLeft, 0, sizeof(state.loopsLeft));
+    }
+    for (uint16_t executed = 0; executed < budget; executed++) {
+        const PatternInstruction& instruction = pattern.code[state.step];
+        state.step = static_cast<uint8_t>(state.step + 1 == pattern.length ? 0 : state.step + 1);
+        if (instruction.op == PatternOp::Key) {
+            state.level = instruction.arg;
+            state.nextMs = now + drawRange(instruction.min, instruction.max, random);
+            return;
+        }
+        uint8_t& passesLeft = state.loopsLeft[instruction.slot];
+        if (passesLeft == 0) {
+            passesLeft = static_cast<uint8_t>(drawRange(instruction.min, instruction.max, random));
+        }
+        if (--passesLeft > 0) {
+            state.step = instruction.arg;
+        }
+    }
+    // Only reachable for a slot emptied while its mode is still running.
+    state.level = LAMP_EFFECT_OFF;
+    state.nextMs = now + LAMP_PATTERN_MS_MAX;
+}
+
+void beginPatternCompile(PatternCompile& compile) {
+    memset(&compile, 0, sizeof(compile));
+}
+
+bool applyPatternToken(void* context, const JsonToken& token) {
+    PatternCompile* compile = static_cast<PatternCompile*>(context);
+    if (token.depth == 0) {
+        return token.type == JsonTokenType::ObjectStart || token.type == JsonTokenType::ObjectEnd ||
+               rejectPattern(compile, "steps");
+    }
+    if (token.depth == 1) {
+        if (token.type == JsonTokenType::ArrayEnd || token.type == JsonTokenType::ObjectEnd) {
+            compile->inSteps = false;
+            return true;
+        }
+        if (strcmp(token.key, "name") == 0) {
+            if (token.type != JsonTokenType::String || token.length > LAMP_MODE_NAME_MAX) {
+                return rejectPattern(compile, "name");
+            }
+            memcpy(compile->pattern.name, token.text, token.length + 1);
+            return true;
+        }
+        if (strcmp(token.key, "steps") == 0) {
+            if (token.type != JsonTokenType::ArrayStart) {
+                return rejectPattern(compile, "steps");
+            }
+            compile->inSteps = true;
+        }
+        return true;
+    }
+    if (!compile->inSteps) {
+        return true;
+    }
+    if (token.depth == 2) {
+        if (token.type == JsonTokenType::ObjectStart) {
+            clearStep(compile);
+            return true;
+        }
+        if (token.type == JsonTokenType::ObjectEnd) {
+            return endStep(compile);
+        }
+        return rejectPattern(compile, "steps");
+    }
+    return applyStepToken(compile, token);
+}
+
+bool finishPatternCompile(PatternCompile& compile) {
+    if (!isValidPatternName(compile.pattern.name)) {
+        return rejectPattern(&compile, "name");
+    }
+    if (!validateLampPattern(compile.pattern)) {
+        return rejectPattern(&compile, "steps");
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+#ifndef MEOW_LAMP_PATTERN_H
+#define MEOW_LAMP_PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "JsonScanner.h"
+#include "LampEffects.h"
+
+// Uploaded lamp patterns.
+//
+// A pattern arrives as JSON steps and is compiled once into fixed 8-byte
+// instructions: keyframes (level plus a fixed or random hold time) and loops
+// (jump back to an earlier step a fixed or random number of times). The
+// compiled form is what gets stored in NVS. Every tick shows exactly one
+// keyframe; validation guarantees every loop body holds a keyframe, so
+// reaching it takes a bounded number of instructions and no allocation.
+//
+//   {"name":"candle","steps":[{"level":255,"ms":[300,900]},
+//    {"level":90,"ms":60},{"loop":0,"times":[2,4]},{"level":0,"ms":120}]}
+
+const uint8_t LAMP_PATTERN_SLOTS = 4;
+const uint8_t LAMP_PATTERN_STEPS_MAX = 32;
+const uint16_t LAMP_PATTERN_MS_MAX = 60000;
+const uint8_t LAMP_PATTERN_TIMES_MAX = 255;
+
+enum class PatternOp : uint8_t {
+    Key = 1,
+    Loop = 2
+};
+
+struct PatternInstruction {
+    PatternOp op;
+    // Key: effect level. Loop: step to jump back to.
+    uint8_t arg;
+    // Loop: index into EffectState::loopsLeft.
+    uint8_t slot;
+    uint8_t reserved;
+    // Key: hold time in ms. Loop: number of passes. Drawn from [min, max].
+    uint16_t min;
+    uint16_t max;
+};
+
+struct LampPattern {
+    char name[LAMP_MODE_NAME_MAX + 1];
+    // 0 marks an empty slot.
+    uint8_t length;
+    PatternInstruction code[LAMP_PATTERN_STEPS_MAX];
+};
+
+extern LampPattern lampPatterns[LAMP_PATTERN_SLOTS];
+
+inline LampMode lampPatternMode(uint8_t slot) {
+    return static_cast<LampMode>(LAMP_MODE_COUNT + slot);
+}
+
+// Slot holding `name`, or -1.
+int findLampPattern(const char* name);
+// Replaces the pattern with the same name or takes a free slot; returns the
+// slot, or -1 when all slots are used.
+int installLampPattern(const LampPattern& pattern);
+void removeLampPattern(uint8_t slot);
+
+// Lowercase letters, digits, '-' and '_', and not a built-in mode name.
+bool isValidPatternName(const char* name);
+// Structural check run on fresh uploads and on patterns loaded from NVS.
+bool validateLampPattern(const LampPattern& pattern);
+
+// Runs instructions until the next keyframe, setting state.level and
+// state.nextMs. state.step is the program counter; one past the end of a
+// replaced, shorter pattern starts it over.
+void runLampPattern(const LampPattern& pattern, EffectState& state, uint32_t now, EffectRandom random);
+
+enum class PatternRange : uint8_t {
+    None,
+    Ms,
+    Times
+};
+
+struct PatternCompile {
+    LampPattern pattern;
+    bool inSteps;
+    // Fields of the step being read.
+    bool hasLevel;
+    bool hasMs;
+    bool hasLoop;
+    bool hasTimes;
+    long level;
+    long loopTarget;
+    long msRange[2];
+    long timesRange[2];
+    PatternRange range;
+    uint8_t rangeCount;
+    uint8_t loops;
+    // Key of the member that failed, if any.
+    const char* errorKey;
+};
+
+void beginPatternCompile(PatternCompile& compile);
+// JsonTokenHandler; rejects the body on the first invalid step.
+bool applyPatternToken(void* context, const JsonToken& token);
+// Validates the whole pattern once the body is complete.
+bool finishPatternCompile(PatternCompile& compile);
+
+#endif
@@ -0,0 +1,51 @@
+#include "LampSimulator.h"
+
+namespace {
+
+uint32_t simulatedRandomState = 1;
+
+}  // namespace
+
+void seedSimulatedRandom(uint32_t seed) {
+    // xorshift32 never leaves 0, so map it to a fixed non-zero state.
+    simulatedRandomState = seed != 0 ? seed : 0x9E3779B9U;
+}
+
+long simulatedRandom(long min, long maxExclusive) {
+    uint32_t x = simulatedRandomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    simulatedRandomState = x;
+    if (maxExclusive <= min) {
+        return min;
+    }
+    return min + static_cast<long>(x % static_cast<uint32_t>(maxExclusive - min));
+}
+
+uint32_t simulateLampEffect(LampMode mode, uint32_t durationMs, uint32_t seed, EffectEdgeHandler handler,
+                            void* context) {
+    seedSimulatedRandom(seed);
+    EffectState state;
+    resetEffect(state);
+    uint32_t now = 0;
+    uint32_t ticks = 1;
+    EffectEdge edge = {0, tickLampEffect(mode, state, now, simulatedRandom)};
+    if (!handler(context, edge)) {
+        return ticks;
+    }
+    // Effects without a step never change after t=0.
+    while (lampEffectDue(mode, state, state.nextMs) && state.nextMs <= durationMs) {
+        now = state.nextMs;
+        const uint8_t level = tickLampEffect(mode, state, now, simulatedRandom);
+        ticks++;
+        if (level != edge.level) {
+            edge.atMs = now;
+            edge.level = level;
+            if (!handler(context, edge)) {
+                break;
+            }
+        }
+    }
+    return ticks;
+}
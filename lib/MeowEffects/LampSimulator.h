@@ -0,0 +1,33 @@
+#ifndef MEOW_LAMP_SIMULATOR_H
+#define MEOW_LAMP_SIMULATOR_H
+
+#include <stdint.h>
+
+#include "LampEffects.h"
+
+// Runs an effect on a virtual clock.
+//
+// The clock jumps straight from one deadline to the next and random draws
+// come from a seeded xorshift generator, so the same mode and seed always
+// give the same timeline and hours of effect time take a few thousand ticks.
+// Only plain C++ is used, so the same code renders timelines on the device
+// and on a host build.
+
+struct EffectEdge {
+    uint32_t atMs;
+    uint8_t level;
+};
+
+// Return false to stop the simulation early.
+typedef bool (*EffectEdgeHandler)(void* context, const EffectEdge& edge);
+
+// Deterministic EffectRandom. Not thread-safe; one simulation at a time.
+void seedSimulatedRandom(uint32_t seed);
+long simulatedRandom(long min, long maxExclusive);
+
+// Reports the level at t=0 and every level change up to `durationMs`.
+// Returns the number of ticks run.
+uint32_t simulateLampEffect(LampMode mode, uint32_t durationMs, uint32_t seed, EffectEdgeHandler handler,
+                            void* context);
+
+#endif
@@ -0,0 +1,83 @@
+#include "StripRenderer.h"
+
+#include "LampGamma.h"
+
+namespace {
+
+// One crest per PURR_WAVE_PX pixels, moving one wavelength per purr cycle.
+constexpr uint16_t PURR_WAVE_PX = 30;
+constexpr uint32_t PURR_WAVE_PERIOD_MS = 990;
+// Troughs of the wave stay at this fraction (of 255) of the envelope.
+constexpr uint8_t PURR_WAVE_FLOOR = 64;
+// Outside a flicker burst, one pixel in this many frames glitches.
+constexpr long BZZZ_IDLE_GLITCH_FRAMES = 8;
+
+// 8-bit gamma-corrected value of a Q8 level.
+uint8_t pixelValue(uint16_t levelQ8) {
+    return static_cast<uint8_t>(lampDutyForLevel(levelQ8) >> (LAMP_PWM_BITS - 8));
+}
+
+uint8_t scaleChannel(uint8_t channel, uint8_t value) {
+    return static_cast<uint8_t>((channel * value * 257U + 32768U) >> 16);
+}
+
+StripPixel colorAt(const StripScene& scene, uint8_t value) {
+    return StripPixel{scaleChannel(scene.green, value), scaleChannel(scene.red, value),
+                      scaleChannel(scene.blue, value)};
+}
+
+void fill(StripPixel* pixels, uint16_t count, StripPixel pixel) {
+    for (uint16_t i = 0; i < count; i++) {
+        pixels[i] = pixel;
+    }
+}
+
+// Smoothstep of a triangle wave: 0 at phase 0, 255 at phase 128.
+uint8_t waveAt(uint8_t phase) {
+    const uint32_t t = phase < 128 ? phase * 2U : (255U - phase) * 2U;
+    return static_cast<uint8_t>(t * t * (765U - 2U * t) / 65025U);
+}
+
+void renderPurr(const StripScene& scene, StripPixel* pixels, uint16_t count) {
+    // Phases are Q8.8 turns so the per-pixel step keeps its fraction.
+    const uint32_t step = 65536U / PURR_WAVE_PX;
+    uint32_t phase = 65536U - (scene.nowMs % PURR_WAVE_PERIOD_MS) * 65536U / PURR_WAVE_PERIOD_MS;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint32_t weight = PURR_WAVE_FLOOR + (255U - PURR_WAVE_FLOOR) * waveAt(static_cast<uint8_t>(phase >> 8)) / 255U;
+        pixels[i] = colorAt(scene, pixelValue(static_cast<uint16_t>(scene.envelope * weight / 255U)));
+        phase += step;
+    }
+}
+
+// During a flicker burst about half the pixels drop out each frame; between
+// bursts a stray pixel dims now and then.
+void renderBzzz(const StripScene& scene, StripPixel* pixels, uint16_t count, EffectRandom random) {
+    const StripPixel lit = colorAt(scene, pixelValue(scene.envelope));
+    if (scene.effectLevel == LAMP_EFFECT_OFF) {
+        const StripPixel dark = {0, 0, 0};
+        for (uint16_t i = 0; i < count; i++) {
+            pixels[i] = random(0, 2) ? lit : dark;
+        }
+        return;
+    }
+    fill(pixels, count, lit);
+    if (count > 0 && random(0, BZZZ_IDLE_GLITCH_FRAMES) == 0) {
+        pixels[random(0, count)] = colorAt(scene, pixelValue(scene.envelope / 4));
+    }
+}
+
+}  // namespace
+
+void renderStrip(const StripScene& scene, StripPixel* pixels, uint16_t count, EffectRandom random) {
+    switch (scene.mode) {
+        case LampMode::Purr:
+            renderPurr(scene, pixels, count);
+            break;
+        case LampMode::Bzzz:
+            renderBzzz(scene, pixels, count, random);
+            break;
+        default:
+            fill(pixels, count, colorAt(scene, pixelValue(scene.level)));
+            break;
+    }
+}
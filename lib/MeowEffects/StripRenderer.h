@@ -0,0 +1,44 @@
+#ifndef MEOW_STRIP_RENDERER_H
+#define MEOW_STRIP_RENDERER_H
+
+#include <stdint.h>
+
+#include "LampEffects.h"
+
+// Renders the lamp mode across an addressable strip.
+//
+// The renderer only fills a pixel buffer from a snapshot of the lamp, so it
+// knows nothing about RMT and runs the same on a host build. Uniform modes
+// cost one gamma lookup per frame plus a fill; purr draws a travelling wave
+// and bzzz knocks out random pixels, at one gamma lookup per pixel.
+
+const uint16_t STRIP_PIXELS_MAX = 300;
+// Frame period of the firmware's strip timer, 60 fps.
+const uint32_t STRIP_FRAME_US = 1000000 / 60;
+
+// WS2812/SK6812 wire order, so a frame streams out as is.
+struct StripPixel {
+    uint8_t green;
+    uint8_t red;
+    uint8_t blue;
+};
+
+struct StripScene {
+    LampMode mode;
+    // Q8 level the single-pin lamp shows right now: brightness, effect and
+    // fade applied.
+    uint16_t level;
+    // Q8 level of the lit lamp without the effect: brightness and fade only.
+    // Purr and bzzz draw their own shape under it.
+    uint16_t envelope;
+    // Current effect output, 0..255.
+    uint8_t effectLevel;
+    uint32_t nowMs;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+};
+
+void renderStrip(const StripScene& scene, StripPixel* pixels, uint16_t count, EffectRandom random);
+
+#endif
@@ -0,0 +1,64 @@
+#include "FileStream.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Sends what the socket takes right now into `sent`. Returns false when the
+// socket failed.
+bool sendWithoutBlocking(int fd, const void* data, size_t length, size_t& sent) {
+    const ssize_t result = send(fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (result < 0) {
+        sent = 0;
+        return errno == EWOULDBLOCK || errno == EAGAIN;
+    }
+    sent = static_cast<size_t>(result);
+    return true;
+}
+
+}  // namespace
+
+bool startFileStream(FileStream& stream, const char* mimeType, const uint8_t* body, size_t bodyLength,
+                     bool withBody) {
+    const int headLength = snprintf(stream.head, sizeof(stream.head),
+                                    "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: %s\r\n"
+                                    "Content-Length: %u\r\n"
+                                    "Content-Encoding: gzip\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "Connection: close\r\n\r\n",
+                                    mimeType, static_cast<unsigned>(bodyLength));
+    if (headLength <= 0 || static_cast<size_t>(headLength) >= sizeof(stream.head)) {
+        return false;
+    }
+    stream.headLength = static_cast<size_t>(headLength);
+    stream.headSent = 0;
+    stream.body = body;
+    stream.bodyLength = withBody ? bodyLength : 0;
+    stream.bodySent = 0;
+    return true;
+}
+
+FileStreamStatus advanceFileStream(FileStream& stream, int fd, bool& progressed) {
+    const size_t before = stream.headSent + stream.bodySent;
+    size_t sent = 1;
+    while (sent > 0 && stream.headSent < stream.headLength) {
+        if (!sendWithoutBlocking(fd, stream.head + stream.headSent, stream.headLength - stream.headSent, sent)) {
+            return FileStreamStatus::Failed;
+        }
+        stream.headSent += sent;
+    }
+    while (sent > 0 && stream.bodySent < stream.bodyLength) {
+        if (!sendWithoutBlocking(fd, stream.body + stream.bodySent, stream.bodyLength - stream.bodySent, sent)) {
+            return FileStreamStatus::Failed;
+        }
+        stream.bodySent += sent;
+    }
+    progressed = stream.headSent + stream.bodySent != before;
+    if (stream.headSent == stream.headLength && stream.bodySent == stream.bodyLength) {
+        return FileStreamStatus::Done;
+    }
+    return FileStreamStatus::Sending;
+}
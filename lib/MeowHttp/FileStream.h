@@ -0,0 +1,42 @@
+#ifndef MEOW_FILE_STREAM_H
+#define MEOW_FILE_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A gzip'd web file sent as one complete HTTP/1.1 response over a socket.
+//
+// The header is formatted into the stream once and the body is sent
+// straight from flash. advanceFileStream() hands the socket whatever it
+// takes right now (send() with MSG_DONTWAIT) and returns, so one pass can
+// move several streams along and a slow phone never holds up the others.
+// Only send() is used, so a host build drives the same code over
+// socketpairs.
+
+const size_t FILE_STREAM_HEAD_MAX = 192;
+
+enum class FileStreamStatus : uint8_t {
+    Sending,
+    Done,
+    // The socket failed; close it.
+    Failed
+};
+
+struct FileStream {
+    char head[FILE_STREAM_HEAD_MAX];
+    size_t headLength;
+    size_t headSent;
+    const uint8_t* body;
+    size_t bodyLength;
+    size_t bodySent;
+};
+
+// Formats the 200 header for `body`; a HEAD reply (`withBody` false) stops
+// after it. Returns false when the header does not fit.
+bool startFileStream(FileStream& stream, const char* mimeType, const uint8_t* body, size_t bodyLength,
+                     bool withBody = true);
+
+// Header first, then the body. `progressed` is set when any byte went out.
+FileStreamStatus advanceFileStream(FileStream& stream, int fd, bool& progressed);
+
+#endif
@@ -0,0 +1,57 @@
+#include "FileTransfers.h"
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+namespace {
+
+const char REFUSAL_BODY[] = "Meow. Too many downloads, try again.";
+const size_t REFUSAL_MAX = 256;
+
+}  // namespace
+
+int findFreeFileTransfer(const FileTransfers& transfers) {
+    for (uint8_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        if (!transfers.slots[i].active) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool beginFileTransfer(FileTransfer& transfer, int fd, const char* mimeType, const uint8_t* body, size_t bodyLength,
+                       bool withBody, uint32_t now) {
+    if (!startFileStream(transfer.stream, mimeType, body, bodyLength, withBody)) {
+        return false;
+    }
+    transfer.fd = fd;
+    transfer.lastProgressMs = now;
+    transfer.active = true;
+    return true;
+}
+
+bool advanceFileTransfer(FileTransfer& transfer, uint32_t now) {
+    bool progressed = false;
+    const FileStreamStatus status = advanceFileStream(transfer.stream, transfer.fd, progressed);
+    if (progressed) {
+        transfer.lastProgressMs = now;
+    }
+    return status == FileStreamStatus::Sending && now - transfer.lastProgressMs < FILE_TRANSFER_STALL_MS;
+}
+
+void refuseFileTransfer(FileTransfers& transfers, int fd) {
+    char reply[REFUSAL_MAX];
+    const int length = snprintf(reply, sizeof(reply),
+                                "HTTP/1.1 503 Service Unavailable\r\n"
+                                "Content-Type: text/plain\r\n"
+                                "Content-Length: %u\r\n"
+                                "Retry-After: %u\r\n"
+                                "Cache-Control: no-store\r\n"
+                                "Connection: close\r\n\r\n%s",
+                                static_cast<unsigned>(sizeof(REFUSAL_BODY) - 1),
+                                static_cast<unsigned>(FILE_TRANSFER_RETRY_S), REFUSAL_BODY);
+    if (length > 0 && static_cast<size_t>(length) < sizeof(reply)) {
+        send(fd, reply, static_cast<size_t>(length), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    transfers.refused++;
+}
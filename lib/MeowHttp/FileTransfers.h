@@ -0,0 +1,57 @@
+#ifndef MEOW_FILE_TRANSFERS_H
+#define MEOW_FILE_TRANSFERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FileStream.h"
+
+// Web file downloads in flight, each on a socket taken over from WebServer.
+//
+// WebServer handles one connection at a time, so sending the 78 KB page from
+// a handler held up every other request until the phone had it all. A web
+// file GET is handed to a free slot instead and every network pass gives
+// each slot one advanceFileTransfer(), so WebServer is free for the next
+// request after one pass. A slot only knows the fd: the caller owns the
+// socket, counts it against its socket budget and closes it once the
+// transfer is over. A file requested while no slot is free is refused with
+// a 503 and Retry-After rather than sent the blocking way.
+
+// As many as the sockets the firmware can take over, so a dozen phones
+// loading the page at once all get a slot while nothing else holds one.
+// About 230 bytes each.
+const uint8_t FILE_TRANSFERS_MAX = 12;
+// A peer that takes no bytes for this long is dropped.
+const uint32_t FILE_TRANSFER_STALL_MS = 10000;
+const uint8_t FILE_TRANSFER_RETRY_S = 1;
+
+struct FileTransfer {
+    FileStream stream;
+    int fd;
+    uint32_t lastProgressMs;
+    // Cleared by the caller when it closes the socket.
+    bool active;
+};
+
+struct FileTransfers {
+    FileTransfer slots[FILE_TRANSFERS_MAX];
+    uint32_t refused;
+};
+
+// A free slot, or -1.
+int findFreeFileTransfer(const FileTransfers& transfers);
+
+// Claims the slot for `body` on `fd`; nothing is sent yet. Returns false,
+// leaving the slot free, when the header does not fit.
+bool beginFileTransfer(FileTransfer& transfer, int fd, const char* mimeType, const uint8_t* body, size_t bodyLength,
+                       bool withBody, uint32_t now);
+
+// Hands the socket what it takes right now. Returns false once the transfer
+// is over (sent, failed or stalled); the caller then closes the socket.
+bool advanceFileTransfer(FileTransfer& transfer, uint32_t now);
+
+// Answers 503 with Retry-After on a fresh socket without waiting; the reply
+// is far smaller than any socket's send buffer.
+void refuseFileTransfer(FileTransfers& transfers, int fd);
+
+#endif
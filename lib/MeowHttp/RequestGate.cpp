@@ -0,0 +1,35 @@
+#include "RequestGate.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Only the network pass calls the gate.
+char peeked[REQUEST_HEAD_PEEK_MAX];
+
+}  // namespace
+
+bool requestHeadComplete(const char* data, size_t length) {
+    for (size_t i = 3; i < length; i++) {
+        if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+            return true;
+        }
+    }
+    return false;
+}
+
+RequestGate gateRequest(int fd, uint32_t waitedMs, bool otherWaiting) {
+    const ssize_t got = recv(fd, peeked, sizeof(peeked), MSG_PEEK | MSG_DONTWAIT);
+    if (got == 0 || (got < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
+        return RequestGate::Drop;
+    }
+    const size_t length = got > 0 ? static_cast<size_t>(got) : 0;
+    if (length == sizeof(peeked) || requestHeadComplete(peeked, length)) {
+        return RequestGate::Serve;
+    }
+    if (waitedMs >= REQUEST_HEAD_WAIT_MS || (length == 0 && otherWaiting && waitedMs >= REQUEST_IDLE_MS)) {
+        return RequestGate::Drop;
+    }
+    return RequestGate::Wait;
+}
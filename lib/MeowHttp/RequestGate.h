@@ -0,0 +1,41 @@
+#ifndef MEOW_REQUEST_GATE_H
+#define MEOW_REQUEST_GATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decides when WebServer may parse the request on its one connection.
+//
+// WebServer serves one connection at a time and reads the request head with
+// blocking line reads. A phone that has connected but sent nothing yet (a
+// browser's spare preconnection, or a slow link) kept every other phone
+// waiting for WebServer's 5 s limit, and a head arriving in pieces stalled
+// the pass inside readStringUntil(). The gate peeks at the socket without
+// consuming anything and lets WebServer parse only a complete head. A
+// connection that has sent nothing gives way to the next one after
+// REQUEST_IDLE_MS, so a spare preconnection costs the others a quarter of a
+// second instead of five. Only recv() is used, so a host build drives the
+// same code over socketpairs.
+
+// A head longer than this is handed to WebServer as it is.
+const size_t REQUEST_HEAD_PEEK_MAX = 1024;
+// Nothing received for this long while another connection waits.
+const uint32_t REQUEST_IDLE_MS = 250;
+// No complete head after this long, whether or not anyone else waits.
+const uint32_t REQUEST_HEAD_WAIT_MS = 5000;
+
+enum class RequestGate : uint8_t {
+    Wait,
+    Serve,
+    // Close the connection and take the next one.
+    Drop
+};
+
+// `waitedMs` since the connection was accepted; `otherWaiting` when the
+// listener already holds the next connection.
+RequestGate gateRequest(int fd, uint32_t waitedMs, bool otherWaiting);
+
+// True when `data` holds the blank line that ends a request head.
+bool requestHeadComplete(const char* data, size_t length);
+
+#endif
@@ -0,0 +1,514 @@
+#include "JsonScanner.h"
+
+#include <limits.h>
+
+static_assert(MEOW_JSON_DEPTH_MAX <= 32, "container mask holds at most 32 levels");
+
+namespace {
+
+bool isJsonSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool isLetter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+const uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+}  // namespace
+
+JsonScanner::JsonScanner(JsonTokenHandler handler, void* context)
+    : handler_(handler), context_(context) {
+    reset();
+}
+
+void JsonScanner::reset() {
+    state_ = State::Value;
+    stringState_ = State::ValueString;
+    error_ = JsonError::None;
+    depth_ = 0;
+    objectMask_ = 0;
+    unicodeDigits_ = 0;
+    unicodeValue_ = 0;
+    highSurrogate_ = 0;
+    negative_ = false;
+    integral_ = true;
+    hasDigits_ = false;
+    number_ = 0;
+    consumed_ = 0;
+    keyLength_ = 0;
+    valueLength_ = 0;
+    key_[0] = '\0';
+    value_[0] = '\0';
+}
+
+void JsonScanner::reset(JsonTokenHandler handler, void* context) {
+    handler_ = handler;
+    context_ = context;
+    reset();
+}
+
+bool JsonScanner::feed(const char* data, size_t length) {
+    if (state_ == State::Failed) {
+        return false;
+    }
+    size_t i = 0;
+    while (i < length) {
+        if (state_ == State::KeyString || state_ == State::ValueString) {
+            const size_t run = copyStringRun(data + i, length - i);
+            i += run;
+            consumed_ += run;
+            if (state_ == State::Failed) {
+                return false;
+            }
+            if (i == length) {
+                break;
+            }
+        }
+        if (!step(data[i])) {
+            return false;
+        }
+        consumed_++;
+        i++;
+    }
+    return true;
+}
+
+// Most of a body is plain string bytes; they are copied in one run instead
+// of going through step() one by one. Stops at the first byte step() has to
+// look at: a quote, a backslash or a control character.
+size_t JsonScanner::copyStringRun(const char* data, size_t length) {
+    if (highSurrogate_ != 0) {
+        return 0;
+    }
+    const bool key = state_ == State::KeyString;
+    char* buffer = key ? key_ : value_;
+    size_t& used = key ? keyLength_ : valueLength_;
+    const size_t room = (key ? MEOW_JSON_KEY_MAX : MEOW_JSON_VALUE_MAX) - used;
+    size_t run = 0;
+    while (run < length) {
+        const char c = data[run];
+        if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20) {
+            break;
+        }
+        if (run == room) {
+            fail(key ? JsonError::KeyTooLong : JsonError::ValueTooLong);
+            return run;
+        }
+        buffer[used + run] = c;
+        run++;
+    }
+    used += run;
+    return run;
+}
+
+bool JsonScanner::finish() {
+    if (depth_ == 0) {
+        if (state_ == State::Number && !emitNumber()) {
+            return false;
+        }
+        if (state_ == State::Literal && !emitLiteral()) {
+            return false;
+        }
+    }
+    if (state_ == State::Done) {
+        return true;
+    }
+    if (state_ == State::Failed) {
+        return false;
+    }
+    return fail(JsonError::Incomplete);
+}
+
+bool JsonScanner::done() const {
+    return state_ == State::Done;
+}
+
+JsonError JsonScanner::error() const {
+    return error_;
+}
+
+const char* JsonScanner::errorKey() const {
+    return key_;
+}
+
+size_t JsonScanner::consumed() const {
+    return consumed_;
+}
+
+bool JsonScanner::step(char c) {
+    switch (state_) {
+        case State::Value:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            return beginValue(c);
+
+        case State::ArrayValueOrEnd:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            if (c == ']') {
+                return closeContainer(false);
+            }
+            return beginValue(c);
+
+        case State::KeyOrEnd:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            if (c == '}') {
+                return closeContainer(true);
+            }
+            return beginKey(c);
+
+        case State::Key:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            return beginKey(c);
+
+        case State::KeyString:
+        case State::ValueString:
+            if (c == '"') {
+                if (!flushSurrogate()) {
+                    return false;
+                }
+                if (state_ == State::KeyString) {
+                    key_[keyLength_] = '\0';
+                    state_ = State::Colon;
+                    return true;
+                }
+                value_[valueLength_] = '\0';
+                return emit(JsonTokenType::String) && endValue();
+            }
+            if (c == '\\') {
+                stringState_ = state_;
+                state_ = State::Escape;
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) {
+                return fail(JsonError::Syntax);
+            }
+            return flushSurrogate() && appendByte(c);
+
+        case State::Escape:
+            state_ = stringState_;
+            switch (c) {
+                case '"':
+                case '\\':
+                case '/':
+                    return flushSurrogate() && appendByte(c);
+                case 'b':
+                    return flushSurrogate() && appendByte('\b');
+                case 'f':
+                    return flushSurrogate() && appendByte('\f');
+                case 'n':
+                    return flushSurrogate() && appendByte('\n');
+                case 'r':
+                    return flushSurrogate() && appendByte('\r');
+                case 't':
+                    return flushSurrogate() && appendByte('\t');
+                case 'u':
+                    unicodeDigits_ = 0;
+                    unicodeValue_ = 0;
+                    state_ = State::Unicode;
+                    return true;
+                default:
+                    return fail(JsonError::Syntax);
+            }
+
+        case State::Unicode: {
+            const int digit = hexValue(c);
+            if (digit < 0) {
+                return fail(JsonError::Syntax);
+            }
+            unicodeValue_ = static_cast<uint16_t>((unicodeValue_ << 4) | digit);
+            if (++unicodeDigits_ < 4) {
+                return true;
+            }
+            state_ = stringState_;
+            return appendEscapedUnit(unicodeValue_);
+        }
+
+        case State::Colon:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            if (c != ':') {
+                return fail(JsonError::Syntax);
+            }
+            state_ = State::Value;
+            return true;
+
+        case State::Number:
+            if (isDigit(c)) {
+                hasDigits_ = true;
+                if (integral_) {
+                    if (number_ > (LONG_MAX - 9) / 10) {
+                        integral_ = false;
+                    } else {
+                        number_ = number_ * 10 + (c - '0');
+                    }
+                }
+                return true;
+            }
+            if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                if (!hasDigits_) {
+                    return fail(JsonError::Syntax);
+                }
+                integral_ = false;
+                return true;
+            }
+            if (!emitNumber()) {
+                return false;
+            }
+            return step(c);
+
+        case State::Literal:
+            if (isLetter(c)) {
+                if (valueLength_ >= 5) {
+                    return fail(JsonError::Syntax);
+                }
+                value_[valueLength_++] = c;
+                return true;
+            }
+            if (!emitLiteral()) {
+                return false;
+            }
+            return step(c);
+
+        case State::CommaOrEnd:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            if (c == ',') {
+                state_ = inObject() ? State::Key : State::Value;
+                return true;
+            }
+            if (c == '}' && inObject()) {
+                return closeContainer(true);
+            }
+            if (c == ']' && !inObject()) {
+                return closeContainer(false);
+            }
+            return fail(JsonError::Syntax);
+
+        case State::Done:
+            if (isJsonSpace(c)) {
+                return true;
+            }
+            return fail(JsonError::Syntax);
+
+        case State::Failed:
+            return false;
+    }
+    return fail(JsonError::Syntax);
+}
+
+bool JsonScanner::beginKey(char c) {
+    if (c != '"') {
+        return fail(JsonError::Syntax);
+    }
+    keyLength_ = 0;
+    key_[0] = '\0';
+    highSurrogate_ = 0;
+    state_ = State::KeyString;
+    return true;
+}
+
+bool JsonScanner::beginValue(char c) {
+    if (c == '{' || c == '[') {
+        if (depth_ >= MEOW_JSON_DEPTH_MAX) {
+            return fail(JsonError::Depth);
+        }
+        const bool object = c == '{';
+        if (!emit(object ? JsonTokenType::ObjectStart : JsonTokenType::ArrayStart)) {
+            return false;
+        }
+        if (object) {
+            objectMask_ |= (1UL << depth_);
+        } else {
+            objectMask_ &= ~(1UL << depth_);
+        }
+        depth_++;
+        keyLength_ = 0;
+        key_[0] = '\0';
+        state_ = object ? State::KeyOrEnd : State::ArrayValueOrEnd;
+        return true;
+    }
+    if (c == '"') {
+        valueLength_ = 0;
+        highSurrogate_ = 0;
+        state_ = State::ValueString;
+        return true;
+    }
+    if (c == '-' || isDigit(c)) {
+        negative_ = c == '-';
+        hasDigits_ = !negative_;
+        integral_ = true;
+        number_ = negative_ ? 0 : c - '0';
+        state_ = State::Number;
+        return true;
+    }
+    if (isLetter(c)) {
+        value_[0] = c;
+        valueLength_ = 1;
+        state_ = State::Literal;
+        return true;
+    }
+    return fail(JsonError::Syntax);
+}
+
+bool JsonScanner::endValue() {
+    state_ = depth_ == 0 ? State::Done : State::CommaOrEnd;
+    return true;
+}
+
+bool JsonScanner::closeContainer(bool object) {
+    depth_--;
+    if (!emit(object ? JsonTokenType::ObjectEnd : JsonTokenType::ArrayEnd)) {
+        return false;
+    }
+    return endValue();
+}
+
+bool JsonScanner::emit(JsonTokenType type) {
+    JsonToken token;
+    token.type = type;
+    token.depth = depth_;
+    token.key = inObject() ? key_ : "";
+    token.text = value_;
+    token.length = type == JsonTokenType::String ? valueLength_ : 0;
+    token.number = negative_ ? -number_ : number_;
+    token.integral = integral_;
+    token.boolean = type == JsonTokenType::Bool && value_[0] == 't';
+    if (type == JsonTokenType::ObjectEnd || type == JsonTokenType::ArrayEnd) {
+        token.key = "";
+    }
+    if (!handler_(context_, token)) {
+        return fail(JsonError::Rejected);
+    }
+    return true;
+}
+
+bool JsonScanner::emitNumber() {
+    if (!hasDigits_) {
+        return fail(JsonError::Syntax);
+    }
+    if (!emit(JsonTokenType::Number)) {
+        return false;
+    }
+    negative_ = false;
+    return endValue();
+}
+
+bool JsonScanner::emitLiteral() {
+    value_[valueLength_] = '\0';
+    JsonTokenType type;
+    if (valueLength_ == 4 && value_[0] == 't' && value_[1] == 'r' && value_[2] == 'u' && value_[3] == 'e') {
+        type = JsonTokenType::Bool;
+    } else if (valueLength_ == 5 && value_[0] == 'f' && value_[1] == 'a' && value_[2] == 'l' &&
+               value_[3] == 's' && value_[4] == 'e') {
+        type = JsonTokenType::Bool;
+    } else if (valueLength_ == 4 && value_[0] == 'n' && value_[1] == 'u' && value_[2] == 'l' && value_[3] == 'l') {
+        type = JsonTokenType::Null;
+    } else {
+        return fail(JsonError::Syntax);
+    }
+    if (!emit(type)) {
+        return false;
+    }
+    return endValue();
+}
+
+bool JsonScanner::appendByte(char c) {
+    if (state_ == State::KeyString) {
+        if (keyLength_ >= MEOW_JSON_KEY_MAX) {
+            return fail(JsonError::KeyTooLong);
+        }
+        key_[keyLength_++] = c;
+        return true;
+    }
+    if (valueLength_ >= MEOW_JSON_VALUE_MAX) {
+        return fail(JsonError::ValueTooLong);
+    }
+    value_[valueLength_++] = c;
+    return true;
+}
+
+bool JsonScanner::appendCodepoint(uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        return appendByte(static_cast<char>(codepoint));
+    }
+    if (codepoint < 0x800) {
+        return appendByte(static_cast<char>(0xC0 | (codepoint >> 6))) &&
+               appendByte(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+    if (codepoint < 0x10000) {
+        return appendByte(static_cast<char>(0xE0 | (codepoint >> 12))) &&
+               appendByte(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F))) &&
+               appendByte(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+    return appendByte(static_cast<char>(0xF0 | (codepoint >> 18))) &&
+           appendByte(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F))) &&
+           appendByte(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F))) &&
+           appendByte(static_cast<char>(0x80 | (codepoint & 0x3F)));
+}
+
+bool JsonScanner::appendEscapedUnit(uint16_t unit) {
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        if (!flushSurrogate()) {
+            return false;
+        }
+        highSurrogate_ = unit;
+        return true;
+    }
+    if (unit >= 0xDC00 && unit <= 0xDFFF) {
+        if (highSurrogate_ == 0) {
+            return appendCodepoint(REPLACEMENT_CHARACTER);
+        }
+        const uint32_t codepoint = 0x10000 + ((static_cast<uint32_t>(highSurrogate_) - 0xD800) << 10) + (unit - 0xDC00);
+        highSurrogate_ = 0;
+        return appendCodepoint(codepoint);
+    }
+    return flushSurrogate() && appendCodepoint(unit);
+}
+
+bool JsonScanner::flushSurrogate() {
+    if (highSurrogate_ == 0) {
+        return true;
+    }
+    highSurrogate_ = 0;
+    return appendCodepoint(REPLACEMENT_CHARACTER);
+}
+
+bool JsonScanner::fail(JsonError error) {
+    if (state_ != State::Failed) {
+        error_ = error;
+        state_ = State::Failed;
+    }
+    return false;
+}
+
+bool JsonScanner::inObject() const {
+    return depth_ > 0 && ((objectMask_ >> (depth_ - 1)) & 1UL) != 0;
+}
@@ -0,0 +1,145 @@
+#ifndef MEOW_JSON_SCANNER_H
+#define MEOW_JSON_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-pass, push-style JSON tokenizer.
+//
+// Bytes are fed in as they arrive and every complete token is reported to a
+// handler exactly once, so a body is scanned a single time no matter how many
+// keys the caller is interested in. Keys and string values are decoded into
+// fixed buffers inside the scanner; nothing is allocated on the heap.
+
+#ifndef MEOW_JSON_KEY_MAX
+#define MEOW_JSON_KEY_MAX 31
+#endif
+
+#ifndef MEOW_JSON_VALUE_MAX
+#define MEOW_JSON_VALUE_MAX 127
+#endif
+
+#ifndef MEOW_JSON_DEPTH_MAX
+#define MEOW_JSON_DEPTH_MAX 8
+#endif
+
+enum class JsonTokenType : uint8_t {
+    ObjectStart,
+    ObjectEnd,
+    ArrayStart,
+    ArrayEnd,
+    String,
+    Number,
+    Bool,
+    Null
+};
+
+enum class JsonError : uint8_t {
+    None,
+    Syntax,
+    Depth,
+    KeyTooLong,
+    ValueTooLong,
+    Rejected,
+    Incomplete
+};
+
+struct JsonToken {
+    JsonTokenType type;
+    // Number of containers enclosing the token; members of the top-level
+    // object are reported with depth 1.
+    uint8_t depth;
+    // Member name the token belongs to, or "" inside arrays. Not set for
+    // ObjectEnd/ArrayEnd.
+    const char* key;
+    // Decoded, nul-terminated string value (String tokens only).
+    const char* text;
+    size_t length;
+    long number;
+    // False when the number had a fraction or exponent; `number` then only
+    // holds the integer part.
+    bool integral;
+    bool boolean;
+};
+
+// Return false to abort the scan with JsonError::Rejected.
+typedef bool (*JsonTokenHandler)(void* context, const JsonToken& token);
+
+class JsonScanner {
+public:
+    JsonScanner(JsonTokenHandler handler, void* context);
+
+    void reset();
+    // Rebinds the scanner to another handler, e.g. for the next request body.
+    void reset(JsonTokenHandler handler, void* context);
+
+    // Consumes a chunk of input. Returns false once the scan has failed;
+    // further input is ignored until reset().
+    bool feed(const char* data, size_t length);
+
+    // Signals end of input. Returns true if exactly one complete JSON value
+    // was seen and the handler accepted every token.
+    bool finish();
+
+    bool done() const;
+    JsonError error() const;
+    // Key the scanner was working on when an error occurred, if any.
+    const char* errorKey() const;
+    size_t consumed() const;
+
+private:
+    enum class State : uint8_t {
+        Value,
+        ArrayValueOrEnd,
+        KeyOrEnd,
+        Key,
+        KeyString,
+        Colon,
+        ValueString,
+        Escape,
+        Unicode,
+        Number,
+        Literal,
+        CommaOrEnd,
+        Done,
+        Failed
+    };
+
+    bool step(char c);
+    size_t copyStringRun(const char* data, size_t length);
+    bool beginKey(char c);
+    bool beginValue(char c);
+    bool endValue();
+    bool closeContainer(bool object);
+    bool emit(JsonTokenType type);
+    bool emitNumber();
+    bool emitLiteral();
+    bool appendByte(char c);
+    bool appendCodepoint(uint32_t codepoint);
+    bool appendEscapedUnit(uint16_t unit);
+    bool flushSurrogate();
+    bool fail(JsonError error);
+    bool inObject() const;
+
+    JsonTokenHandler handler_;
+    void* context_;
+    State state_;
+    State stringState_;
+    JsonError error_;
+    uint8_t depth_;
+    uint32_t objectMask_;
+    uint8_t unicodeDigits_;
+    uint16_t unicodeValue_;
+    uint16_t highSurrogate_;
+    bool negative_;
+    bool integral_;
+    bool hasDigits_;
+    long number_;
+    size_t consumed_;
+    size_t keyLength_;
+    size_t valueLength_;
+    char key_[MEOW_JSON_KEY_MAX + 1];
+    char value_[MEOW_JSON_VALUE_MAX + 1];
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "JsonWriter.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t WRITER_DEPTH_MAX = 32;
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+// Room for the digits and sign of any long.
+const size_t DIGITS_MAX = 24;
+
+// Writes the decimal digits of `value` backwards from `end` and returns the
+// first one. Replaces snprintf(), which was most of the cost of a settings
+// reply.
+char* formatDigits(unsigned long value, char* end) {
+    do {
+        *--end = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+}  // namespace
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity) : JsonWriter(buffer, capacity, nullptr, nullptr) {}
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity, JsonFlushHandler flush, void* context)
+    : buffer_(buffer),
+      capacity_(capacity),
+      flush_(flush),
+      context_(context),
+      length_(0),
+      openMask_(0),
+      depth_(0),
+      afterKey_(false),
+      overflowed_(false),
+      flushed_(false) {
+    terminate();
+}
+
+void JsonWriter::beginObject() {
+    separate();
+    append('{');
+    if (depth_ < WRITER_DEPTH_MAX) {
+        openMask_ &= ~(1UL << depth_);
+        depth_++;
+    }
+}
+
+void JsonWriter::endObject() {
+    if (depth_ > 0) {
+        depth_--;
+    }
+    append('}');
+}
+
+void JsonWriter::beginArray() {
+    separate();
+    append('[');
+    if (depth_ < WRITER_DEPTH_MAX) {
+        openMask_ &= ~(1UL << depth_);
+        depth_++;
+    }
+}
+
+void JsonWriter::endArray() {
+    if (depth_ > 0) {
+        depth_--;
+    }
+    append(']');
+}
+
+void JsonWriter::key(const char* name) {
+    separate();
+    append('"');
+    append(name);
+    append("\":");
+    afterKey_ = true;
+}
+
+void JsonWriter::boolValue(bool value) {
+    separate();
+    append(value ? "true" : "false");
+}
+
+void JsonWriter::intValue(long value) {
+    char digits[DIGITS_MAX];
+    char* end = digits + sizeof(digits);
+    const unsigned long magnitude = value < 0 ? 0UL - static_cast<unsigned long>(value) : value;
+    char* first = formatDigits(magnitude, end);
+    if (value < 0) {
+        *--first = '-';
+    }
+    separate();
+    append(first, static_cast<size_t>(end - first));
+}
+
+void JsonWriter::uintValue(unsigned long value) {
+    char digits[DIGITS_MAX];
+    char* end = digits + sizeof(digits);
+    char* first = formatDigits(value, end);
+    separate();
+    append(first, static_cast<size_t>(end - first));
+}
+
+void JsonWriter::stringValue(const char* value) {
+    separate();
+    append('"');
+    const char* run = value;
+    for (const char* p = value; *p; p++) {
+        const unsigned char c = static_cast<unsigned char>(*p);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        append(run, static_cast<size_t>(p - run));
+        run = p + 1;
+        switch (c) {
+            case '"':
+                append("\\\"");
+                break;
+            case '\\':
+                append("\\\\");
+                break;
+            case '\n':
+                append("\\n");
+                break;
+            case '\r':
+                append("\\r");
+                break;
+            case '\t':
+                append("\\t");
+                break;
+            default: {
+                const char escaped[] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0x0F], '\0'};
+                append(escaped);
+                break;
+            }
+        }
+    }
+    append(run);
+    append('"');
+}
+
+void JsonWriter::nullValue() {
+    separate();
+    append("null");
+}
+
+void JsonWriter::flush() {
+    drain();
+}
+
+bool JsonWriter::overflowed() const {
+    return overflowed_;
+}
+
+bool JsonWriter::flushed() const {
+    return flushed_;
+}
+
+size_t JsonWriter::length() const {
+    return length_;
+}
+
+const char* JsonWriter::c_str() const {
+    return buffer_;
+}
+
+const char* JsonWriter::data() const {
+    return buffer_;
+}
+
+bool JsonWriter::drain() {
+    if (!flush_) {
+        return false;
+    }
+    if (length_ > 0) {
+        flush_(context_, buffer_, length_);
+        flushed_ = true;
+        length_ = 0;
+        terminate();
+    }
+    return true;
+}
+
+void JsonWriter::separate() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+    if (depth_ == 0) {
+        return;
+    }
+    const uint32_t bit = 1UL << (depth_ - 1);
+    if (openMask_ & bit) {
+        append(',');
+    } else {
+        openMask_ |= bit;
+    }
+}
+
+void JsonWriter::append(const char* text) {
+    append(text, strlen(text));
+}
+
+void JsonWriter::append(const char* data, size_t length) {
+    // Nearly every append fits the window; copy it straight in.
+    if (length_ + length < capacity_) {
+        memcpy(buffer_ + length_, data, length);
+        length_ += length;
+        buffer_[length_] = '\0';
+        return;
+    }
+    if (capacity_ < 2) {
+        overflowed_ = overflowed_ || length > 0;
+        return;
+    }
+    while (length > 0) {
+        size_t room = capacity_ - 1 - length_;
+        if (room == 0) {
+            if (!drain()) {
+                overflowed_ = true;
+                return;
+            }
+            room = capacity_ - 1;
+        }
+        const size_t chunk = length < room ? length : room;
+        memcpy(buffer_ + length_, data, chunk);
+        length_ += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    terminate();
+}
+
+void JsonWriter::append(char c) {
+    if (length_ + 1 < capacity_) {
+        buffer_[length_++] = c;
+        buffer_[length_] = '\0';
+        return;
+    }
+    append(&c, 1);
+}
+
+void JsonWriter::terminate() {
+    if (capacity_ > 0) {
+        buffer_[length_] = '\0';
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef MEOW_JSON_WRITER_H
+#define MEOW_JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation-free JSON writer.
+//
+// Output goes into a caller-provided buffer and strings are escaped in place,
+// so building a response never touches the heap. Commas between members and
+// array elements are inserted automatically.
+//
+// With a flush handler the buffer acts as a window: whenever it fills up its
+// contents are handed to the handler and writing continues from the start,
+// so documents of any size can be produced from a small stack buffer.
+
+typedef void (*JsonFlushHandler)(void* context, const char* data, size_t length);
+
+class JsonWriter {
+public:
+    JsonWriter(char* buffer, size_t capacity);
+    JsonWriter(char* buffer, size_t capacity, JsonFlushHandler flush, void* context);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    void key(const char* name);
+    void boolValue(bool value);
+    void intValue(long value);
+    void uintValue(unsigned long value);
+    void stringValue(const char* value);
+    void nullValue();
+
+    // Hands any buffered output to the flush handler.
+    void flush();
+
+    // True when the buffer was too small and there was no flush handler to
+    // drain it; the output is then truncated.
+    bool overflowed() const;
+    // True once the flush handler has been called at least once.
+    bool flushed() const;
+    // Bytes currently held in the buffer.
+    size_t length() const;
+    const char* c_str() const;
+    // Same as c_str(); lets code templated on the writer type also take a
+    // CborWriter.
+    const char* data() const;
+
+private:
+    bool drain();
+    void separate();
+    void append(const char* text);
+    void append(const char* data, size_t length);
+    void append(char c);
+    void terminate();
+
+    char* buffer_;
+    size_t capacity_;
+    JsonFlushHandler flush_;
+    void* context_;
+    size_t length_;
+    uint32_t openMask_;
+    uint8_t depth_;
+    bool afterKey_;
+    bool overflowed_;
+    bool flushed_;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#include "LatencyHistogram.h"
+
+#include <string.h>
+
+uint32_t latencyPercentile(const LatencyHistogram& histogram, uint16_t perMille) {
+    if (histogram.count == 0) {
+        return 0;
+    }
+    const uint64_t target = (static_cast<uint64_t>(histogram.count) * perMille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= target) {
+            if (i == 0) {
+                return 0;
+            }
+            const uint32_t ceiling = i + 1 < LATENCY_BUCKETS ? latencyBucketFloor(i + 1) - 1 : histogram.maxUs;
+            return ceiling < histogram.maxUs ? ceiling : histogram.maxUs;
+        }
+    }
+    return histogram.maxUs;
+}
+
+void resetLatencyHistogram(LatencyHistogram& histogram) {
+    memset(&histogram, 0, sizeof(histogram));
+}
@@ -0,0 +1,46 @@
+#ifndef MEOW_LATENCY_HISTOGRAM_H
+#define MEOW_LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size log2 histogram for latencies in microseconds.
+//
+// Bucket 0 counts zero, bucket i counts [2^(i-1), 2^i) and the last bucket
+// also takes everything larger. Recording is a count-leading-zeros and two
+// increments, so it can stay enabled in production and be called from timer
+// callbacks.
+
+const uint8_t LATENCY_BUCKETS = 16;
+
+struct LatencyHistogram {
+    uint32_t count;
+    uint32_t maxUs;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+inline uint8_t latencyBucket(uint32_t us) {
+    const uint8_t bucket = us == 0 ? 0 : static_cast<uint8_t>(32 - __builtin_clz(us));
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+inline void recordLatency(LatencyHistogram& histogram, uint32_t us) {
+    histogram.count++;
+    histogram.buckets[latencyBucket(us)]++;
+    if (us > histogram.maxUs) {
+        histogram.maxUs = us;
+    }
+}
+
+// Lower bound of `bucket` in microseconds.
+inline uint32_t latencyBucketFloor(uint8_t bucket) {
+    return bucket == 0 ? 0 : 1UL << (bucket - 1);
+}
+
+// Percentile estimate: upper edge of the bucket reaching `perMille` of the
+// samples, capped at the largest sample.
+uint32_t latencyPercentile(const LatencyHistogram& histogram, uint16_t perMille);
+
+void resetLatencyHistogram(LatencyHistogram& histogram);
+
+#endif
@@ -0,0 +1,25 @@
+#include "PhaseProfile.h"
+
+#include <string.h>
+
+uint32_t usPerCycleFor(uint32_t cpuMhz) {
+    return static_cast<uint32_t>((1ULL << 32) / cpuMhz);
+}
+
+void resetPhaseProfile(PhaseProfile& profile) {
+    memset(&profile, 0, sizeof(profile));
+    profile.minCycles = UINT32_MAX;
+}
+
+bool recordPhaseCycles(PhaseProfile& profile, uint32_t cycles, uint32_t usPerCycle) {
+    profile.totalCycles += cycles;
+    recordLatency(profile.took, cyclesToUs(cycles, usPerCycle));
+    if (cycles < profile.minCycles) {
+        profile.minCycles = cycles;
+    }
+    if (cycles <= profile.maxCycles) {
+        return false;
+    }
+    profile.maxCycles = cycles;
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef MEOW_PHASE_PROFILE_H
+#define MEOW_PHASE_PROFILE_H
+
+#include <stdint.h>
+
+#include "LatencyHistogram.h"
+
+// Time spent in one phase of a pass that runs over and over, from CPU cycle
+// counts: min, max and a 64-bit total for the mean, plus a LatencyHistogram
+// in microseconds. Cycles become microseconds through a precomputed
+// 2^32 / MHz factor, so a sample costs a multiply instead of a division.
+// Plain data, so a profile kept by one task can be handed to another
+// through a SeqSnapshot.
+
+struct PhaseProfile {
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    LatencyHistogram took;
+};
+
+// The factor cyclesToUs() multiplies by.
+uint32_t usPerCycleFor(uint32_t cpuMhz);
+
+inline uint32_t cyclesToUs(uint32_t cycles, uint32_t usPerCycle) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(cycles) * usPerCycle) >> 32);
+}
+
+void resetPhaseProfile(PhaseProfile& profile);
+
+// Adds one run of `cycles`. Returns true when it was the slowest so far.
+bool recordPhaseCycles(PhaseProfile& profile, uint32_t cycles, uint32_t usPerCycle);
+
+inline uint32_t phaseMeanCycles(const PhaseProfile& profile) {
+    return profile.took.count == 0 ? 0 : static_cast<uint32_t>(profile.totalCycles / profile.took.count);
+}
+
+#endif
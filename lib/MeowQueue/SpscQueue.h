@@ -0,0 +1,62 @@
+#ifndef MEOW_SPSC_QUEUE_H
+#define MEOW_SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Bounded lock-free queue for exactly one producer and one consumer, e.g. a
+// task on each core.
+//
+// The producer only writes `tail` and the consumer only writes `head`, so
+// neither side ever waits for the other: a push into a full queue or a pop
+// from an empty one just returns false. The release store of an index
+// publishes the slot written before it, and the acquire load on the other
+// side makes that slot visible. Capacity must be a power of two; the indices
+// run freely and wrap through the mask, so all CAPACITY slots are usable.
+
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+    static_assert(CAPACITY <= 0x80000000UL, "capacity must fit the index range");
+
+public:
+    // Producer side.
+    bool push(const T& value) {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        slots_[tail & MASK] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool pop(T& out) {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        out = slots_[head & MASK];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate from either side; exact when the other side is idle. Head
+    // is read first, so the result never goes negative.
+    size_t size() const {
+        const uint32_t head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head;
+    }
+
+private:
+    static const uint32_t MASK = CAPACITY - 1;
+
+    T slots_[CAPACITY];
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "LampSchedule.h"
+
+namespace {
+
+bool heapLess(const ScheduleQueue& queue, uint8_t i, uint8_t j) {
+    return queue.dueMs[queue.heap[i]] < queue.dueMs[queue.heap[j]];
+}
+
+void swapEntries(ScheduleQueue& queue, uint8_t i, uint8_t j) {
+    const uint8_t slot = queue.heap[i];
+    queue.heap[i] = queue.heap[j];
+    queue.heap[j] = slot;
+    queue.position[queue.heap[i]] = i;
+    queue.position[queue.heap[j]] = j;
+}
+
+void siftUp(ScheduleQueue& queue, uint8_t index) {
+    while (index > 0) {
+        const uint8_t parent = static_cast<uint8_t>((index - 1) / 2);
+        if (!heapLess(queue, index, parent)) {
+            return;
+        }
+        swapEntries(queue, index, parent);
+        index = parent;
+    }
+}
+
+void siftDown(ScheduleQueue& queue, uint8_t index) {
+    for (;;) {
+        const unsigned left = 2U * index + 1;
+        if (left >= queue.size) {
+            return;
+        }
+        uint8_t earliest = static_cast<uint8_t>(left);
+        if (left + 1 < queue.size && heapLess(queue, static_cast<uint8_t>(left + 1), earliest)) {
+            earliest = static_cast<uint8_t>(left + 1);
+        }
+        if (!heapLess(queue, earliest, index)) {
+            return;
+        }
+        swapEntries(queue, index, earliest);
+        index = earliest;
+    }
+}
+
+// Seconds since local midnight of `day`, by way of mktime() so DST gaps and
+// repeats resolve the way the C library does.
+int64_t localTimeOn(const struct tm& day, uint16_t minuteOfDay) {
+    struct tm at = day;
+    at.tm_hour = minuteOfDay / 60;
+    at.tm_min = minuteOfDay % 60;
+    at.tm_sec = 0;
+    at.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&at));
+}
+
+}  // namespace
+
+int64_t nextScheduleTime(const ScheduleEntry& entry, time_t now) {
+    switch (entry.kind) {
+        case ScheduleKind::Once:
+            return static_cast<int64_t>(entry.at) > static_cast<int64_t>(now) ? static_cast<int64_t>(entry.at) : -1;
+        case ScheduleKind::Daily: {
+            if ((entry.days & SCHEDULE_EVERY_DAY) == 0 || entry.minuteOfDay >= SCHEDULE_MINUTES_PER_DAY) {
+                return -1;
+            }
+            struct tm today;
+            localtime_r(&now, &today);
+            // Today plus a full week covers every weekday mask.
+            for (int offset = 0; offset <= 7; offset++) {
+                struct tm day = today;
+                day.tm_mday += offset;
+                day.tm_hour = 12;
+                day.tm_min = 0;
+                day.tm_sec = 0;
+                day.tm_isdst = -1;
+                mktime(&day);
+                if ((entry.days & (1U << day.tm_wday)) == 0) {
+                    continue;
+                }
+                const int64_t at = localTimeOn(day, entry.minuteOfDay);
+                if (at > static_cast<int64_t>(now)) {
+                    return at;
+                }
+            }
+            return -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+void clearScheduleQueue(ScheduleQueue& queue) {
+    queue.size = 0;
+    for (uint8_t i = 0; i < SCHEDULE_SLOTS; i++) {
+        queue.position[i] = SCHEDULE_NO_SLOT;
+    }
+}
+
+void queueSchedule(ScheduleQueue& queue, uint8_t slot, uint64_t dueMs) {
+    if (slot >= SCHEDULE_SLOTS) {
+        return;
+    }
+    uint8_t index = queue.position[slot];
+    if (index == SCHEDULE_NO_SLOT) {
+        index = queue.size++;
+        queue.heap[index] = slot;
+        queue.position[slot] = index;
+        queue.dueMs[slot] = dueMs;
+        siftUp(queue, index);
+        return;
+    }
+    const bool earlier = dueMs < queue.dueMs[slot];
+    queue.dueMs[slot] = dueMs;
+    if (earlier) {
+        siftUp(queue, index);
+    } else {
+        siftDown(queue, index);
+    }
+}
+
+void unqueueSchedule(ScheduleQueue& queue, uint8_t slot) {
+    if (slot >= SCHEDULE_SLOTS) {
+        return;
+    }
+    const uint8_t index = queue.position[slot];
+    if (index == SCHEDULE_NO_SLOT) {
+        return;
+    }
+    const uint8_t last = --queue.size;
+    queue.position[slot] = SCHEDULE_NO_SLOT;
+    if (index == last) {
+        return;
+    }
+    // The entry moved into the hole may belong above or below it.
+    const uint8_t moved = queue.heap[last];
+    queue.heap[index] = moved;
+    queue.position[moved] = index;
+    siftUp(queue, index);
+    siftDown(queue, queue.position[moved]);
+}
+
+bool takeDueSchedule(ScheduleQueue& queue, uint64_t nowMs, uint8_t& slot) {
+    if (queue.size == 0 || queue.dueMs[queue.heap[0]] > nowMs) {
+        return false;
+    }
+    slot = queue.heap[0];
+    unqueueSchedule(queue, slot);
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef MEOW_LAMP_SCHEDULE_H
+#define MEOW_LAMP_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Timed lamp actions and the queue that fires them.
+//
+// Entries live in a fixed table; the queue is a binary min-heap of table
+// slots keyed by monotonic milliseconds, so checking for due work is one
+// comparison against the root and adding, moving or removing an entry is
+// O(log n). Wall-clock entries are converted to a monotonic deadline when
+// they are queued and re-queued whenever the clock is set. Only standard C
+// time functions are used, so the same code runs in a host build.
+
+const uint8_t SCHEDULE_SLOTS = 128;
+const uint8_t SCHEDULE_NO_SLOT = 0xFF;
+const size_t SCHEDULE_MODE_MAX = 15;
+// Weekday bits follow tm_wday: bit 0 is Sunday.
+const uint8_t SCHEDULE_EVERY_DAY = 0x7F;
+const uint16_t SCHEDULE_MINUTES_PER_DAY = 24 * 60;
+
+enum class ScheduleKind : uint8_t {
+    // Free slot.
+    None,
+    // Once at `at`, in Unix seconds.
+    Once,
+    // At `minuteOfDay` local time on the days in `days`.
+    Daily,
+    // Once at monotonic `at` milliseconds; set while the wall clock is
+    // unknown and never persisted.
+    Timer
+};
+
+enum class ScheduleAction : uint8_t {
+    Keep,
+    On,
+    Off,
+    Toggle
+};
+
+// Persisted as is, so members are only ever appended.
+struct ScheduleEntry {
+    uint16_t id;
+    ScheduleKind kind;
+    ScheduleAction action;
+    uint8_t days;
+    uint8_t reserved;
+    uint16_t minuteOfDay;
+    uint32_t at;
+    // Mode to switch to, or "" to keep the current one.
+    char mode[SCHEDULE_MODE_MAX + 1];
+};
+
+// Unix seconds of the next run strictly after `now`, or -1 when the entry
+// never runs again (a past one-shot, a daily entry without days). Daily
+// times are local time, so they follow TZ and DST changes.
+int64_t nextScheduleTime(const ScheduleEntry& entry, time_t now);
+
+struct ScheduleQueue {
+    uint8_t size;
+    // Table slots, earliest deadline first.
+    uint8_t heap[SCHEDULE_SLOTS];
+    // Indexed by slot.
+    uint64_t dueMs[SCHEDULE_SLOTS];
+    uint8_t position[SCHEDULE_SLOTS];
+};
+
+void clearScheduleQueue(ScheduleQueue& queue);
+
+// Inserts the slot or moves its existing deadline.
+void queueSchedule(ScheduleQueue& queue, uint8_t slot, uint64_t dueMs);
+
+void unqueueSchedule(ScheduleQueue& queue, uint8_t slot);
+
+// Removes and returns the earliest slot if it is due at `nowMs`.
+bool takeDueSchedule(ScheduleQueue& queue, uint64_t nowMs, uint8_t& slot);
+
+inline bool isScheduleQueued(const ScheduleQueue& queue, uint8_t slot) {
+    return queue.position[slot] != SCHEDULE_NO_SLOT;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef MEOW_LAMP_STATE_H
+#define MEOW_LAMP_STATE_H
+
+#include <stdint.h>
+
+#include "LampEffects.h"
+
+// What GET /api/paw reports, as one 8-byte POD. The firmware publishes it
+// through a SeqSnapshot after every change, so status readers on any task or
+// core copy it whole instead of reading the globals it is built from.
+
+const uint8_t LAMP_STATE_ON = 1 << 0;
+
+struct LampState {
+    // stateRevision at the time of publishing; the ETag and X-Revision.
+    uint32_t revision;
+    LampMode mode;
+    uint8_t flags;
+    uint8_t brightness;
+    uint8_t reserved;
+};
+
+inline bool lampStateOn(const LampState& state) {
+    return (state.flags & LAMP_STATE_ON) != 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "WebSocketFrame.h"
+
+void WebSocketFrameReader::reset() {
+    length_ = 0;
+    payloadLength_ = 0;
+}
+
+uint8_t* WebSocketFrameReader::readPointer() {
+    return frame_ + length_;
+}
+
+size_t WebSocketFrameReader::frameBytes() const {
+    return length_ < 2 ? 2 : WS_MASKED_HEADER_BYTES + (frame_[1] & 0x7F);
+}
+
+size_t WebSocketFrameReader::wanted() const {
+    return frameBytes() - length_;
+}
+
+WebSocketRead WebSocketFrameReader::commit(size_t length) {
+    length_ += length;
+    if (length_ < 2) {
+        return WebSocketRead::NeedMore;
+    }
+    if (!(frame_[0] & 0x80) || !(frame_[1] & 0x80)) {
+        return WebSocketRead::ProtocolError;
+    }
+    if ((frame_[1] & 0x7F) > WS_MESSAGE_MAX) {
+        return WebSocketRead::TooBig;
+    }
+    if (length_ < frameBytes()) {
+        return WebSocketRead::NeedMore;
+    }
+
+    payloadLength_ = frame_[1] & 0x7F;
+    const uint8_t* mask = frame_ + 2;
+    for (size_t i = 0; i < payloadLength_; i++) {
+        payload_[i] = static_cast<char>(frame_[WS_MASKED_HEADER_BYTES + i] ^ mask[i % 4]);
+    }
+    payload_[payloadLength_] = '\0';
+    length_ = 0;
+    return WebSocketRead::Frame;
+}
+
+uint8_t WebSocketFrameReader::opcode() const {
+    return frame_[0] & 0x0F;
+}
+
+char* WebSocketFrameReader::payload() {
+    return payload_;
+}
+
+size_t WebSocketFrameReader::payloadLength() const {
+    return payloadLength_;
+}
+
+size_t writeWebSocketHeader(uint8_t* out, uint8_t opcode, size_t payloadLength) {
+    if (payloadLength > WS_SERVER_PAYLOAD_MAX) {
+        return 0;
+    }
+    out[0] = static_cast<uint8_t>(0x80 | opcode);
+    if (payloadLength < 126) {
+        out[1] = static_cast<uint8_t>(payloadLength);
+        return 2;
+    }
+    out[1] = 126;
+    out[2] = static_cast<uint8_t>(payloadLength >> 8);
+    out[3] = static_cast<uint8_t>(payloadLength & 0xFF);
+    return 4;
+}
@@ -0,0 +1,70 @@
+#ifndef MEOW_WEBSOCKET_FRAME_H
+#define MEOW_WEBSOCKET_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 6455 framing for the /api/ws control channel.
+//
+// Client messages are short commands, so the reader only takes single,
+// masked frames whose payload fits the one-byte length (125 bytes). It asks
+// for exactly the bytes the current frame still needs, which lets the caller
+// read straight from the socket into the frame without ever consuming part
+// of the next one. Server frames are unmasked and use the one- or two-byte
+// length form.
+
+const size_t WS_MESSAGE_MAX = 125;
+const size_t WS_MASKED_HEADER_BYTES = 6;
+const size_t WS_SERVER_HEADER_MAX = 4;
+const size_t WS_SERVER_PAYLOAD_MAX = 0xFFFF;
+
+const uint8_t WS_OP_CONTINUATION = 0x0;
+const uint8_t WS_OP_TEXT = 0x1;
+const uint8_t WS_OP_BINARY = 0x2;
+const uint8_t WS_OP_CLOSE = 0x8;
+const uint8_t WS_OP_PING = 0x9;
+const uint8_t WS_OP_PONG = 0xA;
+
+const uint16_t WS_CLOSE_NORMAL = 1000;
+const uint16_t WS_CLOSE_PROTOCOL_ERROR = 1002;
+const uint16_t WS_CLOSE_TOO_BIG = 1009;
+
+enum class WebSocketRead : uint8_t {
+    NeedMore,
+    Frame,
+    // Fragmented or unmasked frame.
+    ProtocolError,
+    TooBig
+};
+
+class WebSocketFrameReader {
+public:
+    void reset();
+
+    // Where the next read goes and how many bytes it may take.
+    uint8_t* readPointer();
+    size_t wanted() const;
+
+    // Accounts for `length` bytes read into readPointer(). On Frame, the
+    // unmasked payload is available until the next call.
+    WebSocketRead commit(size_t length);
+
+    uint8_t opcode() const;
+    // NUL-terminated, so text commands can be handled as C strings.
+    char* payload();
+    size_t payloadLength() const;
+
+private:
+    size_t frameBytes() const;
+
+    uint8_t frame_[WS_MASKED_HEADER_BYTES + WS_MESSAGE_MAX];
+    char payload_[WS_MESSAGE_MAX + 1];
+    size_t length_;
+    size_t payloadLength_;
+};
+
+// Writes the header of an unmasked, final server frame. Returns its length,
+// or 0 when `payloadLength` exceeds WS_SERVER_PAYLOAD_MAX.
+size_t writeWebSocketHeader(uint8_t* out, uint8_t opcode, size_t payloadLength);
+
+#endif
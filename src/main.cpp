@@ -3,89 +3,719 @@
 #include <DNSServer.h>
 #include <WiFi.h>
 #include <Preferences.h>
+#include <uri/UriGlob.h>
+#include <errno.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/sha1.h>
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#include <driver/rmt_tx.h>
+#else
+#include <driver/rmt.h>
+#endif
 #include <ctype.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <atomic>
+#include <type_traits>
 
+#include "CborScanner.h"
+#include "CborWriter.h"
+#include "CoapMessage.h"
+#include "EffectScheduler.h"
+#include "FileTransfers.h"
+#include "JsonScanner.h"
+#include "JsonWriter.h"
+#include "LampEffects.h"
+#include "LampFade.h"
+#include "LampGamma.h"
+#include "LampPattern.h"
+#include "LampSchedule.h"
+#include "LampSimulator.h"
+#include "LampState.h"
+#include "LatencyHistogram.h"
+#include "PhaseProfile.h"
+#include "RequestGate.h"
+#include "SeqSnapshot.h"
+#include "SpscQueue.h"
+#include "StripRenderer.h"
+#include "WebSocketFrame.h"
+#include "settings.h"
 #include "web_files.h"
 #include "version.h"
 
-#ifndef LED_BUILTIN
-#define LED_BUILTIN 4
-#endif
-
-const int DEFAULT_LED_PIN = LED_BUILTIN;
 const uint8_t LED_ON_LEVEL = HIGH;
 const uint8_t LED_OFF_LEVEL = LOW;
-const uint16_t DEFAULT_MQTT_PORT = 1883;
-const char* DEFAULT_MQTT_TOPIC = "meow/lamp";
-const char* DEFAULT_MODE = "static";
+const LampMode DEFAULT_MODE = LampMode::Static;
 const uint8_t BOOT_BLINK_COUNT = 2;
 const uint16_t BOOT_BLINK_ON_MS = 160;
 const uint16_t BOOT_BLINK_OFF_MS = 140;
+// The lamp pin is driven by LEDC so brightness can be dimmed; effects switch
+// between the gamma-corrected brightness duty and 0.
+const uint8_t LAMP_PWM_CHANNEL = 0;
+const uint32_t LAMP_PWM_FREQUENCY_HZ = 5000;
+// Channel n drives LEDC channel LAMP_PWM_CHANNEL + n, so the count is capped
+// by the LEDC channels the chip has (six on the C3).
+#if defined(SOC_LEDC_CHANNEL_NUM) && SOC_LEDC_CHANNEL_NUM < 8
+const uint8_t LAMP_CHANNELS_MAX = SOC_LEDC_CHANNEL_NUM;
+#else
+const uint8_t LAMP_CHANNELS_MAX = 8;
+#endif
+const int CHANNEL_PIN_NONE = -1;
 
 const char* AP_SSID = "MeowMeow";
 const byte DNS_PORT = 53;
 
-WebServer server(80);
+// WebServer with RequestGate in front of its one connection: it only parses
+// complete request heads, an idle connection gives way to the next one, and
+// a connection whose response is out no longer holds the next one up.
+//
+// This is not an event-driven server. Requests are still parsed one at a
+// time and every connection closes after its response (no keep-alive). The
+// routes rely on WebServer for arguments, headers, raw body streaming and
+// handing sockets over to WebSockets, event streams and parked requests.
+// Replacing it means redoing all of that for every route in setupRoutes().
+// Until then only the work that used to block (downloads, long polls,
+// pushes) runs on non-blocking sockets of its own.
+class GatedWebServer : public WebServer {
+public:
+    explicit GatedWebServer(int port) : WebServer(port) {}
+
+    // Call instead of handleClient().
+    void serve() {
+        if (_currentStatus == HC_WAIT_READ && _currentClient.connected()) {
+            const RequestGate gate =
+                gateRequest(_currentClient.fd(), millis() - _statusChange, _server.hasClient());
+            if (gate == RequestGate::Wait) {
+                return;
+            }
+            if (gate == RequestGate::Drop) {
+                dropCurrentClient();
+            }
+        } else if (_currentStatus == HC_WAIT_CLOSE && _server.hasClient()) {
+            dropCurrentClient();
+        }
+        handleClient();
+    }
+
+private:
+    void dropCurrentClient() {
+        _currentClient.stop();
+        _currentStatus = HC_NONE;
+    }
+};
+
+GatedWebServer server(80);
 DNSServer dnsServer;
 Preferences prefs;
-bool ledOn = false;
-int ledPin = DEFAULT_LED_PIN;
-String currentMode = DEFAULT_MODE;
 
-struct DeviceSettings {
-    bool wifiEnabled;
-    String wifiSsid;
-    String wifiPassword;
-    bool mqttEnabled;
-    String mqttHost;
-    uint16_t mqttPort;
-    String mqttTopic;
-    int ledPin;
+// Every output is a channel with its own pin, mode and on/off state.
+// Channel 0 is the lamp configured through /api/settings and the only one
+// that fades; the others are extra filaments added through /api/channels and
+// are unused while their pin is CHANNEL_PIN_NONE. This table belongs to the
+// network side (loop() or the network task), which serves and persists it.
+struct LampChannel {
+    int pin;
+    LampMode mode;
+    bool on;
 };
 
+LampChannel channels[LAMP_CHANNELS_MAX] = {{DEFAULT_LED_PIN, DEFAULT_MODE, false}};
+// The single-lamp paths (/api/paw, /api/mode, batch, CoAP, WebSocket) keep
+// addressing channel 0 through these names.
+bool& ledOn = channels[0].on;
+int& ledPin = channels[0].pin;
+LampMode& currentMode = channels[0].mode;
+
 DeviceSettings settings;
 
-struct LampEffectState {
-    unsigned long nextMs;
-    int step;
-    int flickersRemaining;
-    bool outputOn;
+// Bumped on every change visible through GET /api/paw or /api/settings and
+// served as the ETag. The boot nonce keeps a tag handed out before a reboot
+// from matching the restarted counter.
+uint32_t stateRevision = 0;
+uint32_t bootNonce = 0;
+
+// ledOn, currentMode, settings.brightness and stateRevision are only written
+// by the network side (loop() or the network task). Every change ends in
+// bumpStateRevision(), which publishes them here; status replies read this
+// copy, so they never see a half-applied change and never hold up the
+// writer. The effect side keeps its own copies (channelOutputs,
+// effectSettings) and never reads these.
+SeqSnapshot<LampState> lampState;
+
+// What changed since the last /api/events broadcast; several changes within
+// one loop() pass go out as one event.
+const uint8_t STATUS_CHANGED = 1 << 0;
+const uint8_t SETTINGS_CHANGED = 1 << 1;
+uint8_t pendingEvents = 0;
+
+const size_t MODE_NAME_MAX = LAMP_MODE_NAME_MAX;
+
+// POST bodies are streamed through the raw-upload callback instead of being
+// buffered into server.arg("plain"), so a request never holds more than one
+// HTTP_RAW_BUFLEN chunk plus the parser state below.
+const size_t MAX_JSON_BODY_BYTES = 1024;
+const size_t MAX_BATCH_BODY_BYTES = 2048;
+const size_t MAX_PATTERN_BODY_BYTES = 2048;
+const size_t MAX_PAW_BODY_BYTES = 32;
+
+enum class BodyStatus : uint8_t {
+    Empty,
+    Streaming,
+    Complete,
+    TooLarge,
+    Malformed
+};
+
+struct RequestBody {
+    BodyStatus status;
+    size_t received;
+    size_t limit;
+};
+
+RequestBody requestBody = {BodyStatus::Empty, 0, 0};
+char pawBody[MAX_PAW_BODY_BYTES + 1];
+
+// /api/* bodies and replies are JSON unless the client asks for CBOR through
+// Content-Type (request) or Accept (reply).
+const char* JSON_CONTENT_TYPE = "application/json";
+const char* CBOR_CONTENT_TYPE = "application/cbor";
+
+enum class WireFormat : uint8_t {
+    Json,
+    Cbor
+};
+
+WireFormat bodyFormat = WireFormat::Json;
+
+long effectRandom(long min, long maxExclusive) {
+    return random(min, maxExclusive);
+}
+
+// The effect side's view of a channel. Mode and on/off only change through
+// an EffectCommand; the pin is written by the network side inside effectMux,
+// since it has to attach the new pin to LEDC first and detach the old one
+// after.
+struct ChannelOutput {
+    int pin;
+    LampMode mode;
+    bool on;
+    EffectState effect;
+    // Effect level currently driven on the pin, so unchanged ticks skip
+    // ledcWrite().
+    uint8_t outputLevel;
+};
+
+// Settings the effect side needs, copied in with every EffectCommand.
+struct EffectSettings {
+    uint16_t brightness;
+    uint16_t fadeMs;
+    bool timerBackend;
+};
+
+// Guarded by effectMux.
+ChannelOutput channelOutputs[LAMP_CHANNELS_MAX];
+EffectSettings effectSettings = {DEFAULT_BRIGHTNESS, 0, false};
+EffectState& effect = channelOutputs[0].effect;
+uint8_t& lampOutputLevel = channelOutputs[0].outputLevel;
+
+// The next edge of every running channel sits in effectSchedule, so stepping
+// looks at the earliest deadline only and costs nothing per idle channel.
+// Edges are either stepped from loop() (the software fallback) or from a
+// one-shot esp_timer armed for the earliest deadline, which keeps them on
+// time while loop() is stuck in a long send. The timer callback runs in the
+// esp_timer task, possibly on the other core, so channel effect state, output
+// levels, the schedule and the timer itself are only touched inside
+// effectMux. With the cores split (see startExecution()) the timer only wakes
+// the effect task, which steps the edges on core 1.
+enum class EffectBackend : uint8_t {
+    Loop,
+    Timer,
+    Task,
+    Count
+};
+
+const char* EFFECT_BACKEND_NAMES[] = {"loop", "timer", "task"};
+
+struct EdgeTiming {
+    uint32_t edges;
+    // Largest |actual - scheduled| edge time since the last reset.
+    uint32_t worstErrorUs;
+    // Edges whose next edge was already due when they ran.
+    uint32_t skipped;
+    LatencyHistogram lateness;
+};
+
+EdgeTiming edgeTiming[static_cast<size_t>(EffectBackend::Count)];
+portMUX_TYPE effectMux = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t effectTimer = nullptr;
+EffectScheduler effectSchedule;
+
+// On dual-core chips the network stack is serviced from a task pinned to
+// core 0 and the effect engine runs in a task pinned to core 1, so a slow
+// send never delays an edge. Lamp on/off and mode changes reach the effect
+// task through effectCommands, which the network task is the only producer
+// of; the single-core C3 keeps the cooperative loop().
+#if !CONFIG_FREERTOS_UNICORE && portNUM_PROCESSORS > 1
+const bool SPLIT_CORES_AVAILABLE = true;
+#else
+const bool SPLIT_CORES_AVAILABLE = false;
+#endif
+const BaseType_t NETWORK_CORE = 0;
+const BaseType_t EFFECT_CORE = 1;
+const uint32_t NETWORK_TASK_STACK = 8192;
+const uint32_t EFFECT_TASK_STACK = 3072;
+// Same as the Arduino loop task the network task replaces.
+const UBaseType_t NETWORK_TASK_PRIORITY = 1;
+// Above the network task, below the WiFi and esp_timer tasks.
+const UBaseType_t EFFECT_TASK_PRIORITY = 5;
+const size_t EFFECT_COMMANDS_MAX = 16;
+
+// The state of one channel as the network side last set it, plus the
+// effect settings of the moment. Commands supersede each other, so the
+// effect side only ever lands on a state the network side has published.
+struct EffectCommand {
+    uint8_t channel;
+    LampMode mode;
+    bool on;
+    // Restarts the effect; otherwise only the level is driven again, for a
+    // brightness change.
+    bool restart;
+    EffectSettings settings;
+};
+
+SpscQueue<EffectCommand, EFFECT_COMMANDS_MAX> effectCommands;
+// Commands that found the queue full, the latest per channel. While any is
+// pending the network side folds new commands in here instead of queueing
+// them, so the effect task takes them after everything queued before and
+// the network side never waits. Guarded by effectMux; only the network side
+// sets bits and only the effect task clears them.
+EffectCommand overflowCommands[LAMP_CHANNELS_MAX];
+std::atomic<uint32_t> overflowChannels{0};
+TaskHandle_t effectTask = nullptr;
+TaskHandle_t networkTask = nullptr;
+// Commands the effect task has applied, and commands folded into an
+// overflow slot because the queue was full.
+std::atomic<uint32_t> commandsApplied{0};
+std::atomic<uint32_t> commandsCoalesced{0};
+
+// On/off and mode changes blend from the outgoing output to the new one on a
+// periodic esp_timer, so fades run at LAMP_FADE_FRAME_MS whatever loop() is
+// doing. While a fade runs, effect ticks only update lampOutputLevel and the
+// frame callback owns the pin. The outgoing side keeps running its old effect,
+// so a mode change is a real crossfade; a change that interrupts a fade starts
+// from the level currently shown instead.
+struct FadeSource {
+    EffectState state;
+    LampMode mode;
+    bool lit;
+    bool frozen;
+    uint16_t frozenLevel;
+};
+
+struct FrameTiming {
+    uint32_t frames;
+    // Largest |actual - LAMP_FADE_FRAME_MS| gap between two frames of a fade.
+    uint32_t worstErrorUs;
+    uint32_t worstCycles;
+};
+
+LampFade fade = {0, 0, false};
+FadeSource fadeFrom;
+int64_t lastFadeFrameUs = 0;
+FrameTiming fadeTiming;
+esp_timer_handle_t fadeTimer = nullptr;
+// Q8 level last written to the pin.
+uint16_t shownLevel = 0;
+
+// Pin writes and timer starts the effect task runs into while it holds
+// effectMux, done once it has let go so a burst of commands never keeps the
+// spinlock across ledcWrite() or esp_timer calls. Set only inside that
+// critical section, and every output path runs under effectMux, so nothing
+// else ever sees it.
+struct DeferredOutputs {
+    int pins[LAMP_CHANNELS_MAX];
+    uint32_t duties[LAMP_CHANNELS_MAX];
+    // Bit per channel with a duty to write.
+    uint32_t channels;
+    bool startFadeTimer;
+    bool armEffectTimer;
+    // -1 leaves the effect timer stopped.
+    int64_t effectDelayUs;
 };
 
-LampEffectState effect = {0, 0, 0, false};
+DeferredOutputs* deferredOutputs = nullptr;
+
+void attachLampPwm(int pin, uint8_t channel = 0) {
+    const uint8_t pwmChannel = LAMP_PWM_CHANNEL + channel;
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+    ledcAttachChannel(pin, LAMP_PWM_FREQUENCY_HZ, LAMP_PWM_BITS, pwmChannel);
+#else
+    ledcSetup(pwmChannel, LAMP_PWM_FREQUENCY_HZ, LAMP_PWM_BITS);
+    ledcAttachPin(pin, pwmChannel);
+#endif
+}
+
+void detachLampPwm(int pin) {
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+    ledcDetach(pin);
+#else
+    ledcDetachPin(pin);
+#endif
+}
+
+void writeChannelDuty(int pin, uint8_t channel, uint32_t duty) {
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+    ledcWrite(pin, duty);
+#else
+    (void)pin;
+    ledcWrite(LAMP_PWM_CHANNEL + channel, duty);
+#endif
+}
+
+void writeChannelLevel(uint8_t channel, uint16_t level) {
+    const int pin = channelOutputs[channel].pin;
+    if (pin == CHANNEL_PIN_NONE) {
+        return;
+    }
+    uint32_t duty = lampDutyForLevel(level);
+    if (LED_ON_LEVEL == LOW) {
+        duty = LAMP_PWM_MAX_DUTY - duty;
+    }
+    if (deferredOutputs) {
+        deferredOutputs->pins[channel] = pin;
+        deferredOutputs->duties[channel] = duty;
+        deferredOutputs->channels |= 1UL << channel;
+        return;
+    }
+    writeChannelDuty(pin, channel, duty);
+}
+
+void writeLampLevel(uint16_t level) {
+    shownLevel = level;
+    writeChannelLevel(0, level);
+}
+
+// Q8 lamp level for an effect level, scaled by the brightness setting.
+uint16_t litLevel(uint8_t effectLevel) {
+    const uint32_t scaled = effectSettings.brightness * effectLevel * 257U + 255U;
+    return static_cast<uint16_t>(scaled >> 8);
+}
+
+void writeChannelOutput(uint8_t channel, uint8_t level, bool force = false) {
+    if (!force && channelOutputs[channel].outputLevel == level) {
+        return;
+    }
+    channelOutputs[channel].outputLevel = level;
+    if (channel != 0) {
+        writeChannelLevel(channel, litLevel(level));
+    } else if (!fade.active) {
+        writeLampLevel(litLevel(level));
+    }
+}
+
+void writeLampOutput(uint8_t level, bool force = false) {
+    writeChannelOutput(0, level, force);
+}
+
+uint8_t effectLevelFor(bool on) {
+    return on ? LAMP_EFFECT_FULL : LAMP_EFFECT_OFF;
+}
+
+uint16_t fadeSourceLevel(FadeSource& source, uint32_t now) {
+    if (source.frozen) {
+        return source.frozenLevel;
+    }
+    return source.lit ? litLevel(tickLampEffect(source.mode, source.state, now, effectRandom)) : 0;
+}
+
+void recordFadeFrame(int64_t nowUs, uint32_t startCycles) {
+    const uint32_t cycles = ESP.getCycleCount() - startCycles;
+    if (cycles > fadeTiming.worstCycles) {
+        fadeTiming.worstCycles = cycles;
+    }
+    fadeTiming.frames++;
+    if (lastFadeFrameUs != 0) {
+        const int64_t error = nowUs - lastFadeFrameUs - static_cast<int64_t>(LAMP_FADE_FRAME_MS) * 1000;
+        const uint32_t magnitude = static_cast<uint32_t>(error < 0 ? -error : error);
+        if (magnitude > fadeTiming.worstErrorUs) {
+            fadeTiming.worstErrorUs = magnitude;
+        }
+    }
+    lastFadeFrameUs = nowUs;
+}
+
+void onFadeFrame(void*) {
+    portENTER_CRITICAL(&effectMux);
+    const uint32_t startCycles = ESP.getCycleCount();
+    if (fade.active) {
+        const uint32_t weight = advanceLampFade(fade);
+        const uint16_t from = fadeSourceLevel(fadeFrom, millis());
+        writeLampLevel(blendLampLevel(from, litLevel(lampOutputLevel), weight));
+        if (!fade.active) {
+            esp_timer_stop(fadeTimer);
+        }
+        recordFadeFrame(esp_timer_get_time(), startCycles);
+    }
+    portEXIT_CRITICAL(&effectMux);
+}
+
+// Call before channel 0's on/off state or mode change; the effect reset that
+// follows the change becomes the fade target. Caller holds effectMux.
+void beginTransition() {
+    if (!fadeTimer || effectSettings.fadeMs == 0) {
+        return;
+    }
+    if (fade.active) {
+        fadeFrom.frozen = true;
+        fadeFrom.frozenLevel = shownLevel;
+    } else {
+        fadeFrom.state = effect;
+        fadeFrom.mode = channelOutputs[0].mode;
+        fadeFrom.lit = channelOutputs[0].on;
+        fadeFrom.frozen = false;
+        lastFadeFrameUs = 0;
+        if (deferredOutputs) {
+            deferredOutputs->startFadeTimer = true;
+        } else {
+            esp_timer_start_periodic(fadeTimer, LAMP_FADE_FRAME_MS * 1000);
+        }
+    }
+    startLampFade(fade, effectSettings.fadeMs, LAMP_FADE_FRAME_MS);
+}
+
+// Caller holds effectMux, or is the network side with no effect task.
+EffectBackend activeEffectBackend() {
+    if (effectTask) {
+        return EffectBackend::Task;
+    }
+    return effectSettings.timerBackend && effectTimer ? EffectBackend::Timer : EffectBackend::Loop;
+}
+
+// millis() is esp_timer_get_time() / 1000 truncated to 32 bits; widening the
+// effect deadline against the 64-bit clock keeps the math right across the
+// 49-day wrap.
+int64_t effectDeadlineUs(uint32_t dueMs, int64_t nowUs) {
+    const uint32_t nowMs = static_cast<uint32_t>(nowUs / 1000);
+    return (nowUs / 1000 + static_cast<int32_t>(dueMs - nowMs)) * 1000;
+}
+
+// Called right after the edge was written, or in the effect task right
+// before its deferred write goes out. `skipped` is set when the effect is
+// already due again, i.e. the edge came too late to be seen.
+void recordEdge(EffectBackend backend, uint32_t scheduledMs, bool skipped) {
+    const int64_t nowUs = esp_timer_get_time();
+    const int64_t error = nowUs - effectDeadlineUs(scheduledMs, nowUs);
+    const uint32_t magnitude = static_cast<uint32_t>(error < 0 ? -error : error);
+    EdgeTiming& timing = edgeTiming[static_cast<size_t>(backend)];
+    timing.edges++;
+    if (magnitude > timing.worstErrorUs) {
+        timing.worstErrorUs = magnitude;
+    }
+    if (skipped) {
+        timing.skipped++;
+    }
+    recordLatency(timing.lateness, error > 0 ? magnitude : 0);
+}
+
+// Caller holds effectMux.
+void queueChannelEdge(uint8_t channel) {
+    const ChannelOutput& lamp = channelOutputs[channel];
+    if (lamp.effect.started && lampEffectSteps(lamp.mode)) {
+        scheduleEffect(effectSchedule, channel, lamp.effect.nextMs);
+    }
+}
+
+void startEffectTimer(int64_t delayUs) {
+    esp_timer_stop(effectTimer);
+    if (delayUs >= 0) {
+        esp_timer_start_once(effectTimer, static_cast<uint64_t>(delayUs));
+    }
+}
+
+// Points the one-shot timer at the earliest deadline, or leaves it stopped
+// when the loop backend is active or nothing steps. Caller holds effectMux.
+void armEffectTimer() {
+    if (!effectTimer) {
+        return;
+    }
+    int64_t delayUs = -1;
+    uint32_t dueMs;
+    if (activeEffectBackend() != EffectBackend::Loop && earliestEffectDeadline(effectSchedule, dueMs)) {
+        const int64_t nowUs = esp_timer_get_time();
+        delayUs = effectDeadlineUs(dueMs, nowUs) - nowUs;
+        delayUs = delayUs > 0 ? delayUs : 0;
+    }
+    if (deferredOutputs) {
+        deferredOutputs->armEffectTimer = true;
+        deferredOutputs->effectDelayUs = delayUs;
+        return;
+    }
+    startEffectTimer(delayUs);
+}
+
+// Runs what the effect task deferred, pins first so a fade that just began
+// starts from the level already shown.
+void flushDeferredOutputs(const DeferredOutputs& outputs) {
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (outputs.channels & (1UL << channel)) {
+            writeChannelDuty(outputs.pins[channel], channel, outputs.duties[channel]);
+        }
+    }
+    if (outputs.startFadeTimer) {
+        esp_timer_start_periodic(fadeTimer, LAMP_FADE_FRAME_MS * 1000);
+    }
+    if (outputs.armEffectTimer) {
+        startEffectTimer(outputs.effectDelayUs);
+    }
+}
+
+// Restarts the channel's effect from its mode and on/off state, writes the
+// first level and queues the first edge. Caller holds effectMux and re-arms
+// the timer afterwards.
+void restartChannelEffect(uint8_t channel) {
+    ChannelOutput& lamp = channelOutputs[channel];
+    cancelEffect(effectSchedule, channel);
+    resetEffect(lamp.effect);
+    if (lamp.on && lamp.pin != CHANNEL_PIN_NONE) {
+        writeChannelOutput(channel, tickLampEffect(lamp.mode, lamp.effect, millis(), effectRandom), true);
+        queueChannelEdge(channel);
+    } else {
+        writeChannelOutput(channel, LAMP_EFFECT_OFF, true);
+    }
+}
+
+// Starts every effect running `mode` over from its first step, so nothing
+// keeps a program counter into a pattern that was just replaced. Caller holds
+// effectMux.
+void resetPatternEffects(LampMode mode) {
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (channelOutputs[channel].mode == mode) {
+            resetEffect(channelOutputs[channel].effect);
+        }
+    }
+    if (fadeFrom.mode == mode) {
+        resetEffect(fadeFrom.state);
+    }
+}
+
+// Brings the effect side's copy of the channel and the settings up to the
+// command. Caller holds effectMux and re-arms the timer afterwards.
+void applyEffectCommand(const EffectCommand& command) {
+    ChannelOutput& lamp = channelOutputs[command.channel];
+    effectSettings = command.settings;
+    if (command.channel == 0 && (command.on != lamp.on || command.mode != lamp.mode)) {
+        beginTransition();
+    }
+    lamp.mode = command.mode;
+    lamp.on = command.on;
+    if (command.restart) {
+        restartChannelEffect(command.channel);
+    } else {
+        writeChannelOutput(command.channel, lamp.outputLevel, true);
+    }
+}
 
-const uint32_t BLINK_ON_MS = 650;
-const uint32_t BLINK_OFF_MS = 650;
-const uint32_t PURR_PATTERN_MS[] = {160, 90, 220, 520};
-const bool PURR_PATTERN_ON[] = {true, false, true, false};
-const size_t PURR_PATTERN_LEN = sizeof(PURR_PATTERN_MS) / sizeof(PURR_PATTERN_MS[0]);
-const uint32_t BZZZ_GAP_MIN_MS = 6000;
-const uint32_t BZZZ_GAP_MAX_MS = 14000;
-const uint16_t BZZZ_FLICKER_MIN_MS = 50;
-const uint16_t BZZZ_FLICKER_MAX_MS = 120;
-const uint8_t BZZZ_FLICKER_MIN_COUNT = 3;
-const uint8_t BZZZ_FLICKER_MAX_COUNT = 4;
+// Folds the command into its channel's overflow slot. A restart still
+// pending is kept, and every pending slot takes the newest settings, since
+// they replace the older ones whichever channel the effect task applies
+// last. Caller holds effectMux.
+void coalesceEffectCommand(const EffectCommand& command) {
+    const uint32_t pending = overflowChannels.load(std::memory_order_relaxed);
+    const uint32_t bit = 1UL << command.channel;
+    EffectCommand& slot = overflowCommands[command.channel];
+    const bool restart = command.restart || ((pending & bit) && slot.restart);
+    slot = command;
+    slot.restart = restart;
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (pending & (1UL << channel)) {
+            overflowCommands[channel].settings = command.settings;
+        }
+    }
+    overflowChannels.store(pending | bit, std::memory_order_relaxed);
+}
 
-void writeLampOutput(bool on, bool force = false) {
-    if (!force && effect.outputOn == on) {
+// Network side only. Hands the command to the effect task while it runs;
+// otherwise applies it here. A full queue never blocks: the command goes to
+// its channel's overflow slot, which keeps only the latest state, and so
+// does everything after it until the effect task has caught up.
+void postEffectCommand(const EffectCommand& command) {
+    if (effectTask) {
+        // Only this side sets overflow bits, so seeing none here is exact.
+        if (overflowChannels.load(std::memory_order_relaxed) != 0 || !effectCommands.push(command)) {
+            portENTER_CRITICAL(&effectMux);
+            if (overflowChannels.load(std::memory_order_relaxed) != 0 || !effectCommands.push(command)) {
+                coalesceEffectCommand(command);
+                commandsCoalesced.fetch_add(1, std::memory_order_relaxed);
+            }
+            portEXIT_CRITICAL(&effectMux);
+        }
+        xTaskNotifyGive(effectTask);
         return;
     }
-    effect.outputOn = on;
-    digitalWrite(ledPin, on ? LED_ON_LEVEL : LED_OFF_LEVEL);
+    portENTER_CRITICAL(&effectMux);
+    applyEffectCommand(command);
+    armEffectTimer();
+    portEXIT_CRITICAL(&effectMux);
+}
+
+void postChannelCommand(uint8_t channel, bool restart) {
+    EffectCommand command;
+    command.channel = channel;
+    command.mode = channels[channel].mode;
+    command.on = channels[channel].on;
+    command.restart = restart;
+    command.settings = {settings.brightness, settings.fadeMs, settings.effectTimer};
+    postEffectCommand(command);
+}
+
+void restartChannel(uint8_t channel) {
+    postChannelCommand(channel, true);
 }
 
 void resetEffectState() {
-    effect.nextMs = 0;
-    effect.step = 0;
-    effect.flickersRemaining = 0;
-    effect.outputOn = !ledOn;
-    writeLampOutput(ledOn, true);
+    restartChannel(0);
+}
+
+// Moves the effect side to the channel's new pin, or stops the channel when
+// it has none. The network side attaches the new pin before and detaches the
+// old one after.
+void setChannelOutputPin(uint8_t channel, int pin) {
+    portENTER_CRITICAL(&effectMux);
+    ChannelOutput& lamp = channelOutputs[channel];
+    lamp.pin = pin;
+    if (pin == CHANNEL_PIN_NONE) {
+        cancelEffect(effectSchedule, channel);
+        armEffectTimer();
+    } else {
+        writeChannelOutput(channel, lamp.outputLevel, true);
+    }
+    portEXIT_CRITICAL(&effectMux);
+}
+
+void publishLampState() {
+    LampState state = {};
+    state.revision = stateRevision;
+    state.mode = currentMode;
+    state.flags = ledOn ? LAMP_STATE_ON : 0;
+    state.brightness = static_cast<uint8_t>(settings.brightness);
+    lampState.publish(state);
+}
+
+void bumpStateRevision(uint8_t changed) {
+    stateRevision++;
+    pendingEvents |= changed;
+    publishLampState();
 }
 
 void setLamp(bool on, bool persist = true) {
     const bool changed = ledOn != on;
     ledOn = on;
     resetEffectState();
+    bumpStateRevision(STATUS_CHANGED);
     if (persist && changed) {
         prefs.putBool("led_on", ledOn);
     }
@@ -102,583 +732,3859 @@ void blinkBootSignal() {
     }
 }
 
-int skipJsonWhitespace(const String& input, int index) {
-    while (index < static_cast<int>(input.length()) && isspace(static_cast<unsigned char>(input[index]))) {
-        index++;
+void applyMode(LampMode mode) {
+    currentMode = mode;
+    prefs.putString("mode", lampModeName(currentMode));
+    resetEffectState();
+    bumpStateRevision(STATUS_CHANGED);
+}
+
+// Sets on/off and mode together with a single transition and effect restart,
+// saving only what changed. The caller bumps the state revision.
+void applyLampState(bool on, LampMode mode) {
+    const bool ledChanged = on != ledOn;
+    const bool modeChanged = mode != currentMode;
+    ledOn = on;
+    currentMode = mode;
+    if (ledChanged) {
+        prefs.putBool("led_on", ledOn);
+    }
+    if (modeChanged) {
+        prefs.putString("mode", lampModeName(currentMode));
+    }
+    resetEffectState();
+}
+
+bool parseDesiredState(const char* input, bool current, bool* out) {
+    if (!input || !out) {
+        return false;
+    }
+    while (isspace(static_cast<unsigned char>(*input))) {
+        input++;
+    }
+    size_t length = strlen(input);
+    while (length > 0 && isspace(static_cast<unsigned char>(input[length - 1]))) {
+        length--;
+    }
+
+    char value[8];
+    if (length >= sizeof(value)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        value[i] = static_cast<char>(tolower(static_cast<unsigned char>(input[i])));
+    }
+    value[length] = '\0';
+
+    if (strcmp(value, "on") == 0 || strcmp(value, "1") == 0 || strcmp(value, "true") == 0) {
+        *out = true;
+        return true;
+    }
+    if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0 || strcmp(value, "false") == 0) {
+        *out = false;
+        return true;
+    }
+    if (strcmp(value, "toggle") == 0) {
+        *out = !current;
+        return true;
+    }
+    return false;
+}
+
+bool isTimeReached(unsigned long now, unsigned long target) {
+    return static_cast<long>(now - target) >= 0;
+}
+
+// Caps the edges stepped per call, so an effect that schedules its next
+// edge at the current time cannot hold effectMux; the rest run on the next
+// call.
+const uint8_t EDGES_PER_PASS_MAX = 2 * LAMP_CHANNELS_MAX;
+
+// Steps every channel whose edge is due, earliest first. The timer and the
+// effect task step an edge at its scheduled deadline rather than at the
+// actual time, so wakeup latency never accumulates into a pattern; loop()
+// steps at the time it gets there. Caller holds effectMux.
+void stepDueChannels(EffectBackend backend, uint32_t now) {
+    uint8_t channel;
+    for (uint8_t edges = 0; edges < EDGES_PER_PASS_MAX && takeDueEffect(effectSchedule, now, channel); edges++) {
+        ChannelOutput& lamp = channelOutputs[channel];
+        const uint32_t scheduledMs = lamp.effect.nextMs;
+        const uint32_t stepMs = backend == EffectBackend::Loop ? now : scheduledMs;
+        writeChannelOutput(channel, tickLampEffect(lamp.mode, lamp.effect, stepMs, effectRandom));
+        recordEdge(backend, scheduledMs, lampEffectDue(lamp.mode, lamp.effect, millis()));
+        queueChannelEdge(channel);
+    }
+}
+
+void onEffectTimer(void*) {
+    if (effectTask) {
+        xTaskNotifyGive(effectTask);
+        return;
+    }
+    portENTER_CRITICAL(&effectMux);
+    // A restart can land between the timer firing and this callback taking
+    // the lock; nothing is due then and the timer is simply re-armed.
+    if (activeEffectBackend() == EffectBackend::Timer) {
+        stepDueChannels(EffectBackend::Timer, millis());
+        armEffectTimer();
+    }
+    portEXIT_CRITICAL(&effectMux);
+}
+
+// 2^32 / CPU MHz for cyclesToUs(); set once at boot by resetLoopProfile().
+uint32_t usPerCycle = 0;
+// The effects phase of the loop profile in split mode: one sample per wakeup
+// of the effect task. Only the task writes it and publishes a copy after each
+// wakeup for the network task to report; a reset is a request it picks up.
+PhaseProfile effectTaskProfile;
+SeqSnapshot<PhaseProfile> effectProfileSnapshot;
+std::atomic<bool> effectProfileResetRequested{true};
+
+// Takes the overflow slots once the queue is empty; while any slot is
+// pending the network side queues nothing, so they are the newest commands.
+// Caller holds effectMux.
+uint32_t applyOverflowCommands() {
+    const uint32_t pending = overflowChannels.load(std::memory_order_relaxed);
+    uint32_t applied = 0;
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (pending & (1UL << channel)) {
+            applyEffectCommand(overflowCommands[channel]);
+            applied++;
+        }
+    }
+    overflowChannels.store(0, std::memory_order_relaxed);
+    return applied;
+}
+
+// Woken by the effect timer at the earliest deadline and by every command.
+// Notifications that arrive while it works are folded into the next wakeup.
+void effectTaskMain(void*) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        const uint32_t startCycles = ESP.getCycleCount();
+        // Under effectMux the commands only update the effect side's copies;
+        // the pins and timers they touch are driven after it is released.
+        // Bounded so a burst cannot hold the lock; the task wakes itself for
+        // whatever is left.
+        DeferredOutputs outputs = {};
+        uint32_t applied = 0;
+        bool drained = false;
+        portENTER_CRITICAL(&effectMux);
+        deferredOutputs = &outputs;
+        EffectCommand command;
+        while (applied < EFFECT_COMMANDS_MAX) {
+            if (!effectCommands.pop(command)) {
+                drained = true;
+                break;
+            }
+            applyEffectCommand(command);
+            applied++;
+        }
+        if (drained) {
+            applied += applyOverflowCommands();
+        }
+        stepDueChannels(EffectBackend::Task, millis());
+        armEffectTimer();
+        deferredOutputs = nullptr;
+        portEXIT_CRITICAL(&effectMux);
+        flushDeferredOutputs(outputs);
+        if (!drained) {
+            xTaskNotifyGive(effectTask);
+        }
+        if (applied != 0) {
+            commandsApplied.fetch_add(applied, std::memory_order_relaxed);
+        }
+        if (effectProfileResetRequested.exchange(false)) {
+            resetPhaseProfile(effectTaskProfile);
+        }
+        recordPhaseCycles(effectTaskProfile, ESP.getCycleCount() - startCycles, usPerCycle);
+        effectProfileSnapshot.publish(effectTaskProfile);
+    }
+}
+
+// A WS2812 strip on settings.stripPin mirrors the lamp. Frames are rendered
+// into the back buffer by StripRenderer and streamed from the front buffer
+// by the RMT peripheral, which shapes the bits in hardware. The frame tick
+// only swaps the buffers and starts the transfer, which returns at once, so
+// frames leave on a fixed cadence one tick after the lamp state they show.
+// Everything that can wait (rendering the next frame, draining the strip and
+// reinstalling the driver after a settings change) runs in the strip task,
+// which the tick and requestStripConfig() wake.
+// A 300-pixel frame takes 9 ms on the wire.
+const uint32_t STRIP_DRAIN_MS = 20;
+const uint32_t STRIP_TASK_STACK = 3072;
+// Above the network task, below the effect task.
+const UBaseType_t STRIP_TASK_PRIORITY = 3;
+
+struct StripConfig {
+    int pin;
+    uint16_t pixels;
+    // 0xRRGGBB.
+    uint32_t color;
+};
+
+struct StripTiming {
+    uint32_t frames;
+    // Ticks that found the previous frame still streaming.
+    uint32_t dropped;
+    // Ticks that found the next frame not rendered yet.
+    uint32_t late;
+    uint32_t worstRenderUs;
+};
+
+StripPixel stripBuffers[2][STRIP_PIXELS_MAX];
+// Guarded by effectMux. While stripBackReady is false the back buffer
+// belongs to the strip task, otherwise to the frame tick.
+uint8_t stripFront = 0;
+bool stripBackReady = false;
+StripConfig stripActive = {STRIP_PIN_NONE, 0, 0};
+StripConfig stripRequest = {STRIP_PIN_NONE, 0, 0};
+bool stripRequestPending = false;
+// The frame tick may start transfers; cleared by the task before it touches
+// the driver.
+bool stripOutputOn = false;
+// A frame tick is between its check of stripOutputOn and its last RMT call.
+bool stripSending = false;
+StripTiming stripTiming;
+esp_timer_handle_t stripTimer = nullptr;
+TaskHandle_t stripTask = nullptr;
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+// 100 ns ticks; WS2812 bits are 0.3/0.9 us (0) and 0.9/0.3 us (1).
+const uint32_t STRIP_RMT_RESOLUTION_HZ = 10000000;
+
+rmt_channel_handle_t stripChannel = nullptr;
+rmt_encoder_handle_t stripEncoder = nullptr;
+
+void releaseStripDriver() {
+    if (stripChannel) {
+        rmt_disable(stripChannel);
+        rmt_del_channel(stripChannel);
+        stripChannel = nullptr;
+    }
+    if (stripEncoder) {
+        rmt_del_encoder(stripEncoder);
+        stripEncoder = nullptr;
+    }
+}
+
+bool installStripDriver(int pin) {
+    rmt_tx_channel_config_t channel = {};
+    channel.gpio_num = static_cast<gpio_num_t>(pin);
+    channel.clk_src = RMT_CLK_SRC_DEFAULT;
+    channel.resolution_hz = STRIP_RMT_RESOLUTION_HZ;
+    channel.trans_queue_depth = 1;
+#if SOC_RMT_SUPPORT_DMA
+    channel.mem_block_symbols = 1024;
+    channel.flags.with_dma = true;
+#else
+    channel.mem_block_symbols = 64;
+#endif
+    rmt_bytes_encoder_config_t bytes = {};
+    bytes.bit0.level0 = 1;
+    bytes.bit0.duration0 = 3;
+    bytes.bit0.level1 = 0;
+    bytes.bit0.duration1 = 9;
+    bytes.bit1.level0 = 1;
+    bytes.bit1.duration0 = 9;
+    bytes.bit1.level1 = 0;
+    bytes.bit1.duration1 = 3;
+    bytes.flags.msb_first = 1;
+    if (rmt_new_tx_channel(&channel, &stripChannel) != ESP_OK) {
+        stripChannel = nullptr;
+        return false;
+    }
+    if (rmt_new_bytes_encoder(&bytes, &stripEncoder) != ESP_OK) {
+        stripEncoder = nullptr;
+        releaseStripDriver();
+        return false;
+    }
+    if (rmt_enable(stripChannel) != ESP_OK) {
+        releaseStripDriver();
+        return false;
+    }
+    return true;
+}
+
+void transmitStrip(const StripPixel* pixels, uint16_t count) {
+    rmt_transmit_config_t transfer = {};
+    rmt_transmit(stripChannel, stripEncoder, pixels, count * sizeof(StripPixel), &transfer);
+}
+
+bool stripTransferDone(uint32_t waitMs) {
+    return rmt_tx_wait_all_done(stripChannel, static_cast<int>(waitMs)) == ESP_OK;
+}
+#else
+const rmt_channel_t STRIP_RMT_CHANNEL = RMT_CHANNEL_0;
+// 80 MHz APB / 2 = 25 ns ticks; WS2812 bits are 0.4/0.85 us (0) and
+// 0.8/0.45 us (1).
+const uint8_t STRIP_RMT_CLOCK_DIV = 2;
+
+// Expands bytes into RMT items as the peripheral drains its memory, so the
+// frame is never held as one 32-bit item per bit.
+void IRAM_ATTR translateStripBytes(const void* source, rmt_item32_t* items, size_t sourceSize, size_t wanted,
+                                   size_t* translated, size_t* itemCount) {
+    rmt_item32_t bit0;
+    bit0.level0 = 1;
+    bit0.duration0 = 16;
+    bit0.level1 = 0;
+    bit0.duration1 = 34;
+    rmt_item32_t bit1;
+    bit1.level0 = 1;
+    bit1.duration0 = 32;
+    bit1.level1 = 0;
+    bit1.duration1 = 18;
+    const uint8_t* bytes = static_cast<const uint8_t*>(source);
+    size_t used = 0;
+    size_t count = 0;
+    while (used < sourceSize && count + 8 <= wanted) {
+        for (uint8_t mask = 0x80; mask != 0; mask >>= 1) {
+            items[count++] = (bytes[used] & mask) ? bit1 : bit0;
+        }
+        used++;
     }
-    return index;
+    *translated = used;
+    *itemCount = count;
 }
 
-int findJsonValueStart(const String& input, const char* key) {
-    const String pattern = String("\"") + key + "\"";
-    int keyPos = input.indexOf(pattern);
-    if (keyPos < 0) {
-        return -1;
+void releaseStripDriver() {
+    rmt_driver_uninstall(STRIP_RMT_CHANNEL);
+}
+
+bool installStripDriver(int pin) {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX(static_cast<gpio_num_t>(pin), STRIP_RMT_CHANNEL);
+    config.clk_div = STRIP_RMT_CLOCK_DIV;
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(STRIP_RMT_CHANNEL, 0, 0) != ESP_OK) {
+        return false;
+    }
+    if (rmt_translator_init(STRIP_RMT_CHANNEL, translateStripBytes) != ESP_OK) {
+        releaseStripDriver();
+        return false;
     }
-    int colonPos = input.indexOf(':', keyPos + pattern.length());
-    if (colonPos < 0) {
-        return -1;
+    return true;
+}
+
+void transmitStrip(const StripPixel* pixels, uint16_t count) {
+    rmt_write_sample(STRIP_RMT_CHANNEL, reinterpret_cast<const uint8_t*>(pixels), count * sizeof(StripPixel), false);
+}
+
+bool stripTransferDone(uint32_t waitMs) {
+    return rmt_wait_tx_done(STRIP_RMT_CHANNEL, pdMS_TO_TICKS(waitMs)) == ESP_OK;
+}
+#endif
+
+// Q8 level of the lit lamp without its effect, following on/off fades.
+// Caller holds effectMux.
+uint16_t lampEnvelope(bool on) {
+    const uint16_t target = on ? litLevel(LAMP_EFFECT_FULL) : 0;
+    if (!fade.active) {
+        return target;
+    }
+    uint16_t from = fadeFrom.frozenLevel;
+    if (!fadeFrom.frozen) {
+        from = fadeFrom.lit ? litLevel(LAMP_EFFECT_FULL) : 0;
+    }
+    return blendLampLevel(from, target, fade.weight);
+}
+
+// Caller holds effectMux.
+StripScene captureStripScene() {
+    StripScene scene;
+    scene.mode = channelOutputs[0].mode;
+    scene.level = shownLevel;
+    scene.envelope = lampEnvelope(channelOutputs[0].on);
+    scene.effectLevel = lampOutputLevel;
+    scene.nowMs = millis();
+    scene.red = static_cast<uint8_t>(stripActive.color >> 16);
+    scene.green = static_cast<uint8_t>(stripActive.color >> 8);
+    scene.blue = static_cast<uint8_t>(stripActive.color);
+    return scene;
+}
+
+// Takes the RMT driver back from the frame tick. Strip task only.
+void stopStripOutput() {
+    esp_timer_stop(stripTimer);
+    portENTER_CRITICAL(&effectMux);
+    stripOutputOn = false;
+    portEXIT_CRITICAL(&effectMux);
+    for (;;) {
+        portENTER_CRITICAL(&effectMux);
+        const bool sending = stripSending;
+        portEXIT_CRITICAL(&effectMux);
+        if (!sending) {
+            return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+// Switches the driver to `config`, blanking the old strip first. Strip task
+// only; the frame tick starts again once the first frame is rendered.
+void applyStripConfig(const StripConfig& config) {
+    stopStripOutput();
+    if (stripActive.pin != STRIP_PIN_NONE) {
+        stripTransferDone(STRIP_DRAIN_MS);
+        memset(stripBuffers[stripFront], 0, stripActive.pixels * sizeof(StripPixel));
+        transmitStrip(stripBuffers[stripFront], stripActive.pixels);
+        stripTransferDone(STRIP_DRAIN_MS);
+        releaseStripDriver();
+        pinMode(stripActive.pin, INPUT);
+    }
+    StripConfig active = {STRIP_PIN_NONE, 0, config.color};
+    if (config.pin != STRIP_PIN_NONE && config.pixels > 0 && installStripDriver(config.pin)) {
+        active = config;
+    }
+    portENTER_CRITICAL(&effectMux);
+    stripActive = active;
+    stripBackReady = false;
+    portEXIT_CRITICAL(&effectMux);
+}
+
+// Runs on the esp_timer task, so it never waits: a frame that is still on
+// the wire or not rendered yet just skips this tick.
+void onStripFrame(void*) {
+    portENTER_CRITICAL(&effectMux);
+    if (!stripOutputOn) {
+        portEXIT_CRITICAL(&effectMux);
+        return;
+    }
+    if (!stripBackReady) {
+        stripTiming.late++;
+        portEXIT_CRITICAL(&effectMux);
+        return;
+    }
+    stripSending = true;
+    portEXIT_CRITICAL(&effectMux);
+    const bool idle = stripTransferDone(0);
+    if (idle) {
+        transmitStrip(stripBuffers[stripFront ^ 1], stripActive.pixels);
+    }
+    portENTER_CRITICAL(&effectMux);
+    if (idle) {
+        stripFront ^= 1;
+        stripBackReady = false;
+        stripTiming.frames++;
+    } else {
+        stripTiming.dropped++;
+    }
+    stripSending = false;
+    portEXIT_CRITICAL(&effectMux);
+    if (idle) {
+        xTaskNotifyGive(stripTask);
+    }
+}
+
+// Woken by requestStripConfig() and by every frame sent. Renders the frame
+// for the next tick into the free back buffer.
+void stripTaskMain(void*) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&effectMux);
+        const bool reconfigure = stripRequestPending;
+        const StripConfig config = stripRequest;
+        stripRequestPending = false;
+        portEXIT_CRITICAL(&effectMux);
+        if (reconfigure && config.pin == stripActive.pin && config.pixels == stripActive.pixels) {
+            portENTER_CRITICAL(&effectMux);
+            stripActive.color = config.color;
+            portEXIT_CRITICAL(&effectMux);
+        } else if (reconfigure) {
+            applyStripConfig(config);
+        }
+        portENTER_CRITICAL(&effectMux);
+        const bool render = stripActive.pin != STRIP_PIN_NONE && !stripBackReady;
+        StripPixel* back = stripBuffers[stripFront ^ 1];
+        StripScene scene = captureStripScene();
+        portEXIT_CRITICAL(&effectMux);
+        if (!render) {
+            continue;
+        }
+        scene.nowMs += STRIP_FRAME_US / 1000;
+        const int64_t startUs = esp_timer_get_time();
+        renderStrip(scene, back, stripActive.pixels, effectRandom);
+        const uint32_t renderUs = static_cast<uint32_t>(esp_timer_get_time() - startUs);
+        portENTER_CRITICAL(&effectMux);
+        stripBackReady = true;
+        if (renderUs > stripTiming.worstRenderUs) {
+            stripTiming.worstRenderUs = renderUs;
+        }
+        const bool start = reconfigure && !stripOutputOn;
+        stripOutputOn = true;
+        portEXIT_CRITICAL(&effectMux);
+        if (start) {
+            esp_timer_start_periodic(stripTimer, STRIP_FRAME_US);
+        }
+    }
+}
+
+// Hands the strip settings to the strip task, which (re)installs the driver
+// and restarts the frame tick when the pin or length changed.
+void requestStripConfig() {
+    if (!stripTask) {
+        return;
+    }
+    portENTER_CRITICAL(&effectMux);
+    stripRequest = {static_cast<int>(settings.stripPin), settings.stripPixels,
+                    static_cast<uint32_t>(settings.stripColor)};
+    stripRequestPending = true;
+    portEXIT_CRITICAL(&effectMux);
+    xTaskNotifyGive(stripTask);
+}
+
+void setupEffectTimer() {
+    esp_timer_create_args_t args = {};
+    args.callback = onEffectTimer;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "lamp_effect";
+    if (esp_timer_create(&args, &effectTimer) != ESP_OK) {
+        effectTimer = nullptr;
+        Serial.println("Meow: effect timer unavailable, stepping effects from loop().");
+    }
+    args.callback = onFadeFrame;
+    args.name = "lamp_fade";
+    if (esp_timer_create(&args, &fadeTimer) != ESP_OK) {
+        fadeTimer = nullptr;
+        Serial.println("Meow: fade timer unavailable, switching instantly.");
+    }
+    args.callback = onStripFrame;
+    args.name = "lamp_strip";
+    if (esp_timer_create(&args, &stripTimer) != ESP_OK) {
+        stripTimer = nullptr;
+        Serial.println("Meow: strip timer unavailable, strip output disabled.");
+    } else if (xTaskCreate(stripTaskMain, "lamp_strip", STRIP_TASK_STACK, nullptr, STRIP_TASK_PRIORITY, &stripTask) !=
+               pdPASS) {
+        stripTask = nullptr;
+        Serial.println("Meow: strip task unavailable, strip output disabled.");
+    }
+}
+
+void updateLampEffect() {
+    portENTER_CRITICAL(&effectMux);
+    if (activeEffectBackend() == EffectBackend::Loop) {
+        stepDueChannels(EffectBackend::Loop, millis());
+    }
+    portEXIT_CRITICAL(&effectMux);
+}
+
+// Uploaded patterns are kept compiled, one NVS blob per slot ("pat0"...).
+// Blobs are validated again on load, so a layout change or corrupt entry just
+// leaves the slot empty.
+void patternPrefsKey(uint8_t slot, char* out, size_t capacity) {
+    snprintf(out, capacity, "pat%u", static_cast<unsigned>(slot));
+}
+
+void loadPatternsFromPrefs() {
+    for (uint8_t slot = 0; slot < LAMP_PATTERN_SLOTS; slot++) {
+        char key[8];
+        patternPrefsKey(slot, key, sizeof(key));
+        LampPattern pattern;
+        if (prefs.getBytesLength(key) == sizeof(pattern) &&
+            prefs.getBytes(key, &pattern, sizeof(pattern)) == sizeof(pattern) && validateLampPattern(pattern)) {
+            lampPatterns[slot] = pattern;
+        }
+    }
+}
+
+// Schedules switch the lamp at a time of day, at a fixed time or after a
+// delay, without a client holding a connection open. Wall-clock time comes
+// from SNTP once a network is reachable or from POST /api/time; until then
+// only delays run, on the monotonic clock. loop() checks the head of
+// scheduleQueue and nothing else, however many entries there are.
+// Wall-clock time counts as set once it is past 2024-01-01.
+const time_t CLOCK_VALID_AFTER = 1704067200;
+const char* SNTP_SERVER = "pool.ntp.org";
+const uint32_t SCHEDULE_IN_S_MAX = 30UL * 24 * 3600;
+// A daily entry is re-queued from this far past its run, so a run that came
+// a little early cannot queue the same minute again.
+const uint32_t SCHEDULE_RUN_GUARD_S = 60;
+const char* SCHEDULE_DAY_NAMES[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+const char* SCHEDULE_ACTION_NAMES[] = {"keep", "on", "off", "toggle"};
+
+enum class ClockSource : uint8_t {
+    None,
+    Sntp,
+    Manual
+};
+
+const char* CLOCK_SOURCE_NAMES[] = {"none", "sntp", "manual"};
+
+ClockSource clockSource = ClockSource::None;
+// Set from the SNTP task, picked up by loop().
+std::atomic<bool> sntpSynced(false);
+ScheduleEntry schedules[SCHEDULE_SLOTS];
+ScheduleQueue scheduleQueue;
+uint16_t nextScheduleId = 1;
+
+uint64_t monotonicMs() {
+    return static_cast<uint64_t>(esp_timer_get_time() / 1000);
+}
+
+bool wallClockSet() {
+    return time(nullptr) >= CLOCK_VALID_AFTER;
+}
+
+void onSntpSync(struct timeval*) {
+    sntpSynced = true;
+}
+
+// The table is stored as one NVS blob ("sched") up to the last used slot and
+// rewritten on every change. Delay entries are stored too but dropped on
+// load, since the monotonic clock restarts with the chip.
+void storeSchedules() {
+    size_t used = 0;
+    for (uint8_t slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+        if (schedules[slot].kind != ScheduleKind::None) {
+            used = slot + 1;
+        }
+    }
+    if (used == 0) {
+        prefs.remove("sched");
+        return;
+    }
+    prefs.putBytes("sched", schedules, used * sizeof(ScheduleEntry));
+}
+
+void loadSchedulesFromPrefs() {
+    memset(schedules, 0, sizeof(schedules));
+    const size_t length = prefs.getBytesLength("sched");
+    if (length == 0 || length % sizeof(ScheduleEntry) != 0 || length > sizeof(schedules) ||
+        prefs.getBytes("sched", schedules, length) != length) {
+        memset(schedules, 0, sizeof(schedules));
+        return;
+    }
+    for (ScheduleEntry& entry : schedules) {
+        if (entry.kind != ScheduleKind::Once && entry.kind != ScheduleKind::Daily) {
+            entry = ScheduleEntry{};
+            continue;
+        }
+        entry.mode[SCHEDULE_MODE_MAX] = '\0';
+        if (entry.id >= nextScheduleId) {
+            nextScheduleId = static_cast<uint16_t>(entry.id + 1);
+        }
+    }
+}
+
+int findSchedule(uint16_t id) {
+    for (uint8_t slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+        if (schedules[slot].kind != ScheduleKind::None && schedules[slot].id == id) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void removeSchedule(uint8_t slot) {
+    unqueueSchedule(scheduleQueue, slot);
+    schedules[slot] = ScheduleEntry{};
+}
+
+// Queues the slot's next run at least `afterS` from now, or parks a
+// wall-clock entry while the clock is unset. Returns false when the entry
+// will never run again.
+bool queueScheduleSlot(uint8_t slot, uint32_t afterS = 0) {
+    const ScheduleEntry& entry = schedules[slot];
+    if (entry.kind == ScheduleKind::Timer) {
+        queueSchedule(scheduleQueue, slot, static_cast<uint64_t>(entry.at) * 1000);
+        return true;
+    }
+    if (!wallClockSet()) {
+        unqueueSchedule(scheduleQueue, slot);
+        return true;
+    }
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    const int64_t next = nextScheduleTime(entry, now.tv_sec + afterS);
+    if (next < 0) {
+        return false;
+    }
+    const int64_t wallMs = static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+    const int64_t delayMs = next * 1000 - wallMs;
+    queueSchedule(scheduleQueue, slot, monotonicMs() + static_cast<uint64_t>(delayMs > 0 ? delayMs : 0));
+    return true;
+}
+
+// Rebuilds every deadline from the current clock, after it was set or the
+// timezone changed. Entries that can no longer run are dropped.
+void requeueSchedules() {
+    bool dropped = false;
+    for (uint8_t slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+        if (schedules[slot].kind != ScheduleKind::None && !queueScheduleSlot(slot)) {
+            removeSchedule(slot);
+            dropped = true;
+        }
+    }
+    if (dropped) {
+        storeSchedules();
+    }
+}
+
+void applyTimezone() {
+    setenv("TZ", settings.timezone, 1);
+    tzset();
+    requeueSchedules();
+}
+
+void setupClock() {
+    clearScheduleQueue(scheduleQueue);
+    loadSchedulesFromPrefs();
+    sntp_set_time_sync_notification_cb(onSntpSync);
+    configTzTime(settings.timezone, SNTP_SERVER);
+    clockSource = wallClockSet() ? ClockSource::Sntp : ClockSource::None;
+    requeueSchedules();
+}
+
+void runSchedule(uint8_t slot) {
+    const ScheduleEntry entry = schedules[slot];
+    if (entry.kind == ScheduleKind::Daily && queueScheduleSlot(slot, SCHEDULE_RUN_GUARD_S)) {
+        // Stays in the table for its next run.
+    } else {
+        removeSchedule(slot);
+        if (entry.kind != ScheduleKind::Timer) {
+            storeSchedules();
+        }
+    }
+
+    LampMode mode = currentMode;
+    // A pattern deleted since the entry was made leaves the mode alone.
+    if (entry.mode[0] != '\0' && !parseLampMode(entry.mode, mode)) {
+        mode = currentMode;
+    }
+    bool on = ledOn;
+    if (entry.action == ScheduleAction::On || entry.action == ScheduleAction::Off) {
+        on = entry.action == ScheduleAction::On;
+    } else if (entry.action == ScheduleAction::Toggle) {
+        on = !ledOn;
+    }
+    applyLampState(on, mode);
+    bumpStateRevision(STATUS_CHANGED);
+}
+
+void serviceSchedules() {
+    if (sntpSynced.exchange(false)) {
+        clockSource = ClockSource::Sntp;
+        requeueSchedules();
+    }
+    uint8_t slot;
+    const uint64_t now = monotonicMs();
+    while (takeDueSchedule(scheduleQueue, now, slot)) {
+        runSchedule(slot);
+    }
+}
+
+// Channels past 0 are one NVS blob each ("ch1"...), with the mode stored by
+// name so it survives pattern slots moving. Channel 0 keeps its led_pin,
+// led_on and mode keys.
+struct StoredChannel {
+    int8_t pin;
+    bool on;
+    char mode[LAMP_MODE_NAME_MAX + 1];
+};
+
+void channelPrefsKey(uint8_t channel, char* out, size_t capacity) {
+    snprintf(out, capacity, "ch%u", static_cast<unsigned>(channel));
+}
+
+void loadChannelsFromPrefs() {
+    for (uint8_t channel = 1; channel < LAMP_CHANNELS_MAX; channel++) {
+        LampChannel& lamp = channels[channel];
+        lamp.pin = CHANNEL_PIN_NONE;
+        lamp.mode = DEFAULT_MODE;
+        lamp.on = false;
+        char key[8];
+        channelPrefsKey(channel, key, sizeof(key));
+        StoredChannel stored;
+        if (prefs.getBytesLength(key) != sizeof(stored) ||
+            prefs.getBytes(key, &stored, sizeof(stored)) != sizeof(stored) || stored.pin < LED_PIN_MIN ||
+            stored.pin > LED_PIN_MAX) {
+            continue;
+        }
+        stored.mode[LAMP_MODE_NAME_MAX] = '\0';
+        lamp.pin = stored.pin;
+        lamp.on = stored.on;
+        if (!parseLampMode(stored.mode, lamp.mode)) {
+            lamp.mode = DEFAULT_MODE;
+        }
+    }
+}
+
+void storeChannel(uint8_t channel) {
+    char key[8];
+    channelPrefsKey(channel, key, sizeof(key));
+    const LampChannel& lamp = channels[channel];
+    if (lamp.pin == CHANNEL_PIN_NONE) {
+        prefs.remove(key);
+        return;
+    }
+    StoredChannel stored = {};
+    stored.pin = static_cast<int8_t>(lamp.pin);
+    stored.on = lamp.on;
+    strncpy(stored.mode, lampModeName(lamp.mode), LAMP_MODE_NAME_MAX);
+    prefs.putBytes(key, &stored, sizeof(stored));
+}
+
+// Index of the extra channel driving `pin`, or -1. Channel 0 is left out so
+// callers can check a new led_pin against the other channels.
+int findChannelOnPin(int pin) {
+    for (uint8_t channel = 1; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (channels[channel].pin == pin) {
+            return channel;
+        }
+    }
+    return -1;
+}
+
+// Key of a pin setting in `next` that another output already drives, or
+// nullptr.
+const char* settingsPinConflict(const DeviceSettings& next) {
+    if (findChannelOnPin(next.ledPin) >= 0) {
+        return "led_pin";
+    }
+    if (next.stripPin != STRIP_PIN_NONE && (next.stripPin == next.ledPin || findChannelOnPin(next.stripPin) >= 0)) {
+        return "strip_pin";
+    }
+    return nullptr;
+}
+
+void loadSettingsFromPrefs() {
+    loadSettings(prefs, settings);
+    loadPatternsFromPrefs();
+    loadChannelsFromPrefs();
+
+    ledOn = prefs.getBool("led_on", false);
+    const String storedMode = prefs.getString("mode", lampModeName(DEFAULT_MODE));
+    if (!parseLampMode(storedMode.c_str(), currentMode)) {
+        currentMode = DEFAULT_MODE;
+    }
+}
+
+void saveSettingsToPrefs(const DeviceSettings& previous) {
+    storeSettings(prefs, settings, previous);
+    prefs.putString("mode", lampModeName(currentMode));
+}
+
+// Re-drives the current level after a brightness or fade change.
+void refreshLampOutput() {
+    postChannelCommand(0, false);
+}
+
+void applyLedPin(int newPin) {
+    if (newPin < LED_PIN_MIN || newPin > LED_PIN_MAX) {
+        return;
+    }
+    if (newPin == ledPin) {
+        return;
+    }
+    int previousPin = ledPin;
+    attachLampPwm(newPin);
+    ledPin = newPin;
+    setChannelOutputPin(0, newPin);
+    if (previousPin != ledPin) {
+        detachLampPwm(previousPin);
+        pinMode(previousPin, INPUT);
+    }
+}
+
+bool stripSettingsChanged(const DeviceSettings& next, const DeviceSettings& previous) {
+    return next.stripPin != previous.stripPin || next.stripPixels != previous.stripPixels ||
+           next.stripColor != previous.stripColor;
+}
+
+// Makes `next` the live settings and applies whatever changed to the
+// hardware, effects and NVS. Returns the change flags for the caller's
+// revision bump. A caller that restarts the effects itself right after
+// passes `updateEffects` false, so the effect side is reset only once.
+uint8_t applySettings(const DeviceSettings& next, bool updateEffects = true) {
+    const DeviceSettings previous = settings;
+    settings = next;
+    applyLedPin(settings.ledPin);
+    if (stripSettingsChanged(settings, previous)) {
+        requestStripConfig();
+    }
+    if (strcmp(settings.timezone, previous.timezone) != 0) {
+        applyTimezone();
+    }
+    const bool brightnessChanged = settings.brightness != previous.brightness;
+    if (updateEffects && settings.effectTimer != previous.effectTimer) {
+        resetEffectState();
+    } else if (updateEffects && (brightnessChanged || settings.fadeMs != previous.fadeMs)) {
+        refreshLampOutput();
+    }
+    saveSettingsToPrefs(previous);
+    // Brightness is part of the status object as well.
+    return brightnessChanged ? SETTINGS_CHANGED | STATUS_CHANGED : SETTINGS_CHANGED;
+}
+
+void commitSettings(const DeviceSettings& next) {
+    bumpStateRevision(applySettings(next));
+}
+
+void setBrightness(uint16_t level) {
+    if (level == settings.brightness) {
+        return;
+    }
+    DeviceSettings next = settings;
+    next.brightness = level;
+    commitSettings(next);
+}
+
+const WebFile* findWebFile(const String& path) {
+    for (size_t i = 0; i < webFilesCount; i++) {
+        if (path == webFiles[i].path) {
+            return &webFiles[i];
+        }
+    }
+    return nullptr;
+}
+
+// Parked requests, event streams, WebSockets and file transfers each hold a
+// socket taken over from WebServer. Besides their own table sizes they share
+// this budget, which with the listener, the request in flight, DNS and CoAP
+// stays within the core's CONFIG_LWIP_MAX_SOCKETS (16).
+const uint8_t DETACHED_SOCKETS_MAX = 12;
+uint8_t detachedSockets = 0;
+
+bool detachedSocketAvailable() {
+    return detachedSockets < DETACHED_SOCKETS_MAX;
+}
+
+// Moves the connection of the current request out of WebServer. Dropping the
+// server's handle lets it accept the next connection; the socket stays open
+// through `into`.
+void takeOverClient(WiFiClient& into) {
+    into = server.client();
+    server.client().stop();
+    detachedSockets++;
+}
+
+// Closes a socket taken over by takeOverClient() and frees its slot.
+void releaseDetachedClient(WiFiClient& client, bool& active) {
+    client.stop();
+    if (active) {
+        active = false;
+        detachedSockets--;
+    }
+}
+
+// Web file GETs are taken over into a FileTransfers slot (see
+// FileTransfers.h). Each transfer also needs a socket from the shared budget.
+static_assert(FILE_TRANSFERS_MAX <= DETACHED_SOCKETS_MAX, "a transfer holds a detached socket");
+FileTransfers fileTransfers;
+WiFiClient fileTransferClients[FILE_TRANSFERS_MAX];
+
+void closeFileTransfer(uint8_t slot) {
+    releaseDetachedClient(fileTransferClients[slot], fileTransfers.slots[slot].active);
+}
+
+// Returns false when no slot or socket is free.
+bool startFileTransfer(const WebFile& file) {
+    const int slot = findFreeFileTransfer(fileTransfers);
+    if (slot < 0 || !detachedSocketAvailable() ||
+        !beginFileTransfer(fileTransfers.slots[slot], server.client().fd(), file.mime_type, file.data, file.size,
+                           server.method() != HTTP_HEAD, millis())) {
+        return false;
+    }
+    takeOverClient(fileTransferClients[slot]);
+    if (!advanceFileTransfer(fileTransfers.slots[slot], millis())) {
+        closeFileTransfer(static_cast<uint8_t>(slot));
+    }
+    return true;
+}
+
+void serviceFileTransfers() {
+    for (uint8_t slot = 0; slot < FILE_TRANSFERS_MAX; slot++) {
+        if (fileTransfers.slots[slot].active && !advanceFileTransfer(fileTransfers.slots[slot], millis())) {
+            closeFileTransfer(slot);
+        }
+    }
+}
+
+bool serveWebFile(const String& path) {
+    String target = path;
+    if (target == "/") {
+        target = "/index.html";
+    }
+
+    const WebFile* file = findWebFile(target);
+    if (!file) {
+        return false;
+    }
+
+    if (!startFileTransfer(*file)) {
+        refuseFileTransfer(fileTransfers, server.client().fd());
+        Serial.printf("Meow: %s refused, all download slots busy (%lu so far).\n", target.c_str(),
+                      static_cast<unsigned long>(fileTransfers.refused));
+    }
+    return true;
+}
+
+String portalUrl() {
+    return String("http://") + WiFi.softAPIP().toString() + "/";
+}
+
+void redirectToPortal() {
+    server.sendHeader("Location", portalUrl());
+    server.send(302, "text/plain", "Meow.");
+}
+
+bool headerContains(const char* name, const char* value) {
+    return server.header(name).indexOf(value) >= 0;
+}
+
+bool acceptsCbor() {
+    return headerContains("Accept", CBOR_CONTENT_TYPE);
+}
+
+// Sends the validator headers for a GET and answers 304 without building a
+// body when If-None-Match already names the current revision. The tag
+// carries the reply format, since JSON and CBOR bodies differ byte for byte.
+bool sendNotModified() {
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%08lx-%lu%s\"", static_cast<unsigned long>(bootNonce),
+             static_cast<unsigned long>(lampState.read().revision), acceptsCbor() ? "-cbor" : "");
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", "no-cache");
+    server.sendHeader("Vary", "Accept");
+    if (!headerContains("If-None-Match", etag)) {
+        return false;
+    }
+    server.send(304);
+    return true;
+}
+
+// Uptime changes every second, so it travels as a header instead of a status
+// field and the status body stays cacheable. X-Revision is the value a
+// long-polling client passes back as `since`.
+void sendStatusHeaders() {
+    server.sendHeader("X-Uptime", String(millis() / 1000));
+    server.sendHeader("X-Revision", String(lampState.read().revision));
+}
+
+// API replies are written into one small shared window. A reply that fits
+// goes out as a single send_P(); a larger one switches to chunked transfer and
+// is streamed to the client with sendContent() each time the window fills.
+const size_t RESPONSE_WINDOW_BYTES = 256;
+char responseWindow[RESPONSE_WINDOW_BYTES];
+
+struct ApiResponse {
+    int code;
+    const char* contentType;
+    bool chunked;
+};
+
+void flushApiResponse(void* context, const char* data, size_t length) {
+    ApiResponse* response = static_cast<ApiResponse*>(context);
+    if (!response->chunked) {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(response->code, response->contentType, "");
+        response->chunked = true;
+    }
+    server.sendContent(data, length);
+}
+
+template <typename Writer, typename Body>
+void sendEncodedResponse(int code, const char* contentType, const Body& body) {
+    ApiResponse response = {code, contentType, false};
+    Writer out(responseWindow, sizeof(responseWindow), flushApiResponse, &response);
+    body(out);
+    if (!response.chunked) {
+        server.send_P(response.code, response.contentType, out.data(), out.length());
+        return;
+    }
+    out.flush();
+    server.sendContent("");
+}
+
+// `body` is called with either a JsonWriter or a CborWriter, depending on the
+// request's Accept header, so it is written as a generic lambda.
+template <typename Body>
+void sendApiResponse(int code, const Body& body) {
+    if (acceptsCbor()) {
+        sendEncodedResponse<CborWriter>(code, CBOR_CONTENT_TYPE, body);
+    } else {
+        sendEncodedResponse<JsonWriter>(code, JSON_CONTENT_TYPE, body);
+    }
+}
+
+void sendError(int code, const char* error) {
+    sendApiResponse(code, [error](auto& out) {
+        out.beginObject();
+        out.key("error");
+        out.stringValue(error);
+        out.endObject();
+    });
+}
+
+template <typename Writer>
+void writeStatusFields(Writer& out) {
+    const LampState state = lampState.read();
+    out.key("led_on");
+    out.boolValue(lampStateOn(state));
+    out.key("ssid");
+    out.stringValue(AP_SSID);
+    out.key("mode");
+    out.stringValue(lampModeName(state.mode));
+    out.key("brightness");
+    out.uintValue(state.brightness);
+}
+
+void sendStatusBody() {
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        writeStatusFields(out);
+        out.endObject();
+    });
+}
+
+void sendStatus() {
+    sendStatusHeaders();
+    sendStatusBody();
+}
+
+template <typename Writer>
+size_t encodeStatus(char* buffer, size_t capacity) {
+    Writer out(buffer, capacity);
+    out.beginObject();
+    writeStatusFields(out);
+    out.endObject();
+    return out.length();
+}
+
+// Detached connections (parked replies, event streams, WebSockets) each own a
+// fixed send queue that loop() drains with non-blocking writes. A peer whose
+// queue would overflow is too slow to keep up and gets disconnected instead of
+// stalling everyone else.
+// Sized for a settings event (see EVENT_MAX) with a status event still queued
+// ahead of it.
+const size_t SEND_QUEUE_BYTES = 1280;
+
+struct SendQueue {
+    char data[SEND_QUEUE_BYTES];
+    size_t head;
+    size_t length;
+};
+
+void clearSendQueue(SendQueue& queue) {
+    queue.head = 0;
+    queue.length = 0;
+}
+
+size_t sendQueueRoom(const SendQueue& queue) {
+    return SEND_QUEUE_BYTES - queue.length;
+}
+
+// Appends all of `data` or nothing; returns false when it does not fit.
+bool enqueueBytes(SendQueue& queue, const char* data, size_t length) {
+    if (length > sendQueueRoom(queue)) {
+        return false;
+    }
+    size_t tail = (queue.head + queue.length) % SEND_QUEUE_BYTES;
+    for (size_t i = 0; i < length; i++) {
+        queue.data[tail] = data[i];
+        tail = (tail + 1) % SEND_QUEUE_BYTES;
+    }
+    queue.length += length;
+    return true;
+}
+
+// Sends as much of the queue as the socket takes without blocking. Returns
+// false when the socket failed.
+bool drainSendQueue(SendQueue& queue, int fd) {
+    while (queue.length > 0) {
+        const size_t contiguous = SEND_QUEUE_BYTES - queue.head;
+        const size_t chunk = queue.length < contiguous ? queue.length : contiguous;
+        const int sent = send(fd, queue.data + queue.head, chunk, MSG_DONTWAIT);
+        if (sent < 0) {
+            return errno == EWOULDBLOCK || errno == EAGAIN;
+        }
+        if (sent == 0) {
+            return true;
+        }
+        queue.head = (queue.head + static_cast<size_t>(sent)) % SEND_QUEUE_BYTES;
+        queue.length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// GET /api/paw?wait=<s>&since=<revision> is parked while the revision still
+// equals `since`. WebServer serves one connection at a time, so a parked
+// request is detached from it and answered later from loop(); the lamp
+// effect and DNS keep running while clients wait.
+// Each parked request holds a socket from DETACHED_SOCKETS_MAX.
+const uint8_t MAX_PARKED_CLIENTS = 2;
+const uint32_t MAX_LONG_POLL_MS = 30000;
+
+// A reply the socket does not take at once is drained from loop() for at most
+// this long.
+const uint32_t PARKED_REPLY_MS = 5000;
+
+struct ParkedClient {
+    WiFiClient client;
+    SendQueue queue;
+    uint32_t since;
+    unsigned long deadlineMs;
+    bool cbor;
+    bool replying;
+    bool active;
+};
+
+ParkedClient parkedClients[MAX_PARKED_CLIENTS];
+
+ParkedClient* findFreeParkedClient() {
+    for (ParkedClient& parked : parkedClients) {
+        if (!parked.active) {
+            return &parked;
+        }
+    }
+    return nullptr;
+}
+
+// Returns false when the request should be answered right away: no `since`,
+// a revision that already moved on (or a reboot), or no free slot.
+bool parkStatusRequest() {
+    const long waitSeconds = server.arg("wait").toInt();
+    if (waitSeconds <= 0 || !server.hasArg("since")) {
+        return false;
+    }
+    const uint32_t since = strtoul(server.arg("since").c_str(), nullptr, 10);
+    ParkedClient* parked = findFreeParkedClient();
+    if (since != stateRevision || !parked || !detachedSocketAvailable()) {
+        return false;
+    }
+
+    const uint32_t waitMs = static_cast<uint32_t>(waitSeconds) * 1000;
+    parked->since = since;
+    parked->deadlineMs = millis() + (waitMs < MAX_LONG_POLL_MS ? waitMs : MAX_LONG_POLL_MS);
+    parked->cbor = acceptsCbor();
+    parked->replying = false;
+    clearSendQueue(parked->queue);
+    parked->active = true;
+    takeOverClient(parked->client);
+    return true;
+}
+
+void releaseParkedClient(ParkedClient& parked) {
+    releaseDetachedClient(parked.client, parked.active);
+}
+
+// Queues the reply and hands the socket what it takes without blocking; the
+// rest goes out from serviceParkedClients().
+void replyToParkedClient(ParkedClient& parked) {
+    char body[RESPONSE_WINDOW_BYTES];
+    const size_t bodyLength = parked.cbor ? encodeStatus<CborWriter>(body, sizeof(body))
+                                          : encodeStatus<JsonWriter>(body, sizeof(body));
+    char head[192];
+    const int headLength = snprintf(head, sizeof(head),
+                                    "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: %s\r\n"
+                                    "Content-Length: %u\r\n"
+                                    "X-Uptime: %lu\r\n"
+                                    "X-Revision: %lu\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "Connection: close\r\n\r\n",
+                                    parked.cbor ? CBOR_CONTENT_TYPE : JSON_CONTENT_TYPE,
+                                    static_cast<unsigned>(bodyLength), millis() / 1000,
+                                    static_cast<unsigned long>(stateRevision));
+    if (headLength <= 0 || static_cast<size_t>(headLength) >= sizeof(head) ||
+        !enqueueBytes(parked.queue, head, static_cast<size_t>(headLength)) ||
+        !enqueueBytes(parked.queue, body, bodyLength)) {
+        releaseParkedClient(parked);
+        return;
+    }
+    parked.replying = true;
+    parked.deadlineMs = millis() + PARKED_REPLY_MS;
+    if (!drainSendQueue(parked.queue, parked.client.fd()) || parked.queue.length == 0) {
+        releaseParkedClient(parked);
+    }
+}
+
+void serviceParkedClients() {
+    const unsigned long now = millis();
+    for (ParkedClient& parked : parkedClients) {
+        if (!parked.active) {
+            continue;
+        }
+        if (parked.replying) {
+            if (!drainSendQueue(parked.queue, parked.client.fd()) || parked.queue.length == 0 ||
+                isTimeReached(now, parked.deadlineMs)) {
+                releaseParkedClient(parked);
+            }
+        } else if (!parked.client.connected()) {
+            releaseParkedClient(parked);
+        } else if (parked.since != stateRevision || isTimeReached(now, parked.deadlineMs)) {
+            replyToParkedClient(parked);
+        }
+    }
+}
+
+// Status as pushed to event streams and WebSockets. Unlike GET /api/paw this
+// carries uptime_s, since there is no header to put it in.
+size_t formatPushedStatus(char* out, size_t capacity) {
+    JsonWriter json(out, capacity);
+    json.beginObject();
+    writeStatusFields(json);
+    json.key("uptime_s");
+    json.uintValue(millis() / 1000);
+    json.endObject();
+    return json.overflowed() ? 0 : json.length();
+}
+
+size_t formatPushedSettings(char* out, size_t capacity) {
+    JsonWriter json(out, capacity);
+    writeSettings(json, settings);
+    return json.overflowed() ? 0 : json.length();
+}
+
+// GET /api/events is a Server-Sent Events stream of "status" and "settings"
+// events, sent through the queues above.
+const uint8_t MAX_EVENT_STREAMS = 3;
+const uint32_t EVENT_HEARTBEAT_MS = 15000;
+const uint16_t EVENT_RETRY_MS = 3000;
+
+struct EventStream {
+    WiFiClient client;
+    SendQueue queue;
+    unsigned long lastWriteMs;
+    bool active;
+};
+
+EventStream eventStreams[MAX_EVENT_STREAMS];
+
+void closeEventStream(EventStream& stream) {
+    releaseDetachedClient(stream.client, stream.active);
+}
+
+void enqueueEvent(EventStream& stream, const char* data, size_t length) {
+    if (!enqueueBytes(stream.queue, data, length)) {
+        closeEventStream(stream);
+    }
+}
+
+// An event is the JSON body behind an "id: <revision>\nevent: <name>\ndata: "
+// prefix and a blank line. The body is written straight after the prefix, so
+// the buffer holds the longest settings object with no copy in between.
+const size_t EVENT_FRAME_BYTES = 48;
+const size_t EVENT_MAX = SETTINGS_JSON_MAX + EVENT_FRAME_BYTES;
+static_assert(EVENT_MAX <= SEND_QUEUE_BYTES, "an event must fit an empty send queue");
+
+char eventBuffer[EVENT_MAX];
+
+// Formats one event into eventBuffer. Returns 0 if it does not fit.
+size_t formatEvent(uint8_t kind) {
+    const bool status = kind == STATUS_CHANGED;
+    const int prefixLength = snprintf(eventBuffer, sizeof(eventBuffer), "id: %lu\nevent: %s\ndata: ",
+                                      static_cast<unsigned long>(stateRevision), status ? "status" : "settings");
+    if (prefixLength <= 0 || static_cast<size_t>(prefixLength) >= sizeof(eventBuffer)) {
+        return 0;
+    }
+    char* data = eventBuffer + prefixLength;
+    const size_t room = sizeof(eventBuffer) - prefixLength;
+    const size_t dataLength = status ? formatPushedStatus(data, room) : formatPushedSettings(data, room);
+    if (dataLength == 0 || dataLength + 2 > room) {
+        Serial.printf("Meow: %s event does not fit %u bytes, not sent.\n", status ? "status" : "settings",
+                      static_cast<unsigned>(sizeof(eventBuffer)));
+        return 0;
+    }
+    data[dataLength] = '\n';
+    data[dataLength + 1] = '\n';
+    return prefixLength + dataLength + 2;
+}
+
+void broadcastEvent(uint8_t kind) {
+    const size_t length = formatEvent(kind);
+    if (length == 0) {
+        return;
+    }
+    for (EventStream& stream : eventStreams) {
+        if (stream.active) {
+            enqueueEvent(stream, eventBuffer, length);
+        }
+    }
+}
+
+void serviceEventStreams(uint8_t changed) {
+    if (changed & STATUS_CHANGED) {
+        broadcastEvent(STATUS_CHANGED);
+    }
+    if (changed & SETTINGS_CHANGED) {
+        broadcastEvent(SETTINGS_CHANGED);
+    }
+
+    const unsigned long now = millis();
+    for (EventStream& stream : eventStreams) {
+        if (!stream.active) {
+            continue;
+        }
+        if (!stream.client.connected()) {
+            closeEventStream(stream);
+            continue;
+        }
+        if (stream.queue.length == 0 && now - stream.lastWriteMs >= EVENT_HEARTBEAT_MS) {
+            enqueueEvent(stream, ":\n\n", 3);
+            stream.lastWriteMs = now;
+        }
+        if (stream.active && !drainSendQueue(stream.queue, stream.client.fd())) {
+            closeEventStream(stream);
+        }
+    }
+}
+
+void handleEvents() {
+    EventStream* stream = nullptr;
+    for (EventStream& candidate : eventStreams) {
+        if (!candidate.active) {
+            stream = &candidate;
+            break;
+        }
+    }
+    if (!stream || !detachedSocketAvailable()) {
+        sendError(503, "too_many_streams");
+        return;
+    }
+
+    clearSendQueue(stream->queue);
+    stream->lastWriteMs = millis();
+    stream->active = true;
+    takeOverClient(stream->client);
+
+    char preamble[160];
+    const int preambleLength = snprintf(preamble, sizeof(preamble),
+                                        "HTTP/1.1 200 OK\r\n"
+                                        "Content-Type: text/event-stream\r\n"
+                                        "Cache-Control: no-store\r\n"
+                                        "Connection: keep-alive\r\n\r\n"
+                                        "retry: %u\n\n",
+                                        static_cast<unsigned>(EVENT_RETRY_MS));
+    enqueueEvent(*stream, preamble, static_cast<size_t>(preambleLength));
+
+    // A new subscriber starts from the current state.
+    const size_t eventLength = formatEvent(STATUS_CHANGED);
+    if (stream->active && eventLength > 0) {
+        enqueueEvent(*stream, eventBuffer, eventLength);
+    }
+    if (stream->active && !drainSendQueue(stream->queue, stream->client.fd())) {
+        closeEventStream(*stream);
+    }
+}
+
+// GET /api/ws upgrades to a WebSocket control channel. Text messages are
+// "on", "off", "toggle" (anything parseDesiredState() takes), "mode <name>"
+// and "state"; every connected socket receives the status object after each
+// change and {"settings":{...}} after settings changes. Frames are parsed
+// straight off the socket in loop(), so a toggle reaches writeLampOutput()
+// without a new TCP connection or an HTTP parse.
+const uint8_t MAX_WS_CLIENTS = 6;
+const uint32_t WS_PING_MS = 15000;
+const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+// The longest pushed message is {"settings":{...}}.
+const size_t WS_PUSH_MAX = SETTINGS_JSON_MAX + 16;
+static_assert(WS_SERVER_HEADER_MAX + WS_PUSH_MAX <= SEND_QUEUE_BYTES, "a pushed message must fit an empty send queue");
+
+struct WebSocketClient {
+    WiFiClient client;
+    SendQueue queue;
+    WebSocketFrameReader reader;
+    unsigned long lastWriteMs;
+    bool active;
+};
+
+WebSocketClient webSockets[MAX_WS_CLIENTS];
+char webSocketMessage[WS_PUSH_MAX];
+// Pushed messages that were not sent: too long to format, or queued for a
+// peer too slow to take them (which is then disconnected).
+uint32_t webSocketDrops = 0;
+
+void noteWebSocketDrop(const char* reason) {
+    webSocketDrops++;
+    Serial.printf("Meow: WebSocket message dropped (%s), %lu so far.\n", reason,
+                  static_cast<unsigned long>(webSocketDrops));
+}
+
+void closeWebSocket(WebSocketClient& socket) {
+    releaseDetachedClient(socket.client, socket.active);
+}
+
+bool enqueueWebSocketFrame(WebSocketClient& socket, uint8_t opcode, const char* payload, size_t length) {
+    uint8_t header[WS_SERVER_HEADER_MAX];
+    const size_t headerLength = writeWebSocketHeader(header, opcode, length);
+    if (headerLength == 0 || headerLength + length > sendQueueRoom(socket.queue)) {
+        noteWebSocketDrop("slow peer");
+        closeWebSocket(socket);
+        return false;
+    }
+    enqueueBytes(socket.queue, reinterpret_cast<const char*>(header), headerLength);
+    enqueueBytes(socket.queue, payload, length);
+    return true;
+}
+
+// Best effort: tells the peer why before dropping the connection.
+void failWebSocket(WebSocketClient& socket, uint16_t code) {
+    const uint8_t frame[] = {0x80 | WS_OP_CLOSE, 2, static_cast<uint8_t>(code >> 8), static_cast<uint8_t>(code & 0xFF)};
+    send(socket.client.fd(), frame, sizeof(frame), MSG_DONTWAIT);
+    closeWebSocket(socket);
+}
+
+void sendWebSocketStatus(WebSocketClient& socket) {
+    char status[RESPONSE_WINDOW_BYTES];
+    const size_t length = formatPushedStatus(status, sizeof(status));
+    if (length > 0) {
+        enqueueWebSocketFrame(socket, WS_OP_TEXT, status, length);
+    }
+}
+
+void broadcastWebSocketMessage(const char* message, size_t length) {
+    for (WebSocketClient& socket : webSockets) {
+        if (socket.active) {
+            enqueueWebSocketFrame(socket, WS_OP_TEXT, message, length);
+        }
+    }
+}
+
+void broadcastWebSockets(uint8_t changed) {
+    if (changed & STATUS_CHANGED) {
+        const size_t length = formatPushedStatus(webSocketMessage, sizeof(webSocketMessage));
+        if (length > 0) {
+            broadcastWebSocketMessage(webSocketMessage, length);
+        } else {
+            noteWebSocketDrop("status too long");
+        }
+    }
+    if (changed & SETTINGS_CHANGED) {
+        JsonWriter json(webSocketMessage, sizeof(webSocketMessage));
+        json.beginObject();
+        json.key("settings");
+        writeSettings(json, settings);
+        json.endObject();
+        if (!json.overflowed()) {
+            broadcastWebSocketMessage(json.c_str(), json.length());
+        } else {
+            noteWebSocketDrop("settings too long");
+        }
+    }
+}
+
+void applyWebSocketCommand(WebSocketClient& socket, char* text) {
+    const char* modePrefix = "mode ";
+    if (strcmp(text, "state") == 0) {
+        sendWebSocketStatus(socket);
+        return;
+    }
+    if (strncmp(text, modePrefix, strlen(modePrefix)) == 0) {
+        char* mode = text + strlen(modePrefix);
+        for (char* p = mode; *p; p++) {
+            *p = static_cast<char>(tolower(static_cast<unsigned char>(*p)));
+        }
+        LampMode parsed;
+        if (parseLampMode(mode, parsed)) {
+            applyMode(parsed);
+            return;
+        }
+    } else {
+        bool desired = ledOn;
+        if (parseDesiredState(text, ledOn, &desired)) {
+            // Like a paw request: a state the lamp is already in changes
+            // nothing, so only the sender hears back.
+            if (desired != ledOn) {
+                setLamp(desired);
+            } else {
+                sendWebSocketStatus(socket);
+            }
+            return;
+        }
+    }
+    const char* error = "{\"error\":\"unknown_command\"}";
+    enqueueWebSocketFrame(socket, WS_OP_TEXT, error, strlen(error));
+}
+
+// Handles the frame the reader just completed. Returns false once the socket
+// was closed.
+bool handleWebSocketFrame(WebSocketClient& socket) {
+    WebSocketFrameReader& reader = socket.reader;
+    switch (reader.opcode()) {
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+            applyWebSocketCommand(socket, reader.payload());
+            return socket.active;
+        case WS_OP_PING:
+            return enqueueWebSocketFrame(socket, WS_OP_PONG, reader.payload(), reader.payloadLength());
+        case WS_OP_PONG:
+            return true;
+        case WS_OP_CLOSE:
+            failWebSocket(socket, WS_CLOSE_NORMAL);
+            return false;
+        case WS_OP_CONTINUATION:
+        default:
+            failWebSocket(socket, WS_CLOSE_PROTOCOL_ERROR);
+            return false;
+    }
+}
+
+// Reads whatever the socket has buffered and handles every complete frame.
+void readWebSocket(WebSocketClient& socket) {
+    WebSocketFrameReader& reader = socket.reader;
+    while (socket.active && socket.client.available() > 0) {
+        const int read = socket.client.read(reader.readPointer(), reader.wanted());
+        if (read <= 0) {
+            return;
+        }
+        switch (reader.commit(static_cast<size_t>(read))) {
+            case WebSocketRead::NeedMore:
+                break;
+            case WebSocketRead::Frame:
+                if (!handleWebSocketFrame(socket)) {
+                    return;
+                }
+                break;
+            case WebSocketRead::ProtocolError:
+                // Fragmented or unmasked client frames are not part of this protocol.
+                failWebSocket(socket, WS_CLOSE_PROTOCOL_ERROR);
+                return;
+            case WebSocketRead::TooBig:
+                failWebSocket(socket, WS_CLOSE_TOO_BIG);
+                return;
+        }
+    }
+}
+
+void serviceWebSockets(uint8_t changed) {
+    broadcastWebSockets(changed);
+
+    const unsigned long now = millis();
+    for (WebSocketClient& socket : webSockets) {
+        if (!socket.active) {
+            continue;
+        }
+        if (!socket.client.connected()) {
+            closeWebSocket(socket);
+            continue;
+        }
+        readWebSocket(socket);
+        if (socket.active && socket.queue.length == 0 && now - socket.lastWriteMs >= WS_PING_MS) {
+            enqueueWebSocketFrame(socket, WS_OP_PING, nullptr, 0);
+            socket.lastWriteMs = now;
+        }
+        if (!socket.active) {
+            continue;
+        }
+        const size_t queued = socket.queue.length;
+        if (!drainSendQueue(socket.queue, socket.client.fd())) {
+            closeWebSocket(socket);
+        } else if (socket.queue.length != queued) {
+            socket.lastWriteMs = now;
+        }
+    }
+}
+
+// Sec-WebSocket-Accept is base64(SHA-1(key + GUID)).
+bool computeWebSocketAccept(const String& key, char* out, size_t capacity) {
+    const String source = key + WS_GUID;
+    unsigned char digest[20];
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+    mbedtls_sha1(reinterpret_cast<const unsigned char*>(source.c_str()), source.length(), digest);
+#else
+    mbedtls_sha1_ret(reinterpret_cast<const unsigned char*>(source.c_str()), source.length(), digest);
+#endif
+    size_t written = 0;
+    if (mbedtls_base64_encode(reinterpret_cast<unsigned char*>(out), capacity, &written, digest, sizeof(digest)) != 0) {
+        return false;
+    }
+    out[written] = '\0';
+    return true;
+}
+
+void handleWebSocketUpgrade() {
+    const String key = server.header("Sec-WebSocket-Key");
+    if (!headerContains("Upgrade", "websocket") || key.isEmpty()) {
+        server.sendHeader("Upgrade", "websocket");
+        sendError(426, "upgrade_required");
+        return;
+    }
+    WebSocketClient* socket = nullptr;
+    for (WebSocketClient& candidate : webSockets) {
+        if (!candidate.active) {
+            socket = &candidate;
+            break;
+        }
+    }
+    char accept[32];
+    if (!socket || !detachedSocketAvailable() || !computeWebSocketAccept(key, accept, sizeof(accept))) {
+        sendError(503, "too_many_sockets");
+        return;
+    }
+
+    clearSendQueue(socket->queue);
+    socket->reader.reset();
+    socket->lastWriteMs = millis();
+    socket->active = true;
+    takeOverClient(socket->client);
+
+    char handshake[160];
+    const int handshakeLength = snprintf(handshake, sizeof(handshake),
+                                         "HTTP/1.1 101 Switching Protocols\r\n"
+                                         "Upgrade: websocket\r\n"
+                                         "Connection: Upgrade\r\n"
+                                         "Sec-WebSocket-Accept: %s\r\n\r\n",
+                                         accept);
+    enqueueBytes(socket->queue, handshake, static_cast<size_t>(handshakeLength));
+    sendWebSocketStatus(*socket);
+    if (socket->active && !drainSendQueue(socket->queue, socket->client.fd())) {
+        closeWebSocket(*socket);
+    }
+}
+
+void handleGetStatus() {
+    if (parkStatusRequest()) {
+        return;
+    }
+    sendStatusHeaders();
+    if (sendNotModified()) {
+        return;
+    }
+    sendStatusBody();
+}
+
+void beginRequestBody(size_t limit) {
+    requestBody.status = BodyStatus::Streaming;
+    requestBody.received = 0;
+    requestBody.limit = limit;
+    const long declared = server.header("Content-Length").toInt();
+    if (declared > 0 && static_cast<size_t>(declared) > limit) {
+        requestBody.status = BodyStatus::TooLarge;
+    }
+}
+
+// Accounts for a received chunk. Returns false once the body is no longer
+// worth parsing; the rest of it is still drained by WebServer but dropped.
+bool acceptBodyChunk(size_t length) {
+    if (requestBody.status != BodyStatus::Streaming) {
+        return false;
+    }
+    requestBody.received += length;
+    if (requestBody.received > requestBody.limit) {
+        requestBody.status = BodyStatus::TooLarge;
+        return false;
+    }
+    return true;
+}
+
+void endRequestBody(bool parsed) {
+    if (requestBody.status != BodyStatus::Streaming) {
+        return;
+    }
+    if (requestBody.received == 0) {
+        requestBody.status = BodyStatus::Empty;
+    } else {
+        requestBody.status = parsed ? BodyStatus::Complete : BodyStatus::Malformed;
+    }
+}
+
+// Hands the body state to the route handler and clears it for the next request.
+BodyStatus takeRequestBody() {
+    const BodyStatus status = requestBody.status;
+    requestBody.status = BodyStatus::Empty;
+    return status;
+}
+
+bool rejectUnreadableBody(BodyStatus status) {
+    if (status == BodyStatus::Empty) {
+        sendError(400, "missing_body");
+        return true;
+    }
+    if (status == BodyStatus::TooLarge) {
+        sendError(413, "body_too_large");
+        return true;
+    }
+    return false;
+}
+
+JsonScanner bodyScanner(nullptr, nullptr);
+CborScanner cborScanner(nullptr, nullptr);
+
+WireFormat requestBodyFormat() {
+    return headerContains("Content-Type", CBOR_CONTENT_TYPE) ? WireFormat::Cbor : WireFormat::Json;
+}
+
+JsonError bodyError() {
+    return bodyFormat == WireFormat::Cbor ? cborScanner.error() : bodyScanner.error();
+}
+
+const char* bodyErrorKey() {
+    return bodyFormat == WireFormat::Cbor ? cborScanner.errorKey() : bodyScanner.errorKey();
+}
+
+// Both scanners emit the same JsonToken stream, so the token handlers below
+// do not care which wire format the body arrived in.
+void streamApiBody(JsonTokenHandler handler, void* context, size_t limit = MAX_JSON_BODY_BYTES) {
+    HTTPRaw& raw = server.raw();
+    switch (raw.status) {
+        case RAW_START:
+            bodyFormat = requestBodyFormat();
+            bodyScanner.reset(handler, context);
+            cborScanner.reset(handler, context);
+            beginRequestBody(limit);
+            break;
+        case RAW_WRITE: {
+            if (!acceptBodyChunk(raw.currentSize)) {
+                break;
+            }
+            const bool fed = bodyFormat == WireFormat::Cbor
+                                 ? cborScanner.feed(raw.buf, raw.currentSize)
+                                 : bodyScanner.feed(reinterpret_cast<const char*>(raw.buf), raw.currentSize);
+            if (!fed) {
+                requestBody.status = BodyStatus::Malformed;
+            }
+            break;
+        }
+        case RAW_END: {
+            const bool finished = bodyFormat == WireFormat::Cbor ? cborScanner.finish() : bodyScanner.finish();
+            endRequestBody(requestBody.received > 0 && finished);
+            break;
+        }
+        case RAW_ABORTED:
+            requestBody.status = BodyStatus::Malformed;
+            break;
+    }
+}
+
+void streamPawBody() {
+    HTTPRaw& raw = server.raw();
+    switch (raw.status) {
+        case RAW_START:
+            pawBody[0] = '\0';
+            bodyFormat = requestBodyFormat();
+            beginRequestBody(MAX_PAW_BODY_BYTES);
+            break;
+        case RAW_WRITE: {
+            const size_t offset = requestBody.received;
+            if (acceptBodyChunk(raw.currentSize)) {
+                memcpy(pawBody + offset, raw.buf, raw.currentSize);
+                pawBody[requestBody.received] = '\0';
+            }
+            break;
+        }
+        case RAW_END:
+            endRequestBody(true);
+            break;
+        case RAW_ABORTED:
+            requestBody.status = BodyStatus::Malformed;
+            break;
+    }
+}
+
+void discardRequestBody() {
+    HTTPRaw& raw = server.raw();
+    if (raw.status == RAW_START) {
+        beginRequestBody(0);
+    }
+}
+
+// Accepts the form body the web UI sends ("state=on&brightness=128") as well
+// as a bare state value. A form carrying neither field is rejected.
+bool readPawForm(char* body, const char** state, const char** brightness) {
+    if (!strchr(body, '=')) {
+        *state = body;
+        return true;
+    }
+    bool found = false;
+    char* field = body;
+    while (field) {
+        char* next = strchr(field, '&');
+        if (next) {
+            *next++ = '\0';
+        }
+        char* value = strchr(field, '=');
+        if (value) {
+            *value++ = '\0';
+            if (strcmp(field, "state") == 0) {
+                *state = value;
+                found = true;
+            } else if (strcmp(field, "brightness") == 0) {
+                *brightness = value;
+                found = true;
+            }
+        }
+        field = next;
+    }
+    return found;
+}
+
+bool parseBrightness(const char* text, long* out) {
+    char* end = nullptr;
+    const long value = strtol(text, &end, 10);
+    if (!isdigit(static_cast<unsigned char>(text[0])) || *end != '\0') {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+struct PawParse {
+    char state[MAX_PAW_BODY_BYTES + 1];
+    bool found;
+    bool hasBrightness;
+    long brightness;
+};
+
+// Takes the state from a bare CBOR text/bool or from the "state" member of a
+// CBOR map, mirroring the two body shapes accepted as text. A map may also
+// carry "brightness".
+bool capturePawToken(void* context, const JsonToken& token) {
+    PawParse* parse = static_cast<PawParse*>(context);
+    if (token.depth == 1 && strcmp(token.key, "brightness") == 0) {
+        if (token.type != JsonTokenType::Number || !token.integral) {
+            return false;
+        }
+        parse->brightness = token.number;
+        parse->hasBrightness = true;
+        return true;
+    }
+    const bool stateMember = token.depth == 1 && strcmp(token.key, "state") == 0;
+    if (token.depth > 0 && !stateMember) {
+        return true;
+    }
+    switch (token.type) {
+        case JsonTokenType::String:
+            memcpy(parse->state, token.text, token.length + 1);
+            parse->found = true;
+            return true;
+        case JsonTokenType::Bool:
+            strcpy(parse->state, token.boolean ? "on" : "off");
+            parse->found = true;
+            return true;
+        case JsonTokenType::ObjectStart:
+        case JsonTokenType::ObjectEnd:
+            return !stateMember;
+        default:
+            return false;
+    }
+}
+
+// Shared by HTTP and CoAP. A missing or empty state toggles the lamp, unless
+// the request only sets the brightness. Returns the error key, or nullptr once
+// the request is applied.
+const char* applyPawRequest(const char* rawState, const PawParse& paw) {
+    if (paw.hasBrightness && (paw.brightness < 0 || paw.brightness > BRIGHTNESS_MAX)) {
+        return "brightness";
+    }
+    // A bare request toggles; one with only a brightness leaves the lamp as
+    // it is, and so does a state the lamp is already in, so neither restarts
+    // the running effect.
+    const bool hasState = rawState && rawState[0] != '\0';
+    bool desiredState = !ledOn;
+    if (hasState && !parseDesiredState(rawState, ledOn, &desiredState)) {
+        return "unknown_state";
+    }
+    if (paw.hasBrightness) {
+        setBrightness(static_cast<uint16_t>(paw.brightness));
+    }
+    if ((hasState || !paw.hasBrightness) && desiredState != ledOn) {
+        setLamp(desiredState);
+    }
+    return nullptr;
+}
+
+void handleSetLamp() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (bodyStatus == BodyStatus::TooLarge) {
+        sendError(413, "body_too_large");
+        return;
+    }
+
+    String queryState = server.arg("state");
+    String queryBrightness = server.arg("brightness");
+    const char* rawState = nullptr;
+    const char* rawBrightness = nullptr;
+    PawParse paw = {{0}, false, false, 0};
+    if (!queryState.isEmpty() || !queryBrightness.isEmpty()) {
+        rawState = queryState.c_str();
+        rawBrightness = queryBrightness.isEmpty() ? nullptr : queryBrightness.c_str();
+    } else if (bodyStatus == BodyStatus::Complete && bodyFormat == WireFormat::Cbor) {
+        cborScanner.reset(capturePawToken, &paw);
+        if (!cborScanner.feed(reinterpret_cast<const uint8_t*>(pawBody), requestBody.received) ||
+            !cborScanner.finish()) {
+            sendError(400, "unknown_state");
+            return;
+        }
+        rawState = paw.state;
+    } else if (bodyStatus == BodyStatus::Complete && !readPawForm(pawBody, &rawState, &rawBrightness)) {
+        sendError(400, "unknown_state");
+        return;
+    }
+
+    if (rawBrightness) {
+        paw.hasBrightness = parseBrightness(rawBrightness, &paw.brightness);
+        if (!paw.hasBrightness) {
+            sendError(400, "brightness");
+            return;
+        }
+    }
+    const char* error = applyPawRequest(rawState, paw);
+    if (error) {
+        sendError(400, error);
+        return;
+    }
+    sendStatus();
+}
+
+void handleGetSettings() {
+    sendApiResponse(200, [](auto& out) { writeSettings(out, settings); });
+}
+
+void handleGetSettingsConditional() {
+    if (sendNotModified()) {
+        return;
+    }
+    handleGetSettings();
+}
+
+// Time from one network pass to the next, in loop() or in the network task,
+// i.e. how long a request or a due schedule can wait to be looked at.
+// Recorded and reported from the same task, so it needs no lock.
+LatencyHistogram passTiming;
+int64_t lastPassUs = 0;
+
+void recordNetworkPass() {
+    const int64_t nowUs = esp_timer_get_time();
+    if (lastPassUs != 0) {
+        recordLatency(passTiming, static_cast<uint32_t>(nowUs - lastPassUs));
+    }
+    lastPassUs = nowUs;
+}
+
+// GET /api/metrics/effects: how far effect edges landed from their deadline,
+// per backend, so the timer and loop() paths can be compared under load, plus
+// the fade frame jitter, the most cycles one frame took and the network pass
+// latency of the execution mode.
+// Shared by every latency histogram the API reports: `bucketsKey` holds the
+// per-bucket counts (bucket 0 is on time, bucket i covers [2^(i-1), 2^i) us).
+template <typename Writer>
+void writeLatencyFields(Writer& out, const LatencyHistogram& histogram, const char* bucketsKey = "late_us") {
+    out.key("p50_us");
+    out.uintValue(latencyPercentile(histogram, 500));
+    out.key("p99_us");
+    out.uintValue(latencyPercentile(histogram, 990));
+    out.key("max_us");
+    out.uintValue(histogram.maxUs);
+    out.key(bucketsKey);
+    out.beginArray();
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        out.uintValue(histogram.buckets[i]);
+    }
+    out.endArray();
+}
+
+void handleGetEffectMetrics() {
+    EdgeTiming timing[static_cast<size_t>(EffectBackend::Count)];
+    portENTER_CRITICAL(&effectMux);
+    memcpy(timing, edgeTiming, sizeof(timing));
+    const FrameTiming frames = fadeTiming;
+    const StripTiming strip = stripTiming;
+    const uint16_t stripPixels = stripActive.pixels;
+    portEXIT_CRITICAL(&effectMux);
+
+    sendApiResponse(200, [&timing, &frames, &strip, stripPixels](auto& out) {
+        out.beginObject();
+        out.key("backend");
+        out.stringValue(EFFECT_BACKEND_NAMES[static_cast<size_t>(activeEffectBackend())]);
+        for (size_t i = 0; i < static_cast<size_t>(EffectBackend::Count); i++) {
+            out.key(EFFECT_BACKEND_NAMES[i]);
+            out.beginObject();
+            out.key("edges");
+            out.uintValue(timing[i].edges);
+            out.key("worst_error_us");
+            out.uintValue(timing[i].worstErrorUs);
+            out.key("skipped");
+            out.uintValue(timing[i].skipped);
+            writeLatencyFields(out, timing[i].lateness);
+            out.endObject();
+        }
+        out.key("fade");
+        out.beginObject();
+        out.key("frames");
+        out.uintValue(frames.frames);
+        out.key("worst_error_us");
+        out.uintValue(frames.worstErrorUs);
+        out.key("worst_cycles");
+        out.uintValue(frames.worstCycles);
+        out.endObject();
+        out.key("strip");
+        out.beginObject();
+        out.key("pixels");
+        out.uintValue(stripPixels);
+        out.key("frames");
+        out.uintValue(strip.frames);
+        out.key("dropped");
+        out.uintValue(strip.dropped);
+        out.key("late");
+        out.uintValue(strip.late);
+        out.key("worst_render_us");
+        out.uintValue(strip.worstRenderUs);
+        out.endObject();
+        out.key("execution");
+        out.beginObject();
+        out.key("mode");
+        out.stringValue(networkTask ? "split" : "cooperative");
+        out.key("passes");
+        out.uintValue(passTiming.count);
+        writeLatencyFields(out, passTiming, "pass_us");
+        out.key("commands");
+        out.uintValue(commandsApplied.load(std::memory_order_relaxed));
+        out.key("commands_coalesced");
+        out.uintValue(commandsCoalesced.load(std::memory_order_relaxed));
+        out.endObject();
+        out.endObject();
+    });
+}
+
+void handleResetEffectMetrics() {
+    portENTER_CRITICAL(&effectMux);
+    memset(edgeTiming, 0, sizeof(edgeTiming));
+    memset(&fadeTiming, 0, sizeof(fadeTiming));
+    memset(&stripTiming, 0, sizeof(stripTiming));
+    portEXIT_CRITICAL(&effectMux);
+    resetLatencyHistogram(passTiming);
+    lastPassUs = 0;
+    commandsApplied.store(0, std::memory_order_relaxed);
+    commandsCoalesced.store(0, std::memory_order_relaxed);
+    handleGetEffectMetrics();
+}
+
+// Every network pass (and loop()'s effect step in the cooperative mode) is
+// split into phases timed with the CPU cycle counter: one counter read per
+// phase boundary and a PhaseProfile sample, so it stays on in production.
+// The HTTP phase remembers the URI WebServer was serving during its slowest
+// pass and the clients phase the kind of client that took longest in its
+// slowest pass; those are what to look at when the lamp stutters. In split
+// mode the effects phase comes from the effect task (effectTaskProfile).
+// The rest is recorded and reported from the network task, so it needs no
+// lock.
+enum class LoopPhase : uint8_t {
+    Dns,
+    Http,
+    // Background file sends, parked clients, event streams, WebSockets, CoAP
+    // and schedules.
+    Clients,
+    Effects,
+    Count
+};
+
+const char* LOOP_PHASE_NAMES[] = {"dns", "http", "clients", "effects"};
+const size_t SLOW_URI_MAX = 64;
+// Probe passes averaged by measureProfileOverhead().
+const uint8_t PROFILE_PROBE_PASSES = 32;
+
+PhaseProfile phaseProfiles[static_cast<size_t>(LoopPhase::Count)];
+char slowestUri[SLOW_URI_MAX];
+// Set by every route callback, so a slow HTTP phase that served no request
+// is not blamed on the URI of an earlier one.
+bool requestDispatched = false;
+// Client service that took longest in the slowest clients phase.
+const char* slowestClient = "";
+// What the profiling itself adds to one network pass, in cycles.
+uint32_t profileOverheadCycles = 0;
+unsigned long lastLoopReportMs = 0;
+
+// The costliest client service of the pass in progress. One counter read
+// per service; the name is a literal, so noting it copies nothing.
+const uint8_t CLIENT_SERVICES = 6;
+
+struct ClientCosts {
+    uint32_t mark;
+    uint32_t worstCycles;
+    const char* worst;
+};
+
+void chargeClientService(ClientCosts& costs, const char* service) {
+    const uint32_t now = ESP.getCycleCount();
+    if (now - costs.mark >= costs.worstCycles) {
+        costs.worstCycles = now - costs.mark;
+        costs.worst = service;
+    }
+    costs.mark = now;
+}
+
+uint32_t cyclesToUs(uint32_t cycles) {
+    return cyclesToUs(cycles, usPerCycle);
+}
+
+// Charges the cycles since `mark` to `profile` and moves `mark` to now.
+// Returns true when this was the profile's slowest run so far.
+bool endPhase(PhaseProfile& profile, uint32_t& mark) {
+    const uint32_t now = ESP.getCycleCount();
+    const uint32_t cycles = now - mark;
+    mark = now;
+    return recordPhaseCycles(profile, cycles, usPerCycle);
+}
+
+bool endLoopPhase(LoopPhase phase, uint32_t& mark) {
+    return endPhase(phaseProfiles[static_cast<size_t>(phase)], mark);
+}
+
+// Runs the counter reads and samples of a network pass (and of the effects
+// phase when loop() steps effects) against scratch profiles, so the cost is
+// measured on this chip at this clock rather than estimated.
+uint32_t measureProfileOverhead() {
+    static PhaseProfile scratch[static_cast<size_t>(LoopPhase::Count)];
+    for (PhaseProfile& profile : scratch) {
+        resetPhaseProfile(profile);
+    }
+    const uint32_t start = ESP.getCycleCount();
+    for (uint8_t pass = 0; pass < PROFILE_PROBE_PASSES; pass++) {
+        uint32_t mark = ESP.getCycleCount();
+        endPhase(scratch[static_cast<size_t>(LoopPhase::Dns)], mark);
+        endPhase(scratch[static_cast<size_t>(LoopPhase::Http)], mark);
+        ClientCosts costs = {mark, 0, ""};
+        for (uint8_t service = 0; service < CLIENT_SERVICES; service++) {
+            chargeClientService(costs, "probe");
+        }
+        endPhase(scratch[static_cast<size_t>(LoopPhase::Clients)], mark);
+        if (!effectTask) {
+            endPhase(scratch[static_cast<size_t>(LoopPhase::Effects)], mark);
+        }
+    }
+    return (ESP.getCycleCount() - start) / PROFILE_PROBE_PASSES;
+}
+
+void resetLoopProfile() {
+    for (PhaseProfile& profile : phaseProfiles) {
+        resetPhaseProfile(profile);
+    }
+    slowestUri[0] = '\0';
+    slowestClient = "";
+    effectProfileResetRequested.store(true);
+    if (usPerCycle == 0) {
+        // Only at boot: the effect task reads it without a lock.
+        usPerCycle = usPerCycleFor(ESP.getCpuFreqMHz());
+    }
+    profileOverheadCycles = measureProfileOverhead();
+}
+
+void noteSlowestRequest() {
+    snprintf(slowestUri, sizeof(slowestUri), "%s", requestDispatched ? server.uri().c_str() : "(idle)");
+}
+
+// The effects phase is the effect task's copy whenever the task runs.
+PhaseProfile loopPhaseProfile(LoopPhase phase) {
+    if (phase != LoopPhase::Effects || !effectTask) {
+        return phaseProfiles[static_cast<size_t>(phase)];
+    }
+    PhaseProfile profile;
+    if (effectProfileResetRequested.load()) {
+        resetPhaseProfile(profile);
+        return profile;
+    }
+    return effectProfileSnapshot.read();
+}
+
+// Profiling cost per mille of the mean network pass (plus loop()'s effects
+// phase when it has one), counting only the time spent working in it.
+uint32_t profileOverheadPermille() {
+    uint32_t passCycles = 0;
+    for (uint8_t i = 0; i < static_cast<uint8_t>(LoopPhase::Count); i++) {
+        if (static_cast<LoopPhase>(i) != LoopPhase::Effects || !effectTask) {
+            passCycles += phaseMeanCycles(phaseProfiles[i]);
+        }
+    }
+    if (passCycles == 0) {
+        return 0;
+    }
+    return static_cast<uint32_t>(static_cast<uint64_t>(profileOverheadCycles) * 1000 / passCycles);
+}
+
+template <typename Writer>
+void writeLoopProfile(Writer& out) {
+    out.beginObject();
+    out.key("cpu_mhz");
+    out.uintValue(ESP.getCpuFreqMHz());
+    for (uint8_t i = 0; i < static_cast<uint8_t>(LoopPhase::Count); i++) {
+        const PhaseProfile profile = loopPhaseProfile(static_cast<LoopPhase>(i));
+        const uint32_t count = profile.took.count;
+        out.key(LOOP_PHASE_NAMES[i]);
+        out.beginObject();
+        out.key("count");
+        out.uintValue(count);
+        out.key("min_us");
+        out.uintValue(count == 0 ? 0 : cyclesToUs(profile.minCycles));
+        out.key("mean_us");
+        out.uintValue(cyclesToUs(phaseMeanCycles(profile)));
+        out.key("max_cycles");
+        out.uintValue(profile.maxCycles);
+        writeLatencyFields(out, profile.took, "took_us");
+        out.endObject();
+    }
+    out.key("slowest_uri");
+    out.stringValue(slowestUri);
+    out.key("slowest_client");
+    out.stringValue(slowestClient);
+    out.key("overhead_cycles");
+    out.uintValue(profileOverheadCycles);
+    out.key("overhead_permille");
+    out.uintValue(profileOverheadPermille());
+    out.endObject();
+}
+
+// GET /api/metrics/loop; DELETE starts over.
+void handleGetLoopProfile() {
+    sendApiResponse(200, [](auto& out) { writeLoopProfile(out); });
+}
+
+void handleResetLoopProfile() {
+    resetLoopProfile();
+    handleGetLoopProfile();
+}
+
+// One line per phase every settings.loopReportS seconds. Returns true when
+// it printed, so the caller can leave the time out of the phases.
+bool reportLoopProfile() {
+    if (settings.loopReportS == 0 || !isTimeReached(millis(), lastLoopReportMs + settings.loopReportS * 1000UL)) {
+        return false;
+    }
+    lastLoopReportMs = millis();
+    for (uint8_t i = 0; i < static_cast<uint8_t>(LoopPhase::Count); i++) {
+        const PhaseProfile profile = loopPhaseProfile(static_cast<LoopPhase>(i));
+        if (profile.took.count == 0) {
+            continue;
+        }
+        Serial.printf("Meow: loop %-7s n=%lu min=%luus mean=%luus p99=%luus max=%luus\n", LOOP_PHASE_NAMES[i],
+                      static_cast<unsigned long>(profile.took.count),
+                      static_cast<unsigned long>(cyclesToUs(profile.minCycles)),
+                      static_cast<unsigned long>(cyclesToUs(phaseMeanCycles(profile))),
+                      static_cast<unsigned long>(latencyPercentile(profile.took, 990)),
+                      static_cast<unsigned long>(profile.took.maxUs));
+    }
+    if (slowestUri[0] != '\0') {
+        Serial.printf("Meow: slowest request %s\n", slowestUri);
+    }
+    if (slowestClient[0] != '\0') {
+        Serial.printf("Meow: slowest clients pass spent most in %s\n", slowestClient);
+    }
+    Serial.printf("Meow: profiling costs %lu cycles a pass (%lu per mille)\n",
+                  static_cast<unsigned long>(profileOverheadCycles),
+                  static_cast<unsigned long>(profileOverheadPermille()));
+    return true;
+}
+
+// GET /api/effects/preview?mode=bzzz&ms=60000&seed=7 renders the effect on
+// a virtual clock and returns its timeline as [ms, level] pairs, the same
+// way a host build of LampSimulator does. The lamp itself is untouched.
+const uint32_t PREVIEW_MS_MAX = 3600000;
+const uint32_t PREVIEW_MS_DEFAULT = 60000;
+const uint16_t PREVIEW_EDGES_MAX = 512;
+
+template <typename Writer>
+struct PreviewOutput {
+    Writer* out;
+    uint16_t edgesLeft;
+};
+
+template <typename Writer>
+bool writePreviewEdge(void* context, const EffectEdge& edge) {
+    PreviewOutput<Writer>* preview = static_cast<PreviewOutput<Writer>*>(context);
+    if (preview->edgesLeft == 0) {
+        return false;
+    }
+    preview->edgesLeft--;
+    preview->out->beginArray();
+    preview->out->uintValue(edge.atMs);
+    preview->out->uintValue(edge.level);
+    preview->out->endArray();
+    return true;
+}
+
+void handleEffectPreview() {
+    String modeName = server.arg("mode");
+    modeName.toLowerCase();
+    LampMode mode = currentMode;
+    if (!modeName.isEmpty() && !parseLampMode(modeName.c_str(), mode)) {
+        sendError(400, "mode");
+        return;
+    }
+    const String msArg = server.arg("ms");
+    const long durationMs = msArg.isEmpty() ? PREVIEW_MS_DEFAULT : msArg.toInt();
+    if (durationMs <= 0 || static_cast<unsigned long>(durationMs) > PREVIEW_MS_MAX) {
+        sendError(400, "ms");
+        return;
+    }
+    const uint32_t seed = static_cast<uint32_t>(server.arg("seed").toInt());
+
+    sendApiResponse(200, [mode, durationMs, seed](auto& out) {
+        typedef typename std::remove_reference<decltype(out)>::type Writer;
+        out.beginObject();
+        out.key("mode");
+        out.stringValue(lampModeName(mode));
+        out.key("seed");
+        out.uintValue(seed);
+        out.key("edges");
+        out.beginArray();
+        PreviewOutput<Writer> preview = {&out, PREVIEW_EDGES_MAX};
+        simulateLampEffect(mode, static_cast<uint32_t>(durationMs), seed, writePreviewEdge<Writer>, &preview);
+        out.endArray();
+        out.key("truncated");
+        out.boolValue(preview.edgesLeft == 0);
+        out.endObject();
+    });
+}
+
+struct ModeParse {
+    char mode[MODE_NAME_MAX + 1];
+    bool found;
+};
+
+bool captureModeToken(void* context, const JsonToken& token) {
+    ModeParse* parse = static_cast<ModeParse*>(context);
+    if (token.depth != 1 || strcmp(token.key, "mode") != 0) {
+        return true;
+    }
+    if (token.type != JsonTokenType::String || token.length > MODE_NAME_MAX) {
+        return false;
+    }
+    for (size_t i = 0; i <= token.length; i++) {
+        parse->mode[i] = static_cast<char>(tolower(static_cast<unsigned char>(token.text[i])));
+    }
+    parse->found = true;
+    return true;
+}
+
+const uint8_t MAX_BATCH_OPS = 16;
+
+// Operations of a batch are applied to this staged copy while the body
+// streams in; the live state only changes once the whole batch validated.
+struct BatchParse {
+    bool ledOn;
+    LampMode mode;
+    SettingsParse settings;
+    bool settingsTouched;
+    bool inSettings;
+    uint8_t opCount;
+    const char* errorKey;
+};
+
+bool isBatchOp(const char* key, const char* op) {
+    return strcmp(key, op) == 0;
+}
+
+bool applyBatchToken(void* context, const JsonToken& token) {
+    BatchParse* batch = static_cast<BatchParse*>(context);
+
+    if (token.depth == 0) {
+        return token.type == JsonTokenType::ArrayStart || token.type == JsonTokenType::ArrayEnd;
+    }
+    if (token.depth == 1) {
+        if (token.type == JsonTokenType::ObjectEnd) {
+            return true;
+        }
+        if (token.type != JsonTokenType::ObjectStart || batch->opCount >= MAX_BATCH_OPS) {
+            batch->errorKey = batch->opCount >= MAX_BATCH_OPS ? "too_many_ops" : "invalid_batch";
+            return false;
+        }
+        batch->opCount++;
+        return true;
+    }
+
+    // Members of the settings object are handed to the settings schema as if
+    // they were the top level of a POST /api/settings body.
+    if (batch->inSettings || (token.depth == 2 && isBatchOp(token.key, "settings"))) {
+        if (token.depth == 2 && token.type == JsonTokenType::ObjectStart) {
+            batch->inSettings = true;
+            batch->settingsTouched = true;
+        } else if (token.depth == 2 && token.type == JsonTokenType::ObjectEnd) {
+            batch->inSettings = false;
+        } else if (token.depth == 2) {
+            batch->errorKey = "settings";
+            return false;
+        }
+        JsonToken nested = token;
+        nested.depth = static_cast<uint8_t>(token.depth - 2);
+        if (!applySettingsToken(&batch->settings, nested)) {
+            batch->errorKey = batch->settings.errorKey ? batch->settings.errorKey : "settings";
+            return false;
+        }
+        return true;
+    }
+
+    if (token.depth != 2 || token.type == JsonTokenType::ObjectEnd || token.type == JsonTokenType::ArrayEnd) {
+        return true;
+    }
+
+    if (isBatchOp(token.key, "paw")) {
+        if (token.type == JsonTokenType::Bool) {
+            batch->ledOn = token.boolean;
+            return true;
+        }
+        if (token.type == JsonTokenType::String && parseDesiredState(token.text, batch->ledOn, &batch->ledOn)) {
+            return true;
+        }
+        batch->errorKey = "unknown_state";
+        return false;
+    }
+
+    if (isBatchOp(token.key, "mode")) {
+        ModeParse mode = {{0}, false};
+        JsonToken member = token;
+        member.depth = 1;
+        if (!captureModeToken(&mode, member) || !parseLampMode(mode.mode, batch->mode)) {
+            batch->errorKey = "mode";
+            return false;
+        }
+        return true;
+    }
+
+    batch->errorKey = "unknown_op";
+    return false;
+}
+
+SettingsParse settingsParse;
+ModeParse modeParse;
+BatchParse batchParse;
+
+void handleSaveSettings() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
+    }
+    if (bodyStatus != BodyStatus::Complete) {
+        if (settingsParse.errorKey) {
+            sendError(400, settingsParse.errorKey);
+        } else if (bodyError() == JsonError::ValueTooLong && findSettingField(bodyErrorKey())) {
+            sendError(400, findSettingField(bodyErrorKey())->jsonKey);
+        } else {
+            sendError(400, "invalid_json");
+        }
+        return;
+    }
+    if (const char* conflict = settingsPinConflict(settingsParse.pending)) {
+        sendError(400, conflict);
+        return;
+    }
+
+    commitSettings(settingsParse.pending);
+    handleGetSettings();
+}
+
+void handleSetMode() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
+    }
+    LampMode mode;
+    if (bodyStatus != BodyStatus::Complete || !modeParse.found || !parseLampMode(modeParse.mode, mode)) {
+        sendError(400, "mode");
+        return;
+    }
+
+    applyMode(mode);
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        out.key("mode");
+        out.stringValue(lampModeName(currentMode));
+        out.endObject();
+    });
+}
+
+void handleBatch() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
+    }
+    if (bodyStatus != BodyStatus::Complete) {
+        sendApiResponse(400, [](auto& out) {
+            out.beginObject();
+            out.key("error");
+            out.stringValue(batchParse.errorKey ? batchParse.errorKey : "invalid_json");
+            if (batchParse.opCount > 0) {
+                out.key("op");
+                out.uintValue(batchParse.opCount - 1);
+            }
+            out.endObject();
+        });
+        return;
+    }
+    const char* conflict = batchParse.settingsTouched ? settingsPinConflict(batchParse.settings.pending) : nullptr;
+    if (conflict) {
+        sendError(400, conflict);
+        return;
+    }
+
+    // Everything validated: commit settings, lamp state and mode together
+    // under one revision, touching NVS only for keys that changed. The
+    // effect restart in applyLampState() is the only one and picks up the
+    // new settings.
+    uint8_t changed = STATUS_CHANGED;
+    if (batchParse.settingsTouched) {
+        changed |= applySettings(batchParse.settings.pending, false);
+    }
+    applyLampState(batchParse.ledOn, batchParse.mode);
+    bumpStateRevision(changed);
+
+    sendStatusHeaders();
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        writeStatusFields(out);
+        out.key("applied");
+        out.uintValue(batchParse.opCount);
+        out.key("settings");
+        writeSettings(out, settings);
+        out.endObject();
+    });
+}
+
+void streamBatchBody() {
+    if (server.raw().status == RAW_START) {
+        batchParse.ledOn = ledOn;
+        batchParse.mode = currentMode;
+        batchParse.settings.pending = settings;
+        batchParse.settings.errorKey = nullptr;
+        batchParse.settingsTouched = false;
+        batchParse.inSettings = false;
+        batchParse.opCount = 0;
+        batchParse.errorKey = nullptr;
+    }
+    streamApiBody(applyBatchToken, &batchParse, MAX_BATCH_BODY_BYTES);
+}
+
+void streamSettingsBody() {
+    if (server.raw().status == RAW_START) {
+        settingsParse.pending = settings;
+        settingsParse.errorKey = nullptr;
+    }
+    streamApiBody(applySettingsToken, &settingsParse);
+}
+
+void streamModeBody() {
+    if (server.raw().status == RAW_START) {
+        modeParse.mode[0] = '\0';
+        modeParse.found = false;
+    }
+    streamApiBody(captureModeToken, &modeParse);
+}
+
+// Changes to channels past 0 reach the effect side as commands, like the
+// lamp's own.
+void setChannelMode(uint8_t channel, LampMode mode) {
+    channels[channel].mode = mode;
+    restartChannel(channel);
+    storeChannel(channel);
+}
+
+void releaseChannelPin(uint8_t channel) {
+    const int pin = channels[channel].pin;
+    channels[channel].pin = CHANNEL_PIN_NONE;
+    setChannelOutputPin(channel, CHANNEL_PIN_NONE);
+    detachLampPwm(pin);
+    pinMode(pin, INPUT);
+}
+
+// Hands every channel's pin to the effect side and starts the extra
+// channels; channel 0 is started by setLamp().
+void startChannels() {
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        const int pin = channels[channel].pin;
+        if (channel > 0 && pin != CHANNEL_PIN_NONE) {
+            attachLampPwm(pin, channel);
+        }
+        setChannelOutputPin(channel, pin);
+        if (channel > 0 && pin != CHANNEL_PIN_NONE) {
+            restartChannel(channel);
+        }
+    }
+}
+
+template <typename Writer>
+void writeChannels(Writer& out) {
+    out.beginObject();
+    out.key("max");
+    out.uintValue(LAMP_CHANNELS_MAX);
+    out.key("channels");
+    out.beginArray();
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        const LampChannel& lamp = channels[channel];
+        if (lamp.pin == CHANNEL_PIN_NONE) {
+            continue;
+        }
+        out.beginObject();
+        out.key("channel");
+        out.uintValue(channel);
+        out.key("pin");
+        out.intValue(lamp.pin);
+        out.key("led_on");
+        out.boolValue(lamp.on);
+        out.key("mode");
+        out.stringValue(lampModeName(lamp.mode));
+        out.endObject();
+    }
+    out.endArray();
+    out.endObject();
+}
+
+void handleGetChannels() {
+    sendApiResponse(200, [](auto& out) { writeChannels(out); });
+}
+
+// POST /api/channels takes one channel object or an array of them, e.g.
+// {"channel": 2, "pin": 5, "paw": "on", "mode": "purr"}. As with a batch,
+// changes are staged per channel and only applied once the whole body
+// validated. "pin": -1 removes a channel; channel 0 is the settings lamp and
+// cannot be removed.
+const uint8_t MAX_CHANNEL_OBJECTS = 16;
+
+struct ChannelChange {
+    int pin;
+    LampMode mode;
+    bool on;
+};
+
+struct ChannelParse {
+    ChannelChange staged[LAMP_CHANNELS_MAX];
+    bool touched[LAMP_CHANNELS_MAX];
+    // Depth of the members of a channel object: 1 for a single object, 2
+    // inside an array.
+    uint8_t memberDepth;
+    uint8_t objectCount;
+    // Members of the object being read, applied at its end once "channel"
+    // is known.
+    long channel;
+    bool hasPin;
+    long pin;
+    bool hasMode;
+    LampMode mode;
+    char paw[8];
+    const char* errorKey;
+};
+
+bool beginChannelObject(ChannelParse* parse) {
+    if (parse->objectCount >= MAX_CHANNEL_OBJECTS) {
+        parse->errorKey = "too_many_channels";
+        return false;
+    }
+    parse->objectCount++;
+    parse->channel = -1;
+    parse->hasPin = false;
+    parse->hasMode = false;
+    parse->paw[0] = '\0';
+    return true;
+}
+
+bool finishChannelObject(ChannelParse* parse) {
+    if (parse->channel < 0 || parse->channel >= LAMP_CHANNELS_MAX) {
+        parse->errorKey = "channel";
+        return false;
+    }
+    ChannelChange& change = parse->staged[parse->channel];
+    if (parse->hasPin) {
+        const bool removes = parse->pin == CHANNEL_PIN_NONE && parse->channel != 0;
+        if (!removes && (parse->pin < LED_PIN_MIN || parse->pin > LED_PIN_MAX)) {
+            parse->errorKey = "pin";
+            return false;
+        }
+        change.pin = static_cast<int>(parse->pin);
+    } else if (change.pin == CHANNEL_PIN_NONE) {
+        parse->errorKey = "unknown_channel";
+        return false;
+    }
+    if (parse->hasMode) {
+        change.mode = parse->mode;
+    }
+    if (parse->paw[0] != '\0' && !parseDesiredState(parse->paw, change.on, &change.on)) {
+        parse->errorKey = "unknown_state";
+        return false;
+    }
+    if (change.pin == CHANNEL_PIN_NONE) {
+        change.on = false;
+        change.mode = DEFAULT_MODE;
+    }
+    parse->touched[parse->channel] = true;
+    return true;
+}
+
+bool applyChannelToken(void* context, const JsonToken& token) {
+    ChannelParse* parse = static_cast<ChannelParse*>(context);
+
+    if (token.depth == 0) {
+        switch (token.type) {
+            case JsonTokenType::ArrayStart:
+                parse->memberDepth = 2;
+                return true;
+            case JsonTokenType::ArrayEnd:
+                return true;
+            case JsonTokenType::ObjectStart:
+                parse->memberDepth = 1;
+                return beginChannelObject(parse);
+            case JsonTokenType::ObjectEnd:
+                return finishChannelObject(parse);
+            default:
+                parse->errorKey = "invalid_channels";
+                return false;
+        }
+    }
+    if (token.depth < parse->memberDepth) {
+        if (token.type == JsonTokenType::ObjectStart) {
+            return beginChannelObject(parse);
+        }
+        if (token.type == JsonTokenType::ObjectEnd) {
+            return finishChannelObject(parse);
+        }
+        parse->errorKey = "invalid_channels";
+        return false;
+    }
+    if (token.depth != parse->memberDepth || token.type == JsonTokenType::ObjectEnd ||
+        token.type == JsonTokenType::ArrayEnd) {
+        return true;
+    }
+
+    if (strcmp(token.key, "channel") == 0 || strcmp(token.key, "pin") == 0) {
+        const bool isChannel = token.key[0] == 'c';
+        if (token.type != JsonTokenType::Number || !token.integral) {
+            parse->errorKey = isChannel ? "channel" : "pin";
+            return false;
+        }
+        if (isChannel) {
+            parse->channel = token.number;
+        } else {
+            parse->hasPin = true;
+            parse->pin = token.number;
+        }
+        return true;
+    }
+    if (strcmp(token.key, "paw") == 0) {
+        if (token.type == JsonTokenType::Bool) {
+            strcpy(parse->paw, token.boolean ? "on" : "off");
+            return true;
+        }
+        if (token.type == JsonTokenType::String && token.length < sizeof(parse->paw)) {
+            memcpy(parse->paw, token.text, token.length + 1);
+            return true;
+        }
+        parse->errorKey = "unknown_state";
+        return false;
+    }
+    if (strcmp(token.key, "mode") == 0) {
+        ModeParse mode = {{0}, false};
+        JsonToken member = token;
+        member.depth = 1;
+        if (!captureModeToken(&mode, member) || !parseLampMode(mode.mode, parse->mode)) {
+            parse->errorKey = "mode";
+            return false;
+        }
+        parse->hasMode = true;
+        return true;
+    }
+
+    parse->errorKey = "unknown_field";
+    return false;
+}
+
+ChannelParse channelParse;
+
+bool stagedPinsConflict() {
+    for (uint8_t a = 0; a < LAMP_CHANNELS_MAX; a++) {
+        for (uint8_t b = a + 1; b < LAMP_CHANNELS_MAX; b++) {
+            const int pin = channelParse.staged[a].pin;
+            if (pin != CHANNEL_PIN_NONE && pin == channelParse.staged[b].pin) {
+                return true;
+            }
+        }
+        if (channelParse.staged[a].pin != CHANNEL_PIN_NONE && channelParse.staged[a].pin == settings.stripPin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void handleSetChannels() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
+    }
+    if (bodyStatus != BodyStatus::Complete) {
+        sendError(400, channelParse.errorKey ? channelParse.errorKey : "invalid_json");
+        return;
+    }
+    if (stagedPinsConflict()) {
+        sendError(400, "pin_in_use");
+        return;
+    }
+
+    // Free moved pins first, so channels can swap pins in one request.
+    for (uint8_t channel = 1; channel < LAMP_CHANNELS_MAX; channel++) {
+        const int pin = channels[channel].pin;
+        if (channelParse.touched[channel] && pin != CHANNEL_PIN_NONE && pin != channelParse.staged[channel].pin) {
+            releaseChannelPin(channel);
+        }
+    }
+
+    if (channelParse.touched[0]) {
+        const ChannelChange& change = channelParse.staged[0];
+        if (change.pin != ledPin) {
+            DeviceSettings next = settings;
+            next.ledPin = change.pin;
+            commitSettings(next);
+        }
+        applyLampState(change.on, change.mode);
+        bumpStateRevision(STATUS_CHANGED);
+    }
+
+    for (uint8_t channel = 1; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (!channelParse.touched[channel]) {
+            continue;
+        }
+        const ChannelChange& change = channelParse.staged[channel];
+        if (change.pin != CHANNEL_PIN_NONE && change.pin != channels[channel].pin) {
+            attachLampPwm(change.pin, channel);
+        }
+        channels[channel].pin = change.pin;
+        channels[channel].mode = change.mode;
+        channels[channel].on = change.on;
+        setChannelOutputPin(channel, change.pin);
+        restartChannel(channel);
+        storeChannel(channel);
+    }
+
+    handleGetChannels();
+}
+
+void streamChannelsBody() {
+    if (server.raw().status == RAW_START) {
+        for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+            channelParse.staged[channel] = {channels[channel].pin, channels[channel].mode, channels[channel].on};
+            channelParse.touched[channel] = false;
+        }
+        channelParse.memberDepth = 1;
+        channelParse.objectCount = 0;
+        channelParse.errorKey = nullptr;
+    }
+    streamApiBody(applyChannelToken, &channelParse);
+}
+
+PatternCompile patternCompile;
+
+template <typename Writer>
+void writePatternSummary(Writer& out, const LampPattern& pattern) {
+    out.beginObject();
+    out.key("name");
+    out.stringValue(pattern.name);
+    out.key("steps");
+    out.uintValue(pattern.length);
+    out.key("bytes");
+    out.uintValue(pattern.length * sizeof(PatternInstruction));
+    out.endObject();
+}
+
+void handleGetPatterns() {
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        out.key("slots");
+        out.uintValue(LAMP_PATTERN_SLOTS);
+        out.key("patterns");
+        out.beginArray();
+        for (uint8_t slot = 0; slot < LAMP_PATTERN_SLOTS; slot++) {
+            if (lampPatterns[slot].length > 0) {
+                writePatternSummary(out, lampPatterns[slot]);
+            }
+        }
+        out.endArray();
+        out.endObject();
+    });
+}
+
+void handleSavePattern() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
+    }
+    if (bodyStatus != BodyStatus::Complete || !finishPatternCompile(patternCompile)) {
+        sendError(400, patternCompile.errorKey ? patternCompile.errorKey : "invalid_json");
+        return;
+    }
+
+    // The timer callbacks may be running the slot being replaced, and the
+    // restart below is only queued in split mode, so their state is reset in
+    // the same critical section as the new code goes in.
+    portENTER_CRITICAL(&effectMux);
+    const int slot = installLampPattern(patternCompile.pattern);
+    if (slot >= 0) {
+        resetPatternEffects(lampPatternMode(static_cast<uint8_t>(slot)));
+    }
+    portEXIT_CRITICAL(&effectMux);
+    if (slot < 0) {
+        sendError(507, "no_free_slot");
+        return;
+    }
+    char key[8];
+    patternPrefsKey(static_cast<uint8_t>(slot), key, sizeof(key));
+    prefs.putBytes(key, &lampPatterns[slot], sizeof(lampPatterns[slot]));
+    for (uint8_t channel = 0; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (channels[channel].mode == lampPatternMode(static_cast<uint8_t>(slot))) {
+            restartChannel(channel);
+        }
+    }
+    sendApiResponse(200, [slot](auto& out) { writePatternSummary(out, lampPatterns[slot]); });
+}
+
+void handleDeletePattern() {
+    const int slot = findLampPattern(server.arg("name").c_str());
+    if (slot < 0) {
+        sendError(404, "unknown_pattern");
+        return;
+    }
+    const LampMode patternMode = lampPatternMode(static_cast<uint8_t>(slot));
+    if (currentMode == patternMode) {
+        applyMode(DEFAULT_MODE);
+    }
+    for (uint8_t channel = 1; channel < LAMP_CHANNELS_MAX; channel++) {
+        if (channels[channel].pin != CHANNEL_PIN_NONE && channels[channel].mode == patternMode) {
+            setChannelMode(channel, DEFAULT_MODE);
+        }
+    }
+    portENTER_CRITICAL(&effectMux);
+    removeLampPattern(static_cast<uint8_t>(slot));
+    portEXIT_CRITICAL(&effectMux);
+    char key[8];
+    patternPrefsKey(static_cast<uint8_t>(slot), key, sizeof(key));
+    prefs.remove(key);
+    handleGetPatterns();
+}
+
+void streamPatternBody() {
+    if (server.raw().status == RAW_START) {
+        beginPatternCompile(patternCompile);
+    }
+    streamApiBody(applyPatternToken, &patternCompile, MAX_PATTERN_BODY_BYTES);
+}
+
+template <typename Writer>
+void writeClockFields(Writer& out) {
+    out.key("time");
+    if (wallClockSet()) {
+        out.uintValue(static_cast<unsigned long>(time(nullptr)));
+    } else {
+        out.nullValue();
+    }
+    out.key("clock");
+    out.stringValue(CLOCK_SOURCE_NAMES[static_cast<size_t>(clockSource)]);
+    out.key("timezone");
+    out.stringValue(settings.timezone);
+}
+
+template <typename Writer>
+void writeSchedule(Writer& out, uint8_t slot) {
+    const ScheduleEntry& entry = schedules[slot];
+    out.beginObject();
+    out.key("id");
+    out.uintValue(entry.id);
+    if (entry.action != ScheduleAction::Keep) {
+        out.key("paw");
+        out.stringValue(SCHEDULE_ACTION_NAMES[static_cast<size_t>(entry.action)]);
+    }
+    if (entry.mode[0] != '\0') {
+        out.key("mode");
+        out.stringValue(entry.mode);
+    }
+    if (entry.kind == ScheduleKind::Daily) {
+        char at[6];
+        snprintf(at, sizeof(at), "%02u:%02u", entry.minuteOfDay / 60U, entry.minuteOfDay % 60U);
+        out.key("at");
+        out.stringValue(at);
+        out.key("days");
+        out.beginArray();
+        for (uint8_t day = 0; day < 7; day++) {
+            if (entry.days & (1U << day)) {
+                out.stringValue(SCHEDULE_DAY_NAMES[day]);
+            }
+        }
+        out.endArray();
+    } else if (entry.kind == ScheduleKind::Once) {
+        out.key("epoch");
+        out.uintValue(entry.at);
+    }
+    // null while the entry waits for the clock to be set.
+    out.key("due_in_s");
+    if (isScheduleQueued(scheduleQueue, slot)) {
+        const uint64_t due = scheduleQueue.dueMs[slot];
+        const uint64_t now = monotonicMs();
+        out.uintValue(static_cast<unsigned long>(due > now ? (due - now) / 1000 : 0));
+    } else {
+        out.nullValue();
+    }
+    out.endObject();
+}
+
+void handleGetSchedules() {
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        writeClockFields(out);
+        out.key("max");
+        out.uintValue(SCHEDULE_SLOTS);
+        out.key("schedules");
+        out.beginArray();
+        for (uint8_t slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+            if (schedules[slot].kind != ScheduleKind::None) {
+                writeSchedule(out, slot);
+            }
+        }
+        out.endArray();
+        out.endObject();
+    });
+}
+
+// POST /api/schedules takes one entry: an action (`paw` and/or `mode`) and
+// exactly one of `at` ("HH:MM" local, with optional `days`), `epoch` (Unix
+// seconds) or `in_s` (seconds from now).
+struct ScheduleParse {
+    ScheduleEntry entry;
+    uint8_t timings;
+    bool hasDays;
+    bool inDays;
+    long inSeconds;
+    long epoch;
+    const char* errorKey;
+};
+
+bool parseScheduleTime(const char* text, uint16_t* minuteOfDay) {
+    unsigned hours;
+    unsigned minutes;
+    char extra;
+    if (sscanf(text, "%u:%u%c", &hours, &minutes, &extra) != 2 || hours > 23 || minutes > 59) {
+        return false;
     }
-    return skipJsonWhitespace(input, colonPos + 1);
+    *minuteOfDay = static_cast<uint16_t>(hours * 60 + minutes);
+    return true;
 }
 
-bool parseJsonStringAt(const String& input, int index, String* out) {
-    if (!out) {
+bool captureScheduleToken(void* context, const JsonToken& token) {
+    ScheduleParse* parse = static_cast<ScheduleParse*>(context);
+    ScheduleEntry& entry = parse->entry;
+
+    if (parse->inDays) {
+        if (token.type == JsonTokenType::ArrayEnd) {
+            parse->inDays = false;
+            return true;
+        }
+        for (uint8_t day = 0; day < 7; day++) {
+            if (token.type == JsonTokenType::String && strcasecmp(token.text, SCHEDULE_DAY_NAMES[day]) == 0) {
+                entry.days |= static_cast<uint8_t>(1U << day);
+                return true;
+            }
+        }
+        parse->errorKey = "days";
         return false;
     }
-    if (index >= static_cast<int>(input.length()) || input[index] != '"') {
-        return false;
+    if (token.depth != 1 || token.type == JsonTokenType::ObjectEnd) {
+        return token.depth <= 1;
     }
-    String result;
-    bool escape = false;
-    for (int i = index + 1; i < static_cast<int>(input.length()); i++) {
-        char c = input[i];
-        if (escape) {
-            switch (c) {
-                case '"':
-                    result += '"';
-                    break;
-                case '\\':
-                    result += '\\';
-                    break;
-                case 'n':
-                    result += '\n';
-                    break;
-                case 'r':
-                    result += '\r';
-                    break;
-                case 't':
-                    result += '\t';
-                    break;
-                default:
-                    result += c;
-                    break;
+
+    if (strcmp(token.key, "paw") == 0) {
+        for (uint8_t action = 1; action < 4; action++) {
+            if (token.type == JsonTokenType::String && strcasecmp(token.text, SCHEDULE_ACTION_NAMES[action]) == 0) {
+                entry.action = static_cast<ScheduleAction>(action);
+                return true;
             }
-            escape = false;
-            continue;
-        }
-        if (c == '\\') {
-            escape = true;
-            continue;
         }
-        if (c == '"') {
-            *out = result;
+        if (token.type == JsonTokenType::Bool) {
+            entry.action = token.boolean ? ScheduleAction::On : ScheduleAction::Off;
             return true;
         }
-        result += c;
-    }
-    return false;
-}
-
-bool parseJsonBoolAt(const String& input, int index, bool* out) {
-    if (!out) {
+        parse->errorKey = "unknown_state";
         return false;
     }
-    if (input.startsWith("true", index)) {
-        *out = true;
+    if (strcmp(token.key, "mode") == 0) {
+        ModeParse mode = {{0}, false};
+        LampMode parsed;
+        if (!captureModeToken(&mode, token) || !parseLampMode(mode.mode, parsed)) {
+            parse->errorKey = "mode";
+            return false;
+        }
+        strncpy(entry.mode, mode.mode, SCHEDULE_MODE_MAX);
         return true;
     }
-    if (input.startsWith("false", index)) {
-        *out = false;
+    if (strcmp(token.key, "at") == 0) {
+        parse->timings++;
+        entry.kind = ScheduleKind::Daily;
+        if (token.type != JsonTokenType::String || !parseScheduleTime(token.text, &entry.minuteOfDay)) {
+            parse->errorKey = "at";
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(token.key, "days") == 0) {
+        if (token.type != JsonTokenType::ArrayStart) {
+            parse->errorKey = "days";
+            return false;
+        }
+        parse->hasDays = true;
+        parse->inDays = true;
+        return true;
+    }
+    if (strcmp(token.key, "epoch") == 0 || strcmp(token.key, "in_s") == 0) {
+        const bool isEpoch = token.key[0] == 'e';
+        parse->timings++;
+        if (token.type != JsonTokenType::Number || !token.integral || token.number <= 0) {
+            parse->errorKey = token.key;
+            return false;
+        }
+        if (isEpoch) {
+            entry.kind = ScheduleKind::Once;
+            parse->epoch = token.number;
+        } else {
+            entry.kind = ScheduleKind::Timer;
+            parse->inSeconds = token.number;
+        }
         return true;
     }
+
+    parse->errorKey = "unknown_field";
     return false;
 }
 
-bool parseJsonIntAt(const String& input, int index, int* out) {
-    if (!out) {
-        return false;
-    }
-    int i = index;
-    bool negative = false;
-    if (i < static_cast<int>(input.length()) && input[i] == '-') {
-        negative = true;
-        i++;
-    }
-    long value = 0;
-    bool hasDigits = false;
-    while (i < static_cast<int>(input.length()) && isdigit(static_cast<unsigned char>(input[i]))) {
-        hasDigits = true;
-        value = value * 10 + (input[i] - '0');
-        i++;
+ScheduleParse scheduleParse;
+
+// Checks the parsed entry and turns `in_s` into a stored one-shot when the
+// clock is set. Returns the error key, or nullptr.
+const char* finishScheduleEntry(ScheduleParse& parse) {
+    ScheduleEntry& entry = parse.entry;
+    if (parse.timings != 1 || (parse.hasDays && entry.kind != ScheduleKind::Daily)) {
+        return "timing";
     }
-    if (!hasDigits) {
-        return false;
+    if (entry.action == ScheduleAction::Keep && entry.mode[0] == '\0') {
+        return "action";
     }
-    if (negative) {
-        value = -value;
+    if (entry.kind == ScheduleKind::Daily) {
+        if (!parse.hasDays) {
+            entry.days = SCHEDULE_EVERY_DAY;
+        } else if (entry.days == 0) {
+            return "days";
+        }
+    } else if (entry.kind == ScheduleKind::Once) {
+        if (parse.epoch < CLOCK_VALID_AFTER || (wallClockSet() && parse.epoch <= time(nullptr))) {
+            return "epoch";
+        }
+        entry.at = static_cast<uint32_t>(parse.epoch);
+    } else {
+        if (parse.inSeconds > static_cast<long>(SCHEDULE_IN_S_MAX)) {
+            return "in_s";
+        }
+        if (wallClockSet()) {
+            entry.kind = ScheduleKind::Once;
+            entry.at = static_cast<uint32_t>(time(nullptr) + parse.inSeconds);
+        } else {
+            entry.at = static_cast<uint32_t>(monotonicMs() / 1000 + parse.inSeconds);
+        }
     }
-    *out = static_cast<int>(value);
-    return true;
+    return nullptr;
 }
 
-bool getJsonBool(const String& input, const char* key, bool* out, bool* found) {
-    int start = findJsonValueStart(input, key);
-    if (start < 0) {
-        if (found) {
-            *found = false;
-        }
-        return true;
+void handleAddSchedule() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
+        return;
     }
-    if (found) {
-        *found = true;
+    if (bodyStatus != BodyStatus::Complete) {
+        sendError(400, scheduleParse.errorKey ? scheduleParse.errorKey : "invalid_json");
+        return;
     }
-    return parseJsonBoolAt(input, start, out);
-}
-
-bool getJsonInt(const String& input, const char* key, int* out, bool* found) {
-    int start = findJsonValueStart(input, key);
-    if (start < 0) {
-        if (found) {
-            *found = false;
+    if (const char* error = finishScheduleEntry(scheduleParse)) {
+        sendError(400, error);
+        return;
+    }
+    int slot = -1;
+    for (uint8_t i = 0; i < SCHEDULE_SLOTS && slot < 0; i++) {
+        if (schedules[i].kind == ScheduleKind::None) {
+            slot = i;
         }
-        return true;
     }
-    if (found) {
-        *found = true;
+    if (slot < 0) {
+        sendError(507, "no_free_slot");
+        return;
+    }
+    uint16_t id;
+    do {
+        id = nextScheduleId++;
+    } while (id == 0 || findSchedule(id) >= 0);
+    ScheduleEntry& entry = schedules[slot];
+    entry = scheduleParse.entry;
+    entry.id = id;
+    queueScheduleSlot(static_cast<uint8_t>(slot));
+    if (entry.kind != ScheduleKind::Timer) {
+        storeSchedules();
     }
-    return parseJsonIntAt(input, start, out);
+    sendApiResponse(200, [slot](auto& out) { writeSchedule(out, static_cast<uint8_t>(slot)); });
 }
 
-bool getJsonString(const String& input, const char* key, String* out, bool* found) {
-    int start = findJsonValueStart(input, key);
-    if (start < 0) {
-        if (found) {
-            *found = false;
-        }
-        return true;
+void handleDeleteSchedule() {
+    const long id = server.arg("id").toInt();
+    const int slot = id > 0 && id <= UINT16_MAX ? findSchedule(static_cast<uint16_t>(id)) : -1;
+    if (slot < 0) {
+        sendError(404, "unknown_schedule");
+        return;
     }
-    if (found) {
-        *found = true;
+    const bool stored = schedules[slot].kind != ScheduleKind::Timer;
+    removeSchedule(static_cast<uint8_t>(slot));
+    if (stored) {
+        storeSchedules();
     }
-    return parseJsonStringAt(input, start, out);
+    handleGetSchedules();
 }
 
-String jsonEscape(const String& input) {
-    String output;
-    output.reserve(input.length() + 8);
-    for (int i = 0; i < static_cast<int>(input.length()); i++) {
-        unsigned char c = static_cast<unsigned char>(input[i]);
-        switch (c) {
-            case '\"':
-                output += "\\\"";
-                break;
-            case '\\':
-                output += "\\\\";
-                break;
-            case '\n':
-                output += "\\n";
-                break;
-            case '\r':
-                output += "\\r";
-                break;
-            case '\t':
-                output += "\\t";
-                break;
-            default:
-                if (c < 0x20) {
-                    char buf[7];
-                    snprintf(buf, sizeof(buf), "\\u%04x", c);
-                    output += buf;
-                } else {
-                    output += static_cast<char>(c);
-                }
-                break;
-        }
+void streamScheduleBody() {
+    if (server.raw().status == RAW_START) {
+        scheduleParse = ScheduleParse{};
     }
-    return output;
+    streamApiBody(captureScheduleToken, &scheduleParse);
 }
 
-bool isValidMode(const String& mode) {
-    return mode == "static" || mode == "purr" || mode == "bzzz" || mode == "blink";
+struct TimeParse {
+    long epoch;
+    bool found;
+};
+
+TimeParse timeParse;
+
+bool captureTimeToken(void* context, const JsonToken& token) {
+    TimeParse* parse = static_cast<TimeParse*>(context);
+    if (token.depth != 1 || strcmp(token.key, "epoch") != 0) {
+        return true;
+    }
+    if (token.type != JsonTokenType::Number || !token.integral || token.number < CLOCK_VALID_AFTER) {
+        return false;
+    }
+    parse->epoch = token.number;
+    parse->found = true;
+    return true;
 }
 
-bool isTimeReached(unsigned long now, unsigned long target) {
-    return static_cast<long>(now - target) >= 0;
+void handleGetTime() {
+    sendApiResponse(200, [](auto& out) {
+        out.beginObject();
+        writeClockFields(out);
+        out.endObject();
+    });
 }
 
-void updateLampEffect() {
-    if (!ledOn) {
-        writeLampOutput(false);
+// POST /api/time {"epoch": ...} sets the clock by hand when no SNTP server
+// is reachable, e.g. from the web UI on the access point.
+void handleSetTime() {
+    const BodyStatus bodyStatus = takeRequestBody();
+    if (rejectUnreadableBody(bodyStatus)) {
         return;
     }
-
-    if (currentMode == "static") {
-        writeLampOutput(true);
+    if (bodyStatus != BodyStatus::Complete || !timeParse.found) {
+        sendError(400, "epoch");
         return;
     }
+    struct timeval now = {static_cast<time_t>(timeParse.epoch), 0};
+    settimeofday(&now, nullptr);
+    clockSource = ClockSource::Manual;
+    requeueSchedules();
+    handleGetTime();
+}
 
-    const unsigned long now = millis();
+void streamTimeBody() {
+    if (server.raw().status == RAW_START) {
+        timeParse = TimeParse{0, false};
+    }
+    streamApiBody(captureTimeToken, &timeParse);
+}
 
-    if (currentMode == "blink") {
-        if (effect.nextMs == 0) {
-            writeLampOutput(true);
-            effect.nextMs = now + BLINK_ON_MS;
-            return;
-        }
+// CoAP on UDP 5683 mirrors /api/paw, /api/mode and /api/settings for
+// constrained clients: GET reads a resource, PUT/POST change it through the
+// same mutation functions as the HTTP routes, and GET with Observe registers
+// for a notification on every change. Datagrams are read from loop()
+// without blocking.
+// Large enough for the longest settings object in or out; a reply whose
+// payload still does not fit is answered 5.00 without one.
+const size_t COAP_PACKET_MAX = COAP_ENVELOPE_MAX + SETTINGS_JSON_MAX;
+const uint8_t COAP_PACKETS_PER_LOOP = 4;
+const uint8_t MAX_COAP_OBSERVERS = 4;
+const uint8_t COAP_EXCHANGE_CACHE = 4;
+const uint32_t COAP_EXCHANGE_LIFETIME_MS = 247000;
+const size_t COAP_CACHED_REPLY_MAX = 160;
 
-        if (isTimeReached(now, effect.nextMs)) {
-            if (effect.outputOn) {
-                writeLampOutput(false);
-                effect.nextMs = now + BLINK_OFF_MS;
-            } else {
-                writeLampOutput(true);
-                effect.nextMs = now + BLINK_ON_MS;
-            }
-        }
-        return;
-    }
+WiFiUDP coapUdp;
+uint8_t coapPacket[COAP_PACKET_MAX];
+uint8_t coapReplyPacket[COAP_PACKET_MAX];
+char coapPayload[SETTINGS_JSON_MAX];
+uint16_t coapMessageId = 0;
+uint32_t coapObserveSequence = 0;
 
-    if (currentMode == "purr") {
-        if (effect.nextMs == 0) {
-            effect.step = 0;
-            writeLampOutput(PURR_PATTERN_ON[0]);
-            effect.nextMs = now + PURR_PATTERN_MS[0];
-            return;
-        }
+enum class CoapResource : uint8_t {
+    Paw,
+    Mode,
+    Settings
+};
 
-        if (isTimeReached(now, effect.nextMs)) {
-            effect.step = (effect.step + 1) % static_cast<int>(PURR_PATTERN_LEN);
-            writeLampOutput(PURR_PATTERN_ON[effect.step]);
-            effect.nextMs = now + PURR_PATTERN_MS[effect.step];
-        }
-        return;
-    }
+struct CoapObserver {
+    IPAddress ip;
+    uint16_t port;
+    uint8_t token[COAP_TOKEN_MAX];
+    uint8_t tokenLength;
+    CoapResource resource;
+    bool cbor;
+    uint16_t lastMessageId;
+    bool active;
+};
 
-    if (currentMode == "bzzz") {
-        if (effect.nextMs == 0) {
-            writeLampOutput(true);
-            effect.flickersRemaining = 0;
-            effect.nextMs = now + random(BZZZ_GAP_MIN_MS, BZZZ_GAP_MAX_MS + 1);
-            return;
-        }
+CoapObserver coapObservers[MAX_COAP_OBSERVERS];
 
-        if (effect.flickersRemaining == 0) {
-            if (isTimeReached(now, effect.nextMs)) {
-                const uint8_t flickers = random(BZZZ_FLICKER_MIN_COUNT, BZZZ_FLICKER_MAX_COUNT + 1);
-                effect.flickersRemaining = flickers * 2;
-                effect.nextMs = now;
-            } else {
-                writeLampOutput(true);
-                return;
-            }
-        }
+// Replies to recent confirmable requests. A retransmitted request is answered
+// from here instead of being applied twice (a toggle must not toggle back).
+struct CoapExchange {
+    IPAddress ip;
+    uint16_t port;
+    uint16_t messageId;
+    unsigned long atMs;
+    uint8_t reply[COAP_CACHED_REPLY_MAX];
+    size_t replyLength;
+    bool used;
+};
 
-        if (isTimeReached(now, effect.nextMs)) {
-            writeLampOutput(!effect.outputOn);
-            effect.flickersRemaining--;
-            effect.nextMs = now + random(BZZZ_FLICKER_MIN_MS, BZZZ_FLICKER_MAX_MS + 1);
+CoapExchange coapExchanges[COAP_EXCHANGE_CACHE];
+uint8_t nextCoapExchange = 0;
 
-            if (effect.flickersRemaining <= 0) {
-                writeLampOutput(true);
-                effect.nextMs = now + random(BZZZ_GAP_MIN_MS, BZZZ_GAP_MAX_MS + 1);
-            }
-        }
-        return;
+bool findCoapResource(const char* path, CoapResource& out) {
+    if (strcmp(path, "api/paw") == 0) {
+        out = CoapResource::Paw;
+    } else if (strcmp(path, "api/mode") == 0) {
+        out = CoapResource::Mode;
+    } else if (strcmp(path, "api/settings") == 0) {
+        out = CoapResource::Settings;
+    } else {
+        return false;
     }
-
-    writeLampOutput(true);
+    return true;
 }
 
-void loadSettingsFromPrefs() {
-    settings.wifiEnabled = prefs.getBool("wifi_en", false);
-    settings.wifiSsid = prefs.getString("wifi_ssid", "");
-    settings.wifiPassword = prefs.getString("wifi_pass", "");
-    settings.mqttEnabled = prefs.getBool("mqtt_en", false);
-    settings.mqttHost = prefs.getString("mqtt_host", "");
-    settings.mqttPort = static_cast<uint16_t>(prefs.getUInt("mqtt_port", DEFAULT_MQTT_PORT));
-    settings.mqttTopic = prefs.getString("mqtt_topic", DEFAULT_MQTT_TOPIC);
-    settings.ledPin = prefs.getInt("led_pin", DEFAULT_LED_PIN);
-
-    if (settings.ledPin < 0 || settings.ledPin > 40) {
-        settings.ledPin = DEFAULT_LED_PIN;
-    }
-    if (settings.mqttPort == 0 || settings.mqttPort > 65535) {
-        settings.mqttPort = DEFAULT_MQTT_PORT;
+template <typename Writer>
+void writeCoapResource(Writer& out, CoapResource resource) {
+    switch (resource) {
+        case CoapResource::Paw:
+            out.beginObject();
+            writeStatusFields(out);
+            out.endObject();
+            break;
+        case CoapResource::Mode:
+            out.beginObject();
+            out.key("mode");
+            out.stringValue(lampModeName(lampState.read().mode));
+            out.endObject();
+            break;
+        case CoapResource::Settings:
+            writeSettings(out, settings);
+            break;
     }
+}
 
-    ledOn = prefs.getBool("led_on", false);
-    currentMode = prefs.getString("mode", DEFAULT_MODE);
-    if (!isValidMode(currentMode)) {
-        currentMode = DEFAULT_MODE;
+size_t encodeCoapResource(CoapResource resource, bool cbor, char* buffer, size_t capacity) {
+    if (cbor) {
+        CborWriter out(buffer, capacity);
+        writeCoapResource(out, resource);
+        return out.overflowed() ? 0 : out.length();
     }
+    JsonWriter out(buffer, capacity);
+    writeCoapResource(out, resource);
+    return out.overflowed() ? 0 : out.length();
 }
 
-void saveSettingsToPrefs() {
-    prefs.putBool("wifi_en", settings.wifiEnabled);
-    prefs.putString("wifi_ssid", settings.wifiSsid);
-    prefs.putString("wifi_pass", settings.wifiPassword);
-    prefs.putBool("mqtt_en", settings.mqttEnabled);
-    prefs.putString("mqtt_host", settings.mqttHost);
-    prefs.putUInt("mqtt_port", settings.mqttPort);
-    prefs.putString("mqtt_topic", settings.mqttTopic);
-    prefs.putInt("led_pin", settings.ledPin);
-    prefs.putString("mode", currentMode);
+void sendCoapPacket(const IPAddress& ip, uint16_t port, const uint8_t* data, size_t length) {
+    coapUdp.beginPacket(ip, port);
+    coapUdp.write(data, length);
+    coapUdp.endPacket();
 }
 
-void applyLedPin(int newPin) {
-    if (newPin < 0 || newPin > 40) {
-        return;
-    }
-    if (newPin == ledPin) {
-        return;
-    }
-    int previousPin = ledPin;
-    ledPin = newPin;
-    pinMode(ledPin, OUTPUT);
-    writeLampOutput(effect.outputOn, true);
-    if (previousPin != ledPin) {
-        pinMode(previousPin, INPUT);
-    }
+bool isStructuredCoapPayload(const CoapMessage& request) {
+    return request.hasContentFormat &&
+           (request.contentFormat == COAP_FORMAT_JSON || request.contentFormat == COAP_FORMAT_CBOR);
 }
 
-String settingsToJson() {
-    String payload = "{";
-    payload += "\"wifi_enabled\":";
-    payload += settings.wifiEnabled ? "true" : "false";
-    payload += ",\"wifi_ssid\":\"";
-    payload += jsonEscape(settings.wifiSsid);
-    payload += "\",\"wifi_password\":\"";
-    payload += jsonEscape(settings.wifiPassword);
-    payload += "\",\"mqtt_enabled\":";
-    payload += settings.mqttEnabled ? "true" : "false";
-    payload += ",\"mqtt_host\":\"";
-    payload += jsonEscape(settings.mqttHost);
-    payload += "\",\"mqtt_port\":";
-    payload += settings.mqttPort;
-    payload += ",\"mqtt_topic\":\"";
-    payload += jsonEscape(settings.mqttTopic);
-    payload += "\",\"led_pin\":";
-    payload += settings.ledPin;
-    payload += "}";
-    return payload;
+bool isTextCoapPayload(const CoapMessage& request) {
+    return !request.hasContentFormat || request.contentFormat == COAP_FORMAT_TEXT;
 }
 
-const WebFile* findWebFile(const String& path) {
-    for (size_t i = 0; i < webFilesCount; i++) {
-        if (path == webFiles[i].path) {
-            return &webFiles[i];
-        }
+bool scanCoapPayload(const CoapMessage& request, JsonTokenHandler handler, void* context) {
+    if (request.contentFormat == COAP_FORMAT_CBOR) {
+        cborScanner.reset(handler, context);
+        return cborScanner.feed(request.payload, request.payloadLength) && cborScanner.finish();
     }
-    return nullptr;
+    bodyScanner.reset(handler, context);
+    return bodyScanner.feed(reinterpret_cast<const char*>(request.payload), request.payloadLength) &&
+           bodyScanner.finish();
 }
 
-bool serveWebFile(const String& path) {
-    String target = path;
-    if (target == "/") {
-        target = "/index.html";
-    }
-
-    const WebFile* file = findWebFile(target);
-    if (!file) {
+// Copies a text payload into `out`, or returns false if it does not fit.
+bool copyCoapText(const CoapMessage& request, char* out, size_t capacity) {
+    if (request.payloadLength >= capacity) {
         return false;
     }
-
-    server.sendHeader("Cache-Control", "no-store");
-    server.sendHeader("Content-Encoding", "gzip");
-    server.send_P(200, file->mime_type, reinterpret_cast<const char*>(file->data), file->size);
+    memcpy(out, request.payload, request.payloadLength);
+    out[request.payloadLength] = '\0';
     return true;
 }
 
-String portalUrl() {
-    return String("http://") + WiFi.softAPIP().toString() + "/";
-}
-
-void redirectToPortal() {
-    server.sendHeader("Location", portalUrl());
-    server.send(302, "text/plain", "Meow.");
-}
-
-void sendStatus() {
-    char payload[200];
-    const unsigned long uptimeSeconds = millis() / 1000;
-    snprintf(payload, sizeof(payload),
-             "{\"led_on\":%s,\"uptime_s\":%lu,\"ssid\":\"%s\",\"mode\":\"%s\"}",
-             ledOn ? "true" : "false",
-             uptimeSeconds,
-             AP_SSID,
-             currentMode.c_str());
-    server.send(200, "application/json", payload);
+CoapCode applyCoapPaw(const CoapMessage& request) {
+    PawParse paw = {{0}, false, false, 0};
+    if (request.payloadLength > 0) {
+        if (isStructuredCoapPayload(request)) {
+            if (!scanCoapPayload(request, capturePawToken, &paw) || (!paw.found && !paw.hasBrightness)) {
+                return CoapCode::BadRequest;
+            }
+        } else if (!isTextCoapPayload(request)) {
+            return CoapCode::UnsupportedContentFormat;
+        } else if (!copyCoapText(request, paw.state, sizeof(paw.state)) || paw.state[0] == '\0') {
+            return CoapCode::BadRequest;
+        }
+    }
+    return applyPawRequest(paw.state, paw) ? CoapCode::BadRequest : CoapCode::Changed;
 }
 
-bool parseDesiredState(const String& input, bool* out) {
-    if (!out) {
-        return false;
+CoapCode applyCoapMode(const CoapMessage& request) {
+    ModeParse mode = {{0}, false};
+    if (isStructuredCoapPayload(request)) {
+        if (!scanCoapPayload(request, captureModeToken, &mode) || !mode.found) {
+            return CoapCode::BadRequest;
+        }
+    } else if (!isTextCoapPayload(request)) {
+        return CoapCode::UnsupportedContentFormat;
+    } else if (copyCoapText(request, mode.mode, sizeof(mode.mode))) {
+        for (char* p = mode.mode; *p; p++) {
+            *p = static_cast<char>(tolower(static_cast<unsigned char>(*p)));
+        }
     }
-    String value = input;
-    value.trim();
-    value.toLowerCase();
-    if (value == "on" || value == "1" || value == "true") {
-        *out = true;
-        return true;
+    LampMode parsed;
+    if (!parseLampMode(mode.mode, parsed)) {
+        return CoapCode::BadRequest;
     }
-    if (value == "off" || value == "0" || value == "false") {
-        *out = false;
-        return true;
+    applyMode(parsed);
+    return CoapCode::Changed;
+}
+
+CoapCode applyCoapSettings(const CoapMessage& request) {
+    if (!isStructuredCoapPayload(request)) {
+        return CoapCode::UnsupportedContentFormat;
     }
-    if (value == "toggle") {
-        *out = !ledOn;
-        return true;
+    settingsParse.pending = settings;
+    settingsParse.errorKey = nullptr;
+    if (!scanCoapPayload(request, applySettingsToken, &settingsParse) || settingsPinConflict(settingsParse.pending)) {
+        return CoapCode::BadRequest;
     }
-    return false;
+    commitSettings(settingsParse.pending);
+    return CoapCode::Changed;
 }
 
-void handleSetLamp() {
-    String rawState = server.arg("state");
-    if (rawState.isEmpty()) {
-        rawState = server.arg("plain");
+CoapObserver* findCoapObserver(const IPAddress& ip, uint16_t port, const CoapMessage& request) {
+    for (CoapObserver& observer : coapObservers) {
+        if (observer.active && observer.ip == ip && observer.port == port &&
+            observer.tokenLength == request.tokenLength &&
+            memcmp(observer.token, request.token, request.tokenLength) == 0) {
+            return &observer;
+        }
     }
+    return nullptr;
+}
 
-    bool desiredState = ledOn;
-    if (rawState.isEmpty()) {
-        desiredState = !ledOn;
-    } else if (!parseDesiredState(rawState, &desiredState)) {
-        server.send(400, "application/json", "{\"error\":\"unknown_state\"}");
-        return;
+// Registers or refreshes an observation. Returns false when the table is
+// full, in which case the GET is answered without Observe.
+bool registerCoapObserver(const IPAddress& ip, uint16_t port, const CoapMessage& request, CoapResource resource,
+                          bool cbor) {
+    CoapObserver* observer = findCoapObserver(ip, port, request);
+    for (size_t i = 0; !observer && i < MAX_COAP_OBSERVERS; i++) {
+        if (!coapObservers[i].active) {
+            observer = &coapObservers[i];
+        }
     }
-
-    setLamp(desiredState);
-    sendStatus();
+    if (!observer) {
+        return false;
+    }
+    observer->ip = ip;
+    observer->port = port;
+    memcpy(observer->token, request.token, request.tokenLength);
+    observer->tokenLength = request.tokenLength;
+    observer->resource = resource;
+    observer->cbor = cbor;
+    observer->lastMessageId = 0;
+    observer->active = true;
+    return true;
 }
 
-void handleGetSettings() {
-    server.send(200, "application/json", settingsToJson());
+bool replayCoapExchange(const IPAddress& ip, uint16_t port, uint16_t messageId) {
+    const unsigned long now = millis();
+    for (const CoapExchange& exchange : coapExchanges) {
+        if (exchange.used && exchange.messageId == messageId && exchange.port == port && exchange.ip == ip &&
+            now - exchange.atMs < COAP_EXCHANGE_LIFETIME_MS) {
+            sendCoapPacket(ip, port, exchange.reply, exchange.replyLength);
+            return true;
+        }
+    }
+    return false;
 }
 
-void handleSaveSettings() {
-    String body = server.arg("plain");
-    if (body.isEmpty()) {
-        server.send(400, "application/json", "{\"error\":\"missing_body\"}");
+void rememberCoapExchange(const IPAddress& ip, uint16_t port, uint16_t messageId, const uint8_t* reply,
+                          size_t length) {
+    if (length > COAP_CACHED_REPLY_MAX) {
+        // Only large GET /api/settings replies end up here, and those are
+        // safe to recompute on a retransmission.
         return;
     }
+    CoapExchange& exchange = coapExchanges[nextCoapExchange];
+    nextCoapExchange = static_cast<uint8_t>((nextCoapExchange + 1) % COAP_EXCHANGE_CACHE);
+    exchange.ip = ip;
+    exchange.port = port;
+    exchange.messageId = messageId;
+    exchange.atMs = millis();
+    memcpy(exchange.reply, reply, length);
+    exchange.replyLength = length;
+    exchange.used = true;
+}
 
-    bool found = false;
-    bool valueBool = false;
-    int valueInt = 0;
-    String valueStr;
-
-    if (!getJsonBool(body, "wifi_enabled", &valueBool, &found)) {
-        server.send(400, "application/json", "{\"error\":\"wifi_enabled\"}");
+// Fills `reply` for a request to one of the mirrored resources. The payload
+// is encoded into coapPayload.
+void handleCoapRequest(const CoapMessage& request, const IPAddress& ip, uint16_t port, CoapMessage& reply) {
+    CoapResource resource;
+    if (request.unknownCriticalOption) {
+        reply.code = CoapCode::BadOption;
         return;
     }
-    if (found) {
-        settings.wifiEnabled = valueBool;
+    if (!findCoapResource(request.path, resource)) {
+        reply.code = CoapCode::NotFound;
+        return;
     }
-
-    if (!getJsonString(body, "wifi_ssid", &valueStr, &found)) {
-        server.send(400, "application/json", "{\"error\":\"wifi_ssid\"}");
+    if (request.hasAccept && request.accept != COAP_FORMAT_JSON && request.accept != COAP_FORMAT_CBOR) {
+        reply.code = CoapCode::NotAcceptable;
         return;
     }
-    if (found) {
-        settings.wifiSsid = valueStr;
+    const bool cbor = request.hasAccept && request.accept == COAP_FORMAT_CBOR;
+
+    switch (request.code) {
+        case CoapCode::Get:
+            reply.code = CoapCode::Content;
+            if (request.hasObserve && request.observe == COAP_OBSERVE_REGISTER) {
+                reply.hasObserve = registerCoapObserver(ip, port, request, resource, cbor);
+                reply.observe = coapObserveSequence;
+            } else if (request.hasObserve && request.observe == COAP_OBSERVE_DEREGISTER) {
+                CoapObserver* observer = findCoapObserver(ip, port, request);
+                if (observer) {
+                    observer->active = false;
+                }
+            }
+            break;
+        case CoapCode::Post:
+        case CoapCode::Put:
+            if (resource == CoapResource::Paw) {
+                reply.code = applyCoapPaw(request);
+            } else if (resource == CoapResource::Mode) {
+                reply.code = applyCoapMode(request);
+            } else {
+                reply.code = applyCoapSettings(request);
+            }
+            if (reply.code != CoapCode::Changed) {
+                return;
+            }
+            break;
+        default:
+            reply.code = CoapCode::MethodNotAllowed;
+            return;
     }
 
-    if (!getJsonString(body, "wifi_password", &valueStr, &found)) {
-        server.send(400, "application/json", "{\"error\":\"wifi_password\"}");
+    reply.payloadLength = encodeCoapResource(resource, cbor, coapPayload, sizeof(coapPayload));
+    if (reply.payloadLength == 0) {
+        Serial.printf("Meow: CoAP %s does not fit %u bytes.\n", request.path,
+                      static_cast<unsigned>(sizeof(coapPayload)));
+        reply.code = CoapCode::InternalServerError;
+        if (reply.hasObserve) {
+            findCoapObserver(ip, port, request)->active = false;
+            reply.hasObserve = false;
+        }
         return;
     }
-    if (found) {
-        settings.wifiPassword = valueStr;
-    }
+    reply.payload = reinterpret_cast<const uint8_t*>(coapPayload);
+    reply.hasContentFormat = true;
+    reply.contentFormat = cbor ? COAP_FORMAT_CBOR : COAP_FORMAT_JSON;
+}
 
-    if (!getJsonBool(body, "mqtt_enabled", &valueBool, &found)) {
-        server.send(400, "application/json", "{\"error\":\"mqtt_enabled\"}");
+void handleCoapPacket(size_t length, bool truncated) {
+    CoapMessage request;
+    if (!parseCoapMessage(coapPacket, length, request)) {
         return;
     }
-    if (found) {
-        settings.mqttEnabled = valueBool;
-    }
+    const IPAddress ip = coapUdp.remoteIP();
+    const uint16_t port = coapUdp.remotePort();
 
-    if (!getJsonString(body, "mqtt_host", &valueStr, &found)) {
-        server.send(400, "application/json", "{\"error\":\"mqtt_host\"}");
+    if (request.type == CoapType::Reset) {
+        // A reset in answer to a notification cancels that observation.
+        for (CoapObserver& observer : coapObservers) {
+            if (observer.active && observer.lastMessageId == request.messageId && observer.ip == ip &&
+                observer.port == port) {
+                observer.active = false;
+            }
+        }
         return;
     }
-    if (found) {
-        settings.mqttHost = valueStr;
-    }
-
-    if (!getJsonInt(body, "mqtt_port", &valueInt, &found)) {
-        server.send(400, "application/json", "{\"error\":\"mqtt_port\"}");
+    if (request.type == CoapType::Acknowledgement || static_cast<uint8_t>(request.code) >= 0x20) {
         return;
     }
-    if (found) {
-        if (valueInt > 0 && valueInt <= 65535) {
-            settings.mqttPort = static_cast<uint16_t>(valueInt);
+    if (request.code == CoapCode::Empty) {
+        // CoAP ping: a confirmable empty message is answered with a reset.
+        if (request.type == CoapType::Confirmable) {
+            CoapMessage pong = {};
+            pong.type = CoapType::Reset;
+            pong.messageId = request.messageId;
+            uint8_t packet[4];
+            const size_t pongLength = buildCoapMessage(pong, packet, sizeof(packet));
+            sendCoapPacket(ip, port, packet, pongLength);
         }
+        return;
+    }
+    const bool confirmable = request.type == CoapType::Confirmable;
+    if (confirmable && replayCoapExchange(ip, port, request.messageId)) {
+        return;
+    }
+
+    CoapMessage reply = {};
+    reply.type = confirmable ? CoapType::Acknowledgement : CoapType::NonConfirmable;
+    reply.messageId = confirmable ? request.messageId : coapMessageId++;
+    memcpy(reply.token, request.token, request.tokenLength);
+    reply.tokenLength = request.tokenLength;
+    if (truncated) {
+        reply.code = CoapCode::RequestEntityTooLarge;
+    } else {
+        handleCoapRequest(request, ip, port, reply);
     }
 
-    if (!getJsonString(body, "mqtt_topic", &valueStr, &found)) {
-        server.send(400, "application/json", "{\"error\":\"mqtt_topic\"}");
+    const size_t packetLength = buildCoapMessage(reply, coapReplyPacket, sizeof(coapReplyPacket));
+    if (packetLength == 0) {
         return;
     }
-    if (found) {
-        settings.mqttTopic = valueStr;
+    sendCoapPacket(ip, port, coapReplyPacket, packetLength);
+    if (confirmable) {
+        rememberCoapExchange(ip, port, request.messageId, coapReplyPacket, packetLength);
     }
+}
 
-    if (!getJsonInt(body, "led_pin", &valueInt, &found)) {
-        server.send(400, "application/json", "{\"error\":\"led_pin\"}");
+void notifyCoapObservers(uint8_t changed) {
+    if (changed == 0) {
         return;
     }
-    if (found) {
-        if (valueInt >= 0 && valueInt <= 40) {
-            settings.ledPin = valueInt;
-            applyLedPin(settings.ledPin);
+    coapObserveSequence = (coapObserveSequence + 1) & 0xFFFFFF;
+    for (CoapObserver& observer : coapObservers) {
+        const uint8_t watched = observer.resource == CoapResource::Settings ? SETTINGS_CHANGED : STATUS_CHANGED;
+        if (!observer.active || !(changed & watched)) {
+            continue;
+        }
+        const size_t payloadLength =
+            encodeCoapResource(observer.resource, observer.cbor, coapPayload, sizeof(coapPayload));
+        if (payloadLength == 0) {
+            Serial.printf("Meow: CoAP notification does not fit %u bytes, skipped.\n",
+                          static_cast<unsigned>(sizeof(coapPayload)));
+            continue;
+        }
+        CoapMessage notification = {};
+        notification.type = CoapType::NonConfirmable;
+        notification.code = CoapCode::Content;
+        notification.messageId = coapMessageId++;
+        memcpy(notification.token, observer.token, observer.tokenLength);
+        notification.tokenLength = observer.tokenLength;
+        notification.hasObserve = true;
+        notification.observe = coapObserveSequence;
+        notification.hasContentFormat = true;
+        notification.contentFormat = observer.cbor ? COAP_FORMAT_CBOR : COAP_FORMAT_JSON;
+        notification.payloadLength = payloadLength;
+        notification.payload = reinterpret_cast<const uint8_t*>(coapPayload);
+
+        const size_t packetLength = buildCoapMessage(notification, coapReplyPacket, sizeof(coapReplyPacket));
+        if (packetLength > 0) {
+            observer.lastMessageId = notification.messageId;
+            sendCoapPacket(observer.ip, observer.port, coapReplyPacket, packetLength);
         }
     }
+}
 
-    saveSettingsToPrefs();
-    handleGetSettings();
+void serviceCoap(uint8_t changed) {
+    for (uint8_t i = 0; i < COAP_PACKETS_PER_LOOP; i++) {
+        const int size = coapUdp.parsePacket();
+        if (size <= 0) {
+            break;
+        }
+        const int length = coapUdp.read(coapPacket, sizeof(coapPacket));
+        if (length > 0) {
+            handleCoapPacket(static_cast<size_t>(length), static_cast<size_t>(size) > sizeof(coapPacket));
+        }
+    }
+    notifyCoapObservers(changed);
 }
 
-void handleSetMode() {
-    String body = server.arg("plain");
-    if (body.isEmpty()) {
-        server.send(400, "application/json", "{\"error\":\"missing_body\"}");
+void handleNotFound() {
+    takeRequestBody();
+    if (server.uri().startsWith("/api/")) {
+        sendError(404, "unknown_api");
         return;
     }
-
-    bool found = false;
-    String valueStr;
-    if (!getJsonString(body, "mode", &valueStr, &found) || !found) {
-        server.send(400, "application/json", "{\"error\":\"mode\"}");
+    if (serveWebFile(server.uri())) {
         return;
     }
+    redirectToPortal();
+}
 
-    valueStr.toLowerCase();
-    if (!isValidMode(valueStr)) {
-        server.send(400, "application/json", "{\"error\":\"mode\"}");
+// Registers a route whose callbacks mark the pass as having served a
+// request: the body callback in the passes that stream a body, the handler
+// in the one that answers.
+void route(const Uri& uri, HTTPMethod method, WebServer::THandlerFunction handler,
+           WebServer::THandlerFunction body = nullptr) {
+    auto dispatch = [handler]() {
+        requestDispatched = true;
+        handler();
+    };
+    if (!body) {
+        server.on(uri, method, dispatch);
         return;
     }
-
-    currentMode = valueStr;
-    prefs.putString("mode", currentMode);
-    resetEffectState();
-    server.send(200, "application/json", String("{\"mode\":\"") + currentMode + "\"}");
+    server.on(uri, method, dispatch, [body]() {
+        requestDispatched = true;
+        body();
+    });
 }
 
 void setupRoutes() {
-    server.on("/api/paw", HTTP_GET, []() { sendStatus(); });
-    server.on("/api/paw", HTTP_POST, []() { handleSetLamp(); });
-    server.on("/api/settings", HTTP_GET, []() { handleGetSettings(); });
-    server.on("/api/settings", HTTP_POST, []() { handleSaveSettings(); });
-    server.on("/api/mode", HTTP_POST, []() { handleSetMode(); });
-
-    server.on("/generate_204", HTTP_GET, []() { redirectToPortal(); });
-    server.on("/gen_204", HTTP_GET, []() { redirectToPortal(); });
-    server.on("/hotspot-detect.html", HTTP_GET, []() { redirectToPortal(); });
-    server.on("/ncsi.txt", HTTP_GET, []() { redirectToPortal(); });
-    server.on("/success.txt", HTTP_GET, []() { redirectToPortal(); });
-    server.on("/fwlink", HTTP_GET, []() { redirectToPortal(); });
+    const char* headerKeys[] = {"Content-Length", "Content-Type", "Accept", "If-None-Match", "Upgrade",
+                                "Sec-WebSocket-Key"};
+    server.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
+
+    route("/api/paw", HTTP_GET, []() { handleGetStatus(); });
+    route("/api/paw", HTTP_POST, []() { handleSetLamp(); }, []() { streamPawBody(); });
+    route("/api/events", HTTP_GET, []() { handleEvents(); });
+    route("/api/ws", HTTP_GET, []() { handleWebSocketUpgrade(); });
+    route("/api/settings", HTTP_GET, []() { handleGetSettingsConditional(); });
+    route("/api/settings", HTTP_POST, []() { handleSaveSettings(); }, []() { streamSettingsBody(); });
+    route("/api/mode", HTTP_POST, []() { handleSetMode(); }, []() { streamModeBody(); });
+    route("/api/effects/preview", HTTP_GET, []() { handleEffectPreview(); });
+    route("/api/patterns", HTTP_GET, []() { handleGetPatterns(); });
+    route("/api/patterns", HTTP_POST, []() { handleSavePattern(); }, []() { streamPatternBody(); });
+    route("/api/patterns", HTTP_DELETE, []() { handleDeletePattern(); }, []() { discardRequestBody(); });
+    route("/api/metrics/effects", HTTP_GET, []() { handleGetEffectMetrics(); });
+    route("/api/metrics/effects", HTTP_DELETE, []() { handleResetEffectMetrics(); }, []() { discardRequestBody(); });
+    route("/api/metrics/loop", HTTP_GET, []() { handleGetLoopProfile(); });
+    route("/api/metrics/loop", HTTP_DELETE, []() { handleResetLoopProfile(); }, []() { discardRequestBody(); });
+    route("/api/channels", HTTP_GET, []() { handleGetChannels(); });
+    route("/api/channels", HTTP_POST, []() { handleSetChannels(); }, []() { streamChannelsBody(); });
+    route("/api/schedules", HTTP_GET, []() { handleGetSchedules(); });
+    route("/api/schedules", HTTP_POST, []() { handleAddSchedule(); }, []() { streamScheduleBody(); });
+    route("/api/schedules", HTTP_DELETE, []() { handleDeleteSchedule(); }, []() { discardRequestBody(); });
+    route("/api/time", HTTP_GET, []() { handleGetTime(); });
+    route("/api/time", HTTP_POST, []() { handleSetTime(); }, []() { streamTimeBody(); });
+    route("/api/batch", HTTP_POST, []() { handleBatch(); }, []() { streamBatchBody(); });
+
+    route("/generate_204", HTTP_GET, []() { redirectToPortal(); });
+    route("/gen_204", HTTP_GET, []() { redirectToPortal(); });
+    route("/hotspot-detect.html", HTTP_GET, []() { redirectToPortal(); });
+    route("/ncsi.txt", HTTP_GET, []() { redirectToPortal(); });
+    route("/success.txt", HTTP_GET, []() { redirectToPortal(); });
+    route("/fwlink", HTTP_GET, []() { redirectToPortal(); });
+
+    // Catch-all for bodies on unknown paths, so they are drained in chunks
+    // instead of landing in server.arg("plain"). Must stay the last route.
+    const HTTPMethod bodyMethods[] = {HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE};
+    for (HTTPMethod method : bodyMethods) {
+        route(UriGlob("*"), method, []() { handleNotFound(); }, []() { discardRequestBody(); });
+    }
 
     server.onNotFound([]() {
-        if (server.uri().startsWith("/api/")) {
-            server.send(404, "application/json", "{\"error\":\"unknown_api\"}");
-            return;
-        }
-        if (serveWebFile(server.uri())) {
-            return;
-        }
-        redirectToPortal();
+        requestDispatched = true;
+        handleNotFound();
     });
 }
 
@@ -698,12 +4604,89 @@ void setupCaptivePortal() {
     Serial.println("Meow: I route every track to my bowl.");
 }
 
+// `mark` is the cycle count the pass started at; it ends at the last phase.
+void serviceNetwork(uint32_t& mark) {
+    dnsServer.processNextRequest();
+    endLoopPhase(LoopPhase::Dns, mark);
+    requestDispatched = false;
+    server.serve();
+    if (endLoopPhase(LoopPhase::Http, mark)) {
+        noteSlowestRequest();
+        mark = ESP.getCycleCount();
+    }
+    ClientCosts costs = {mark, 0, ""};
+    serviceFileTransfers();
+    chargeClientService(costs, "files");
+    serviceParkedClients();
+    chargeClientService(costs, "long_polls");
+    const uint8_t changed = pendingEvents;
+    pendingEvents = 0;
+    serviceEventStreams(changed);
+    chargeClientService(costs, "events");
+    serviceWebSockets(changed);
+    chargeClientService(costs, "websockets");
+    serviceCoap(changed);
+    chargeClientService(costs, "coap");
+    serviceSchedules();
+    chargeClientService(costs, "schedules");
+    if (endLoopPhase(LoopPhase::Clients, mark)) {
+        slowestClient = costs.worst;
+    }
+    if (reportLoopProfile()) {
+        mark = ESP.getCycleCount();
+    }
+}
+
+void networkTaskMain(void*) {
+    for (;;) {
+        recordNetworkPass();
+        uint32_t mark = ESP.getCycleCount();
+        serviceNetwork(mark);
+        // Core 0's idle task is watched by the task watchdog and needs a
+        // tick now and then.
+        vTaskDelay(1);
+    }
+}
+
+// Splits the firmware across both cores when the chip and settings.splitCores
+// allow it. Anything that fails leaves the cooperative loop() in charge of
+// that part. Runs last in setup(), so the tasks start on a finished setup.
+void startExecution() {
+    if (!SPLIT_CORES_AVAILABLE || !settings.splitCores) {
+        Serial.println("Meow: running the cooperative loop.");
+        return;
+    }
+    // Edges in the task are woken by the effect timer.
+    if (!effectTimer) {
+        Serial.println("Meow: effect timer unavailable, running the cooperative loop.");
+        return;
+    }
+    if (xTaskCreatePinnedToCore(effectTaskMain, "lamp_effect", EFFECT_TASK_STACK, nullptr, EFFECT_TASK_PRIORITY,
+                                &effectTask, EFFECT_CORE) != pdPASS) {
+        effectTask = nullptr;
+        Serial.println("Meow: effect task unavailable, running the cooperative loop.");
+        return;
+    }
+    // The backend just changed; the timer may have been stopped for loop().
+    portENTER_CRITICAL(&effectMux);
+    armEffectTimer();
+    portEXIT_CRITICAL(&effectMux);
+    if (xTaskCreatePinnedToCore(networkTaskMain, "meow_network", NETWORK_TASK_STACK, nullptr, NETWORK_TASK_PRIORITY,
+                                &networkTask, NETWORK_CORE) != pdPASS) {
+        networkTask = nullptr;
+        Serial.println("Meow: network task unavailable, serving from loop().");
+        return;
+    }
+    Serial.println("Meow: network on core 0, effects on core 1.");
+}
+
 void setup() {
     Serial.begin(115200);
     Serial.println();
     Serial.println("Meow. I wake up and claim my territory.");
     Serial.printf("Meow. Firmware %s.\n", VERSION_STR);
     randomSeed(static_cast<unsigned long>(micros()));
+    bootNonce = esp_random();
 
     prefs.begin("meowlamp", false);
     loadSettingsFromPrefs();
@@ -711,17 +4694,33 @@ void setup() {
     pinMode(ledPin, OUTPUT);
     digitalWrite(ledPin, LED_OFF_LEVEL);
     blinkBootSignal();
+    attachLampPwm(ledPin);
+    clearEffectScheduler(effectSchedule);
+    setupEffectTimer();
+    startChannels();
     setLamp(ledOn, false);
+    requestStripConfig();
+    setupClock();
 
     setupAccessPoint();
     setupCaptivePortal();
+    coapMessageId = static_cast<uint16_t>(esp_random());
+    coapUdp.begin(COAP_DEFAULT_PORT);
     setupRoutes();
+    resetLoopProfile();
     server.begin();
     Serial.println("Meow. I am ready for paw commands.");
+    startExecution();
 }
 
 void loop() {
-    dnsServer.processNextRequest();
-    server.handleClient();
+    if (networkTask) {
+        // The network task on core 0 has taken over.
+        vTaskDelete(nullptr);
+    }
+    recordNetworkPass();
+    uint32_t mark = ESP.getCycleCount();
+    serviceNetwork(mark);
     updateLampEffect();
+    endLoopPhase(LoopPhase::Effects, mark);
 }
@@ -0,0 +1,316 @@
+#include "settings.h"
+
+#include <string.h>
+
+#include "StripRenderer.h"
+
+namespace {
+
+constexpr SettingField boolSetting(const char* jsonKey, const char* nvsKey, size_t offset, bool fallback) {
+    return SettingField{jsonKey, nvsKey, SettingType::Bool, static_cast<uint16_t>(offset), 0, 0, 1, fallback ? 1 : 0, nullptr};
+}
+
+constexpr SettingField intSetting(const char* jsonKey, const char* nvsKey, size_t offset,
+                                  int32_t minValue, int32_t maxValue, int32_t fallback) {
+    return SettingField{jsonKey, nvsKey, SettingType::Int, static_cast<uint16_t>(offset), 0, minValue, maxValue, fallback, nullptr};
+}
+
+constexpr SettingField uint16Setting(const char* jsonKey, const char* nvsKey, size_t offset,
+                                     int32_t minValue, int32_t maxValue, int32_t fallback) {
+    return SettingField{jsonKey, nvsKey, SettingType::UInt16, static_cast<uint16_t>(offset), 0, minValue, maxValue, fallback, nullptr};
+}
+
+constexpr SettingField textSetting(const char* jsonKey, const char* nvsKey, size_t offset, size_t size,
+                                   const char* fallback) {
+    return SettingField{jsonKey, nvsKey, SettingType::Text, static_cast<uint16_t>(offset), static_cast<uint16_t>(size), 0, 0, 0, fallback};
+}
+
+constexpr SettingField SETTINGS_SCHEMA[] = {
+    boolSetting("wifi_enabled", "wifi_en", offsetof(DeviceSettings, wifiEnabled), false),
+    textSetting("wifi_ssid", "wifi_ssid", offsetof(DeviceSettings, wifiSsid), sizeof(DeviceSettings::wifiSsid), ""),
+    textSetting("wifi_password", "wifi_pass", offsetof(DeviceSettings, wifiPassword),
+                sizeof(DeviceSettings::wifiPassword), ""),
+    boolSetting("mqtt_enabled", "mqtt_en", offsetof(DeviceSettings, mqttEnabled), false),
+    textSetting("mqtt_host", "mqtt_host", offsetof(DeviceSettings, mqttHost), sizeof(DeviceSettings::mqttHost), ""),
+    uint16Setting("mqtt_port", "mqtt_port", offsetof(DeviceSettings, mqttPort), 1, 65535, DEFAULT_MQTT_PORT),
+    textSetting("mqtt_topic", "mqtt_topic", offsetof(DeviceSettings, mqttTopic), sizeof(DeviceSettings::mqttTopic),
+                DEFAULT_MQTT_TOPIC),
+    intSetting("led_pin", "led_pin", offsetof(DeviceSettings, ledPin), LED_PIN_MIN, LED_PIN_MAX, DEFAULT_LED_PIN),
+    uint16Setting("brightness", "brightness", offsetof(DeviceSettings, brightness), 0, BRIGHTNESS_MAX,
+                  DEFAULT_BRIGHTNESS),
+    uint16Setting("fade_ms", "fade_ms", offsetof(DeviceSettings, fadeMs), 0, FADE_MS_MAX, DEFAULT_FADE_MS),
+    boolSetting("effect_timer", "fx_timer", offsetof(DeviceSettings, effectTimer), true),
+    intSetting("strip_pin", "strip_pin", offsetof(DeviceSettings, stripPin), STRIP_PIN_NONE, LED_PIN_MAX,
+               STRIP_PIN_NONE),
+    uint16Setting("strip_pixels", "strip_px", offsetof(DeviceSettings, stripPixels), 0, STRIP_PIXELS_MAX, 0),
+    intSetting("strip_color", "strip_rgb", offsetof(DeviceSettings, stripColor), 0, STRIP_COLOR_MAX,
+               DEFAULT_STRIP_COLOR),
+    textSetting("timezone", "tz", offsetof(DeviceSettings, timezone), sizeof(DeviceSettings::timezone),
+                DEFAULT_TIMEZONE),
+    boolSetting("split_cores", "split", offsetof(DeviceSettings, splitCores), true),
+    uint16Setting("loop_report_s", "loop_rpt", offsetof(DeviceSettings, loopReportS), 0, LOOP_REPORT_S_MAX, 0),
+};
+
+constexpr size_t SETTINGS_FIELD_COUNT = sizeof(SETTINGS_SCHEMA) / sizeof(SETTINGS_SCHEMA[0]);
+
+constexpr bool textFieldsFitScanner(size_t index) {
+    return index >= SETTINGS_FIELD_COUNT ||
+           ((SETTINGS_SCHEMA[index].type != SettingType::Text ||
+             SETTINGS_SCHEMA[index].size <= MEOW_JSON_VALUE_MAX + 1) &&
+            textFieldsFitScanner(index + 1));
+}
+
+static_assert(textFieldsFitScanner(0), "a text setting is longer than the JSON scanner value buffer");
+
+constexpr size_t textLength(const char* text) {
+    return *text ? 1 + textLength(text + 1) : 0;
+}
+
+constexpr size_t digitCount(uint32_t value) {
+    return value < 10 ? 1 : 1 + digitCount(value / 10);
+}
+
+constexpr size_t decimalLength(int32_t value) {
+    return value < 0 ? 1 + digitCount(0U - static_cast<uint32_t>(value)) : digitCount(static_cast<uint32_t>(value));
+}
+
+constexpr size_t larger(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+// Longest JSON value of a field: "false", the wider range end, or a text of
+// quotes or backslashes, each escaped to two bytes.
+constexpr size_t jsonValueMax(const SettingField& field) {
+    return field.type == SettingType::Bool   ? 5
+           : field.type == SettingType::Text ? 2 + 2 * (field.size - 1)
+                                             : larger(decimalLength(field.minValue), decimalLength(field.maxValue));
+}
+
+// Braces, then per member the quoted key, colon, value and comma.
+constexpr size_t settingsJsonMax(size_t index) {
+    return index >= SETTINGS_FIELD_COUNT
+               ? 2
+               : textLength(SETTINGS_SCHEMA[index].jsonKey) + 4 + jsonValueMax(SETTINGS_SCHEMA[index]) +
+                     settingsJsonMax(index + 1);
+}
+
+static_assert(settingsJsonMax(0) < SETTINGS_JSON_MAX, "SETTINGS_JSON_MAX is smaller than the longest settings JSON");
+
+void* fieldPointer(DeviceSettings& value, const SettingField& field) {
+    return reinterpret_cast<uint8_t*>(&value) + field.offset;
+}
+
+const void* fieldPointer(const DeviceSettings& value, const SettingField& field) {
+    return reinterpret_cast<const uint8_t*>(&value) + field.offset;
+}
+
+bool inRange(const SettingField& field, long value) {
+    return value >= field.minValue && value <= field.maxValue;
+}
+
+long readNumber(const DeviceSettings& value, const SettingField& field) {
+    const void* ptr = fieldPointer(value, field);
+    if (field.type == SettingType::UInt16) {
+        return *static_cast<const uint16_t*>(ptr);
+    }
+    return *static_cast<const int32_t*>(ptr);
+}
+
+void writeNumber(DeviceSettings& value, const SettingField& field, long number) {
+    void* ptr = fieldPointer(value, field);
+    if (field.type == SettingType::UInt16) {
+        *static_cast<uint16_t*>(ptr) = static_cast<uint16_t>(number);
+    } else {
+        *static_cast<int32_t*>(ptr) = static_cast<int32_t>(number);
+    }
+}
+
+void writeText(DeviceSettings& value, const SettingField& field, const char* text) {
+    char* dest = static_cast<char*>(fieldPointer(value, field));
+    strncpy(dest, text, field.size - 1);
+    dest[field.size - 1] = '\0';
+}
+
+// Older firmware stored text settings without today's caps, and getString()
+// into the field fails for a value that does not fit. Such a value is cut at
+// the cap, on a UTF-8 character boundary, rather than dropped for the
+// default; it stays long in NVS until the setting is saved again.
+void loadLongText(Preferences& prefs, DeviceSettings& out, const SettingField& field) {
+    const String stored = prefs.isKey(field.nvsKey) ? prefs.getString(field.nvsKey) : String();
+    if (stored.length() < field.size) {
+        writeText(out, field, field.defaultText);
+        return;
+    }
+    const char* text = stored.c_str();
+    size_t length = field.size - 1;
+    while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80) {
+        length--;
+    }
+    char* dest = static_cast<char*>(fieldPointer(out, field));
+    memcpy(dest, text, length);
+    dest[length] = '\0';
+    Serial.printf("Meow: setting %s is %u bytes in NVS, keeping the first %u.\n", field.jsonKey,
+                  static_cast<unsigned>(stored.length()), static_cast<unsigned>(length));
+}
+
+bool hasControlCharacter(const char* text) {
+    for (; *text; text++) {
+        if (static_cast<unsigned char>(*text) < 0x20) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool fieldChanged(const DeviceSettings& next, const DeviceSettings& previous, const SettingField& field) {
+    switch (field.type) {
+        case SettingType::Bool:
+            return *static_cast<const bool*>(fieldPointer(next, field)) !=
+                   *static_cast<const bool*>(fieldPointer(previous, field));
+        case SettingType::Int:
+        case SettingType::UInt16:
+            return readNumber(next, field) != readNumber(previous, field);
+        case SettingType::Text:
+            return strcmp(static_cast<const char*>(fieldPointer(next, field)),
+                          static_cast<const char*>(fieldPointer(previous, field))) != 0;
+    }
+    return true;
+}
+
+}  // namespace
+
+const SettingField* findSettingField(const char* jsonKey) {
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        if (strcmp(jsonKey, SETTINGS_SCHEMA[i].jsonKey) == 0) {
+            return &SETTINGS_SCHEMA[i];
+        }
+    }
+    return nullptr;
+}
+
+void loadSettings(Preferences& prefs, DeviceSettings& out) {
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        const SettingField& field = SETTINGS_SCHEMA[i];
+        switch (field.type) {
+            case SettingType::Bool:
+                *static_cast<bool*>(fieldPointer(out, field)) = prefs.getBool(field.nvsKey, field.defaultValue != 0);
+                break;
+            case SettingType::Int: {
+                const long value = prefs.getInt(field.nvsKey, field.defaultValue);
+                writeNumber(out, field, inRange(field, value) ? value : field.defaultValue);
+                break;
+            }
+            case SettingType::UInt16: {
+                const long value = static_cast<long>(prefs.getUInt(field.nvsKey, field.defaultValue));
+                writeNumber(out, field, inRange(field, value) ? value : field.defaultValue);
+                break;
+            }
+            case SettingType::Text: {
+                char* dest = static_cast<char*>(fieldPointer(out, field));
+                if (prefs.getString(field.nvsKey, dest, field.size) == 0) {
+                    loadLongText(prefs, out, field);
+                }
+                // Stored by firmware that accepted them; they would break
+                // the SETTINGS_JSON_MAX bound.
+                if (hasControlCharacter(dest)) {
+                    Serial.printf("Meow: setting %s has control characters in NVS, using the default.\n",
+                                  field.jsonKey);
+                    writeText(out, field, field.defaultText);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void storeSettings(Preferences& prefs, const DeviceSettings& next, const DeviceSettings& previous) {
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        const SettingField& field = SETTINGS_SCHEMA[i];
+        if (!fieldChanged(next, previous, field)) {
+            continue;
+        }
+        switch (field.type) {
+            case SettingType::Bool:
+                prefs.putBool(field.nvsKey, *static_cast<const bool*>(fieldPointer(next, field)));
+                break;
+            case SettingType::Int:
+                prefs.putInt(field.nvsKey, static_cast<int32_t>(readNumber(next, field)));
+                break;
+            case SettingType::UInt16:
+                prefs.putUInt(field.nvsKey, static_cast<uint32_t>(readNumber(next, field)));
+                break;
+            case SettingType::Text:
+                prefs.putString(field.nvsKey, static_cast<const char*>(fieldPointer(next, field)));
+                break;
+        }
+    }
+}
+
+template <typename Writer>
+void writeSettings(Writer& writer, const DeviceSettings& value) {
+    writer.beginObject();
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        const SettingField& field = SETTINGS_SCHEMA[i];
+        writer.key(field.jsonKey);
+        switch (field.type) {
+            case SettingType::Bool:
+                writer.boolValue(*static_cast<const bool*>(fieldPointer(value, field)));
+                break;
+            case SettingType::Int:
+            case SettingType::UInt16:
+                writer.intValue(readNumber(value, field));
+                break;
+            case SettingType::Text:
+                writer.stringValue(static_cast<const char*>(fieldPointer(value, field)));
+                break;
+        }
+    }
+    writer.endObject();
+}
+
+template void writeSettings(JsonWriter& writer, const DeviceSettings& value);
+template void writeSettings(CborWriter& writer, const DeviceSettings& value);
+
+bool applySettingsToken(void* context, const JsonToken& token) {
+    SettingsParse* parse = static_cast<SettingsParse*>(context);
+    if (token.depth == 0) {
+        return token.type == JsonTokenType::ObjectStart || token.type == JsonTokenType::ObjectEnd;
+    }
+    if (token.depth != 1 || token.type == JsonTokenType::ObjectEnd || token.type == JsonTokenType::ArrayEnd) {
+        return true;
+    }
+
+    const SettingField* field = findSettingField(token.key);
+    if (!field) {
+        return true;
+    }
+
+    switch (field->type) {
+        case SettingType::Bool:
+            if (token.type != JsonTokenType::Bool) {
+                parse->errorKey = field->jsonKey;
+                return false;
+            }
+            *static_cast<bool*>(fieldPointer(parse->pending, *field)) = token.boolean;
+            return true;
+        case SettingType::Int:
+        case SettingType::UInt16:
+            if (token.type != JsonTokenType::Number || !token.integral) {
+                parse->errorKey = field->jsonKey;
+                return false;
+            }
+            if (inRange(*field, token.number)) {
+                writeNumber(parse->pending, *field, token.number);
+            }
+            return true;
+        case SettingType::Text:
+            if (token.type != JsonTokenType::String || token.length >= field->size ||
+                hasControlCharacter(token.text)) {
+                parse->errorKey = field->jsonKey;
+                return false;
+            }
+            writeText(parse->pending, *field, token.text);
+            return true;
+    }
+    return true;
+}
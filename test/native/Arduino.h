@@ -0,0 +1,36 @@
+#ifndef MEOW_NATIVE_ARDUINO_H
+#define MEOW_NATIVE_ARDUINO_H
+
+// Just enough of the Arduino core for settings.cpp in the native test build.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#define LED_BUILTIN 8
+
+struct HardwareSerial {
+    template <typename... Args>
+    int printf(const char* format, Args... args) {
+        return fprintf(stderr, format, args...);
+    }
+};
+
+inline HardwareSerial Serial;
+
+class String {
+public:
+    String() {}
+    String(const char* text) : value_(text ? text : "") {}
+
+    const char* c_str() const { return value_.c_str(); }
+    size_t length() const { return value_.size(); }
+
+private:
+    std::string value_;
+};
+
+#endif
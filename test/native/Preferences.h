@@ -0,0 +1,79 @@
+#ifndef MEOW_NATIVE_PREFERENCES_H
+#define MEOW_NATIVE_PREFERENCES_H
+
+// In-memory Preferences with the NVS behaviour settings.cpp relies on:
+// getString() into a buffer fails when the stored string and its terminator
+// do not fit, and a getter on the wrong type falls back to the default.
+
+#include <map>
+#include <string>
+
+#include "Arduino.h"
+
+class Preferences {
+public:
+    bool begin(const char*, bool = false) { return true; }
+    void end() {}
+    bool clear() {
+        entries_.clear();
+        return true;
+    }
+    bool isKey(const char* key) { return entries_.count(key) != 0; }
+
+    size_t putBool(const char* key, bool value) { return put(key, Type::Bool, value ? "1" : "0"); }
+    size_t putInt(const char* key, int32_t value) { return put(key, Type::Int, std::to_string(value)); }
+    size_t putUInt(const char* key, uint32_t value) { return put(key, Type::UInt, std::to_string(value)); }
+    size_t putString(const char* key, const char* value) { return put(key, Type::Text, value); }
+
+    bool getBool(const char* key, bool fallback = false) {
+        const Entry* entry = find(key, Type::Bool);
+        return entry ? entry->value == "1" : fallback;
+    }
+    int32_t getInt(const char* key, int32_t fallback = 0) {
+        const Entry* entry = find(key, Type::Int);
+        return entry ? static_cast<int32_t>(std::stol(entry->value)) : fallback;
+    }
+    uint32_t getUInt(const char* key, uint32_t fallback = 0) {
+        const Entry* entry = find(key, Type::UInt);
+        return entry ? static_cast<uint32_t>(std::stoul(entry->value)) : fallback;
+    }
+    // Returns the length including the terminator, or 0.
+    size_t getString(const char* key, char* value, size_t maxLength) {
+        const Entry* entry = find(key, Type::Text);
+        if (!entry || entry->value.size() + 1 > maxLength) {
+            return 0;
+        }
+        memcpy(value, entry->value.c_str(), entry->value.size() + 1);
+        return entry->value.size() + 1;
+    }
+    String getString(const char* key, String fallback = String()) {
+        const Entry* entry = find(key, Type::Text);
+        return entry ? String(entry->value.c_str()) : fallback;
+    }
+
+    size_t writes() const { return writes_; }
+
+private:
+    enum class Type { Bool, Int, UInt, Text };
+
+    struct Entry {
+        Type type;
+        std::string value;
+    };
+
+    size_t put(const char* key, Type type, const std::string& value) {
+        entries_[key] = Entry{type, value};
+        writes_++;
+        return value.size();
+    }
+
+    const Entry* find(const char* key, Type type) const {
+        const auto it = entries_.find(key);
+        return it != entries_.end() && it->second.type == type ? &it->second : nullptr;
+    }
+
+    std::map<std::string, Entry> entries_;
+    size_t writes_ = 0;
+};
+
+#endif
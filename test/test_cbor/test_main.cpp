@@ -0,0 +1,225 @@
+// CborWriter and CborScanner, plus encode/decode cost and size against the
+// JSON paths for the status and settings bodies.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "CborScanner.h"
+#include "CborWriter.h"
+#include "settings.h"
+
+namespace {
+
+struct Recorded {
+    std::vector<JsonTokenType> types;
+    std::vector<std::string> keys;
+    std::vector<std::string> texts;
+    std::vector<long> numbers;
+    std::vector<bool> integral;
+};
+
+bool recordToken(void* context, const JsonToken& token) {
+    Recorded* recorded = static_cast<Recorded*>(context);
+    recorded->types.push_back(token.type);
+    const bool hasKey = token.type != JsonTokenType::ObjectEnd && token.type != JsonTokenType::ArrayEnd;
+    recorded->keys.push_back(hasKey ? token.key : "");
+    recorded->texts.push_back(token.type == JsonTokenType::String ? token.text : "");
+    long number = 0;
+    if (token.type == JsonTokenType::Number) {
+        number = token.number;
+    } else if (token.type == JsonTokenType::Bool) {
+        number = token.boolean;
+    }
+    recorded->numbers.push_back(number);
+    recorded->integral.push_back(token.type == JsonTokenType::Number && token.integral);
+    return true;
+}
+
+bool decode(const std::vector<uint8_t>& bytes, Recorded& recorded, JsonError* error = nullptr) {
+    CborScanner scanner(recordToken, &recorded);
+    const bool ok = scanner.feed(bytes.data(), bytes.size()) && scanner.finish();
+    if (error) {
+        *error = scanner.error();
+    }
+    return ok;
+}
+
+template <typename Write>
+std::vector<uint8_t> encode(const Write& write) {
+    char buffer[256];
+    CborWriter out(buffer, sizeof(buffer));
+    write(out);
+    TEST_ASSERT_FALSE(out.overflowed());
+    return std::vector<uint8_t>(buffer, buffer + out.length());
+}
+
+template <typename Writer>
+void writeStatus(Writer& out) {
+    out.beginObject();
+    out.key("led_on");
+    out.boolValue(true);
+    out.key("ssid");
+    out.stringValue("MeowMeow");
+    out.key("mode");
+    out.stringValue("purr");
+    out.key("brightness");
+    out.uintValue(200);
+    out.endObject();
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+// Encodings from RFC 8949 appendix A.
+void test_writer_uses_shortest_heads() {
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.uintValue(23); }) == std::vector<uint8_t>({0x17}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.uintValue(24); }) == std::vector<uint8_t>({0x18, 0x18}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.uintValue(1000); }) == std::vector<uint8_t>({0x19, 0x03, 0xE8}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.uintValue(1000000); }) ==
+                     std::vector<uint8_t>({0x1A, 0x00, 0x0F, 0x42, 0x40}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.intValue(-1); }) == std::vector<uint8_t>({0x20}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.intValue(-1000); }) == std::vector<uint8_t>({0x39, 0x03, 0xE7}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) { out.stringValue("IETF"); }) ==
+                     std::vector<uint8_t>({0x64, 0x49, 0x45, 0x54, 0x46}));
+    TEST_ASSERT_TRUE(encode([](CborWriter& out) {
+                         out.beginArray();
+                         out.boolValue(false);
+                         out.boolValue(true);
+                         out.nullValue();
+                         out.endArray();
+                     }) == std::vector<uint8_t>({0x9F, 0xF4, 0xF5, 0xF6, 0xFF}));
+}
+
+void test_scanner_reads_definite_maps_and_floats() {
+    // {"a": 1, "b": [2, 3], "c": 1.5 (half), "d": 100000.0 (single)}
+    const std::vector<uint8_t> bytes = {0xA4, 0x61, 0x61, 0x01, 0x61, 0x62, 0x82, 0x02, 0x03, 0x61, 0x63,
+                                        0xF9, 0x3E, 0x00, 0x61, 0x64, 0xFA, 0x47, 0xC3, 0x50, 0x00};
+    Recorded recorded = {};
+    TEST_ASSERT_TRUE(decode(bytes, recorded));
+    TEST_ASSERT_EQUAL(9, recorded.types.size());
+    TEST_ASSERT_EQUAL_STRING("a", recorded.keys[1].c_str());
+    TEST_ASSERT_EQUAL(1, recorded.numbers[1]);
+    TEST_ASSERT_TRUE(recorded.types[2] == JsonTokenType::ArrayStart);
+    TEST_ASSERT_EQUAL(3, recorded.numbers[4]);
+    TEST_ASSERT_TRUE(recorded.types[5] == JsonTokenType::ArrayEnd);
+    TEST_ASSERT_EQUAL(1, recorded.numbers[6]);
+    TEST_ASSERT_FALSE(recorded.integral[6]);
+    TEST_ASSERT_EQUAL(100000, recorded.numbers[7]);
+    TEST_ASSERT_TRUE(recorded.integral[7]);
+    TEST_ASSERT_TRUE(recorded.types[8] == JsonTokenType::ObjectEnd);
+}
+
+void test_scanner_skips_tags_and_rejects_byte_strings() {
+    Recorded recorded = {};
+    // 1(1363896240): an epoch time tag around an integer.
+    TEST_ASSERT_TRUE(decode({0xC1, 0x1A, 0x51, 0x4B, 0x67, 0xB0}, recorded));
+    TEST_ASSERT_EQUAL(1363896240, recorded.numbers[0]);
+
+    JsonError error;
+    recorded = {};
+    TEST_ASSERT_FALSE(decode({0x42, 0x01, 0x02}, recorded, &error));
+    recorded = {};
+    // A map key that is not a text string.
+    TEST_ASSERT_FALSE(decode({0xA1, 0x01, 0x02}, recorded, &error));
+    recorded = {};
+    TEST_ASSERT_FALSE(decode({0x82, 0x01}, recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::Incomplete);
+}
+
+void test_cbor_tokens_match_json_tokens() {
+    char json[128];
+    JsonWriter jsonOut(json, sizeof(json));
+    writeStatus(jsonOut);
+    Recorded fromJson = {};
+    JsonScanner jsonScanner(recordToken, &fromJson);
+    TEST_ASSERT_TRUE(jsonScanner.feed(json, jsonOut.length()) && jsonScanner.finish());
+
+    Recorded fromCbor = {};
+    TEST_ASSERT_TRUE(decode(encode([](CborWriter& out) { writeStatus(out); }), fromCbor));
+    TEST_ASSERT_TRUE(fromJson.types == fromCbor.types);
+    TEST_ASSERT_TRUE(fromJson.keys == fromCbor.keys);
+    TEST_ASSERT_TRUE(fromJson.texts == fromCbor.texts);
+    TEST_ASSERT_TRUE(fromJson.numbers == fromCbor.numbers);
+}
+
+template <typename Work>
+double nanosPerRound(int rounds, const Work& work) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        work();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+}
+
+bool countToken(void* context, const JsonToken&) {
+    (*static_cast<size_t*>(context))++;
+    return true;
+}
+
+template <typename Write>
+void benchmarkBody(const char* name, const Write& write) {
+    const int rounds = 100000;
+    char json[1024];
+    char cbor[1024];
+    size_t jsonLength = 0;
+    size_t cborLength = 0;
+    const double jsonEncode = nanosPerRound(rounds, [&]() {
+        JsonWriter out(json, sizeof(json));
+        write(out);
+        jsonLength = out.length();
+    });
+    const double cborEncode = nanosPerRound(rounds, [&]() {
+        CborWriter out(cbor, sizeof(cbor));
+        write(out);
+        cborLength = out.length();
+    });
+
+    size_t jsonTokens = 0;
+    size_t cborTokens = 0;
+    JsonScanner jsonScanner(countToken, &jsonTokens);
+    CborScanner cborScanner(countToken, &cborTokens);
+    const double jsonDecode = nanosPerRound(rounds, [&]() {
+        jsonScanner.reset(countToken, &jsonTokens);
+        jsonScanner.feed(json, jsonLength);
+        jsonScanner.finish();
+    });
+    const double cborDecode = nanosPerRound(rounds, [&]() {
+        cborScanner.reset(countToken, &cborTokens);
+        cborScanner.feed(reinterpret_cast<const uint8_t*>(cbor), cborLength);
+        cborScanner.finish();
+    });
+    TEST_ASSERT_EQUAL(jsonTokens, cborTokens);
+    printf("%-9s %6zu B %8.0f ns %8.0f ns | %6zu B %8.0f ns %8.0f ns\n", name, jsonLength, jsonEncode, jsonDecode,
+           cborLength, cborEncode, cborDecode);
+}
+
+void test_benchmark_cbor_against_json() {
+    Preferences prefs;
+    DeviceSettings settings;
+    loadSettings(prefs, settings);
+    strcpy(settings.wifiSsid, "Meow Net");
+    strcpy(settings.mqttHost, "broker.local");
+
+    printf("%-9s %8s %11s %11s | %8s %11s %11s\n", "body", "JSON", "encode", "decode", "CBOR", "encode", "decode");
+    benchmarkBody("status", [](auto& out) { writeStatus(out); });
+    benchmarkBody("settings", [&](auto& out) { writeSettings(out, settings); });
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_writer_uses_shortest_heads);
+    RUN_TEST(test_scanner_reads_definite_maps_and_floats);
+    RUN_TEST(test_scanner_skips_tags_and_rejects_byte_strings);
+    RUN_TEST(test_cbor_tokens_match_json_tokens);
+    RUN_TEST(test_benchmark_cbor_against_json);
+    return UNITY_END();
+}
@@ -0,0 +1,294 @@
+// CoapMessage parsing and building, the reply size bound, and a round trip
+// over loopback UDP: a client toggles /api/paw with a confirmable POST while
+// another one observes it, the way serviceCoap() answers both.
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "CoapMessage.h"
+#include "JsonWriter.h"
+#include "LatencyHistogram.h"
+#include "settings.h"
+
+namespace {
+
+// A request the way a client library encodes it: Uri-Path "api" "paw",
+// optional Observe, Content-Format and payload.
+size_t buildRequest(uint8_t* out, CoapType type, CoapCode code, uint16_t messageId, uint8_t token, bool observe,
+                    const char* text) {
+    size_t length = 0;
+    out[length++] = static_cast<uint8_t>(1 << 6 | static_cast<uint8_t>(type) << 4 | 1);
+    out[length++] = static_cast<uint8_t>(code);
+    out[length++] = static_cast<uint8_t>(messageId >> 8);
+    out[length++] = static_cast<uint8_t>(messageId & 0xFF);
+    out[length++] = token;
+    uint16_t previous = 0;
+    if (observe) {
+        // Observe (6), empty value: register.
+        out[length++] = 0x60;
+        previous = 6;
+    }
+    out[length++] = static_cast<uint8_t>((11 - previous) << 4 | 3);
+    memcpy(out + length, "api", 3);
+    length += 3;
+    out[length++] = 0x03;
+    memcpy(out + length, "paw", 3);
+    length += 3;
+    if (text) {
+        // Content-Format (12), empty value: text/plain.
+        out[length++] = 0x10;
+        out[length++] = 0xFF;
+        memcpy(out + length, text, strlen(text));
+        length += strlen(text);
+    }
+    return length;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_parse_reads_path_observe_and_payload() {
+    uint8_t packet[64];
+    const size_t length = buildRequest(packet, CoapType::Confirmable, CoapCode::Post, 0x1234, 0xAB, true, "toggle");
+    CoapMessage message;
+    TEST_ASSERT_TRUE(parseCoapMessage(packet, length, message));
+    TEST_ASSERT_TRUE(message.type == CoapType::Confirmable);
+    TEST_ASSERT_TRUE(message.code == CoapCode::Post);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, message.messageId);
+    TEST_ASSERT_EQUAL(1, message.tokenLength);
+    TEST_ASSERT_EQUAL_HEX8(0xAB, message.token[0]);
+    TEST_ASSERT_EQUAL_STRING("api/paw", message.path);
+    TEST_ASSERT_TRUE(message.hasObserve);
+    TEST_ASSERT_EQUAL(COAP_OBSERVE_REGISTER, message.observe);
+    TEST_ASSERT_TRUE(message.hasContentFormat);
+    TEST_ASSERT_EQUAL(COAP_FORMAT_TEXT, message.contentFormat);
+    TEST_ASSERT_EQUAL(6, message.payloadLength);
+    TEST_ASSERT_EQUAL_MEMORY("toggle", message.payload, 6);
+}
+
+void test_parse_flags_unknown_critical_options() {
+    // Header, then If-Match (1), a critical option the codec does not know.
+    const uint8_t packet[] = {0x40, 0x01, 0x00, 0x01, 0x11, 0x00};
+    CoapMessage message;
+    TEST_ASSERT_TRUE(parseCoapMessage(packet, sizeof(packet), message));
+    TEST_ASSERT_TRUE(message.unknownCriticalOption);
+}
+
+// Every option the firmware sets at its widest and the longest settings
+// object as payload: COAP_PACKET_MAX in main.cpp is this sum.
+void test_largest_reply_fits_the_envelope_bound() {
+    static char payload[SETTINGS_JSON_MAX];
+    memset(payload, 'x', sizeof(payload));
+    CoapMessage reply = {};
+    reply.type = CoapType::Acknowledgement;
+    reply.code = CoapCode::Content;
+    reply.tokenLength = COAP_TOKEN_MAX;
+    reply.hasObserve = true;
+    reply.observe = 0xFFFFFF;
+    reply.hasContentFormat = true;
+    reply.contentFormat = 0xFFFF;
+    reply.payload = reinterpret_cast<const uint8_t*>(payload);
+    reply.payloadLength = sizeof(payload);
+
+    static uint8_t packet[COAP_ENVELOPE_MAX + SETTINGS_JSON_MAX];
+    TEST_ASSERT_EQUAL(sizeof(packet), buildCoapMessage(reply, packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL(0, buildCoapMessage(reply, packet, sizeof(packet) - 1));
+
+    CoapMessage parsed;
+    TEST_ASSERT_TRUE(parseCoapMessage(packet, sizeof(packet), parsed));
+    TEST_ASSERT_EQUAL(SETTINGS_JSON_MAX, parsed.payloadLength);
+    TEST_ASSERT_EQUAL(0xFFFFFF, parsed.observe);
+}
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+int openSocket(sockaddr_in& address) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    return fd;
+}
+
+struct Server {
+    int fd;
+    bool lampOn;
+    uint16_t messageId;
+    uint32_t observeSequence;
+    bool hasObserver;
+    sockaddr_in observer;
+    uint8_t observerToken;
+    size_t packetsSent;
+};
+
+size_t encodeStatus(const Server& server, char* out, size_t capacity) {
+    JsonWriter json(out, capacity);
+    json.beginObject();
+    json.key("led_on");
+    json.boolValue(server.lampOn);
+    json.key("ssid");
+    json.stringValue("MeowMeow");
+    json.key("mode");
+    json.stringValue("static");
+    json.key("brightness");
+    json.uintValue(255);
+    json.endObject();
+    return json.length();
+}
+
+void sendTo(Server& server, const CoapMessage& message, const sockaddr_in& to) {
+    uint8_t packet[COAP_ENVELOPE_MAX + 128];
+    const size_t length = buildCoapMessage(message, packet, sizeof(packet));
+    TEST_ASSERT_TRUE(length > 0);
+    sendto(server.fd, packet, length, 0, reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+    server.packetsSent++;
+}
+
+// One datagram through the path handleCoapPacket() takes: parse, apply,
+// answer with the resource, then notify the observer as
+// notifyCoapObservers() does on the same pass.
+void serviceOne(Server& server) {
+    uint8_t packet[COAP_ENVELOPE_MAX + SETTINGS_JSON_MAX];
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    const ssize_t got =
+        recvfrom(server.fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+    TEST_ASSERT_TRUE(got > 0);
+    CoapMessage request;
+    TEST_ASSERT_TRUE(parseCoapMessage(packet, static_cast<size_t>(got), request));
+    TEST_ASSERT_EQUAL_STRING("api/paw", request.path);
+
+    CoapMessage reply = {};
+    reply.type = CoapType::Acknowledgement;
+    reply.messageId = request.messageId;
+    memcpy(reply.token, request.token, request.tokenLength);
+    reply.tokenLength = request.tokenLength;
+    char payload[128];
+    bool changed = false;
+    if (request.code == CoapCode::Get) {
+        reply.code = CoapCode::Content;
+        if (request.hasObserve && request.observe == COAP_OBSERVE_REGISTER) {
+            server.hasObserver = true;
+            server.observer = from;
+            server.observerToken = request.token[0];
+            reply.hasObserve = true;
+            reply.observe = server.observeSequence;
+        }
+    } else {
+        server.lampOn = !server.lampOn;
+        reply.code = CoapCode::Changed;
+        changed = true;
+    }
+    reply.payloadLength = encodeStatus(server, payload, sizeof(payload));
+    reply.payload = reinterpret_cast<const uint8_t*>(payload);
+    reply.hasContentFormat = true;
+    reply.contentFormat = COAP_FORMAT_JSON;
+    sendTo(server, reply, from);
+
+    if (changed && server.hasObserver) {
+        server.observeSequence = (server.observeSequence + 1) & 0xFFFFFF;
+        CoapMessage notification = reply;
+        notification.type = CoapType::NonConfirmable;
+        notification.code = CoapCode::Content;
+        notification.messageId = server.messageId++;
+        notification.token[0] = server.observerToken;
+        notification.hasObserve = true;
+        notification.observe = server.observeSequence;
+        sendTo(server, notification, server.observer);
+    }
+}
+
+CoapMessage receive(int fd, uint8_t* packet, size_t capacity) {
+    const ssize_t got = recv(fd, packet, capacity, 0);
+    CoapMessage message;
+    TEST_ASSERT_TRUE(got > 0 && parseCoapMessage(packet, static_cast<size_t>(got), message));
+    return message;
+}
+
+uint32_t microsSince(Clock::time_point start) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+}
+
+}  // namespace bench
+
+// Loopback UDP on the host: the numbers bound the codec and the request
+// path, not the radio. Packets are counted on the server side.
+void test_benchmark_toggle_round_trip_over_udp() {
+    using namespace bench;
+    sockaddr_in serverAddress;
+    sockaddr_in clientAddress;
+    sockaddr_in observerAddress;
+    Server server = {};
+    server.fd = openSocket(serverAddress);
+    const int client = openSocket(clientAddress);
+    const int observer = openSocket(observerAddress);
+    connect(client, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress));
+    connect(observer, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress));
+
+    uint8_t packet[COAP_ENVELOPE_MAX + SETTINGS_JSON_MAX];
+    size_t length = buildRequest(packet, CoapType::Confirmable, CoapCode::Get, 1, 0x0B, true, nullptr);
+    send(observer, packet, length, 0);
+    serviceOne(server);
+    TEST_ASSERT_TRUE(receive(observer, packet, sizeof(packet)).hasObserve);
+
+    LatencyHistogram roundTrip = {};
+    LatencyHistogram notified = {};
+    const int toggles = 2000;
+    size_t requestBytes = 0;
+    const size_t packetsBefore = server.packetsSent;
+    for (int i = 0; i < toggles; i++) {
+        length = buildRequest(packet, CoapType::Confirmable, CoapCode::Post, static_cast<uint16_t>(i + 2), 0x0C, false,
+                              "toggle");
+        requestBytes = length;
+        const Clock::time_point start = Clock::now();
+        send(client, packet, length, 0);
+        serviceOne(server);
+        const CoapMessage ack = receive(client, packet, sizeof(packet));
+        recordLatency(roundTrip, microsSince(start));
+        TEST_ASSERT_TRUE(ack.type == CoapType::Acknowledgement && ack.code == CoapCode::Changed);
+        TEST_ASSERT_EQUAL(i + 2, ack.messageId);
+        const CoapMessage notification = receive(observer, packet, sizeof(packet));
+        recordLatency(notified, microsSince(start));
+        TEST_ASSERT_EQUAL(i + 1, notification.observe);
+    }
+    const double packetsPerToggle = 1.0 + static_cast<double>(server.packetsSent - packetsBefore) / toggles;
+
+    printf("toggle request %zu B; packets per toggle %.1f (request, ACK, one notification per observer)\n",
+           requestBytes, packetsPerToggle);
+    printf("%-24s p50=%5lu us p99=%5lu us max=%5lu us\n", "POST to ACK",
+           static_cast<unsigned long>(latencyPercentile(roundTrip, 500)),
+           static_cast<unsigned long>(latencyPercentile(roundTrip, 990)), static_cast<unsigned long>(roundTrip.maxUs));
+    printf("%-24s p50=%5lu us p99=%5lu us max=%5lu us\n", "POST to notification",
+           static_cast<unsigned long>(latencyPercentile(notified, 500)),
+           static_cast<unsigned long>(latencyPercentile(notified, 990)), static_cast<unsigned long>(notified.maxUs));
+    TEST_ASSERT_EQUAL(3, static_cast<int>(packetsPerToggle + 0.5));
+
+    close(server.fd);
+    close(client);
+    close(observer);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_reads_path_observe_and_payload);
+    RUN_TEST(test_parse_flags_unknown_critical_options);
+    RUN_TEST(test_largest_reply_fits_the_envelope_bound);
+    RUN_TEST(test_benchmark_toggle_round_trip_over_udp);
+    return UNITY_END();
+}
@@ -0,0 +1,232 @@
+// The effect table: mode names, each built-in effect's timeline, and a
+// ticks-per-second benchmark against the String-comparing
+// updateLampEffect() it replaced.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+
+#include "LampEffects.h"
+#include "LampSimulator.h"
+
+namespace {
+
+long fixedRandom(long min, long) {
+    return min;
+}
+
+EffectState freshState() {
+    EffectState state;
+    resetEffect(state);
+    return state;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_mode_names_round_trip() {
+    for (size_t i = 0; i < LAMP_MODE_COUNT; i++) {
+        LampMode parsed;
+        TEST_ASSERT_TRUE(parseLampMode(lampModeName(static_cast<LampMode>(i)), parsed));
+        TEST_ASSERT_EQUAL(i, static_cast<size_t>(parsed));
+    }
+    LampMode parsed;
+    TEST_ASSERT_FALSE(parseLampMode("Purr", parsed));
+    TEST_ASSERT_FALSE(parseLampMode("", parsed));
+}
+
+void test_static_is_full_and_never_due() {
+    EffectState state = freshState();
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Static, state, 100, fixedRandom));
+    TEST_ASSERT_FALSE(lampEffectSteps(LampMode::Static));
+    TEST_ASSERT_FALSE(lampEffectDue(LampMode::Static, state, 1000000));
+}
+
+void test_blink_toggles_on_its_deadlines() {
+    EffectState state = freshState();
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Blink, state, 1000, fixedRandom));
+    TEST_ASSERT_FALSE(lampEffectDue(LampMode::Blink, state, 1649));
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Blink, state, 1649, fixedRandom));
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_OFF, tickLampEffect(LampMode::Blink, state, 1650, fixedRandom));
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Blink, state, 2300, fixedRandom));
+}
+
+void test_purr_follows_its_pattern() {
+    const uint32_t edges[] = {0, 160, 250, 470, 990, 1150};
+    const uint8_t levels[] = {LAMP_EFFECT_FULL, LAMP_EFFECT_OFF, LAMP_EFFECT_FULL,
+                              LAMP_EFFECT_OFF,  LAMP_EFFECT_FULL, LAMP_EFFECT_OFF};
+    EffectState state = freshState();
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        TEST_ASSERT_EQUAL(levels[i], tickLampEffect(LampMode::Purr, state, edges[i], fixedRandom));
+    }
+}
+
+void test_bzzz_flickers_after_its_gap() {
+    EffectState state = freshState();
+    // With the lowest draw: a 6 s gap, then 3 flickers of 50 ms each way.
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Bzzz, state, 0, fixedRandom));
+    TEST_ASSERT_EQUAL(6000, state.nextMs);
+    uint32_t now = 6000;
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(LAMP_EFFECT_OFF, tickLampEffect(LampMode::Bzzz, state, now, fixedRandom));
+        now += 50;
+        TEST_ASSERT_EQUAL(LAMP_EFFECT_FULL, tickLampEffect(LampMode::Bzzz, state, now, fixedRandom));
+        now += 50;
+    }
+    TEST_ASSERT_EQUAL(now - 50 + 6000, state.nextMs);
+}
+
+// updateLampEffect() before the table, ported to std::string with the
+// output write reduced to a store.
+namespace legacy {
+
+const uint32_t BLINK_ON_MS = 650;
+const uint32_t BLINK_OFF_MS = 650;
+const uint32_t PURR_PATTERN_MS[] = {160, 90, 220, 520};
+const bool PURR_PATTERN_ON[] = {true, false, true, false};
+const size_t PURR_PATTERN_LEN = 4;
+const uint32_t BZZZ_GAP_MIN_MS = 6000;
+const uint32_t BZZZ_GAP_MAX_MS = 14000;
+const uint16_t BZZZ_FLICKER_MIN_MS = 50;
+const uint16_t BZZZ_FLICKER_MAX_MS = 120;
+const uint8_t BZZZ_FLICKER_MIN_COUNT = 3;
+const uint8_t BZZZ_FLICKER_MAX_COUNT = 4;
+
+struct Effect {
+    unsigned long nextMs;
+    int step;
+    int flickersRemaining;
+    bool outputOn;
+};
+
+std::string currentMode;
+Effect effect;
+bool ledOn = true;
+
+void writeLampOutput(bool on) {
+    effect.outputOn = on;
+}
+
+bool isTimeReached(unsigned long now, unsigned long deadline) {
+    return static_cast<long>(now - deadline) >= 0;
+}
+
+void updateLampEffect(unsigned long now) {
+    if (!ledOn) {
+        writeLampOutput(false);
+        return;
+    }
+    if (currentMode == "static") {
+        writeLampOutput(true);
+        return;
+    }
+    if (currentMode == "blink") {
+        if (effect.nextMs == 0) {
+            writeLampOutput(true);
+            effect.nextMs = now + BLINK_ON_MS;
+            return;
+        }
+        if (isTimeReached(now, effect.nextMs)) {
+            if (effect.outputOn) {
+                writeLampOutput(false);
+                effect.nextMs = now + BLINK_OFF_MS;
+            } else {
+                writeLampOutput(true);
+                effect.nextMs = now + BLINK_ON_MS;
+            }
+        }
+        return;
+    }
+    if (currentMode == "purr") {
+        if (effect.nextMs == 0) {
+            effect.step = 0;
+            writeLampOutput(PURR_PATTERN_ON[0]);
+            effect.nextMs = now + PURR_PATTERN_MS[0];
+            return;
+        }
+        if (isTimeReached(now, effect.nextMs)) {
+            effect.step = (effect.step + 1) % static_cast<int>(PURR_PATTERN_LEN);
+            writeLampOutput(PURR_PATTERN_ON[effect.step]);
+            effect.nextMs = now + PURR_PATTERN_MS[effect.step];
+        }
+        return;
+    }
+    if (currentMode == "bzzz") {
+        if (effect.nextMs == 0) {
+            writeLampOutput(true);
+            effect.flickersRemaining = 0;
+            effect.nextMs = now + simulatedRandom(BZZZ_GAP_MIN_MS, BZZZ_GAP_MAX_MS + 1);
+            return;
+        }
+        if (effect.flickersRemaining == 0) {
+            if (isTimeReached(now, effect.nextMs)) {
+                effect.flickersRemaining =
+                    static_cast<int>(simulatedRandom(BZZZ_FLICKER_MIN_COUNT, BZZZ_FLICKER_MAX_COUNT + 1)) * 2;
+                effect.nextMs = now;
+            } else {
+                writeLampOutput(true);
+                return;
+            }
+        }
+        if (isTimeReached(now, effect.nextMs)) {
+            writeLampOutput(!effect.outputOn);
+            effect.flickersRemaining--;
+            effect.nextMs = now + simulatedRandom(BZZZ_FLICKER_MIN_MS, BZZZ_FLICKER_MAX_MS + 1);
+            if (effect.flickersRemaining <= 0) {
+                writeLampOutput(true);
+                effect.nextMs = now + simulatedRandom(BZZZ_GAP_MIN_MS, BZZZ_GAP_MAX_MS + 1);
+            }
+        }
+        return;
+    }
+    writeLampOutput(true);
+}
+
+}  // namespace legacy
+
+// loop() ticks far more often than edges fall due, so the clock advances by
+// 1 ms every tick and most ticks only compare the deadline.
+void test_benchmark_ticks_per_second() {
+    const uint32_t ticks = 20000000;
+    volatile uint8_t sink = 0;
+    printf("%-8s %14s %14s %8s\n", "mode", "legacy Mtick/s", "table Mtick/s", "speedup");
+    for (size_t i = 0; i < LAMP_MODE_COUNT; i++) {
+        const LampMode mode = static_cast<LampMode>(i);
+        legacy::currentMode = lampModeName(mode);
+        legacy::effect = {};
+        seedSimulatedRandom(7);
+        const auto legacyStart = std::chrono::steady_clock::now();
+        for (uint32_t now = 1; now <= ticks; now++) {
+            legacy::updateLampEffect(now);
+            sink = sink + legacy::effect.outputOn;
+        }
+        const auto tableStart = std::chrono::steady_clock::now();
+        EffectState state = freshState();
+        seedSimulatedRandom(7);
+        for (uint32_t now = 1; now <= ticks; now++) {
+            sink = sink + tickLampEffect(mode, state, now, simulatedRandom);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const double legacySeconds = std::chrono::duration<double>(tableStart - legacyStart).count();
+        const double tableSeconds = std::chrono::duration<double>(end - tableStart).count();
+        printf("%-8s %14.0f %14.0f %7.1fx\n", lampModeName(mode), ticks / legacySeconds / 1e6,
+               ticks / tableSeconds / 1e6, legacySeconds / tableSeconds);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_mode_names_round_trip);
+    RUN_TEST(test_static_is_full_and_never_due);
+    RUN_TEST(test_blink_toggles_on_its_deadlines);
+    RUN_TEST(test_purr_follows_its_pattern);
+    RUN_TEST(test_bzzz_flickers_after_its_gap);
+    RUN_TEST(test_benchmark_ticks_per_second);
+    return UNITY_END();
+}
@@ -0,0 +1,185 @@
+// LampFade and the blend into the gamma table, a per-frame cost benchmark,
+// and a frame-timing trace of a fade driven at LAMP_FADE_FRAME_MS by a
+// periodic thread, the way the esp_timer drives onFadeFrame() on the device.
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+
+#include "LampEffects.h"
+#include "LampFade.h"
+#include "LampGamma.h"
+#include "LampSimulator.h"
+#include "LatencyHistogram.h"
+
+namespace {
+
+// One onFadeFrame(): advance, tick the outgoing effect, blend, map to duty.
+struct Crossfade {
+    LampFade fade;
+    // False for a fade up from off, like FadeSource::lit.
+    bool fromLit;
+    LampMode fromMode;
+    EffectState fromState;
+    LampMode toMode;
+    EffectState toState;
+};
+
+void startCrossfade(Crossfade& crossfade, LampMode from, LampMode to, uint32_t durationMs) {
+    crossfade.fromLit = true;
+    crossfade.fromMode = from;
+    crossfade.toMode = to;
+    resetEffect(crossfade.fromState);
+    resetEffect(crossfade.toState);
+    startLampFade(crossfade.fade, durationMs, LAMP_FADE_FRAME_MS);
+}
+
+uint16_t fadeFrame(Crossfade& crossfade, uint32_t nowMs) {
+    const uint32_t weight = advanceLampFade(crossfade.fade);
+    const uint16_t from =
+        crossfade.fromLit ? lampLevel(tickLampEffect(crossfade.fromMode, crossfade.fromState, nowMs, simulatedRandom))
+                          : 0;
+    const uint16_t to = lampLevel(tickLampEffect(crossfade.toMode, crossfade.toState, nowMs, simulatedRandom));
+    return lampDutyForLevel(blendLampLevel(from, to, weight));
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_fade_lands_on_target_after_duration_frames() {
+    LampFade fade;
+    startLampFade(fade, 300, LAMP_FADE_FRAME_MS);
+    uint32_t frames = 0;
+    uint32_t weight = 0;
+    while (fade.active) {
+        const uint32_t next = advanceLampFade(fade);
+        TEST_ASSERT_TRUE(next > weight);
+        weight = next;
+        frames++;
+    }
+    TEST_ASSERT_EQUAL(30, frames);
+    TEST_ASSERT_EQUAL(LAMP_FADE_ONE, weight);
+}
+
+void test_short_fade_takes_one_frame() {
+    LampFade fade;
+    startLampFade(fade, 3, LAMP_FADE_FRAME_MS);
+    TEST_ASSERT_EQUAL(LAMP_FADE_ONE, advanceLampFade(fade));
+    TEST_ASSERT_FALSE(fade.active);
+}
+
+void test_blend_hits_endpoints_and_duty_never_drops() {
+    TEST_ASSERT_EQUAL(0, blendLampLevel(0, LAMP_LEVEL_MAX, 0));
+    TEST_ASSERT_EQUAL(LAMP_LEVEL_MAX, blendLampLevel(0, LAMP_LEVEL_MAX, LAMP_FADE_ONE));
+    TEST_ASSERT_EQUAL(LAMP_LEVEL_MAX, blendLampLevel(LAMP_LEVEL_MAX, LAMP_LEVEL_MAX, LAMP_FADE_ONE / 3));
+
+    LampFade fade;
+    startLampFade(fade, 2000, LAMP_FADE_FRAME_MS);
+    uint16_t duty = lampDutyForLevel(0);
+    while (fade.active) {
+        const uint16_t next = lampDutyForLevel(blendLampLevel(0, LAMP_LEVEL_MAX, advanceLampFade(fade)));
+        TEST_ASSERT_TRUE(next >= duty);
+        duty = next;
+    }
+    TEST_ASSERT_EQUAL(LAMP_PWM_MAX_DUTY, duty);
+}
+
+void test_crossfade_ends_on_the_incoming_effect() {
+    Crossfade crossfade;
+    seedSimulatedRandom(1);
+    startCrossfade(crossfade, LampMode::Purr, LampMode::Static, 500);
+    uint32_t now = 0;
+    uint16_t duty = 0;
+    while (crossfade.fade.active) {
+        now += LAMP_FADE_FRAME_MS;
+        duty = fadeFrame(crossfade, now);
+    }
+    TEST_ASSERT_EQUAL(LAMP_PWM_MAX_DUTY, duty);
+}
+
+// The frame cost must not depend on the fade length.
+void test_benchmark_frame_cost() {
+    const uint32_t durations[] = {100, 1000, 10000};
+    const int frames = 5000000;
+    volatile uint16_t sink = 0;
+    printf("%10s %12s\n", "fade ms", "ns/frame");
+    for (uint32_t duration : durations) {
+        Crossfade crossfade;
+        seedSimulatedRandom(3);
+        startCrossfade(crossfade, LampMode::Bzzz, LampMode::Purr, duration);
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            if (!crossfade.fade.active) {
+                startLampFade(crossfade.fade, duration, LAMP_FADE_FRAME_MS);
+            }
+            sink = sink + fadeFrame(crossfade, static_cast<uint32_t>(i) * LAMP_FADE_FRAME_MS);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        printf("%10lu %12.1f\n", static_cast<unsigned long>(duration),
+               std::chrono::duration<double, std::nano>(end - start).count() / frames);
+    }
+}
+
+// A 1 s fade up from off on a thread woken every LAMP_FADE_FRAME_MS. Prints
+// the first frames and the jitter of the wakeups (|actual -
+// LAMP_FADE_FRAME_MS| between frames), which on the device is
+// fadeTiming.worstErrorUs. The host scheduler sets the jitter here, so only
+// the frame count is asserted.
+void test_frame_timing_trace() {
+    using Clock = std::chrono::steady_clock;
+    Crossfade crossfade;
+    seedSimulatedRandom(5);
+    startCrossfade(crossfade, LampMode::Static, LampMode::Static, 1000);
+    crossfade.fromLit = false;
+
+    LatencyHistogram jitter = {};
+    LatencyHistogram cost = {};
+    uint32_t frames = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start;
+    Clock::time_point last = start;
+    printf("%6s %8s %8s %6s\n", "frame", "t_us", "weight", "duty");
+    while (crossfade.fade.active) {
+        deadline += std::chrono::milliseconds(LAMP_FADE_FRAME_MS);
+        std::this_thread::sleep_until(deadline);
+        const Clock::time_point woke = Clock::now();
+        const uint32_t nowMs =
+            static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(woke - start).count());
+        const uint16_t duty = fadeFrame(crossfade, nowMs);
+        const Clock::time_point done = Clock::now();
+
+        const int64_t gapUs = std::chrono::duration_cast<std::chrono::microseconds>(woke - last).count();
+        const int64_t error = gapUs - static_cast<int64_t>(LAMP_FADE_FRAME_MS) * 1000;
+        recordLatency(jitter, static_cast<uint32_t>(error < 0 ? -error : error));
+        const int64_t costUs = std::chrono::duration_cast<std::chrono::microseconds>(done - woke).count();
+        recordLatency(cost, static_cast<uint32_t>(costUs));
+        last = woke;
+        if (frames < 8 || !crossfade.fade.active) {
+            printf("%6lu %8lld %8lu %6u\n", static_cast<unsigned long>(frames),
+                   static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(woke - start).count()),
+                   static_cast<unsigned long>(crossfade.fade.weight), duty);
+        }
+        frames++;
+    }
+    printf("jitter  p50=%lu us p99=%lu us max=%lu us\n", static_cast<unsigned long>(latencyPercentile(jitter, 500)),
+           static_cast<unsigned long>(latencyPercentile(jitter, 990)), static_cast<unsigned long>(jitter.maxUs));
+    printf("compute p99=%lu us max=%lu us\n", static_cast<unsigned long>(latencyPercentile(cost, 990)),
+           static_cast<unsigned long>(cost.maxUs));
+    TEST_ASSERT_EQUAL(100, frames);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_fade_lands_on_target_after_duration_frames);
+    RUN_TEST(test_short_fade_takes_one_frame);
+    RUN_TEST(test_blend_hits_endpoints_and_duty_never_drops);
+    RUN_TEST(test_crossfade_ends_on_the_incoming_effect);
+    RUN_TEST(test_benchmark_frame_cost);
+    RUN_TEST(test_frame_timing_trace);
+    return UNITY_END();
+}
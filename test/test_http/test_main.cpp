@@ -0,0 +1,584 @@
+// FileStream, FileTransfers and RequestGate, then a load test of phones
+// fetching index.html at once. The old path parsed one connection at a time
+// and sent each file with a blocking send_P() before loop() could do
+// anything else. The firmware now gates each connection on a complete
+// request head and moves up to FILE_TRANSFERS_MAX downloads along per pass,
+// answering the rest 503 with Retry-After. The load test runs that code over
+// socketpairs. The test only stands in for WebServer's accept and head
+// parsing, and for the WiFiClient handling around the pool. A toggle sent
+// every few milliseconds measures how long loop() is held up.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileStream.h"
+#include "FileTransfers.h"
+#include "RequestGate.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The gzip'd index.html in lib/WebService/web_files.h.
+const size_t PAGE_BYTES = 78712;
+
+// A phone on Wi-Fi reads in chunks with gaps; the server side gets a socket
+// buffer about the size of lwIP's send window.
+const size_t READ_CHUNK = 4096;
+const auto READ_GAP = std::chrono::microseconds(500);
+const int SEND_BUFFER = 5744;
+// Retry-After is FILE_TRANSFER_RETRY_S on the lamp; scaled down so the test
+// stays short.
+const auto RETRY_AFTER = std::chrono::milliseconds(20);
+const auto TOGGLE_EVERY = std::chrono::milliseconds(2);
+const char REQUEST[] = "GET /index.html HTTP/1.1\r\nHost: 192.168.4.1\r\nAccept-Encoding: gzip\r\n\r\n";
+
+uint8_t page[PAGE_BYTES];
+
+void fillPage() {
+    uint32_t state = 0x12345678;
+    for (uint8_t& byte : page) {
+        state = state * 1664525 + 1013904223;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+}
+
+uint32_t microsSince(Clock::time_point start) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+}
+
+uint32_t millisSince(Clock::time_point start) {
+    return microsSince(start) / 1000;
+}
+
+// Reads what is there without waiting.
+size_t drain(int fd, uint8_t* buffer, size_t length) {
+    const ssize_t got = recv(fd, buffer, length, MSG_DONTWAIT);
+    return got > 0 ? static_cast<size_t>(got) : 0;
+}
+
+void connectedPair(int fds[2]) {
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &SEND_BUFFER, sizeof(SEND_BUFFER));
+}
+
+// Reads a whole response until the server closes. Returns the status code.
+int readResponse(int fd, std::vector<uint8_t>& body, std::string* head = nullptr) {
+    std::vector<uint8_t> response;
+    uint8_t chunk[READ_CHUNK];
+    ssize_t got;
+    while ((got = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        response.insert(response.end(), chunk, chunk + got);
+        std::this_thread::sleep_for(READ_GAP);
+    }
+    const char* text = reinterpret_cast<const char*>(response.data());
+    const char* end = static_cast<const char*>(memmem(text, response.size(), "\r\n\r\n", 4));
+    if (response.size() < 12 || end == nullptr) {
+        return 0;
+    }
+    if (head != nullptr) {
+        head->assign(text, end + 4);
+    }
+    body.assign(response.begin() + (end + 4 - text), response.end());
+    return atoi(text + 9);
+}
+
+// Takes the request head off the socket, the way WebServer parses it.
+void consumeHead(int fd) {
+    char head[REQUEST_HEAD_PEEK_MAX];
+    const ssize_t got = recv(fd, head, sizeof(head), MSG_PEEK | MSG_DONTWAIT);
+    const char* end = got > 0 ? static_cast<const char*>(memmem(head, got, "\r\n\r\n", 4)) : nullptr;
+    if (end != nullptr) {
+        recv(fd, head, static_cast<size_t>(end + 4 - head), 0);
+    }
+}
+
+// The listening socket: clients hand in their server end, the pass takes
+// them in order.
+struct Listener {
+    std::mutex lock;
+    std::deque<int> pending;
+
+    int connect() {
+        int fds[2];
+        connectedPair(fds);
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(fds[0]);
+        return fds[1];
+    }
+
+    int accept() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (pending.empty()) {
+            return -1;
+        }
+        const int fd = pending.front();
+        pending.pop_front();
+        return fd;
+    }
+
+    bool waiting() {
+        std::lock_guard<std::mutex> guard(lock);
+        return !pending.empty();
+    }
+};
+
+// Percentile of `samples` in microseconds; the runs are short enough to keep
+// every sample, so this is exact rather than a histogram bucket edge.
+uint32_t percentile(std::vector<uint32_t> samples, uint16_t perMille) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * perMille / 1000];
+}
+
+struct LoadResult {
+    std::vector<uint32_t> lastByte;
+    std::vector<uint32_t> toggle;
+    uint32_t refused;
+    uint32_t corrupt;
+    double seconds;
+};
+
+// Every phone requests the page at once and retries after a 503. With
+// `idlePhone` one more connection comes first and never sends a request,
+// like a browser's spare preconnection. The server loop also reads toggles
+// from a socket written every TOGGLE_EVERY.
+template <typename Server>
+LoadResult runLoad(size_t phones, bool idlePhone, Server& server) {
+    LoadResult result;
+    Listener listener;
+    std::atomic<size_t> finished{0};
+    std::atomic<uint32_t> refused{0};
+    std::atomic<uint32_t> corrupt{0};
+    std::mutex resultLock;
+
+    int toggleFds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, toggleFds));
+    const int idleFd = idlePhone ? listener.connect() : -1;
+
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < phones; i++) {
+        clients.emplace_back([&]() {
+            std::vector<uint8_t> body;
+            int status;
+            while (true) {
+                const int fd = listener.connect();
+                TEST_ASSERT_EQUAL(sizeof(REQUEST) - 1, send(fd, REQUEST, sizeof(REQUEST) - 1, 0));
+                status = readResponse(fd, body);
+                close(fd);
+                if (status != 503) {
+                    break;
+                }
+                refused.fetch_add(1);
+                std::this_thread::sleep_for(RETRY_AFTER);
+            }
+            if (status != 200 || body.size() != PAGE_BYTES || memcmp(body.data(), page, PAGE_BYTES) != 0) {
+                corrupt.fetch_add(1);
+            }
+            const uint32_t us = microsSince(start);
+            std::lock_guard<std::mutex> guard(resultLock);
+            result.lastByte.push_back(us);
+            finished.fetch_add(1);
+        });
+    }
+    std::thread toggler([&]() {
+        while (finished.load() < phones) {
+            const Clock::time_point sentAt = Clock::now();
+            TEST_ASSERT_EQUAL(sizeof(sentAt), send(toggleFds[1], &sentAt, sizeof(sentAt), 0));
+            std::this_thread::sleep_for(TOGGLE_EVERY);
+        }
+    });
+
+    while (finished.load() < phones) {
+        Clock::time_point sentAt;
+        while (drain(toggleFds[0], reinterpret_cast<uint8_t*>(&sentAt), sizeof(sentAt)) == sizeof(sentAt)) {
+            result.toggle.push_back(microsSince(sentAt));
+        }
+        server.pass(listener, millisSince(start));
+        std::this_thread::yield();
+    }
+    toggler.join();
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    server.finish();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.refused = refused.load();
+    result.corrupt = corrupt.load();
+    if (idleFd >= 0) {
+        close(idleFd);
+    }
+    close(toggleFds[0]);
+    close(toggleFds[1]);
+    return result;
+}
+
+// The one connection WebServer works on, which the pass keeps between calls.
+struct Connection {
+    int fd = -1;
+    uint32_t acceptedMs = 0;
+
+    bool take(Listener& listener, uint32_t nowMs) {
+        if (fd < 0) {
+            fd = listener.accept();
+            acceptedMs = nowMs;
+        }
+        return fd >= 0;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+// The server before this change, replayed: WebServer waits up to its 5 s
+// limit for a head on its one connection, then the handler sends the whole
+// file with a blocking send_P().
+struct BlockingServer {
+    Connection current;
+
+    void pass(Listener& listener, uint32_t nowMs) {
+        if (!current.take(listener, nowMs)) {
+            return;
+        }
+        char head[REQUEST_HEAD_PEEK_MAX];
+        const ssize_t got = recv(current.fd, head, sizeof(head), MSG_PEEK | MSG_DONTWAIT);
+        if (got > 0 && requestHeadComplete(head, static_cast<size_t>(got))) {
+            consumeHead(current.fd);
+            FileStream stream;
+            TEST_ASSERT_TRUE(startFileStream(stream, "text/html", page, PAGE_BYTES));
+            bool progressed;
+            while (advanceFileStream(stream, current.fd, progressed) == FileStreamStatus::Sending) {
+                std::this_thread::yield();
+            }
+            current.close();
+        } else if (got == 0 || nowMs - current.acceptedMs >= REQUEST_HEAD_WAIT_MS) {
+            current.close();
+        }
+    }
+
+    void finish() {
+        current.close();
+    }
+};
+
+// The firmware: GatedWebServer::serve(), then startFileTransfer() or the
+// refusal in serveWebFile(), then serviceFileTransfers().
+struct FirmwareServer {
+    Connection current;
+    FileTransfers transfers = {};
+
+    void pass(Listener& listener, uint32_t nowMs) {
+        if (current.take(listener, nowMs)) {
+            switch (gateRequest(current.fd, nowMs - current.acceptedMs, listener.waiting())) {
+                case RequestGate::Wait:
+                    break;
+                case RequestGate::Drop:
+                    current.close();
+                    break;
+                case RequestGate::Serve:
+                    consumeHead(current.fd);
+                    serveFile(current.fd, nowMs);
+                    current.fd = -1;
+                    break;
+            }
+        }
+        for (FileTransfer& transfer : transfers.slots) {
+            if (transfer.active && !advanceFileTransfer(transfer, nowMs)) {
+                closeTransfer(transfer);
+            }
+        }
+    }
+
+    void serveFile(int fd, uint32_t nowMs) {
+        const int slot = findFreeFileTransfer(transfers);
+        if (slot < 0 || !beginFileTransfer(transfers.slots[slot], fd, "text/html", page, PAGE_BYTES, true, nowMs)) {
+            refuseFileTransfer(transfers, fd);
+            close(fd);
+            return;
+        }
+        if (!advanceFileTransfer(transfers.slots[slot], nowMs)) {
+            closeTransfer(transfers.slots[slot]);
+        }
+    }
+
+    void closeTransfer(FileTransfer& transfer) {
+        close(transfer.fd);
+        transfer.active = false;
+    }
+
+    void finish() {
+        current.close();
+        for (FileTransfer& transfer : transfers.slots) {
+            TEST_ASSERT_FALSE(transfer.active);
+        }
+    }
+};
+
+void printResult(const char* name, size_t phones, bool idlePhone, const LoadResult& result) {
+    printf("%-9s %2u phones%s %8.0f KB/s  last byte p50=%6.1f p99=%6.1f ms  toggle p50=%6lu p99=%6lu us  503s=%lu\n",
+           name, static_cast<unsigned>(phones), idlePhone ? " +idle" : "      ",
+           phones * PAGE_BYTES / 1024.0 / result.seconds, percentile(result.lastByte, 500) / 1000.0,
+           percentile(result.lastByte, 990) / 1000.0, static_cast<unsigned long>(percentile(result.toggle, 500)),
+           static_cast<unsigned long>(percentile(result.toggle, 990)), static_cast<unsigned long>(result.refused));
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_header_carries_type_and_length() {
+    FileStream stream;
+    fillPage();
+    TEST_ASSERT_TRUE(startFileStream(stream, "text/css", page, 2789));
+    const char* expected = "HTTP/1.1 200 OK\r\nContent-Type: text/css\r\nContent-Length: 2789\r\n"
+                           "Content-Encoding: gzip\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(expected), stream.headLength);
+    TEST_ASSERT_EQUAL(0, memcmp(expected, stream.head, stream.headLength));
+
+    char longType[FILE_STREAM_HEAD_MAX];
+    memset(longType, 'x', sizeof(longType) - 1);
+    longType[sizeof(longType) - 1] = '\0';
+    TEST_ASSERT_FALSE(startFileStream(stream, longType, page, 10));
+}
+
+// A full socket buffer leaves the stream where it stopped; reading some
+// lets the next advance carry on until every byte arrived once.
+void test_stream_resumes_after_a_full_socket() {
+    fillPage();
+    int fds[2];
+    connectedPair(fds);
+    FileStream stream;
+    TEST_ASSERT_TRUE(startFileStream(stream, "text/html", page, PAGE_BYTES));
+    std::vector<uint8_t> received;
+    uint8_t chunk[READ_CHUNK];
+    bool progressed = false;
+    int stalls = 0;
+    FileStreamStatus status;
+    while ((status = advanceFileStream(stream, fds[0], progressed)) == FileStreamStatus::Sending) {
+        if (!progressed) {
+            stalls++;
+        }
+        const size_t got = drain(fds[1], chunk, sizeof(chunk));
+        received.insert(received.end(), chunk, chunk + got);
+    }
+    TEST_ASSERT_TRUE(status == FileStreamStatus::Done);
+    TEST_ASSERT_TRUE(stalls > 0);
+    close(fds[0]);
+    size_t got;
+    while ((got = drain(fds[1], chunk, sizeof(chunk))) > 0) {
+        received.insert(received.end(), chunk, chunk + got);
+    }
+    close(fds[1]);
+    TEST_ASSERT_EQUAL(stream.headLength + PAGE_BYTES, received.size());
+    TEST_ASSERT_EQUAL(0, memcmp(stream.head, received.data(), stream.headLength));
+    TEST_ASSERT_EQUAL(0, memcmp(page, received.data() + stream.headLength, PAGE_BYTES));
+}
+
+void test_head_reply_stops_after_the_header() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    FileStream stream;
+    TEST_ASSERT_TRUE(startFileStream(stream, "text/html", page, PAGE_BYTES, false));
+    TEST_ASSERT_NOT_NULL(strstr(stream.head, "Content-Length: 78712\r\n"));
+    bool progressed;
+    TEST_ASSERT_TRUE(advanceFileStream(stream, fds[0], progressed) == FileStreamStatus::Done);
+    TEST_ASSERT_TRUE(progressed);
+    uint8_t chunk[READ_CHUNK];
+    TEST_ASSERT_EQUAL(stream.headLength, drain(fds[1], chunk, sizeof(chunk)));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_closed_peer_fails_the_stream() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    close(fds[1]);
+    FileStream stream;
+    TEST_ASSERT_TRUE(startFileStream(stream, "text/html", page, PAGE_BYTES));
+    bool progressed;
+    TEST_ASSERT_TRUE(advanceFileStream(stream, fds[0], progressed) == FileStreamStatus::Failed);
+    close(fds[0]);
+}
+
+void test_transfers_fill_every_slot_then_free_them() {
+    fillPage();
+    FileTransfers transfers = {};
+    int peers[FILE_TRANSFERS_MAX];
+    for (uint8_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        TEST_ASSERT_EQUAL(i, findFreeFileTransfer(transfers));
+        int fds[2];
+        connectedPair(fds);
+        peers[i] = fds[1];
+        TEST_ASSERT_TRUE(beginFileTransfer(transfers.slots[i], fds[0], "text/html", page, PAGE_BYTES, true, 0));
+        TEST_ASSERT_TRUE(advanceFileTransfer(transfers.slots[i], 0));
+    }
+    TEST_ASSERT_EQUAL(-1, findFreeFileTransfer(transfers));
+
+    // Reading keeps a transfer going; the one nobody reads stalls out.
+    uint8_t chunk[READ_CHUNK];
+    uint32_t now = 0;
+    while (now < FILE_TRANSFER_STALL_MS && advanceFileTransfer(transfers.slots[0], now)) {
+        now += 100;
+        drain(peers[0], chunk, sizeof(chunk));
+    }
+    TEST_ASSERT_TRUE(now < FILE_TRANSFER_STALL_MS);
+    TEST_ASSERT_TRUE(advanceFileTransfer(transfers.slots[1], FILE_TRANSFER_STALL_MS - 1));
+    TEST_ASSERT_FALSE(advanceFileTransfer(transfers.slots[1], FILE_TRANSFER_STALL_MS));
+
+    // The caller closes the socket and frees the slot.
+    for (uint8_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        close(transfers.slots[i].fd);
+        close(peers[i]);
+    }
+    transfers.slots[1].active = false;
+    TEST_ASSERT_EQUAL(1, findFreeFileTransfer(transfers));
+}
+
+void test_refusal_is_a_complete_503() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    FileTransfers transfers = {};
+    refuseFileTransfer(transfers, fds[0]);
+    close(fds[0]);
+    TEST_ASSERT_EQUAL(1, transfers.refused);
+    std::vector<uint8_t> body;
+    std::string head;
+    TEST_ASSERT_EQUAL(503, readResponse(fds[1], body, &head));
+    close(fds[1]);
+    char retry[32];
+    snprintf(retry, sizeof(retry), "Retry-After: %u\r\n", static_cast<unsigned>(FILE_TRANSFER_RETRY_S));
+    TEST_ASSERT_NOT_NULL(strstr(head.c_str(), retry));
+    char length[32];
+    snprintf(length, sizeof(length), "Content-Length: %u\r\n", static_cast<unsigned>(body.size()));
+    TEST_ASSERT_NOT_NULL(strstr(head.c_str(), length));
+}
+
+void test_head_needs_the_blank_line() {
+    TEST_ASSERT_TRUE(requestHeadComplete(REQUEST, sizeof(REQUEST) - 1));
+    TEST_ASSERT_FALSE(requestHeadComplete(REQUEST, sizeof(REQUEST) - 2));
+    TEST_ASSERT_FALSE(requestHeadComplete("GET / HTTP/1.1\r\n", 16));
+    TEST_ASSERT_FALSE(requestHeadComplete("GET / HTTP/1.1\n\n", 16));
+    TEST_ASSERT_FALSE(requestHeadComplete("", 0));
+}
+
+void test_gate_waits_for_a_whole_head() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    TEST_ASSERT_TRUE(gateRequest(fds[0], 0, false) == RequestGate::Wait);
+    // Half a head keeps its connection while others wait, up to the limit.
+    send(fds[1], REQUEST, 20, 0);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_IDLE_MS * 4, true) == RequestGate::Wait);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_HEAD_WAIT_MS, false) == RequestGate::Drop);
+    send(fds[1], REQUEST + 20, sizeof(REQUEST) - 21, 0);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], 0, true) == RequestGate::Serve);
+    // Peeking leaves the whole head for WebServer.
+    char head[sizeof(REQUEST)];
+    TEST_ASSERT_EQUAL(sizeof(REQUEST) - 1, recv(fds[0], head, sizeof(head), MSG_DONTWAIT));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_gate_drops_idle_and_closed_connections() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_IDLE_MS * 10, false) == RequestGate::Wait);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_IDLE_MS - 1, true) == RequestGate::Wait);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_IDLE_MS, true) == RequestGate::Drop);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], REQUEST_HEAD_WAIT_MS, false) == RequestGate::Drop);
+    close(fds[1]);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], 0, false) == RequestGate::Drop);
+    close(fds[0]);
+}
+
+void test_gate_hands_over_an_oversized_head() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::string head = "GET / HTTP/1.1\r\nCookie: ";
+    head.append(REQUEST_HEAD_PEEK_MAX, 'c');
+    send(fds[1], head.data(), head.size(), 0);
+    TEST_ASSERT_TRUE(gateRequest(fds[0], 0, false) == RequestGate::Serve);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Host sockets and scaled-down Retry-After, so the absolute times are not
+// the lamp's; the comparison is. Every phone must get the page intact, and
+// with the firmware a toggle never waits behind a whole download.
+void test_load_blocking_server_against_the_firmware() {
+    fillPage();
+    const size_t phoneCounts[] = {1, 4, FILE_TRANSFERS_MAX, FILE_TRANSFERS_MAX + 4};
+    for (size_t phones : phoneCounts) {
+        BlockingServer blockingServer;
+        const LoadResult blocking = runLoad(phones, false, blockingServer);
+        printResult("blocking", phones, false, blocking);
+        FirmwareServer firmwareServer;
+        const LoadResult firmware = runLoad(phones, false, firmwareServer);
+        printResult("firmware", phones, false, firmware);
+
+        TEST_ASSERT_EQUAL(0, blocking.corrupt);
+        TEST_ASSERT_EQUAL(0, firmware.corrupt);
+        TEST_ASSERT_EQUAL(phones, firmware.lastByte.size());
+        if (phones <= FILE_TRANSFERS_MAX) {
+            TEST_ASSERT_EQUAL(0, firmware.refused);
+        }
+        if (phones > 1) {
+            TEST_ASSERT_TRUE(percentile(firmware.toggle, 990) < percentile(blocking.toggle, 990));
+        }
+    }
+}
+
+// A spare connection that never sends a request held the old server for
+// its whole head timeout; the gate lets it go once others queue behind it.
+void test_load_with_an_idle_connection() {
+    fillPage();
+    BlockingServer blockingServer;
+    const LoadResult blocking = runLoad(FILE_TRANSFERS_MAX, true, blockingServer);
+    printResult("blocking", FILE_TRANSFERS_MAX, true, blocking);
+    FirmwareServer firmwareServer;
+    const LoadResult firmware = runLoad(FILE_TRANSFERS_MAX, true, firmwareServer);
+    printResult("firmware", FILE_TRANSFERS_MAX, true, firmware);
+
+    TEST_ASSERT_EQUAL(0, blocking.corrupt);
+    TEST_ASSERT_EQUAL(0, firmware.corrupt);
+    TEST_ASSERT_TRUE(percentile(blocking.lastByte, 0) >= REQUEST_HEAD_WAIT_MS * 1000);
+    TEST_ASSERT_TRUE(percentile(firmware.lastByte, 990) < REQUEST_HEAD_WAIT_MS * 1000);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_header_carries_type_and_length);
+    RUN_TEST(test_stream_resumes_after_a_full_socket);
+    RUN_TEST(test_head_reply_stops_after_the_header);
+    RUN_TEST(test_closed_peer_fails_the_stream);
+    RUN_TEST(test_transfers_fill_every_slot_then_free_them);
+    RUN_TEST(test_refusal_is_a_complete_503);
+    RUN_TEST(test_head_needs_the_blank_line);
+    RUN_TEST(test_gate_waits_for_a_whole_head);
+    RUN_TEST(test_gate_drops_idle_and_closed_connections);
+    RUN_TEST(test_gate_hands_over_an_oversized_head);
+    RUN_TEST(test_load_blocking_server_against_the_firmware);
+    RUN_TEST(test_load_with_an_idle_connection);
+    return UNITY_END();
+}
@@ -0,0 +1,359 @@
+// JsonScanner and JsonWriter, plus a benchmark of the scanner against the
+// per-key String helpers it replaced in handleSaveSettings().
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "JsonScanner.h"
+#include "JsonWriter.h"
+
+namespace {
+
+struct Recorded {
+    std::vector<JsonTokenType> types;
+    std::vector<std::string> keys;
+    std::vector<std::string> texts;
+    std::vector<long> numbers;
+    bool rejectKey;
+};
+
+bool recordToken(void* context, const JsonToken& token) {
+    Recorded* recorded = static_cast<Recorded*>(context);
+    recorded->types.push_back(token.type);
+    const bool hasKey = token.type != JsonTokenType::ObjectEnd && token.type != JsonTokenType::ArrayEnd;
+    recorded->keys.push_back(hasKey ? token.key : "");
+    recorded->texts.push_back(token.type == JsonTokenType::String ? token.text : "");
+    recorded->numbers.push_back(token.type == JsonTokenType::Number ? token.number : 0);
+    return !(recorded->rejectKey && hasKey && strcmp(token.key, "stop") == 0);
+}
+
+bool scanAll(const char* body, Recorded& recorded, JsonError* error = nullptr) {
+    JsonScanner scanner(recordToken, &recorded);
+    const bool ok = scanner.feed(body, strlen(body)) && scanner.finish();
+    if (error) {
+        *error = scanner.error();
+    }
+    return ok;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_scanner_reports_members_in_order() {
+    Recorded recorded = {};
+    TEST_ASSERT_TRUE(scanAll("{\"led_pin\": 4, \"wifi_ssid\":\"cat\", \"on\":true, \"x\":null}", recorded));
+    TEST_ASSERT_EQUAL(6, recorded.types.size());
+    TEST_ASSERT_TRUE(recorded.types[0] == JsonTokenType::ObjectStart);
+    TEST_ASSERT_TRUE(recorded.types[1] == JsonTokenType::Number);
+    TEST_ASSERT_EQUAL_STRING("led_pin", recorded.keys[1].c_str());
+    TEST_ASSERT_EQUAL(4, recorded.numbers[1]);
+    TEST_ASSERT_TRUE(recorded.types[2] == JsonTokenType::String);
+    TEST_ASSERT_EQUAL_STRING("cat", recorded.texts[2].c_str());
+    TEST_ASSERT_TRUE(recorded.types[3] == JsonTokenType::Bool);
+    TEST_ASSERT_TRUE(recorded.types[4] == JsonTokenType::Null);
+    TEST_ASSERT_TRUE(recorded.types[5] == JsonTokenType::ObjectEnd);
+}
+
+void test_scanner_decodes_escapes_to_utf8() {
+    Recorded recorded = {};
+    TEST_ASSERT_TRUE(scanAll("{\"s\":\"a\\\"b\\\\c\\n\\u00e9\\ud83d\\ude3a\"}", recorded));
+    TEST_ASSERT_EQUAL_STRING("a\"b\\c\n\xC3\xA9\xF0\x9F\x98\xBA", recorded.texts[1].c_str());
+}
+
+void test_scanner_gives_the_same_tokens_byte_by_byte() {
+    const char* body = "{\"a\":[1,-22,3.5e1],\"b\":{\"c\":\"d\"},\"e\":false}";
+    Recorded whole = {};
+    TEST_ASSERT_TRUE(scanAll(body, whole));
+
+    Recorded split = {};
+    JsonScanner scanner(recordToken, &split);
+    for (const char* p = body; *p; p++) {
+        TEST_ASSERT_TRUE(scanner.feed(p, 1));
+    }
+    TEST_ASSERT_TRUE(scanner.finish());
+    TEST_ASSERT_TRUE(whole.types == split.types);
+    TEST_ASSERT_TRUE(whole.keys == split.keys);
+    TEST_ASSERT_TRUE(whole.numbers == split.numbers);
+}
+
+void test_scanner_rejects_bad_input() {
+    JsonError error;
+    Recorded recorded = {};
+    TEST_ASSERT_FALSE(scanAll("{\"a\":1,}", recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::Syntax);
+
+    recorded = {};
+    TEST_ASSERT_FALSE(scanAll("{\"a\":1} x", recorded, &error));
+
+    recorded = {};
+    TEST_ASSERT_FALSE(scanAll("{\"a\":", recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::Incomplete);
+
+    recorded = {};
+    TEST_ASSERT_FALSE(scanAll("[[[[[[[[[[1]]]]]]]]]]", recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::Depth);
+
+    std::string longValue = "{\"a\":\"" + std::string(MEOW_JSON_VALUE_MAX + 1, 'x') + "\"}";
+    recorded = {};
+    TEST_ASSERT_FALSE(scanAll(longValue.c_str(), recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::ValueTooLong);
+
+    recorded = {};
+    recorded.rejectKey = true;
+    TEST_ASSERT_FALSE(scanAll("{\"go\":1,\"stop\":2,\"never\":3}", recorded, &error));
+    TEST_ASSERT_TRUE(error == JsonError::Rejected);
+    TEST_ASSERT_EQUAL(3, recorded.types.size());
+}
+
+void test_writer_escapes_and_separates() {
+    char buffer[128];
+    JsonWriter out(buffer, sizeof(buffer));
+    out.beginObject();
+    out.key("s");
+    out.stringValue("q\"b\\\n\x01");
+    out.key("list");
+    out.beginArray();
+    out.intValue(-5);
+    out.uintValue(7);
+    out.boolValue(true);
+    out.nullValue();
+    out.endArray();
+    out.endObject();
+    TEST_ASSERT_FALSE(out.overflowed());
+    TEST_ASSERT_EQUAL_STRING("{\"s\":\"q\\\"b\\\\\\n\\u0001\",\"list\":[-5,7,true,null]}", out.c_str());
+}
+
+void test_writer_formats_integer_extremes() {
+    char buffer[96];
+    JsonWriter out(buffer, sizeof(buffer));
+    out.beginArray();
+    out.intValue(0);
+    out.intValue(-2147483647L - 1);
+    out.intValue(2147483647L);
+    out.uintValue(4294967295UL);
+    out.endArray();
+    TEST_ASSERT_EQUAL_STRING("[0,-2147483648,2147483647,4294967295]", out.c_str());
+}
+
+void test_writer_reports_overflow() {
+    char buffer[8];
+    JsonWriter out(buffer, sizeof(buffer));
+    out.beginObject();
+    out.key("longer");
+    out.intValue(1);
+    out.endObject();
+    TEST_ASSERT_TRUE(out.overflowed());
+}
+
+void collect(void* context, const char* data, size_t length) {
+    static_cast<std::string*>(context)->append(data, length);
+}
+
+void test_writer_window_streams_any_size() {
+    char window[16];
+    std::string output;
+    JsonWriter out(window, sizeof(window), collect, &output);
+    out.beginArray();
+    for (int i = 0; i < 50; i++) {
+        out.stringValue("meow");
+    }
+    out.endArray();
+    out.flush();
+    TEST_ASSERT_FALSE(out.overflowed());
+    TEST_ASSERT_TRUE(out.flushed());
+    TEST_ASSERT_EQUAL(2 + 50 * 6 + 49, output.size());
+}
+
+// The helpers handleSaveSettings() used before the scanner, ported from
+// Arduino String to std::string: every key looked up searches the whole body
+// again and builds a String for the pattern and for each string value.
+namespace legacy {
+
+int skipJsonWhitespace(const std::string& input, int index) {
+    while (index < static_cast<int>(input.size()) && isspace(static_cast<unsigned char>(input[index]))) {
+        index++;
+    }
+    return index;
+}
+
+int findJsonValueStart(const std::string& input, const char* key) {
+    const std::string pattern = std::string("\"") + key + "\"";
+    const size_t keyPos = input.find(pattern);
+    if (keyPos == std::string::npos) {
+        return -1;
+    }
+    const size_t colonPos = input.find(':', keyPos + pattern.size());
+    if (colonPos == std::string::npos) {
+        return -1;
+    }
+    return skipJsonWhitespace(input, static_cast<int>(colonPos) + 1);
+}
+
+bool getJsonString(const std::string& input, const char* key, std::string* out) {
+    const int start = findJsonValueStart(input, key);
+    if (start < 0 || input[start] != '"') {
+        return false;
+    }
+    std::string result;
+    bool escape = false;
+    for (size_t i = start + 1; i < input.size(); i++) {
+        const char c = input[i];
+        if (escape) {
+            result += c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c;
+            escape = false;
+        } else if (c == '\\') {
+            escape = true;
+        } else if (c == '"') {
+            *out = result;
+            return true;
+        } else {
+            result += c;
+        }
+    }
+    return false;
+}
+
+bool getJsonInt(const std::string& input, const char* key, int* out) {
+    const int start = findJsonValueStart(input, key);
+    if (start < 0) {
+        return false;
+    }
+    *out = atoi(input.c_str() + start);
+    return true;
+}
+
+bool getJsonBool(const std::string& input, const char* key, bool* out) {
+    const int start = findJsonValueStart(input, key);
+    if (start < 0) {
+        return false;
+    }
+    *out = input.compare(start, 4, "true") == 0;
+    return true;
+}
+
+}  // namespace legacy
+
+struct BenchSettings {
+    bool wifiEnabled;
+    std::string ssid;
+    std::string password;
+    bool mqttEnabled;
+    std::string host;
+    int port;
+    std::string topic;
+    int ledPin;
+};
+
+void parseLegacy(const std::string& body, BenchSettings& out) {
+    legacy::getJsonBool(body, "wifi_enabled", &out.wifiEnabled);
+    legacy::getJsonString(body, "wifi_ssid", &out.ssid);
+    legacy::getJsonString(body, "wifi_password", &out.password);
+    legacy::getJsonBool(body, "mqtt_enabled", &out.mqttEnabled);
+    legacy::getJsonString(body, "mqtt_host", &out.host);
+    legacy::getJsonInt(body, "mqtt_port", &out.port);
+    legacy::getJsonString(body, "mqtt_topic", &out.topic);
+    legacy::getJsonInt(body, "led_pin", &out.ledPin);
+}
+
+bool captureBenchToken(void* context, const JsonToken& token) {
+    BenchSettings* out = static_cast<BenchSettings*>(context);
+    if (token.depth != 1 || token.type == JsonTokenType::ObjectEnd) {
+        return true;
+    }
+    if (strcmp(token.key, "wifi_enabled") == 0) {
+        out->wifiEnabled = token.boolean;
+    } else if (strcmp(token.key, "wifi_ssid") == 0) {
+        out->ssid = token.text;
+    } else if (strcmp(token.key, "wifi_password") == 0) {
+        out->password = token.text;
+    } else if (strcmp(token.key, "mqtt_enabled") == 0) {
+        out->mqttEnabled = token.boolean;
+    } else if (strcmp(token.key, "mqtt_host") == 0) {
+        out->host = token.text;
+    } else if (strcmp(token.key, "mqtt_port") == 0) {
+        out->port = static_cast<int>(token.number);
+    } else if (strcmp(token.key, "mqtt_topic") == 0) {
+        out->topic = token.text;
+    } else if (strcmp(token.key, "led_pin") == 0) {
+        out->ledPin = static_cast<int>(token.number);
+    }
+    return true;
+}
+
+void parseScanner(JsonScanner& scanner, const std::string& body, BenchSettings& out) {
+    scanner.reset(captureBenchToken, &out);
+    scanner.feed(body.data(), body.size());
+    scanner.finish();
+}
+
+// The settings members come last, after padding members the page does not
+// send today, so both parsers walk the whole body.
+std::string makeBody(size_t targetBytes) {
+    const std::string tail =
+        "\"wifi_enabled\":true,\"wifi_ssid\":\"Meow Net\",\"wifi_password\":\"p\\\"ss\","
+        "\"mqtt_enabled\":false,\"mqtt_host\":\"broker.local\",\"mqtt_port\":1883,"
+        "\"mqtt_topic\":\"meow/lamp\",\"led_pin\":8}";
+    std::string body = "{";
+    for (int i = 0; body.size() + tail.size() + 24 < targetBytes; i++) {
+        char member[32];
+        snprintf(member, sizeof(member), "\"pad%03d\":\"%08d\",", i, i);
+        body += member;
+    }
+    return body + tail;
+}
+
+void test_benchmark_scanner_against_legacy_helpers() {
+    const size_t sizes[] = {100, 256, 512, 1024, 2048, 4096};
+    JsonScanner scanner(captureBenchToken, nullptr);
+    printf("%8s %12s %12s %8s\n", "bytes", "legacy ns", "scanner ns", "speedup");
+    for (size_t size : sizes) {
+        const std::string body = makeBody(size);
+        BenchSettings expected = {};
+        BenchSettings actual = {};
+        parseLegacy(body, expected);
+        parseScanner(scanner, body, actual);
+        TEST_ASSERT_EQUAL_STRING(expected.password.c_str(), actual.password.c_str());
+        TEST_ASSERT_EQUAL_STRING(expected.topic.c_str(), actual.topic.c_str());
+        TEST_ASSERT_EQUAL(expected.port, actual.port);
+        TEST_ASSERT_EQUAL(expected.ledPin, actual.ledPin);
+
+        const int rounds = 20000;
+        const auto legacyStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            BenchSettings out = {};
+            parseLegacy(body, out);
+        }
+        const auto scannerStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            BenchSettings out = {};
+            parseScanner(scanner, body, out);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const double legacyNs = std::chrono::duration<double, std::nano>(scannerStart - legacyStart).count() / rounds;
+        const double scannerNs = std::chrono::duration<double, std::nano>(end - scannerStart).count() / rounds;
+        printf("%8zu %12.0f %12.0f %7.1fx\n", body.size(), legacyNs, scannerNs, legacyNs / scannerNs);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_scanner_reports_members_in_order);
+    RUN_TEST(test_scanner_decodes_escapes_to_utf8);
+    RUN_TEST(test_scanner_gives_the_same_tokens_byte_by_byte);
+    RUN_TEST(test_scanner_rejects_bad_input);
+    RUN_TEST(test_writer_escapes_and_separates);
+    RUN_TEST(test_writer_formats_integer_extremes);
+    RUN_TEST(test_writer_reports_overflow);
+    RUN_TEST(test_writer_window_streams_any_size);
+    RUN_TEST(test_benchmark_scanner_against_legacy_helpers);
+    return UNITY_END();
+}
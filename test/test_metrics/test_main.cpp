@@ -0,0 +1,80 @@
+// PhaseProfile: cycle to microsecond conversion, min/max/mean bookkeeping,
+// and what one sample costs next to a network pass.
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "PhaseProfile.h"
+
+namespace {
+
+const uint32_t CPU_MHZ = 240;
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_cycles_convert_without_division() {
+    const uint32_t usPerCycle = usPerCycleFor(CPU_MHZ);
+    TEST_ASSERT_EQUAL(0, cyclesToUs(CPU_MHZ - 1, usPerCycle));
+    // The factor rounds down, so an exact multiple can land one short.
+    TEST_ASSERT_UINT32_WITHIN(1, 1, cyclesToUs(CPU_MHZ, usPerCycle));
+    TEST_ASSERT_UINT32_WITHIN(1, 1000000, cyclesToUs(CPU_MHZ * 1000000, usPerCycle));
+    TEST_ASSERT_UINT32_WITHIN(1, 17895697, cyclesToUs(UINT32_MAX, usPerCycle));
+}
+
+void test_profile_tracks_min_max_and_mean() {
+    const uint32_t usPerCycle = usPerCycleFor(CPU_MHZ);
+    PhaseProfile profile;
+    resetPhaseProfile(profile);
+    TEST_ASSERT_EQUAL(0, phaseMeanCycles(profile));
+    TEST_ASSERT_TRUE(recordPhaseCycles(profile, 2400, usPerCycle));
+    TEST_ASSERT_FALSE(recordPhaseCycles(profile, 240, usPerCycle));
+    TEST_ASSERT_TRUE(recordPhaseCycles(profile, 24000, usPerCycle));
+    TEST_ASSERT_FALSE(recordPhaseCycles(profile, 24000, usPerCycle));
+    TEST_ASSERT_EQUAL(4, profile.took.count);
+    TEST_ASSERT_EQUAL(240, profile.minCycles);
+    TEST_ASSERT_EQUAL(24000, profile.maxCycles);
+    TEST_ASSERT_EQUAL(12660, phaseMeanCycles(profile));
+    TEST_ASSERT_UINT32_WITHIN(1, 100, profile.took.maxUs);
+
+    resetPhaseProfile(profile);
+    TEST_ASSERT_EQUAL(0, profile.took.count);
+    TEST_ASSERT_EQUAL(UINT32_MAX, profile.minCycles);
+}
+
+// A pass records three phases (four when loop() steps effects). The host
+// is several times faster than the ESP32, so the share printed is a lower
+// bound; the firmware measures its own as overhead_permille.
+void test_benchmark_sample_cost() {
+    const uint32_t usPerCycle = usPerCycleFor(CPU_MHZ);
+    const int samples = 10000000;
+    PhaseProfile profile;
+    resetPhaseProfile(profile);
+    uint32_t cycles = 12345;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+        cycles = cycles * 1103515245 + 12345;
+        recordPhaseCycles(profile, cycles >> 12, usPerCycle);
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                      samples;
+    TEST_ASSERT_EQUAL(samples, profile.took.count);
+    printf("%.1f ns per sample (including a random number)\n", ns);
+    const double passesUs[] = {20, 100, 1000};
+    for (double passUs : passesUs) {
+        printf("  4 samples in a %6.0f us pass: %.3f%%\n", passUs, 4 * ns / (passUs * 1000) * 100);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_cycles_convert_without_division);
+    RUN_TEST(test_profile_tracks_min_max_and_mean);
+    RUN_TEST(test_benchmark_sample_cost);
+    return UNITY_END();
+}
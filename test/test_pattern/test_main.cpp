@@ -0,0 +1,275 @@
+// LampPattern: what the compiler rejects, revalidation of bytes loaded back
+// from NVS, and the interpreter's keyframes, loops and wrap at the end.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "JsonScanner.h"
+#include "LampPattern.h"
+
+namespace {
+
+const char* CANDLE = "{\"name\":\"candle\",\"steps\":[{\"level\":255,\"ms\":[300,900]},"
+                     "{\"level\":90,\"ms\":60},{\"loop\":0,\"times\":[2,4]},{\"level\":0,\"ms\":120}]}";
+
+long fixedRandom(long min, long) {
+    return min;
+}
+
+long highRandom(long, long maxExclusive) {
+    return maxExclusive - 1;
+}
+
+bool compilePattern(const std::string& body, PatternCompile& compile) {
+    beginPatternCompile(compile);
+    JsonScanner scanner(applyPatternToken, &compile);
+    return scanner.feed(body.data(), body.size()) && scanner.finish() && finishPatternCompile(compile);
+}
+
+// Body of `count` keyframes followed by `tail`.
+std::string keyframes(int count, const std::string& tail = "") {
+    std::string body = "{\"name\":\"p\",\"steps\":[";
+    for (int i = 0; i < count; i++) {
+        body += i == 0 ? "" : ",";
+        body += "{\"level\":" + std::to_string(i % 256) + ",\"ms\":10}";
+    }
+    return body + tail + "]}";
+}
+
+LampPattern candle() {
+    PatternCompile compile;
+    TEST_ASSERT_TRUE(compilePattern(CANDLE, compile));
+    return compile.pattern;
+}
+
+EffectState freshState() {
+    EffectState state;
+    resetEffect(state);
+    return state;
+}
+
+}  // namespace
+
+void setUp() {
+    memset(lampPatterns, 0, sizeof(lampPatterns));
+}
+
+void tearDown() {}
+
+void test_compiles_keyframes_and_loops() {
+    const LampPattern pattern = candle();
+    TEST_ASSERT_EQUAL_STRING("candle", pattern.name);
+    TEST_ASSERT_EQUAL(4, pattern.length);
+    TEST_ASSERT_TRUE(pattern.code[0].op == PatternOp::Key);
+    TEST_ASSERT_EQUAL(255, pattern.code[0].arg);
+    TEST_ASSERT_EQUAL(300, pattern.code[0].min);
+    TEST_ASSERT_EQUAL(900, pattern.code[0].max);
+    TEST_ASSERT_EQUAL(60, pattern.code[1].min);
+    TEST_ASSERT_EQUAL(60, pattern.code[1].max);
+    TEST_ASSERT_TRUE(pattern.code[2].op == PatternOp::Loop);
+    TEST_ASSERT_EQUAL(0, pattern.code[2].arg);
+    TEST_ASSERT_EQUAL(0, pattern.code[2].slot);
+    TEST_ASSERT_EQUAL(2, pattern.code[2].min);
+    TEST_ASSERT_EQUAL(4, pattern.code[2].max);
+    TEST_ASSERT_TRUE(validateLampPattern(pattern));
+}
+
+void test_rejects_too_many_steps() {
+    PatternCompile compile;
+    TEST_ASSERT_TRUE(compilePattern(keyframes(LAMP_PATTERN_STEPS_MAX), compile));
+    TEST_ASSERT_FALSE(compilePattern(keyframes(LAMP_PATTERN_STEPS_MAX + 1), compile));
+    TEST_ASSERT_EQUAL_STRING("steps", compile.errorKey);
+}
+
+void test_rejects_bad_steps() {
+    PatternCompile compile;
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":256,\"ms\":10}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("level", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":1,\"ms\":0}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("ms", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":1,\"ms\":[20,10]}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("ms", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":1,\"ms\":60001}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("ms", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":1,\"ms\":[1,2,3]}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("ms", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[{\"level\":1,\"ms\":10,\"fade\":1}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("steps", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"p\",\"steps\":[]}", compile));
+    TEST_ASSERT_EQUAL_STRING("steps", compile.errorKey);
+}
+
+void test_rejects_bad_names() {
+    PatternCompile compile;
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"Candle\",\"steps\":[{\"level\":1,\"ms\":10}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("name", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"purr\",\"steps\":[{\"level\":1,\"ms\":10}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("name", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"name\":\"a-very-long-name1\",\"steps\":[{\"level\":1,\"ms\":10}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("name", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern("{\"steps\":[{\"level\":1,\"ms\":10}]}", compile));
+    TEST_ASSERT_EQUAL_STRING("name", compile.errorKey);
+}
+
+void test_rejects_bad_loop_nesting() {
+    PatternCompile compile;
+    // A loop may only jump back to an earlier step.
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, ",{\"loop\":1,\"times\":2}"), compile));
+    TEST_ASSERT_EQUAL_STRING("loop", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, ",{\"loop\":-1,\"times\":2}"), compile));
+    TEST_ASSERT_EQUAL_STRING("loop", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, ",{\"loop\":0,\"times\":0}"), compile));
+    TEST_ASSERT_EQUAL_STRING("times", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, ",{\"loop\":0,\"times\":256}"), compile));
+    TEST_ASSERT_EQUAL_STRING("times", compile.errorKey);
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, ",{\"loop\":0,\"times\":2,\"level\":1}"), compile));
+    TEST_ASSERT_EQUAL_STRING("loop", compile.errorKey);
+
+    // Nested loops are fine while each has its own counter.
+    TEST_ASSERT_TRUE(compilePattern(keyframes(2, ",{\"loop\":1,\"times\":2},{\"loop\":0,\"times\":3}"), compile));
+    std::string tooMany;
+    for (int i = 0; i <= LAMP_PATTERN_LOOPS_MAX; i++) {
+        tooMany += ",{\"loop\":0,\"times\":2}";
+    }
+    TEST_ASSERT_FALSE(compilePattern(keyframes(1, tooMany), compile));
+    TEST_ASSERT_EQUAL_STRING("loop", compile.errorKey);
+}
+
+// A loop whose body holds no keyframe could spin past the 2 * length
+// instruction budget without showing anything, so it never compiles.
+void test_rejects_loop_without_keyframe() {
+    PatternCompile compile;
+    TEST_ASSERT_FALSE(
+        compilePattern(keyframes(1, ",{\"loop\":0,\"times\":2},{\"loop\":1,\"times\":255}"), compile));
+    TEST_ASSERT_EQUAL_STRING("steps", compile.errorKey);
+}
+
+void test_revalidates_corrupted_nvs_bytes() {
+    const LampPattern good = candle();
+    TEST_ASSERT_TRUE(validateLampPattern(good));
+
+    LampPattern pattern = good;
+    pattern.code[1].op = static_cast<PatternOp>(7);
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.length = 0;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.length = LAMP_PATTERN_STEPS_MAX + 1;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    memset(pattern.name, 'a', sizeof(pattern.name));
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[0].min = 1000;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[3].max = LAMP_PATTERN_MS_MAX + 1;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[2].arg = 2;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[2].slot = LAMP_PATTERN_LOOPS_MAX;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[2].min = 0;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+    pattern = good;
+    pattern.code[0].op = PatternOp::Loop;
+    TEST_ASSERT_FALSE(validateLampPattern(pattern));
+}
+
+void test_interpreter_steps_loops_and_wraps() {
+    const LampPattern pattern = candle();
+    EffectState state = freshState();
+    const uint8_t levels[] = {255, 90, 255, 90, 0, 255, 90};
+    const uint16_t holds[] = {300, 60, 300, 60, 120, 300, 60};
+    uint32_t now = 1000;
+    for (size_t i = 0; i < sizeof(levels); i++) {
+        runLampPattern(pattern, state, now, fixedRandom);
+        TEST_ASSERT_EQUAL(levels[i], state.level);
+        TEST_ASSERT_EQUAL(now + holds[i], state.nextMs);
+        now = state.nextMs;
+    }
+
+    // With the longest draws the loop makes four passes over the first two
+    // keyframes, then clears its counter and the pattern ends on the last one.
+    EffectState high = freshState();
+    int shown = 0;
+    do {
+        runLampPattern(pattern, high, 0, highRandom);
+        shown++;
+    } while (high.level != 0 && shown < 20);
+    TEST_ASSERT_EQUAL(9, shown);
+    TEST_ASSERT_EQUAL(120, high.nextMs);
+    TEST_ASSERT_EQUAL(0, high.loopsLeft[0]);
+    TEST_ASSERT_EQUAL(0, high.step);
+    runLampPattern(pattern, high, 0, highRandom);
+    TEST_ASSERT_EQUAL(255, high.level);
+    TEST_ASSERT_EQUAL(900, high.nextMs);
+}
+
+void test_interpreter_restarts_after_shorter_replacement() {
+    PatternCompile compile;
+    TEST_ASSERT_TRUE(compilePattern(keyframes(LAMP_PATTERN_STEPS_MAX), compile));
+    EffectState state = freshState();
+    for (int i = 0; i < 20; i++) {
+        runLampPattern(compile.pattern, state, 0, fixedRandom);
+    }
+    TEST_ASSERT_EQUAL(20, state.step);
+    state.loopsLeft[0] = 3;
+
+    const LampPattern shorter = candle();
+    runLampPattern(shorter, state, 0, fixedRandom);
+    TEST_ASSERT_EQUAL(255, state.level);
+    TEST_ASSERT_EQUAL(1, state.step);
+    TEST_ASSERT_EQUAL(0, state.loopsLeft[0]);
+}
+
+void test_interpreter_goes_dark_on_an_emptied_slot() {
+    const LampPattern empty = {};
+    EffectState state = freshState();
+    state.step = 3;
+    runLampPattern(empty, state, 500, fixedRandom);
+    TEST_ASSERT_EQUAL(LAMP_EFFECT_OFF, state.level);
+    TEST_ASSERT_EQUAL(500 + LAMP_PATTERN_MS_MAX, state.nextMs);
+}
+
+void test_slots_install_replace_and_remove() {
+    LampPattern pattern = candle();
+    TEST_ASSERT_EQUAL(0, installLampPattern(pattern));
+    pattern.code[0].arg = 200;
+    TEST_ASSERT_EQUAL(0, installLampPattern(pattern));
+    TEST_ASSERT_EQUAL(200, lampPatterns[0].code[0].arg);
+    for (uint8_t i = 1; i < LAMP_PATTERN_SLOTS; i++) {
+        snprintf(pattern.name, sizeof(pattern.name), "p%u", i);
+        TEST_ASSERT_EQUAL(i, installLampPattern(pattern));
+    }
+    strcpy(pattern.name, "full");
+    TEST_ASSERT_EQUAL(-1, installLampPattern(pattern));
+    removeLampPattern(2);
+    TEST_ASSERT_EQUAL(0, findLampPattern("candle"));
+    TEST_ASSERT_EQUAL(2, installLampPattern(pattern));
+    TEST_ASSERT_EQUAL(2, findLampPattern("full"));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_compiles_keyframes_and_loops);
+    RUN_TEST(test_rejects_too_many_steps);
+    RUN_TEST(test_rejects_bad_steps);
+    RUN_TEST(test_rejects_bad_names);
+    RUN_TEST(test_rejects_bad_loop_nesting);
+    RUN_TEST(test_rejects_loop_without_keyframe);
+    RUN_TEST(test_revalidates_corrupted_nvs_bytes);
+    RUN_TEST(test_interpreter_steps_loops_and_wraps);
+    RUN_TEST(test_interpreter_restarts_after_shorter_replacement);
+    RUN_TEST(test_interpreter_goes_dark_on_an_emptied_slot);
+    RUN_TEST(test_slots_install_replace_and_remove);
+    return UNITY_END();
+}
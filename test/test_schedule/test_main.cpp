@@ -0,0 +1,175 @@
+// LampSchedule: next run times for one-shot and daily entries, the deadline
+// heap against a linear scan, and a benchmark of insert, move and due-check
+// cost as the table fills up to SCHEDULE_SLOTS.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "LampSchedule.h"
+#include "LampSimulator.h"
+
+namespace {
+
+// 2024-06-03 (a Monday) 12:00:00 UTC.
+const time_t MONDAY_NOON = 1717416000;
+
+ScheduleEntry dailyEntry(uint8_t days, uint16_t minuteOfDay) {
+    ScheduleEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = ScheduleKind::Daily;
+    entry.action = ScheduleAction::On;
+    entry.days = days;
+    entry.minuteOfDay = minuteOfDay;
+    return entry;
+}
+
+// Earliest queued deadline by scanning every slot; what loop() would do
+// without the heap.
+bool scanEarliest(const bool* queued, const uint64_t* dueMs, uint64_t& out) {
+    bool found = false;
+    for (uint8_t slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+        if (queued[slot] && (!found || dueMs[slot] < out)) {
+            out = dueMs[slot];
+            found = true;
+        }
+    }
+    return found;
+}
+
+}  // namespace
+
+void setUp() {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+}
+
+void tearDown() {}
+
+void test_once_runs_only_in_the_future() {
+    ScheduleEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = ScheduleKind::Once;
+    entry.at = static_cast<uint32_t>(MONDAY_NOON + 60);
+    TEST_ASSERT_EQUAL_INT64(MONDAY_NOON + 60, nextScheduleTime(entry, MONDAY_NOON));
+    TEST_ASSERT_EQUAL_INT64(-1, nextScheduleTime(entry, MONDAY_NOON + 60));
+}
+
+void test_daily_picks_the_next_enabled_day() {
+    // 18:30 every day: later today.
+    TEST_ASSERT_EQUAL_INT64(MONDAY_NOON + 6 * 3600 + 1800,
+                            nextScheduleTime(dailyEntry(SCHEDULE_EVERY_DAY, 18 * 60 + 30), MONDAY_NOON));
+    // 07:00 every day: already past, so tomorrow.
+    TEST_ASSERT_EQUAL_INT64(MONDAY_NOON + 19 * 3600,
+                            nextScheduleTime(dailyEntry(SCHEDULE_EVERY_DAY, 7 * 60), MONDAY_NOON));
+    // 07:00 on Sundays only: six days on.
+    TEST_ASSERT_EQUAL_INT64(MONDAY_NOON + 5 * 86400 + 19 * 3600,
+                            nextScheduleTime(dailyEntry(0x01, 7 * 60), MONDAY_NOON));
+    TEST_ASSERT_EQUAL_INT64(-1, nextScheduleTime(dailyEntry(0, 7 * 60), MONDAY_NOON));
+    TEST_ASSERT_EQUAL_INT64(-1,
+                            nextScheduleTime(dailyEntry(SCHEDULE_EVERY_DAY, SCHEDULE_MINUTES_PER_DAY), MONDAY_NOON));
+}
+
+void test_queue_fires_earliest_first_and_moves_entries() {
+    ScheduleQueue queue;
+    clearScheduleQueue(queue);
+    queueSchedule(queue, 5, 500);
+    queueSchedule(queue, 1, 100);
+    queueSchedule(queue, 9, 900);
+    queueSchedule(queue, 9, 50);
+    unqueueSchedule(queue, 1);
+    uint8_t slot;
+    TEST_ASSERT_FALSE(takeDueSchedule(queue, 49, slot));
+    TEST_ASSERT_TRUE(takeDueSchedule(queue, 1000, slot));
+    TEST_ASSERT_EQUAL(9, slot);
+    TEST_ASSERT_TRUE(takeDueSchedule(queue, 1000, slot));
+    TEST_ASSERT_EQUAL(5, slot);
+    TEST_ASSERT_FALSE(takeDueSchedule(queue, 1000, slot));
+    TEST_ASSERT_FALSE(isScheduleQueued(queue, 5));
+}
+
+void test_random_operations_match_a_linear_scan() {
+    ScheduleQueue queue;
+    clearScheduleQueue(queue);
+    bool queued[SCHEDULE_SLOTS] = {};
+    uint64_t dueMs[SCHEDULE_SLOTS] = {};
+    seedSimulatedRandom(17);
+    for (int i = 0; i < 100000; i++) {
+        const uint8_t slot = static_cast<uint8_t>(simulatedRandom(0, SCHEDULE_SLOTS));
+        if (simulatedRandom(0, 4) == 0) {
+            unqueueSchedule(queue, slot);
+            queued[slot] = false;
+        } else {
+            const uint64_t due = static_cast<uint64_t>(simulatedRandom(0, 1000000)) * 1000;
+            queueSchedule(queue, slot, due);
+            queued[slot] = true;
+            dueMs[slot] = due;
+        }
+        uint64_t expected = 0;
+        const bool any = scanEarliest(queued, dueMs, expected);
+        TEST_ASSERT_EQUAL(any, queue.size > 0);
+        if (any) {
+            TEST_ASSERT_TRUE(expected == queue.dueMs[queue.heap[0]]);
+        }
+    }
+}
+
+// For each fill level: moving a random entry to a new deadline (the cost of
+// an insert or an edit), the idle due-check loop() makes every pass, and the
+// same check done by scanning the table.
+void test_benchmark_queue_operations() {
+    const uint8_t fills[] = {8, 32, SCHEDULE_SLOTS};
+    const int rounds = 2000000;
+    printf("%8s %12s %14s %14s\n", "entries", "move ns", "due-check ns", "scan ns");
+    for (uint8_t fill : fills) {
+        ScheduleQueue queue;
+        clearScheduleQueue(queue);
+        bool queued[SCHEDULE_SLOTS] = {};
+        seedSimulatedRandom(23);
+        for (uint8_t slot = 0; slot < fill; slot++) {
+            queueSchedule(queue, slot, 100000000 + static_cast<uint64_t>(simulatedRandom(0, 86400000)));
+            queued[slot] = true;
+        }
+        uint64_t deadlines[1024];
+        for (uint64_t& deadline : deadlines) {
+            deadline = 100000000 + static_cast<uint64_t>(simulatedRandom(0, 86400000));
+        }
+
+        const auto moveStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            queueSchedule(queue, static_cast<uint8_t>(i % fill), deadlines[i & 1023]);
+        }
+        const auto checkStart = std::chrono::steady_clock::now();
+        volatile uint32_t due = 0;
+        for (int i = 0; i < rounds; i++) {
+            uint8_t slot;
+            due = due + takeDueSchedule(queue, static_cast<uint64_t>(i), slot);
+        }
+        const auto scanStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            uint64_t earliest = 0;
+            due = due + (scanEarliest(queued, queue.dueMs, earliest) && earliest <= static_cast<uint64_t>(i));
+        }
+        const auto end = std::chrono::steady_clock::now();
+        TEST_ASSERT_EQUAL(0, due);
+        TEST_ASSERT_EQUAL(fill, queue.size);
+        printf("%8u %12.1f %14.1f %14.1f\n", fill,
+               std::chrono::duration<double, std::nano>(checkStart - moveStart).count() / rounds,
+               std::chrono::duration<double, std::nano>(scanStart - checkStart).count() / rounds,
+               std::chrono::duration<double, std::nano>(end - scanStart).count() / rounds);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_once_runs_only_in_the_future);
+    RUN_TEST(test_daily_picks_the_next_enabled_day);
+    RUN_TEST(test_queue_fires_earliest_first_and_moves_entries);
+    RUN_TEST(test_random_operations_match_a_linear_scan);
+    RUN_TEST(test_benchmark_queue_operations);
+    return UNITY_END();
+}
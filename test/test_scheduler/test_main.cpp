@@ -0,0 +1,203 @@
+// EffectScheduler: heap order, rescheduling, cancelling and wrap-around,
+// checked against a linear scan, plus a benchmark of one loop() tick with
+// 1, 8 and 32 channels against checking every channel each tick.
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "EffectScheduler.h"
+#include "LampEffects.h"
+#include "LampSimulator.h"
+
+namespace {
+
+// Earliest scheduled channel by linear scan; the reference for the heap.
+bool scanEarliest(const bool* scheduled, const uint32_t* dueMs, uint8_t count, uint32_t& out) {
+    bool found = false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (scheduled[i] && (!found || static_cast<int32_t>(dueMs[i] - out) < 0)) {
+            out = dueMs[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_takes_due_channels_earliest_first() {
+    EffectScheduler scheduler;
+    clearEffectScheduler(scheduler);
+    scheduleEffect(scheduler, 3, 300);
+    scheduleEffect(scheduler, 1, 100);
+    scheduleEffect(scheduler, 2, 200);
+    uint8_t channel;
+    TEST_ASSERT_FALSE(takeDueEffect(scheduler, 99, channel));
+    TEST_ASSERT_TRUE(takeDueEffect(scheduler, 250, channel));
+    TEST_ASSERT_EQUAL(1, channel);
+    TEST_ASSERT_TRUE(takeDueEffect(scheduler, 250, channel));
+    TEST_ASSERT_EQUAL(2, channel);
+    TEST_ASSERT_FALSE(takeDueEffect(scheduler, 250, channel));
+    TEST_ASSERT_TRUE(isEffectScheduled(scheduler, 3));
+    TEST_ASSERT_FALSE(isEffectScheduled(scheduler, 1));
+}
+
+void test_reschedule_and_cancel_move_the_root() {
+    EffectScheduler scheduler;
+    clearEffectScheduler(scheduler);
+    scheduleEffect(scheduler, 0, 100);
+    scheduleEffect(scheduler, 1, 200);
+    uint32_t due;
+    scheduleEffect(scheduler, 0, 300);
+    TEST_ASSERT_TRUE(earliestEffectDeadline(scheduler, due));
+    TEST_ASSERT_EQUAL(200, due);
+    scheduleEffect(scheduler, 0, 50);
+    TEST_ASSERT_TRUE(earliestEffectDeadline(scheduler, due));
+    TEST_ASSERT_EQUAL(50, due);
+    cancelEffect(scheduler, 0);
+    TEST_ASSERT_TRUE(earliestEffectDeadline(scheduler, due));
+    TEST_ASSERT_EQUAL(200, due);
+    cancelEffect(scheduler, 1);
+    TEST_ASSERT_FALSE(earliestEffectDeadline(scheduler, due));
+}
+
+void test_deadlines_across_the_millis_wrap() {
+    EffectScheduler scheduler;
+    clearEffectScheduler(scheduler);
+    scheduleEffect(scheduler, 0, 10);
+    scheduleEffect(scheduler, 1, 0xFFFFFFF0UL);
+    uint8_t channel;
+    TEST_ASSERT_TRUE(takeDueEffect(scheduler, 0xFFFFFFF8UL, channel));
+    TEST_ASSERT_EQUAL(1, channel);
+    TEST_ASSERT_FALSE(takeDueEffect(scheduler, 0xFFFFFFF8UL, channel));
+    TEST_ASSERT_TRUE(takeDueEffect(scheduler, 12, channel));
+    TEST_ASSERT_EQUAL(0, channel);
+}
+
+void test_random_operations_match_a_linear_scan() {
+    EffectScheduler scheduler;
+    clearEffectScheduler(scheduler);
+    bool scheduled[EFFECT_SCHEDULER_CAPACITY] = {};
+    uint32_t dueMs[EFFECT_SCHEDULER_CAPACITY] = {};
+    seedSimulatedRandom(11);
+    for (int i = 0; i < 100000; i++) {
+        const uint8_t channel = static_cast<uint8_t>(simulatedRandom(0, EFFECT_SCHEDULER_CAPACITY));
+        if (simulatedRandom(0, 4) == 0) {
+            cancelEffect(scheduler, channel);
+            scheduled[channel] = false;
+        } else {
+            const uint32_t due = static_cast<uint32_t>(simulatedRandom(0, 100000));
+            scheduleEffect(scheduler, channel, due);
+            scheduled[channel] = true;
+            dueMs[channel] = due;
+        }
+        uint32_t expected = 0;
+        uint32_t actual = 0;
+        const bool any = scanEarliest(scheduled, dueMs, EFFECT_SCHEDULER_CAPACITY, expected);
+        TEST_ASSERT_EQUAL(any, earliestEffectDeadline(scheduler, actual));
+        if (any) {
+            TEST_ASSERT_EQUAL(expected, actual);
+        }
+    }
+}
+
+namespace bench {
+
+struct Channel {
+    LampMode mode;
+    EffectState state;
+    uint8_t level;
+};
+
+Channel channels[EFFECT_SCHEDULER_CAPACITY];
+
+// Channels due in the same millisecond run in heap order here and in index
+// order in the scan, so a shared random stream would diverge between them.
+long middleRandom(long min, long max) {
+    return min + (max - min) / 2;
+}
+
+void startChannels(uint8_t count, EffectScheduler* scheduler) {
+    const LampMode modes[] = {LampMode::Blink, LampMode::Purr, LampMode::Bzzz};
+    if (scheduler) {
+        clearEffectScheduler(*scheduler);
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        Channel& channel = channels[i];
+        channel.mode = modes[i % 3];
+        resetEffect(channel.state);
+        channel.level = tickLampEffect(channel.mode, channel.state, 0, middleRandom);
+        if (scheduler) {
+            scheduleEffect(*scheduler, i, channel.state.nextMs);
+        }
+    }
+}
+
+// Ticks every virtual millisecond for `durationMs`; returns the edges run.
+uint32_t runScheduled(uint8_t count, uint32_t durationMs) {
+    EffectScheduler scheduler;
+    startChannels(count, &scheduler);
+    uint32_t edges = 0;
+    for (uint32_t now = 1; now <= durationMs; now++) {
+        uint8_t id;
+        while (takeDueEffect(scheduler, now, id)) {
+            Channel& channel = channels[id];
+            channel.level = tickLampEffect(channel.mode, channel.state, now, middleRandom);
+            scheduleEffect(scheduler, id, channel.state.nextMs);
+            edges++;
+        }
+    }
+    return edges;
+}
+
+// What loop() did before the scheduler: ask every channel every tick.
+uint32_t runScanned(uint8_t count, uint32_t durationMs) {
+    startChannels(count, nullptr);
+    uint32_t edges = 0;
+    for (uint32_t now = 1; now <= durationMs; now++) {
+        for (uint8_t id = 0; id < count; id++) {
+            Channel& channel = channels[id];
+            if (lampEffectDue(channel.mode, channel.state, now)) {
+                channel.level = tickLampEffect(channel.mode, channel.state, now, middleRandom);
+                edges++;
+            }
+        }
+    }
+    return edges;
+}
+
+}  // namespace bench
+
+void test_benchmark_channels_per_tick() {
+    const uint8_t counts[] = {1, 8, 32};
+    const uint32_t durationMs = 3600000;
+    printf("%8s %10s %14s %14s %14s\n", "channels", "edges/h", "scan ns/tick", "heap ns/tick", "heap ns/edge");
+    for (uint8_t count : counts) {
+        const auto scanStart = std::chrono::steady_clock::now();
+        const uint32_t scanEdges = bench::runScanned(count, durationMs);
+        const auto heapStart = std::chrono::steady_clock::now();
+        const uint32_t heapEdges = bench::runScheduled(count, durationMs);
+        const auto end = std::chrono::steady_clock::now();
+        TEST_ASSERT_EQUAL(scanEdges, heapEdges);
+        const double scanNs = std::chrono::duration<double, std::nano>(heapStart - scanStart).count();
+        const double heapNs = std::chrono::duration<double, std::nano>(end - heapStart).count();
+        printf("%8u %10lu %14.1f %14.1f %14.1f\n", count, static_cast<unsigned long>(heapEdges), scanNs / durationMs,
+               heapNs / durationMs, heapNs / heapEdges);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_takes_due_channels_earliest_first);
+    RUN_TEST(test_reschedule_and_cancel_move_the_root);
+    RUN_TEST(test_deadlines_across_the_millis_wrap);
+    RUN_TEST(test_random_operations_match_a_linear_scan);
+    RUN_TEST(test_benchmark_channels_per_tick);
+    return UNITY_END();
+}
@@ -0,0 +1,459 @@
+// The settings schema: NVS load/store, the JSON reader and writers, and a
+// benchmark against the hand-coded String version it replaced.
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "CborScanner.h"
+#include "StripRenderer.h"
+#include "settings.h"
+
+namespace {
+
+size_t allocations = 0;
+
+DeviceSettings loadDefaults() {
+    Preferences prefs;
+    DeviceSettings value;
+    loadSettings(prefs, value);
+    return value;
+}
+
+// Compares settings member by member; memcmp would also compare padding.
+std::string settingsJson(const DeviceSettings& value) {
+    char buffer[1024];
+    JsonWriter out(buffer, sizeof(buffer));
+    writeSettings(out, value);
+    return out.c_str();
+}
+
+bool parseSettings(const char* body, SettingsParse& parse) {
+    JsonScanner scanner(applySettingsToken, &parse);
+    return scanner.feed(body, strlen(body)) && scanner.finish();
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    allocations++;
+    void* block = malloc(size ? size : 1);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void operator delete(void* block) noexcept {
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_nvs_loads_defaults() {
+    const DeviceSettings value = loadDefaults();
+    TEST_ASSERT_FALSE(value.wifiEnabled);
+    TEST_ASSERT_EQUAL_STRING("", value.wifiSsid);
+    TEST_ASSERT_EQUAL(DEFAULT_MQTT_PORT, value.mqttPort);
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_MQTT_TOPIC, value.mqttTopic);
+    TEST_ASSERT_EQUAL(DEFAULT_LED_PIN, value.ledPin);
+    TEST_ASSERT_EQUAL(DEFAULT_BRIGHTNESS, value.brightness);
+    TEST_ASSERT_EQUAL(STRIP_PIN_NONE, value.stripPin);
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_TIMEZONE, value.timezone);
+    TEST_ASSERT_TRUE(value.splitCores);
+}
+
+void test_store_writes_only_changed_fields_and_loads_back() {
+    Preferences prefs;
+    const DeviceSettings previous = loadDefaults();
+    DeviceSettings next = previous;
+    strcpy(next.wifiSsid, "Meow Net");
+    next.mqttPort = 8883;
+    next.brightness = 12;
+    storeSettings(prefs, next, previous);
+    TEST_ASSERT_EQUAL(3, prefs.writes());
+
+    DeviceSettings loaded;
+    loadSettings(prefs, loaded);
+    TEST_ASSERT_EQUAL_STRING("Meow Net", loaded.wifiSsid);
+    TEST_ASSERT_EQUAL(8883, loaded.mqttPort);
+    TEST_ASSERT_EQUAL(12, loaded.brightness);
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_MQTT_TOPIC, loaded.mqttTopic);
+}
+
+void test_out_of_range_nvs_numbers_fall_back() {
+    Preferences prefs;
+    prefs.putInt("led_pin", 99);
+    prefs.putUInt("brightness", 4000);
+    DeviceSettings loaded;
+    loadSettings(prefs, loaded);
+    TEST_ASSERT_EQUAL(DEFAULT_LED_PIN, loaded.ledPin);
+    TEST_ASSERT_EQUAL(DEFAULT_BRIGHTNESS, loaded.brightness);
+}
+
+void test_overlong_nvs_text_is_truncated() {
+    Preferences prefs;
+    // 33 bytes, one over the SSID cap, ending in a two-byte character that
+    // straddles the cut.
+    const std::string ssid = std::string(31, 's') + "\xC3\xA9";
+    prefs.putString("wifi_ssid", ssid.c_str());
+    prefs.putString("mqtt_topic", std::string(MQTT_TOPIC_MAX + 20, 't').c_str());
+    DeviceSettings loaded;
+    loadSettings(prefs, loaded);
+    TEST_ASSERT_EQUAL_STRING(std::string(31, 's').c_str(), loaded.wifiSsid);
+    TEST_ASSERT_EQUAL(MQTT_TOPIC_MAX, strlen(loaded.mqttTopic));
+}
+
+void test_nvs_text_with_control_characters_falls_back() {
+    Preferences prefs;
+    prefs.putString("mqtt_topic", "meow\x01lamp");
+    DeviceSettings loaded;
+    loadSettings(prefs, loaded);
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_MQTT_TOPIC, loaded.mqttTopic);
+}
+
+void test_parse_applies_valid_members() {
+    SettingsParse parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_TRUE(parseSettings("{\"wifi_ssid\":\"cat\",\"led_pin\":5,\"effect_timer\":false,\"x\":1}", parse));
+    TEST_ASSERT_EQUAL_STRING("cat", parse.pending.wifiSsid);
+    TEST_ASSERT_EQUAL(5, parse.pending.ledPin);
+    TEST_ASSERT_FALSE(parse.pending.effectTimer);
+}
+
+void test_parse_ignores_out_of_range_numbers() {
+    SettingsParse parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_TRUE(parseSettings("{\"mqtt_port\":0,\"led_pin\":41,\"brightness\":256}", parse));
+    TEST_ASSERT_EQUAL(DEFAULT_MQTT_PORT, parse.pending.mqttPort);
+    TEST_ASSERT_EQUAL(DEFAULT_LED_PIN, parse.pending.ledPin);
+    TEST_ASSERT_EQUAL(DEFAULT_BRIGHTNESS, parse.pending.brightness);
+}
+
+void test_parse_rejects_wrong_types_and_long_text() {
+    SettingsParse parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_FALSE(parseSettings("{\"led_pin\":\"5\"}", parse));
+    TEST_ASSERT_EQUAL_STRING("led_pin", parse.errorKey);
+
+    parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_FALSE(parseSettings("{\"wifi_enabled\":1}", parse));
+    TEST_ASSERT_EQUAL_STRING("wifi_enabled", parse.errorKey);
+
+    parse = {loadDefaults(), nullptr};
+    const std::string body = "{\"wifi_ssid\":\"" + std::string(WIFI_SSID_MAX + 1, 'a') + "\"}";
+    TEST_ASSERT_FALSE(parseSettings(body.c_str(), parse));
+    TEST_ASSERT_EQUAL_STRING("wifi_ssid", parse.errorKey);
+
+    parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_FALSE(parseSettings("{\"mqtt_host\":\"a\\u0007b\"}", parse));
+    TEST_ASSERT_EQUAL_STRING("mqtt_host", parse.errorKey);
+}
+
+// Every text at its cap and made of quotes, which escape to two bytes, and
+// every number at its widest.
+void test_longest_settings_fit_settings_json_max() {
+    DeviceSettings value = loadDefaults();
+    strcpy(value.wifiSsid, std::string(WIFI_SSID_MAX, '"').c_str());
+    strcpy(value.wifiPassword, std::string(WIFI_PASSWORD_MAX, '"').c_str());
+    strcpy(value.mqttHost, std::string(MQTT_HOST_MAX, '"').c_str());
+    strcpy(value.mqttTopic, std::string(MQTT_TOPIC_MAX, '"').c_str());
+    strcpy(value.timezone, std::string(TIMEZONE_MAX, '"').c_str());
+    value.wifiEnabled = false;
+    value.mqttEnabled = false;
+    value.effectTimer = false;
+    value.splitCores = false;
+    value.mqttPort = 65535;
+    value.ledPin = LED_PIN_MAX;
+    value.fadeMs = FADE_MS_MAX;
+    value.stripPin = STRIP_PIN_NONE;
+    value.stripPixels = STRIP_PIXELS_MAX;
+    value.stripColor = STRIP_COLOR_MAX;
+    value.loopReportS = LOOP_REPORT_S_MAX;
+
+    char buffer[SETTINGS_JSON_MAX];
+    JsonWriter json(buffer, sizeof(buffer));
+    writeSettings(json, value);
+    TEST_ASSERT_FALSE(json.overflowed());
+    printf("longest settings JSON: %u of %u bytes\n", static_cast<unsigned>(json.length()),
+           static_cast<unsigned>(SETTINGS_JSON_MAX));
+
+    CborWriter cbor(buffer, sizeof(buffer));
+    writeSettings(cbor, value);
+    TEST_ASSERT_FALSE(cbor.overflowed());
+}
+
+void test_written_json_parses_back() {
+    DeviceSettings value = loadDefaults();
+    strcpy(value.wifiPassword, "p\"ss\\word");
+    value.stripColor = 0x123456;
+    char buffer[1024];
+    JsonWriter out(buffer, sizeof(buffer));
+    writeSettings(out, value);
+    TEST_ASSERT_FALSE(out.overflowed());
+
+    SettingsParse parse = {loadDefaults(), nullptr};
+    TEST_ASSERT_TRUE(parseSettings(out.c_str(), parse));
+    TEST_ASSERT_EQUAL_STRING(settingsJson(value).c_str(), settingsJson(parse.pending).c_str());
+}
+
+void test_written_cbor_parses_back() {
+    DeviceSettings value = loadDefaults();
+    strcpy(value.mqttHost, "broker.local");
+    value.fadeMs = 1234;
+    char buffer[1024];
+    CborWriter out(buffer, sizeof(buffer));
+    writeSettings(out, value);
+    TEST_ASSERT_FALSE(out.overflowed());
+
+    SettingsParse parse = {loadDefaults(), nullptr};
+    CborScanner scanner(applySettingsToken, &parse);
+    TEST_ASSERT_TRUE(scanner.feed(reinterpret_cast<const uint8_t*>(out.data()), out.length()) && scanner.finish());
+    TEST_ASSERT_EQUAL_STRING(settingsJson(value).c_str(), settingsJson(parse.pending).c_str());
+}
+
+// The eight settings as main.cpp kept them before the schema: String members,
+// a String-building settingsToJson() with jsonEscape(), and a parser with
+// one case per field. Ported from Arduino String to std::string.
+namespace legacy {
+
+struct DeviceSettings {
+    bool wifiEnabled;
+    std::string wifiSsid;
+    std::string wifiPassword;
+    bool mqttEnabled;
+    std::string mqttHost;
+    uint16_t mqttPort;
+    std::string mqttTopic;
+    int ledPin;
+};
+
+std::string jsonEscape(const std::string& input) {
+    std::string output;
+    output.reserve(input.size() + 8);
+    for (unsigned char c : input) {
+        switch (c) {
+            case '"':
+                output += "\\\"";
+                break;
+            case '\\':
+                output += "\\\\";
+                break;
+            case '\n':
+                output += "\\n";
+                break;
+            default:
+                if (c < 0x20) {
+                    char buf[7];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    output += buf;
+                } else {
+                    output += static_cast<char>(c);
+                }
+                break;
+        }
+    }
+    return output;
+}
+
+// What settingsToJson() would have grown into by now: the same String
+// building, carried on over every setting the schema holds today.
+struct FullSettings {
+    DeviceSettings base;
+    uint16_t brightness;
+    uint16_t fadeMs;
+    bool effectTimer;
+    int stripPin;
+    uint16_t stripPixels;
+    int stripColor;
+    std::string timezone;
+    bool splitCores;
+    uint16_t loopReportS;
+};
+
+std::string settingsToJson(const DeviceSettings& settings);
+
+std::string fullSettingsToJson(const FullSettings& settings) {
+    std::string payload = settingsToJson(settings.base);
+    payload.pop_back();
+    payload += ",\"brightness\":";
+    payload += std::to_string(settings.brightness);
+    payload += ",\"fade_ms\":";
+    payload += std::to_string(settings.fadeMs);
+    payload += ",\"effect_timer\":";
+    payload += settings.effectTimer ? "true" : "false";
+    payload += ",\"strip_pin\":";
+    payload += std::to_string(settings.stripPin);
+    payload += ",\"strip_pixels\":";
+    payload += std::to_string(settings.stripPixels);
+    payload += ",\"strip_color\":";
+    payload += std::to_string(settings.stripColor);
+    payload += ",\"timezone\":\"";
+    payload += jsonEscape(settings.timezone);
+    payload += "\",\"split_cores\":";
+    payload += settings.splitCores ? "true" : "false";
+    payload += ",\"loop_report_s\":";
+    payload += std::to_string(settings.loopReportS);
+    payload += "}";
+    return payload;
+}
+
+std::string settingsToJson(const DeviceSettings& settings) {
+    std::string payload = "{";
+    payload += "\"wifi_enabled\":";
+    payload += settings.wifiEnabled ? "true" : "false";
+    payload += ",\"wifi_ssid\":\"";
+    payload += jsonEscape(settings.wifiSsid);
+    payload += "\",\"wifi_password\":\"";
+    payload += jsonEscape(settings.wifiPassword);
+    payload += "\",\"mqtt_enabled\":";
+    payload += settings.mqttEnabled ? "true" : "false";
+    payload += ",\"mqtt_host\":\"";
+    payload += jsonEscape(settings.mqttHost);
+    payload += "\",\"mqtt_port\":";
+    payload += std::to_string(settings.mqttPort);
+    payload += ",\"mqtt_topic\":\"";
+    payload += jsonEscape(settings.mqttTopic);
+    payload += "\",\"led_pin\":";
+    payload += std::to_string(settings.ledPin);
+    payload += "}";
+    return payload;
+}
+
+bool applySettingsToken(void* context, const JsonToken& token) {
+    DeviceSettings* pending = static_cast<DeviceSettings*>(context);
+    if (token.depth != 1 || token.type == JsonTokenType::ObjectEnd) {
+        return true;
+    }
+    if (strcmp(token.key, "wifi_enabled") == 0 || strcmp(token.key, "mqtt_enabled") == 0) {
+        if (token.type != JsonTokenType::Bool) {
+            return false;
+        }
+        (token.key[0] == 'w' ? pending->wifiEnabled : pending->mqttEnabled) = token.boolean;
+    } else if (strcmp(token.key, "wifi_ssid") == 0) {
+        pending->wifiSsid = token.text;
+    } else if (strcmp(token.key, "wifi_password") == 0) {
+        pending->wifiPassword = token.text;
+    } else if (strcmp(token.key, "mqtt_host") == 0) {
+        pending->mqttHost = token.text;
+    } else if (strcmp(token.key, "mqtt_topic") == 0) {
+        pending->mqttTopic = token.text;
+    } else if (strcmp(token.key, "mqtt_port") == 0) {
+        if (token.number > 0 && token.number <= 65535) {
+            pending->mqttPort = static_cast<uint16_t>(token.number);
+        }
+    } else if (strcmp(token.key, "led_pin") == 0) {
+        if (token.number >= 0 && token.number <= 40) {
+            pending->ledPin = static_cast<int>(token.number);
+        }
+    }
+    return true;
+}
+
+}  // namespace legacy
+
+// Best of five runs, so a preempted run does not decide the comparison.
+template <typename Work>
+double nanosPerRound(int rounds, size_t& allocated, const Work& work) {
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        const size_t before = allocations;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            work();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        allocated = (allocations - before) / rounds;
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+        best = run == 0 || ns < best ? ns : best;
+    }
+    return best;
+}
+
+void test_benchmark_schema_against_hand_coded_settings() {
+    const int rounds = 100000;
+    legacy::DeviceSettings oldValue = {true, "Meow Net", "p\"ss", false, "broker.local", 1883, "meow/lamp", 8};
+    DeviceSettings value = loadDefaults();
+    value.wifiEnabled = true;
+    strcpy(value.wifiSsid, "Meow Net");
+    strcpy(value.wifiPassword, "p\"ss");
+    strcpy(value.mqttHost, "broker.local");
+
+    size_t oldAllocs;
+    size_t newAllocs;
+    size_t oldBytes = 0;
+    size_t newBytes = 0;
+    const double oldWrite =
+        nanosPerRound(rounds, oldAllocs, [&]() { oldBytes = legacy::settingsToJson(oldValue).size(); });
+    char buffer[1024];
+    const double newWrite = nanosPerRound(rounds, newAllocs, [&]() {
+        JsonWriter out(buffer, sizeof(buffer));
+        writeSettings(out, value);
+        newBytes = out.length();
+    });
+    // The schema writes every setting and the original code only eight, so
+    // it is also compared with that code carried on over all of them.
+    const legacy::FullSettings fullValue = {oldValue, value.brightness, value.fadeMs, value.effectTimer,
+                                            value.stripPin, value.stripPixels, value.stripColor, value.timezone,
+                                            value.splitCores, value.loopReportS};
+    size_t fullAllocs;
+    size_t fullBytes = 0;
+    const double fullWrite =
+        nanosPerRound(rounds, fullAllocs, [&]() { fullBytes = legacy::fullSettingsToJson(fullValue).size(); });
+    printf("serialize: hand-coded 8 fields %.0f ns, %zu allocs, %zu B (%.2f ns/B)\n", oldWrite, oldAllocs, oldBytes,
+           oldWrite / oldBytes);
+    printf("           hand-coded all %.0f ns, %zu allocs, %zu B (%.2f ns/B)\n", fullWrite, fullAllocs, fullBytes,
+           fullWrite / fullBytes);
+    printf("           schema all     %.0f ns, %zu allocs, %zu B (%.2f ns/B)\n", newWrite, newAllocs, newBytes,
+           newWrite / newBytes);
+    TEST_ASSERT_EQUAL(0, newAllocs);
+    TEST_ASSERT_EQUAL(fullBytes, newBytes);
+    TEST_ASSERT_TRUE(newWrite < fullWrite);
+
+    std::string body = legacy::settingsToJson(oldValue);
+    JsonScanner scanner(applySettingsToken, nullptr);
+    const double oldParse = nanosPerRound(rounds, oldAllocs, [&]() {
+        legacy::DeviceSettings pending = oldValue;
+        scanner.reset(legacy::applySettingsToken, &pending);
+        scanner.feed(body.data(), body.size());
+        scanner.finish();
+    });
+    const double newParse = nanosPerRound(rounds, newAllocs, [&]() {
+        SettingsParse parse = {value, nullptr};
+        scanner.reset(applySettingsToken, &parse);
+        scanner.feed(body.data(), body.size());
+        scanner.finish();
+    });
+    printf("parse:     hand-coded %.0f ns, %zu allocs; schema %.0f ns, %zu allocs\n", oldParse, oldAllocs, newParse,
+           newAllocs);
+    // The schema keeps every text at its cap in place of heap strings, so it
+    // is the larger one; it trades RAM for never allocating.
+    printf("state:     hand-coded 8 fields %zu B, all %zu B, plus heap strings; schema %zu B, fixed\n",
+           sizeof(legacy::DeviceSettings), sizeof(legacy::FullSettings), sizeof(DeviceSettings));
+    TEST_ASSERT_EQUAL(0, newAllocs);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_nvs_loads_defaults);
+    RUN_TEST(test_store_writes_only_changed_fields_and_loads_back);
+    RUN_TEST(test_out_of_range_nvs_numbers_fall_back);
+    RUN_TEST(test_overlong_nvs_text_is_truncated);
+    RUN_TEST(test_nvs_text_with_control_characters_falls_back);
+    RUN_TEST(test_parse_applies_valid_members);
+    RUN_TEST(test_parse_ignores_out_of_range_numbers);
+    RUN_TEST(test_parse_rejects_wrong_types_and_long_text);
+    RUN_TEST(test_longest_settings_fit_settings_json_max);
+    RUN_TEST(test_written_json_parses_back);
+    RUN_TEST(test_written_cbor_parses_back);
+    RUN_TEST(test_benchmark_schema_against_hand_coded_settings);
+    return UNITY_END();
+}
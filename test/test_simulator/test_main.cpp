@@ -0,0 +1,139 @@
+// LampSimulator: timelines compared against the golden files next to this
+// test, determinism per seed, and how fast hours of effect time render.
+//
+// After an intended effect change, regenerate the files and review the diff:
+//   MEOW_UPDATE_GOLDEN=1 pio test -e native -f test_simulator
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "LampEffects.h"
+#include "LampSimulator.h"
+
+namespace {
+
+const uint32_t GOLDEN_SEED = 42;
+
+struct GoldenCase {
+    LampMode mode;
+    uint32_t durationMs;
+};
+
+// Long enough for several bzzz bursts; the cyclic modes repeat sooner.
+const GoldenCase GOLDEN_CASES[] = {
+    {LampMode::Static, 60000},
+    {LampMode::Blink, 60000},
+    {LampMode::Purr, 60000},
+    {LampMode::Bzzz, 600000},
+};
+
+bool appendEdge(void* context, const EffectEdge& edge) {
+    *static_cast<std::ostringstream*>(context) << edge.atMs << ' ' << static_cast<unsigned>(edge.level) << '\n';
+    return true;
+}
+
+std::string renderTimeline(LampMode mode, uint32_t durationMs, uint32_t seed) {
+    std::ostringstream out;
+    out << "# mode=" << lampModeName(mode) << " seed=" << seed << " ms=" << durationMs << '\n';
+    simulateLampEffect(mode, durationMs, seed, appendEdge, &out);
+    return out.str();
+}
+
+std::string goldenPath(LampMode mode) {
+    const std::string here = __FILE__;
+    const size_t slash = here.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? std::string(".") : here.substr(0, slash);
+    return dir + "/golden/" + lampModeName(mode) + ".txt";
+}
+
+bool updatingGolden() {
+    const char* flag = getenv("MEOW_UPDATE_GOLDEN");
+    return flag && flag[0] != '\0' && flag[0] != '0';
+}
+
+bool countEdge(void* context, const EffectEdge&) {
+    (*static_cast<uint32_t*>(context))++;
+    return true;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_timelines_match_golden_files() {
+    for (const GoldenCase& golden : GOLDEN_CASES) {
+        const std::string path = goldenPath(golden.mode);
+        const std::string actual = renderTimeline(golden.mode, golden.durationMs, GOLDEN_SEED);
+        if (updatingGolden()) {
+            std::ofstream(path) << actual;
+            printf("wrote %s\n", path.c_str());
+            continue;
+        }
+        std::ifstream file(path);
+        TEST_ASSERT_TRUE_MESSAGE(file.good(), path.c_str());
+        std::stringstream expected;
+        expected << file.rdbuf();
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(expected.str().c_str(), actual.c_str(), path.c_str());
+    }
+}
+
+void test_same_seed_same_timeline() {
+    TEST_ASSERT_EQUAL_STRING(renderTimeline(LampMode::Bzzz, 120000, 7).c_str(),
+                             renderTimeline(LampMode::Bzzz, 120000, 7).c_str());
+    TEST_ASSERT_FALSE(renderTimeline(LampMode::Bzzz, 120000, 7) == renderTimeline(LampMode::Bzzz, 120000, 8));
+}
+
+void test_edges_stop_at_the_duration() {
+    uint32_t edges = 0;
+    simulateLampEffect(LampMode::Blink, 1300, 1, countEdge, &edges);
+    // t=0 on, 650 off, 1300 on.
+    TEST_ASSERT_EQUAL(3, edges);
+}
+
+// Deadline jumps: how long a day of each effect takes to render. Then the
+// same effect ticked at every virtual millisecond, as loop() would, for a
+// ticks-per-second figure.
+void test_benchmark_virtual_time() {
+    const uint32_t day = 24UL * 3600 * 1000;
+    printf("%-8s %10s %10s %10s\n", "mode", "edges/day", "ticks/day", "ms/day");
+    for (size_t i = 0; i < LAMP_MODE_COUNT; i++) {
+        const LampMode mode = static_cast<LampMode>(i);
+        uint32_t edges = 0;
+        const auto start = std::chrono::steady_clock::now();
+        const uint32_t ticks = simulateLampEffect(mode, day, 1, countEdge, &edges);
+        const auto end = std::chrono::steady_clock::now();
+        printf("%-8s %10lu %10lu %10.2f\n", lampModeName(mode), static_cast<unsigned long>(edges),
+               static_cast<unsigned long>(ticks), std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    const uint32_t hour = 3600UL * 1000;
+    EffectState state;
+    resetEffect(state);
+    seedSimulatedRandom(1);
+    volatile uint8_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t now = 0; now < hour; now++) {
+        sink = sink + tickLampEffect(LampMode::Bzzz, state, now, simulatedRandom);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double ticksPerSecond = hour / seconds;
+    printf("bzzz at 1 ms steps: %.0f M virtual ticks/s\n", ticksPerSecond / 1e6);
+    TEST_ASSERT_TRUE(ticksPerSecond > 1e6);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_timelines_match_golden_files);
+    RUN_TEST(test_same_seed_same_timeline);
+    RUN_TEST(test_edges_stop_at_the_duration);
+    RUN_TEST(test_benchmark_virtual_time);
+    return UNITY_END();
+}
@@ -0,0 +1,206 @@
+// SeqSnapshot and SpscQueue: the single-thread contract, then a writer and
+// readers (or a producer and a consumer) on separate threads hammering one
+// instance, checking every value read for tearing, loss and order.
+//
+// On one host core the threads interleave through preemption, which lands
+// anywhere in a publish() or push(); with more cores they also overlap.
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "LampState.h"
+#include "SeqSnapshot.h"
+#include "SpscQueue.h"
+
+namespace {
+
+// Big enough that a copy spans many words and a preempted publish() leaves
+// it half written.
+const size_t STRESS_WORDS = 16;
+
+struct Stamp {
+    uint32_t words[STRESS_WORDS];
+};
+
+uint32_t stampWord(uint32_t value, size_t i) {
+    return value ^ (0x9E3779B9U * static_cast<uint32_t>(i + 1));
+}
+
+Stamp makeStamp(uint32_t value) {
+    Stamp stamp;
+    for (size_t i = 0; i < STRESS_WORDS; i++) {
+        stamp.words[i] = stampWord(value, i);
+    }
+    return stamp;
+}
+
+// The value all words agree on, or false for a torn copy.
+bool stampValue(const Stamp& stamp, uint32_t& value) {
+    value = stamp.words[0] ^ 0x9E3779B9U;
+    for (size_t i = 1; i < STRESS_WORDS; i++) {
+        if (stamp.words[i] != stampWord(value, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Item {
+    uint32_t sequence;
+    uint32_t check;
+};
+
+uint32_t itemCheck(uint32_t sequence) {
+    return ~sequence * 2654435761U;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_snapshot_reads_latest_value() {
+    SeqSnapshot<LampState> snapshot;
+    TEST_ASSERT_EQUAL(0, snapshot.read().revision);
+    LampState state = {};
+    state.revision = 7;
+    state.mode = LampMode::Purr;
+    state.flags = LAMP_STATE_ON;
+    state.brightness = 128;
+    snapshot.publish(state);
+    const LampState read = snapshot.read();
+    TEST_ASSERT_EQUAL(7, read.revision);
+    TEST_ASSERT_TRUE(read.mode == LampMode::Purr);
+    TEST_ASSERT_TRUE(lampStateOn(read));
+    TEST_ASSERT_EQUAL(128, read.brightness);
+}
+
+void test_queue_is_fifo_and_bounded() {
+    SpscQueue<Item, 4> queue;
+    Item item;
+    TEST_ASSERT_FALSE(queue.pop(item));
+    for (uint32_t round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            TEST_ASSERT_TRUE(queue.push(Item{round * 4 + i, 0}));
+        }
+        TEST_ASSERT_FALSE(queue.push(Item{99, 0}));
+        TEST_ASSERT_EQUAL(4, queue.size());
+        for (uint32_t i = 0; i < 4; i++) {
+            TEST_ASSERT_TRUE(queue.pop(item));
+            TEST_ASSERT_EQUAL(round * 4 + i, item.sequence);
+        }
+        TEST_ASSERT_FALSE(queue.pop(item));
+    }
+}
+
+// One writer publishing increasing values, two readers checking that every
+// copy is whole and that values never go backwards.
+void test_snapshot_stress_two_threads() {
+    const uint32_t publishes = 2000000;
+    SeqSnapshot<Stamp> snapshot;
+    snapshot.publish(makeStamp(0));
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> torn{0};
+    std::atomic<uint32_t> backwards{0};
+    std::atomic<uint64_t> reads{0};
+
+    auto reader = [&]() {
+        uint32_t last = 0;
+        uint64_t count = 0;
+        while (!done.load(std::memory_order_acquire)) {
+            uint32_t value;
+            if (!stampValue(snapshot.read(), value)) {
+                torn.fetch_add(1);
+            } else if (value < last) {
+                backwards.fetch_add(1);
+            } else {
+                last = value;
+            }
+            count++;
+        }
+        reads.fetch_add(count);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread first(reader);
+    std::thread second(reader);
+    for (uint32_t value = 1; value <= publishes; value++) {
+        snapshot.publish(makeStamp(value));
+    }
+    done.store(true, std::memory_order_release);
+    first.join();
+    second.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t last;
+    TEST_ASSERT_TRUE(stampValue(snapshot.read(), last));
+    TEST_ASSERT_EQUAL(publishes, last);
+    printf("snapshot: %lu publishes, %llu reads in %.2f s, %lu torn, %lu backwards\n",
+           static_cast<unsigned long>(publishes), static_cast<unsigned long long>(reads.load()), seconds,
+           static_cast<unsigned long>(torn.load()), static_cast<unsigned long>(backwards.load()));
+    TEST_ASSERT_EQUAL(0, torn.load());
+    TEST_ASSERT_EQUAL(0, backwards.load());
+}
+
+// A producer and a consumer through a queue as deep as effectCommands;
+// every item must arrive once, in order and intact.
+void test_queue_stress_two_threads() {
+    const uint32_t items = 2000000;
+    SpscQueue<Item, 16> queue;
+    std::atomic<uint32_t> fullRetries{0};
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        uint32_t retries = 0;
+        for (uint32_t sequence = 0; sequence < items; sequence++) {
+            while (!queue.push(Item{sequence, itemCheck(sequence)})) {
+                retries++;
+                std::this_thread::yield();
+            }
+        }
+        fullRetries.store(retries);
+    });
+
+    uint32_t expected = 0;
+    uint32_t outOfOrder = 0;
+    uint32_t corrupt = 0;
+    while (expected < items) {
+        Item item;
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (item.sequence != expected) {
+            outOfOrder++;
+        }
+        if (item.check != itemCheck(item.sequence)) {
+            corrupt++;
+        }
+        expected = item.sequence + 1;
+    }
+    producer.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Item item;
+    TEST_ASSERT_FALSE(queue.pop(item));
+    printf("queue: %lu items in %.2f s (%.1f M/s), %lu full retries, %lu out of order, %lu corrupt\n",
+           static_cast<unsigned long>(items), seconds, items / seconds / 1e6,
+           static_cast<unsigned long>(fullRetries.load()), static_cast<unsigned long>(outOfOrder),
+           static_cast<unsigned long>(corrupt));
+    TEST_ASSERT_EQUAL(0, outOfOrder);
+    TEST_ASSERT_EQUAL(0, corrupt);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_snapshot_reads_latest_value);
+    RUN_TEST(test_queue_is_fifo_and_bounded);
+    RUN_TEST(test_snapshot_stress_two_threads);
+    RUN_TEST(test_queue_stress_two_threads);
+    return UNITY_END();
+}
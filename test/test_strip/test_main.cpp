@@ -0,0 +1,115 @@
+// StripRenderer: colours, the purr wave and bzzz dropouts, plus the cost of
+// a 300-pixel frame per mode against the 60 fps frame budget.
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "LampFade.h"
+#include "LampSimulator.h"
+#include "StripRenderer.h"
+
+namespace {
+
+StripScene sceneFor(LampMode mode, uint16_t level) {
+    StripScene scene = {};
+    scene.mode = mode;
+    scene.level = level;
+    scene.envelope = level;
+    scene.effectLevel = LAMP_EFFECT_FULL;
+    scene.red = 0xFF;
+    scene.green = 0xB4;
+    scene.blue = 0x6B;
+    return scene;
+}
+
+bool isDark(const StripPixel& pixel) {
+    return pixel.red == 0 && pixel.green == 0 && pixel.blue == 0;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_static_fills_in_grb_order() {
+    StripPixel pixels[STRIP_PIXELS_MAX];
+    renderStrip(sceneFor(LampMode::Static, LAMP_LEVEL_MAX), pixels, STRIP_PIXELS_MAX, simulatedRandom);
+    for (const StripPixel& pixel : pixels) {
+        TEST_ASSERT_EQUAL(0xFF, pixel.red);
+        TEST_ASSERT_EQUAL(0xB4, pixel.green);
+        TEST_ASSERT_EQUAL(0x6B, pixel.blue);
+    }
+    renderStrip(sceneFor(LampMode::Static, 0), pixels, STRIP_PIXELS_MAX, simulatedRandom);
+    for (const StripPixel& pixel : pixels) {
+        TEST_ASSERT_TRUE(isDark(pixel));
+    }
+}
+
+void test_purr_wave_stays_above_its_floor() {
+    StripPixel pixels[STRIP_PIXELS_MAX];
+    renderStrip(sceneFor(LampMode::Purr, LAMP_LEVEL_MAX), pixels, STRIP_PIXELS_MAX, simulatedRandom);
+    uint8_t lowest = 0xFF;
+    uint8_t highest = 0;
+    for (const StripPixel& pixel : pixels) {
+        lowest = pixel.red < lowest ? pixel.red : lowest;
+        highest = pixel.red > highest ? pixel.red : highest;
+    }
+    TEST_ASSERT_TRUE(lowest > 0);
+    TEST_ASSERT_TRUE(highest > lowest);
+}
+
+void test_bzzz_drops_pixels_only_during_a_flicker() {
+    StripPixel pixels[STRIP_PIXELS_MAX];
+    StripScene scene = sceneFor(LampMode::Bzzz, LAMP_LEVEL_MAX);
+    seedSimulatedRandom(3);
+    scene.effectLevel = LAMP_EFFECT_OFF;
+    renderStrip(scene, pixels, STRIP_PIXELS_MAX, simulatedRandom);
+    uint16_t dark = 0;
+    for (const StripPixel& pixel : pixels) {
+        dark += isDark(pixel) ? 1 : 0;
+    }
+    TEST_ASSERT_TRUE(dark > STRIP_PIXELS_MAX / 4 && dark < STRIP_PIXELS_MAX * 3 / 4);
+
+    scene.effectLevel = LAMP_EFFECT_FULL;
+    for (int frame = 0; frame < 100; frame++) {
+        renderStrip(scene, pixels, STRIP_PIXELS_MAX, simulatedRandom);
+        for (const StripPixel& pixel : pixels) {
+            TEST_ASSERT_FALSE(isDark(pixel));
+        }
+    }
+}
+
+// The strip task has one frame period to render; the host is far faster
+// than the ESP32, so the budget share printed here is a lower bound.
+void test_benchmark_frame_cost() {
+    const LampMode modes[] = {LampMode::Static, LampMode::Purr, LampMode::Bzzz};
+    const int frames = 20000;
+    StripPixel pixels[STRIP_PIXELS_MAX];
+    printf("%-8s %12s %12s\n", "mode", "us/frame", "% of budget");
+    for (LampMode mode : modes) {
+        StripScene scene = sceneFor(mode, LAMP_LEVEL_MAX);
+        seedSimulatedRandom(9);
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            scene.nowMs = static_cast<uint32_t>(i) * (STRIP_FRAME_US / 1000);
+            scene.effectLevel = (i & 8) ? LAMP_EFFECT_OFF : LAMP_EFFECT_FULL;
+            renderStrip(scene, pixels, STRIP_PIXELS_MAX, simulatedRandom);
+        }
+        const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+                          frames;
+        printf("%-8s %12.2f %12.3f\n", lampModeName(mode), us, us * 100 / STRIP_FRAME_US);
+        TEST_ASSERT_TRUE(us < STRIP_FRAME_US);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_static_fills_in_grb_order);
+    RUN_TEST(test_purr_wave_stays_above_its_floor);
+    RUN_TEST(test_bzzz_drops_pixels_only_during_a_flicker);
+    RUN_TEST(test_benchmark_frame_cost);
+    return UNITY_END();
+}
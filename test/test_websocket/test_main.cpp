@@ -0,0 +1,279 @@
+// WebSocketFrameReader and writeWebSocketHeader, plus a latency benchmark of
+// the /api/ws path: eight clients on local socket pairs send "toggle", a
+// service pass shaped like serviceWebSockets() reads and applies it, and the
+// status is broadcast back to every client.
+
+#include <unity.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "JsonWriter.h"
+#include "LatencyHistogram.h"
+#include "WebSocketFrame.h"
+
+namespace {
+
+const uint8_t MASK[4] = {0x37, 0xFA, 0x21, 0x3D};
+
+// A masked client frame, the way a browser sends it.
+size_t maskedFrame(uint8_t* out, uint8_t opcode, const char* text, bool final = true) {
+    const size_t length = strlen(text);
+    out[0] = static_cast<uint8_t>((final ? 0x80 : 0x00) | opcode);
+    out[1] = static_cast<uint8_t>(0x80 | length);
+    memcpy(out + 2, MASK, sizeof(MASK));
+    for (size_t i = 0; i < length; i++) {
+        out[WS_MASKED_HEADER_BYTES + i] = static_cast<uint8_t>(text[i]) ^ MASK[i % 4];
+    }
+    return WS_MASKED_HEADER_BYTES + length;
+}
+
+// Feeds `length` bytes the way readWebSocket() does: never more than the
+// reader wants, at most `chunk` at a time.
+WebSocketRead feed(WebSocketFrameReader& reader, const uint8_t* data, size_t length, size_t chunk) {
+    WebSocketRead result = WebSocketRead::NeedMore;
+    while (length > 0) {
+        size_t take = reader.wanted() < chunk ? reader.wanted() : chunk;
+        take = take < length ? take : length;
+        memcpy(reader.readPointer(), data, take);
+        data += take;
+        length -= take;
+        result = reader.commit(take);
+        if (result != WebSocketRead::NeedMore) {
+            return result;
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+// The masked "Hello" from RFC 6455 section 5.7.
+void test_reader_unmasks_the_rfc_example_byte_by_byte() {
+    const uint8_t frame[] = {0x81, 0x85, 0x37, 0xFA, 0x21, 0x3D, 0x7F, 0x9F, 0x4D, 0x51, 0x58};
+    WebSocketFrameReader reader;
+    reader.reset();
+    TEST_ASSERT_TRUE(feed(reader, frame, sizeof(frame), 1) == WebSocketRead::Frame);
+    TEST_ASSERT_EQUAL(WS_OP_TEXT, reader.opcode());
+    TEST_ASSERT_EQUAL(5, reader.payloadLength());
+    TEST_ASSERT_EQUAL_STRING("Hello", reader.payload());
+}
+
+void test_reader_never_wants_bytes_of_the_next_frame() {
+    uint8_t frames[64];
+    size_t length = maskedFrame(frames, WS_OP_TEXT, "toggle");
+    length += maskedFrame(frames + length, WS_OP_PING, "");
+    length += maskedFrame(frames + length, WS_OP_TEXT, "mode purr");
+
+    WebSocketFrameReader reader;
+    reader.reset();
+    const uint8_t* next = frames;
+    TEST_ASSERT_TRUE(feed(reader, next, length, 64) == WebSocketRead::Frame);
+    TEST_ASSERT_EQUAL_STRING("toggle", reader.payload());
+    next += WS_MASKED_HEADER_BYTES + 6;
+    TEST_ASSERT_TRUE(feed(reader, next, frames + length - next, 64) == WebSocketRead::Frame);
+    TEST_ASSERT_EQUAL(WS_OP_PING, reader.opcode());
+    TEST_ASSERT_EQUAL(0, reader.payloadLength());
+    next += WS_MASKED_HEADER_BYTES;
+    TEST_ASSERT_TRUE(feed(reader, next, frames + length - next, 64) == WebSocketRead::Frame);
+    TEST_ASSERT_EQUAL_STRING("mode purr", reader.payload());
+}
+
+void test_reader_rejects_fragments_unmasked_and_long_frames() {
+    uint8_t frame[WS_MASKED_HEADER_BYTES + WS_MESSAGE_MAX];
+    WebSocketFrameReader reader;
+
+    reader.reset();
+    const size_t fragment = maskedFrame(frame, WS_OP_TEXT, "tog", false);
+    TEST_ASSERT_TRUE(feed(reader, frame, fragment, 64) == WebSocketRead::ProtocolError);
+
+    reader.reset();
+    const uint8_t unmasked[] = {0x81, 0x02, 'o', 'n'};
+    TEST_ASSERT_TRUE(feed(reader, unmasked, sizeof(unmasked), 64) == WebSocketRead::ProtocolError);
+
+    reader.reset();
+    const uint8_t extended[] = {0x81, 0xFE, 0x00, 0x80};
+    TEST_ASSERT_TRUE(feed(reader, extended, sizeof(extended), 64) == WebSocketRead::TooBig);
+}
+
+void test_server_headers_use_the_shortest_length() {
+    uint8_t header[WS_SERVER_HEADER_MAX];
+    TEST_ASSERT_EQUAL(2, writeWebSocketHeader(header, WS_OP_TEXT, 125));
+    TEST_ASSERT_EQUAL_HEX8(0x81, header[0]);
+    TEST_ASSERT_EQUAL_HEX8(125, header[1]);
+    TEST_ASSERT_EQUAL(4, writeWebSocketHeader(header, WS_OP_TEXT, 1040));
+    TEST_ASSERT_EQUAL_HEX8(126, header[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x04, header[2]);
+    TEST_ASSERT_EQUAL_HEX8(0x10, header[3]);
+    TEST_ASSERT_EQUAL(0, writeWebSocketHeader(header, WS_OP_TEXT, WS_SERVER_PAYLOAD_MAX + 1));
+}
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+const size_t CLIENTS = 8;
+
+struct Peer {
+    int serverFd;
+    int clientFd;
+    WebSocketFrameReader reader;
+    Clock::time_point sentAt;
+};
+
+Peer peers[CLIENTS];
+bool lampOn = false;
+LatencyHistogram toOutput;
+LatencyHistogram toBroadcast;
+
+uint32_t microsSince(Clock::time_point start) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+}
+
+// Stands in for writeLampOutput(): the point the request's target is
+// measured to.
+void writeLampOutput(const Peer& peer) {
+    recordLatency(toOutput, microsSince(peer.sentAt));
+}
+
+void broadcastStatus() {
+    char message[128];
+    JsonWriter json(message, sizeof(message));
+    json.beginObject();
+    json.key("led_on");
+    json.boolValue(lampOn);
+    json.key("ssid");
+    json.stringValue("MeowMeow");
+    json.key("mode");
+    json.stringValue("static");
+    json.key("brightness");
+    json.uintValue(255);
+    json.endObject();
+    uint8_t frame[WS_SERVER_HEADER_MAX + sizeof(message)];
+    const size_t headerLength = writeWebSocketHeader(frame, WS_OP_TEXT, json.length());
+    memcpy(frame + headerLength, message, json.length());
+    for (Peer& peer : peers) {
+        TEST_ASSERT_EQUAL(headerLength + json.length(),
+                          send(peer.serverFd, frame, headerLength + json.length(), MSG_DONTWAIT));
+    }
+}
+
+// One pass of serviceWebSockets(): read every socket without blocking,
+// apply complete frames, then broadcast once if anything changed.
+void servicePass() {
+    bool changed = false;
+    for (Peer& peer : peers) {
+        for (;;) {
+            const ssize_t got = recv(peer.serverFd, peer.reader.readPointer(), peer.reader.wanted(), MSG_DONTWAIT);
+            if (got <= 0) {
+                TEST_ASSERT_TRUE(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+                break;
+            }
+            const WebSocketRead result = peer.reader.commit(static_cast<size_t>(got));
+            TEST_ASSERT_TRUE(result != WebSocketRead::ProtocolError && result != WebSocketRead::TooBig);
+            if (result == WebSocketRead::Frame && strcmp(peer.reader.payload(), "toggle") == 0) {
+                lampOn = !lampOn;
+                writeLampOutput(peer);
+                changed = true;
+            }
+        }
+    }
+    if (changed) {
+        broadcastStatus();
+    }
+}
+
+// Reads the status frame every client got and charges the time since
+// `sender`'s toggle went out.
+void collectBroadcast(const Peer& sender) {
+    for (Peer& peer : peers) {
+        uint8_t frame[256];
+        const ssize_t got = recv(peer.clientFd, frame, sizeof(frame), 0);
+        TEST_ASSERT_TRUE(got > 2);
+        TEST_ASSERT_EQUAL_HEX8(0x81, frame[0]);
+    }
+    recordLatency(toBroadcast, microsSince(sender.sentAt));
+}
+
+void sendToggle(Peer& peer) {
+    uint8_t frame[16];
+    const size_t length = maskedFrame(frame, WS_OP_TEXT, "toggle");
+    peer.sentAt = Clock::now();
+    TEST_ASSERT_EQUAL(length, send(peer.clientFd, frame, length, 0));
+}
+
+void printHistogram(const char* name, const LatencyHistogram& histogram) {
+    printf("%-30s n=%5lu p50=%5lu us p99=%5lu us max=%5lu us\n", name, static_cast<unsigned long>(histogram.count),
+           static_cast<unsigned long>(latencyPercentile(histogram, 500)),
+           static_cast<unsigned long>(latencyPercentile(histogram, 990)),
+           static_cast<unsigned long>(histogram.maxUs));
+}
+
+}  // namespace bench
+
+// Host sockets and a desktop CPU, so the absolute numbers only bound the
+// protocol work; the radio and lwIP are not in them. The 10 ms target is
+// asserted on p99 of receipt to writeLampOutput().
+void test_benchmark_toggle_latency_with_eight_clients() {
+    using namespace bench;
+    for (Peer& peer : peers) {
+        int fds[2];
+        TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        peer.serverFd = fds[0];
+        peer.clientFd = fds[1];
+        peer.reader.reset();
+    }
+    resetLatencyHistogram(toOutput);
+    resetLatencyHistogram(toBroadcast);
+
+    const int rounds = 2000;
+    // Clients take turns, one toggle per pass.
+    for (int round = 0; round < rounds; round++) {
+        Peer& sender = peers[round % CLIENTS];
+        sendToggle(sender);
+        servicePass();
+        collectBroadcast(sender);
+    }
+    printHistogram("one toggle per pass", toOutput);
+    printHistogram("  ...until all 8 have status", toBroadcast);
+    const uint32_t singleP99 = latencyPercentile(toOutput, 990);
+
+    // All eight toggle at once; the last one read waits for the other seven.
+    resetLatencyHistogram(toOutput);
+    for (int round = 0; round < rounds / static_cast<int>(CLIENTS); round++) {
+        for (Peer& peer : peers) {
+            sendToggle(peer);
+        }
+        servicePass();
+        for (Peer& peer : peers) {
+            uint8_t frame[256];
+            TEST_ASSERT_TRUE(recv(peer.clientFd, frame, sizeof(frame), 0) > 2);
+        }
+    }
+    printHistogram("eight toggles per pass", toOutput);
+
+    for (Peer& peer : peers) {
+        close(peer.serverFd);
+        close(peer.clientFd);
+    }
+    TEST_ASSERT_LESS_THAN_UINT32(10000, singleP99);
+    TEST_ASSERT_LESS_THAN_UINT32(10000, latencyPercentile(toOutput, 990));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reader_unmasks_the_rfc_example_byte_by_byte);
+    RUN_TEST(test_reader_never_wants_bytes_of_the_next_frame);
+    RUN_TEST(test_reader_rejects_fragments_unmasked_and_long_frames);
+    RUN_TEST(test_server_headers_use_the_shortest_length);
+    RUN_TEST(test_benchmark_toggle_latency_with_eight_clients);
+    return UNITY_END();
+}
@@ -1,6 +1,11 @@
 const API_ENDPOINT = '/api/paw';
 const SETTINGS_ENDPOINT = '/api/settings';
 const MODE_ENDPOINT = '/api/mode';
+const EVENTS_ENDPOINT = '/api/events';
+const CONTROL_ENDPOINT = '/api/ws';
+const LONG_POLL_WAIT_S = 25;
+const STATUS_RETRY_MS = 5000;
+const UPTIME_TICK_MS = 30000;
 const params = new URLSearchParams(window.location.search);
 const MOCK_MODE =
     params.has('mock') ||
@@ -22,6 +27,8 @@ const defaultSettings = {
 let ledOn = false;
 let currentMode = 'static';
 let settingsState = { ...defaultSettings };
+let uptimeBase = null;
+let controlSocket = null;
 
 const mockApi = (() => {
     const startTime = Date.now();
@@ -63,13 +70,38 @@ const mockApi = (() => {
     };
 })();
 
+// Uptime travels in a header so the status body keeps its ETag between polls.
+async function readStatus(response) {
+    const data = await response.json();
+    const uptime = Number.parseInt(response.headers.get('X-Uptime'), 10);
+    if (!Number.isNaN(uptime)) {
+        data.uptime_s = uptime;
+    }
+    const revision = response.headers.get('X-Revision');
+    if (revision !== null) {
+        data.revision = revision;
+    }
+    return data;
+}
+
 const liveApi = {
     async getStatus() {
-        const response = await fetch(API_ENDPOINT, { cache: 'no-store' });
+        // no-cache revalidates with If-None-Match; unchanged state costs a 304.
+        const response = await fetch(API_ENDPOINT, { cache: 'no-cache' });
         if (!response.ok) {
             throw new Error('status');
         }
-        return response.json();
+        return readStatus(response);
+    },
+    // Long-poll: the device holds the request until the state revision moves
+    // past `since` or the wait expires.
+    async waitStatus(since) {
+        const query = new URLSearchParams({ wait: LONG_POLL_WAIT_S, since });
+        const response = await fetch(`${API_ENDPOINT}?${query}`, { cache: 'no-store' });
+        if (!response.ok) {
+            throw new Error('status');
+        }
+        return readStatus(response);
     },
     async setLed(on) {
         const body = new URLSearchParams({ state: on ? 'on' : 'off' });
@@ -83,10 +115,10 @@ const liveApi = {
         if (!response.ok) {
             throw new Error('toggle');
         }
-        return response.json();
+        return readStatus(response);
     },
     async getSettings() {
-        const response = await fetch(SETTINGS_ENDPOINT, { cache: 'no-store' });
+        const response = await fetch(SETTINGS_ENDPOINT, { cache: 'no-cache' });
         if (!response.ok) {
             throw new Error('settings');
         }
@@ -128,9 +160,13 @@ document.addEventListener('DOMContentLoaded', () => {
     applyVersion();
     setModePill();
     updateModeUI();
-    refreshStatus();
     loadSettings();
-    setInterval(refreshStatus, 5000);
+    if (!MOCK_MODE && typeof WebSocket !== 'undefined') {
+        connectControl();
+    } else {
+        followStatus();
+    }
+    setInterval(renderUptime, UPTIME_TICK_MS);
 });
 
 function bindUI() {
@@ -207,17 +243,93 @@ function applyVersion() {
     versionElement.href = `https://github.com/Friedjof/MeowMeow/releases/tag/${version}`;
 }
 
-async function refreshStatus() {
-    try {
-        const data = await api.getStatus();
-        updateConnection(MOCK_MODE ? 'mock' : 'ok');
-        applyStatus(data);
-    } catch (error) {
-        updateConnection('down');
+function sleep(ms) {
+    return new Promise((resolve) => setTimeout(resolve, ms));
+}
+
+function followStatus() {
+    if (!MOCK_MODE && typeof EventSource !== 'undefined') {
+        subscribeEvents();
+    } else {
+        watchStatus();
+    }
+}
+
+// WebSocket control channel: toggles and mode changes skip the HTTP round
+// trip and every change arrives as a pushed status. If the socket never
+// opens, fall back to Server-Sent Events or long-polling.
+function connectControl() {
+    const socket = new WebSocket(`ws://${window.location.host}${CONTROL_ENDPOINT}`);
+    let opened = false;
+    socket.addEventListener('open', () => {
+        opened = true;
+        controlSocket = socket;
+        updateConnection('ok');
+    });
+    socket.addEventListener('message', (event) => {
+        const data = JSON.parse(event.data);
+        if (data.settings) {
+            if (!document.body.classList.contains('settings-open')) {
+                applySettings(data.settings);
+            }
+        } else if (!data.error) {
+            updateConnection('ok');
+            applyStatus(data);
+        }
+    });
+    socket.addEventListener('close', () => {
+        controlSocket = null;
+        if (opened) {
+            updateConnection('down');
+            setTimeout(connectControl, STATUS_RETRY_MS);
+        } else {
+            followStatus();
+        }
+    });
+}
+
+// Pushed updates from the device; EventSource reconnects on its own and the
+// device resends the current status on every (re)connect.
+function subscribeEvents() {
+    const source = new EventSource(EVENTS_ENDPOINT);
+    source.addEventListener('open', () => updateConnection('ok'));
+    source.addEventListener('error', () => updateConnection('down'));
+    source.addEventListener('status', (event) => {
+        updateConnection('ok');
+        applyStatus(JSON.parse(event.data));
+    });
+    source.addEventListener('settings', (event) => {
+        // Do not overwrite a form the user is editing.
+        if (!document.body.classList.contains('settings-open')) {
+            applySettings(JSON.parse(event.data));
+        }
+    });
+}
+
+async function watchStatus() {
+    let since = null;
+    for (;;) {
+        try {
+            const data = since === null ? await api.getStatus() : await api.waitStatus(since);
+            updateConnection(MOCK_MODE ? 'mock' : 'ok');
+            applyStatus(data);
+            since = data.revision ?? null;
+        } catch (error) {
+            updateConnection('down');
+            since = null;
+        }
+        // Without a revision (mock mode, errors) fall back to plain polling.
+        if (since === null) {
+            await sleep(STATUS_RETRY_MS);
+        }
     }
 }
 
 async function setLedState(desired) {
+    if (controlSocket) {
+        controlSocket.send(desired ? 'on' : 'off');
+        return;
+    }
     try {
         const data = await api.setLed(desired);
         updateConnection(MOCK_MODE ? 'mock' : 'ok');
@@ -237,7 +349,8 @@ function applyStatus(data) {
     }
 
     if (typeof data.uptime_s === 'number') {
-        document.getElementById('uptime').textContent = formatUptime(data.uptime_s);
+        uptimeBase = { seconds: data.uptime_s, at: Date.now() };
+        renderUptime();
     }
 
     if (typeof data.ssid === 'string' && data.ssid.length > 0) {
@@ -361,6 +474,11 @@ async function handleModeChange(mode) {
         return;
     }
 
+    if (controlSocket) {
+        controlSocket.send(`mode ${mode}`);
+        return;
+    }
+
     try {
         await api.setMode(mode);
     } catch (error) {
@@ -491,6 +609,15 @@ function setSaveStatus(message) {
     status.textContent = message;
 }
 
+// Status only arrives on changes now, so uptime keeps counting locally.
+function renderUptime() {
+    if (!uptimeBase) {
+        return;
+    }
+    const elapsed = Math.floor((Date.now() - uptimeBase.at) / 1000);
+    document.getElementById('uptime').textContent = formatUptime(uptimeBase.seconds + elapsed);
+}
+
 function formatUptime(seconds) {
     const days = Math.floor(seconds / 86400);
     const hours = Math.floor((seconds % 86400) / 3600);